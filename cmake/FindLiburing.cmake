@@ -0,0 +1,82 @@
+#.rst:
+# FindLiburing
+# -----------
+#
+# Find the liburing library.
+#
+# IMPORTED Targets
+# ^^^^^^^^^^^^^^^^
+#
+# This module defines :prop_tgt:`IMPORTED` targets:
+#
+# ``Liburing::Liburing``
+#   The liburing library, if found.
+#
+# Result variables
+# ^^^^^^^^^^^^^^^^
+#
+# This module defines the following variables:
+#
+# ::
+#
+#   Liburing_FOUND          - true if the headers and library were found
+#   Liburing_INCLUDE_DIRS   - where to find headers
+#   Liburing_LIBRARIES      - list of libraries to link
+#   Liburing_VERSION        - library version that was found, if any
+
+# use pkg-config to get the directories and then use these values
+# in the find_path() and find_library() calls
+find_package(PkgConfig QUIET)
+pkg_check_modules(PC_Liburing QUIET liburing)
+
+# find the headers
+find_path(Liburing_INCLUDE_DIR
+        NAMES liburing.h
+        HINTS
+        ${PC_Liburing_INCLUDEDIR}
+        ${PC_Liburing_INCLUDE_DIRS}
+        )
+
+# find the library
+find_library(Liburing
+        NAMES uring liburing
+        HINTS
+        ${PC_Liburing_LIBDIR}
+        ${PC_Liburing_LIBRARY_DIRS}
+        )
+
+# determine the version
+if(PC_Liburing_VERSION)
+    set(Liburing_VERSION ${PC_Liburing_VERSION})
+endif()
+
+include(FindPackageHandleStandardArgs)
+find_package_handle_standard_args(Liburing
+        REQUIRED_VARS Liburing Liburing_INCLUDE_DIR
+        VERSION_VAR Liburing_VERSION
+        )
+
+if (Liburing_FOUND)
+    set(Liburing_INCLUDE_DIRS ${Liburing_INCLUDE_DIR})
+    set(Liburing_LIBRARIES ${Liburing})
+endif()
+
+if (Liburing_FOUND AND NOT TARGET Liburing::Liburing)
+    # create the new library target
+    add_library(Liburing::Liburing UNKNOWN IMPORTED)
+    # set the required include dirs for the target
+    set_target_properties(Liburing::Liburing
+            PROPERTIES
+            INTERFACE_INCLUDE_DIRECTORIES "${Liburing_INCLUDE_DIRS}"
+            )
+    # set the required libraries for the target
+    if (EXISTS "${Liburing}")
+        set_target_properties(Liburing::Liburing
+                PROPERTIES
+                IMPORTED_LINK_INTERFACE_LANGUAGES "C"
+                IMPORTED_LOCATION "${Liburing}"
+                )
+    endif()
+endif()
+
+mark_as_advanced(Liburing_INCLUDE_DIR Liburing_LIBRARIES Liburing)
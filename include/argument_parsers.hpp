@@ -12,6 +12,8 @@
 #include "dottorrent/hash_function.hpp"
 #include "dottorrent/info_hash.hpp"
 #include "list_edit_mode.hpp"
+#include "hash_backend.hpp"
+#include "read_backend.hpp"
 
 dottorrent::protocol protocol_transformer(const std::vector<std::string>& v, bool allow_hybrid = true);
 
@@ -19,6 +21,24 @@ std::optional<std::size_t> piece_size_transformer(const std::vector<std::string>
 
 std::optional<std::size_t> io_block_size_transformer(const std::vector<std::string>& v);
 
+torrenttools::io_engine io_engine_transformer(const std::vector<std::string>& v);
+
+torrenttools::read_order read_order_transformer(const std::vector<std::string>& v);
+
+std::size_t io_queue_depth_transformer(const std::vector<std::string>& v);
+
+std::size_t data_size_transformer(const std::vector<std::string>& v);
+
+std::size_t max_read_rate_transformer(const std::vector<std::string>& v);
+
+std::size_t max_iops_transformer(const std::vector<std::string>& v);
+
+std::size_t max_memory_transformer(const std::vector<std::string>& v);
+
+std::optional<std::size_t> threads_transformer(const std::vector<std::string>& v);
+
+std::optional<torrenttools::hash_backend> hash_backend_transformer(const std::vector<std::string>& v);
+
 std::vector<std::vector<std::string>> announce_transformer(const std::vector<std::string>& s);
 
 std::vector<std::vector<std::string>> announce_transformer(const YAML::Node& s);
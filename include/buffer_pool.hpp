@@ -0,0 +1,117 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <vector>
+#include <new>
+
+#include <gsl-lite/gsl-lite.hpp>
+
+namespace torrenttools {
+
+/// Fixed size pool of aligned buffers used to read data from storage.
+/// Acquiring a buffer blocks until one is returned to the pool,
+/// which bounds the memory used when the hashers can not keep up with the reader.
+/// The pool must outlive all buffers acquired from it.
+class buffer_pool
+{
+public:
+    using buffer_handle = std::shared_ptr<std::byte>;
+
+    static constexpr std::size_t default_alignment = 4096;
+
+    buffer_pool(std::size_t buffer_size, std::size_t buffer_count, std::size_t alignment = default_alignment)
+        : buffer_size_(round_up(buffer_size, alignment))
+        , buffer_count_(buffer_count)
+        , alignment_(alignment)
+        , storage_(static_cast<std::byte*>(
+                ::operator new(buffer_size_ * buffer_count_, std::align_val_t(alignment_))))
+    {
+        Expects(buffer_count > 0);
+        free_list_.reserve(buffer_count_);
+        for (std::size_t i = 0; i < buffer_count_; ++i) {
+            free_list_.push_back(storage_ + i * buffer_size_);
+        }
+    }
+
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+    ~buffer_pool()
+    {
+        ::operator delete(storage_, std::align_val_t(alignment_));
+    }
+
+    /// Block until a buffer is available.
+    /// @returns an empty handle if a stop was requested while waiting.
+    buffer_handle acquire(std::stop_token stop_token = {})
+    {
+        std::unique_lock lck(mutex_);
+        if (!cv_.wait(lck, stop_token, [this]() { return !free_list_.empty(); })) {
+            return nullptr;
+        }
+        return take();
+    }
+
+    /// @returns a buffer or an empty handle when none is available.
+    buffer_handle try_acquire()
+    {
+        std::unique_lock lck(mutex_);
+        if (free_list_.empty()) {
+            return nullptr;
+        }
+        return take();
+    }
+
+    std::size_t buffer_size() const noexcept
+    { return buffer_size_; }
+
+    std::size_t buffer_count() const noexcept
+    { return buffer_count_; }
+
+    std::size_t alignment() const noexcept
+    { return alignment_; }
+
+    /// Start of the memory backing all buffers.
+    /// The memory is not touched until a buffer is used, so memory policies can still be applied.
+    std::byte* data() noexcept
+    { return storage_; }
+
+    std::size_t size_bytes() const noexcept
+    { return buffer_size_ * buffer_count_; }
+
+private:
+    static constexpr std::size_t round_up(std::size_t value, std::size_t multiple) noexcept
+    {
+        return (value + multiple - 1) / multiple * multiple;
+    }
+
+    buffer_handle take()
+    {
+        auto* ptr = free_list_.back();
+        free_list_.pop_back();
+        return buffer_handle(ptr, [this](std::byte* p) { release(p); });
+    }
+
+    void release(std::byte* ptr)
+    {
+        {
+            std::unique_lock lck(mutex_);
+            free_list_.push_back(ptr);
+        }
+        cv_.notify_one();
+    }
+
+    std::size_t buffer_size_;
+    std::size_t buffer_count_;
+    std::size_t alignment_;
+    std::byte* storage_;
+
+    std::mutex mutex_;
+    std::condition_variable_any cv_;
+    std::vector<std::byte*> free_list_;
+};
+
+} // namespace torrenttools
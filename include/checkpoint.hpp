@@ -0,0 +1,72 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+#include <dottorrent/general.hpp>
+#include <dottorrent/hash.hpp>
+#include <dottorrent/hash_function.hpp>
+
+#include "hash_cache.hpp"
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+/// Return a hash identifying the files of a storage, their modification times and the hashes to compute.
+/// A checkpoint can only be resumed as long as the signature does not change.
+std::string make_checkpoint_signature(const dt::file_storage& storage, dt::protocol protocol,
+                                      const std::unordered_set<dt::hash_function>& checksums);
+
+
+/// Pieces and files completed before a checkpoint was written.
+struct checkpoint_state
+{
+    /// Index and hash of completed v1 pieces.
+    std::vector<std::pair<std::size_t, dt::sha1_hash>> pieces {};
+    /// Hashes of completed files by file index.
+    std::map<std::size_t, hash_cache_entry> files {};
+};
+
+/// Read a checkpoint file.
+/// A partially written record at the end of the file is ignored.
+/// @throws std::invalid_argument if the file is not a checkpoint or the signature does not match.
+checkpoint_state read_checkpoint(const fs::path& path, std::string_view signature);
+
+
+/// Appends completed pieces and files to a checkpoint file.
+/// Records are only appended, so a checkpoint that is interrupted while writing stays valid.
+class checkpoint_writer
+{
+public:
+    /// Create a new checkpoint file, or append to an existing checkpoint with the same signature when resuming.
+    /// @throws std::runtime_error if the file can not be opened.
+    checkpoint_writer(const fs::path& path, std::string_view signature, bool append);
+
+    const fs::path& path() const noexcept;
+
+    void add_pieces(std::size_t first_piece, std::span<const dt::sha1_hash> hashes);
+
+    void add_file(std::size_t file_index, const hash_cache_entry& entry);
+
+    /// Write all added records to disk.
+    /// @throws std::runtime_error if writing failed.
+    void flush();
+
+    /// Close and delete the checkpoint file.
+    void remove();
+
+private:
+    fs::path path_;
+    std::ofstream file_;
+};
+
+} // namespace torrenttools
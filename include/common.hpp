@@ -5,6 +5,7 @@
 #include <filesystem>
 
 #include <dottorrent/metafile.hpp>
+#include "hash_backend.hpp"
 #include "tracker_database.hpp"
 
 namespace fs = std::filesystem;
@@ -34,4 +35,7 @@ void set_tracker_group(dottorrent::metafile& m, const std::vector<std::string>&
         const torrenttools::tracker_database* tracker_db,
         const torrenttools::config* config);
 
-std::filesystem::path get_destination_path(dottorrent::metafile& m, std::optional<fs::path> destination_path);
\ No newline at end of file
+std::filesystem::path get_destination_path(dottorrent::metafile& m, std::optional<fs::path> destination_path);
+
+/// Return the hash backends to use, calibration results are cached in the user cache directory.
+tt::hash_backend_selection get_hash_backends(std::optional<tt::hash_backend> forced);
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace torrenttools {
+
+/// Return the number of CPUs in the affinity mask of this process.
+std::size_t cpuset_cpu_count();
+
+/// Return the CPU quota of the cgroup of this process in number of CPUs,
+/// or std::nullopt when no quota is set or cgroups are not available.
+std::optional<double> cgroup_cpu_quota();
+
+/// Return the number of CPUs this process can effectively use.
+/// Takes the affinity mask and the cgroup CPU quota into account.
+/// Returns at least 1.
+std::size_t available_cpu_count();
+
+
+/// Instruction set extensions relevant for hashing.
+struct cpu_features
+{
+    /// Intel SHA extensions.
+    bool sha_ni = false;
+    bool avx2 = false;
+    bool avx512 = false;
+};
+
+cpu_features detect_cpu_features();
+
+/// Return the model name of the CPU or an empty string when it is unknown.
+std::string cpu_model_name();
+
+
+/// A logical CPU this process is allowed to run on.
+struct cpu_info
+{
+    int id;
+    /// Physical core of the logical CPU. SMT siblings share the same core id and package id.
+    int core_id;
+    int package_id;
+    int numa_node;
+};
+
+/// Return the logical CPUs in the affinity mask of this process.
+/// Returns an empty list when the topology can not be determined.
+std::vector<cpu_info> read_cpu_topology();
+
+
+/// Where the threads of a hash_pipeline run.
+struct thread_placement
+{
+    /// CPU for each hashing thread, empty when hashing threads are not pinned.
+    std::vector<int> hasher_cpus {};
+    /// CPUs the reader and checksum threads may run on, empty when they are not pinned.
+    std::vector<int> reader_cpus {};
+    /// NUMA node that threads and buffers are bound to.
+    std::optional<int> numa_node {};
+};
+
+/// Pin threads to one logical CPU of different physical cores, SMT siblings are only used
+/// when there are more threads than physical cores.
+/// When numa_local is set all threads are restricted to the NUMA node with the most physical cores.
+thread_placement make_thread_placement(std::size_t thread_count, bool numa_local);
+
+/// Restrict the calling thread to the given CPUs.
+/// @returns false if the affinity could not be set.
+bool set_current_thread_affinity(std::span<const int> cpus);
+
+/// Ask the kernel to allocate the pages of a memory region on a NUMA node.
+/// Must be called before the memory is touched.
+/// @returns false if the policy could not be set.
+bool bind_memory_to_node(void* address, std::size_t length, int node);
+
+/// Move the calling thread to the idle CPU scheduling class (SCHED_IDLE) and the idle io priority class,
+/// so it only uses the CPU time and disk bandwidth other processes leave unused.
+/// Threads created by the calling thread afterwards inherit both classes.
+/// @returns false if either class could not be set.
+bool set_background_priority();
+
+/// Format a list of cpus as ranges, eg. "0-3,8,10-11".
+std::string format_cpu_list(std::span<const int> cpus);
+
+} // namespace torrenttools
@@ -5,6 +5,8 @@
 #include <cstdint>
 #include <filesystem>
 #include <chrono>
+#include <functional>
+#include <iosfwd>
 
 #include <dottorrent/metafile.hpp>
 #include <dottorrent/storage_hasher.hpp>
@@ -15,6 +17,9 @@
 #include "config.hpp"
 #include "tracker_database.hpp"
 #include "info.hpp"
+#include "hash_backend.hpp"
+#include "hash_cache.hpp"
+#include "read_backend.hpp"
 
 namespace {
 namespace fs = std::filesystem;
@@ -23,7 +28,7 @@ namespace dt = dottorrent;
 
 // forward declarations
 namespace CLI { class App; }
-namespace torrenttools { class file_matcher; }
+namespace torrenttools { class file_matcher; class prehasher; }
 
 struct create_app_options
 {
@@ -52,11 +57,50 @@ struct create_app_options
     std::optional<std::string> created_by;
     bool set_creation_date = true;
     std::optional<std::chrono::system_clock::time_point> creation_date;
-    std::uint8_t threads = 1;
+    /// Number of hashing threads, std::nullopt to tune the number of threads automatically.
+    std::optional<std::size_t> threads = 2;
     std::optional<std::size_t> io_block_size;
     bool simple_progress;
     std::optional<std::string> profile;
     bool enable_cross_seeding = true;
+    torrenttools::io_engine io_engine = torrenttools::io_engine::sync;
+    std::size_t io_queue_depth = 32;
+    bool direct_io = false;
+    bool cpu_affinity = false;
+    bool numa = false;
+    /// Hash backend to use, std::nullopt to select the fastest backend.
+    std::optional<torrenttools::hash_backend> hash_backend = std::nullopt;
+    /// Manifest listing the targets and options of multiple metafiles to create.
+    std::optional<std::filesystem::path> batch_manifest = std::nullopt;
+    /// Directory with hashes of previously hashed files, std::nullopt to disable the cache.
+    std::optional<std::filesystem::path> hash_cache = std::nullopt;
+    /// File to save the hashing progress to, defaults to the destination with a .checkpoint extension
+    /// when resuming.
+    std::optional<std::filesystem::path> checkpoint = std::nullopt;
+    /// Continue from the checkpoint of an interrupted run.
+    bool resume = false;
+    /// Hash the contents of a single file read from standard input, named by name.
+    bool read_data_from_stdin = false;
+    /// Number of bytes to read from standard input with read_data_from_stdin.
+    std::optional<std::size_t> data_size = std::nullopt;
+    /// Tar archive to hash the files of without extracting it, "-" to read the archive from standard input.
+    std::optional<std::filesystem::path> tar_archive = std::nullopt;
+    /// Directory to copy the files to while they are hashed.
+    std::optional<std::filesystem::path> copy_to = std::nullopt;
+    /// Order in which the files are read.
+    torrenttools::read_order read_order = torrenttools::read_order::storage;
+    /// Drop data that was read from the page cache after it is hashed.
+    bool drop_cache = false;
+    /// Maximum number of bytes read per second, 0 for no limit.
+    std::size_t max_read_rate = 0;
+    /// Maximum number of read operations per second, 0 for no limit.
+    std::size_t max_iops = 0;
+    /// Run with idle cpu and io priority.
+    bool background = false;
+    /// Memory budget for the file list of a scanned directory, 0 for no limit.
+    std::size_t max_memory = 0;
+    /// Hash files while the target directory is scanned.
+    bool pipeline = false;
 };
 
 void configure_create_app(CLI::App* app, create_app_options& options);
@@ -66,8 +110,35 @@ void configure_matcher(torrenttools::file_matcher& matcher, const create_app_opt
 void merge_create_profile(const tt::config& cfg, std::string_view profile_name,
                           const CLI::App* app, create_app_options& options);
 
+/// Replace all options for which is_set returns false with the value from defaults.
+/// Options are identified by the long name of their command line option, eg. "announce".
+void merge_create_options(const create_app_options& defaults,
+                          const std::function<bool(std::string_view)>& is_set,
+                          create_app_options& options);
+
 void postprocess_create_app(const CLI::App* app, const main_app_options& main_options, create_app_options& options);
 
 void run_create_app(const main_app_options& main_options, create_app_options& options);
 
-void set_files_with_progress(dottorrent::metafile& m, const create_app_options& options, std::ostream& os);
\ No newline at end of file
+/// Read the jobs of the batch manifest given by --batch.
+/// Options of a job are taken from its manifest entry, then from the command line,
+/// then from the profile of the entry or the profile given on the command line.
+/// @param config configuration with the profiles of the entries, can be nullptr.
+std::vector<create_app_options> load_create_batch(const CLI::App* app, const torrenttools::config* config,
+                                                  const create_app_options& options);
+
+/// Create the metafiles of all jobs in a single process.
+/// Targets are scanned ahead of hashing and the next job starts reading
+/// while the hashing threads finish the blocks of the previous job.
+/// All jobs share one hash_scheduler, its thread and read options are taken from the first job that is hashed.
+/// @param config, tracker_db loaded once for all jobs by load_config_and_tracker_db, can be nullptr.
+/// @throws std::runtime_error when any of the jobs failed, after all other jobs are done.
+void run_create_batch(const std::vector<create_app_options>& jobs, const torrenttools::config* config,
+                      const torrenttools::tracker_database* tracker_db, std::ostream& os);
+
+/// Select files and add them to the metafile.
+/// @param prehasher queue files to be hashed as they are found while scanning a directory target.
+/// @returns the identity of each file read while scanning a directory target, in the order of the storage.
+std::vector<std::optional<torrenttools::file_identity>>
+set_files_with_progress(dottorrent::metafile& m, const create_app_options& options, std::ostream& os,
+                        torrenttools::prehasher* prehasher = nullptr);
\ No newline at end of file
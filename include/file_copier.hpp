@@ -0,0 +1,89 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+
+#include "read_backend.hpp"
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+/// A range of the data of a data_chunk.
+struct data_range
+{
+    std::size_t offset;
+    std::size_t length;
+};
+
+
+/// Writes the data read from a storage to copies of its files, so data is copied while it is hashed.
+///
+/// Each file is written to a temporary file next to its destination, which is renamed
+/// to the destination when the last byte of the file is written.
+/// On filesystems that support reflinks (btrfs, xfs) files are cloned instead of written
+/// and the data that is read is only hashed.
+/// Data that is not written, eg. pieces that failed verification, is left as a hole of zeros.
+/// Files of which no data is written are not created.
+/// Temporary files of incomplete copies are removed when the copier is destroyed.
+class file_copier
+{
+public:
+    /// Create the destination directories and all empty files.
+    /// @param clone clone files from their source when possible.
+    /// @throws std::runtime_error if a destination file already exists.
+    file_copier(const dt::file_storage& storage, fs::path destination, bool clone);
+
+    file_copier(const file_copier&) = delete;
+    file_copier& operator=(const file_copier&) = delete;
+
+    ~file_copier();
+
+    /// Return the path a file is copied to.
+    fs::path destination_path(std::size_t file_index) const;
+
+    /// Write the data of all regular file segments of a chunk.
+    /// Chunks must not be written concurrently.
+    /// @throws std::runtime_error if the data could not be written.
+    void write(const data_chunk& chunk);
+
+    /// Write the data of a chunk that lies within ranges, the rest of the chunk is not written.
+    /// Ranges must be sorted and must not overlap.
+    void write(const data_chunk& chunk, std::span<const data_range> ranges);
+
+    /// Check that all files were copied completely.
+    /// @throws std::runtime_error if a file is incomplete.
+    void finish();
+
+    std::size_t bytes_written() const noexcept;
+
+    /// Number of bytes of regular files that were not written.
+    std::size_t bytes_discarded() const noexcept;
+
+    /// Number of files that were cloned instead of written.
+    std::size_t cloned_file_count() const noexcept;
+
+private:
+    struct open_file;
+
+    open_file& open(std::size_t file_index);
+    void write_segment(const file_segment& segment, std::span<const std::byte> data);
+    void complete(std::size_t file_index);
+
+    const dt::file_storage& storage_;
+    fs::path destination_;
+    bool clone_;
+    /// Bytes left to write per file.
+    std::vector<std::size_t> bytes_remaining_;
+    std::vector<std::unique_ptr<open_file>> open_files_;
+    std::atomic_size_t bytes_written_ = 0;
+    std::atomic_size_t bytes_discarded_ = 0;
+    std::size_t cloned_file_count_ = 0;
+};
+
+} // namespace torrenttools
@@ -3,13 +3,22 @@
 #include <unordered_set>
 #include <set>
 #include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include <gsl-lite/gsl-lite.hpp>
 #include <fmt/format.h>
 #include <re2/re2.h>
 #include <re2/set.h>
 
+#include "hash_cache.hpp"
+#include "path_arena.hpp"
 
 namespace torrenttools {
 
@@ -17,21 +26,84 @@ using namespace fmt::literals;
 
 namespace { namespace fs = std::filesystem; }
 
+/// Metadata of a file read while scanning, so the file does not have to be stat'ed again.
+struct scanned_file
+{
+    std::uint64_t file_size;
+    /// Identity of the file, std::nullopt when it was not read while scanning.
+    std::optional<file_identity> identity;
+};
+
+/// Files found by the file_matcher in sorted order.
+/// Paths are relative to the search root and stored in a path_arena.
+class scanned_file_list
+{
+public:
+    scanned_file_list() = default;
+
+    scanned_file_list(fs::path root, path_arena paths, std::vector<scanned_file> files)
+        : root_(std::move(root))
+        , paths_(std::move(paths))
+        , files_(std::move(files))
+    {
+        Expects(paths_.size() == files_.size());
+    }
+
+    std::size_t size() const noexcept
+    { return paths_.size(); }
+
+    bool empty() const noexcept
+    { return paths_.empty(); }
+
+    const fs::path& root() const noexcept
+    { return root_; }
+
+    /// Return the path of a file relative to the search root.
+    std::string_view relative_path(std::size_t index) const noexcept
+    { return paths_[index]; }
+
+    /// Return the path of a file including the search root.
+    fs::path path(std::size_t index) const
+    { return root_ / fs::path(paths_[index]); }
+
+    const scanned_file& file(std::size_t index) const noexcept
+    { return files_[paths_.id(index)]; }
+
+private:
+    fs::path root_ {};
+    path_arena paths_ {};
+    /// Metadata by path id.
+    std::vector<scanned_file> files_ {};
+};
+
 /// Recurse over the files contained in a given path and filter the results.
 ///
 /// @param file_include_list: allow only given extensions in the output;
 /// @param file_exclude_list: do not allow given extensions in the output;
 /// @param exclude_directories: do not recurse in directories matching pattern
 /// When combining both include lists and exclude lists the include list will be applied first.
+///
+/// Directories are scanned in parallel by a pool of worker threads which match the files they find.
+/// Each worker scans the directories it finds itself and idle workers steal directories from the others.
+/// Results are sorted by path, so the output does not depend on the order in which directories are scanned.
+///
+/// On Linux directories are read with getdents64 and opened relative to their parent.
+/// The file type is taken from the directory entry and only files that pass the filters are stat'ed,
+/// with a single statx call for the size, modification time and inode.
+///
+/// With a memory budget, workers that exceed their share of the budget sort their results and write them
+/// as a run to a temporary spill file. The runs are merged while the results are read with for_each_result,
+/// so the memory used for the file list does not depend on the number of files.
 class file_matcher
 {
 public:
-    file_matcher()
-        : directory_exclude_list_()
-        , file_include_list_(make_default_options(), re2::RE2::Anchor::ANCHOR_START)
-        , file_exclude_list_(make_default_options(), re2::RE2::Anchor::ANCHOR_START)
-        , include_hidden_files_()
-    {};
+    /// Scanning is bound by the latency of the filesystem rather than by the CPU,
+    /// so network filesystems benefit from more threads than there are cores.
+    static constexpr std::size_t default_thread_count = 8;
+
+    file_matcher();
+
+    ~file_matcher();
 
     void include_hidden_files(bool flag)
     {
@@ -127,6 +199,34 @@ public:
         search_root_ = root;
     }
 
+    /// Set the number of threads scanning directories.
+    void set_thread_count(std::size_t count)
+    {
+        Expects(count > 0);
+        thread_count_ = count;
+    }
+
+    /// Limit the memory used to hold the results, results are spilled to a temporary file when it is exceeded.
+    /// @param bytes the memory budget, 0 for no limit.
+    void set_max_memory(std::size_t bytes)
+    {
+        max_memory_ = bytes;
+    }
+
+    /// Call a function with the path relative to the search root and the metadata of each matched file
+    /// as soon as it is found, in the order in which files are found.
+    /// The function is called concurrently by the scanning threads.
+    void set_match_callback(std::function<void(std::string_view, const scanned_file&)> f)
+    {
+        match_callback_ = std::move(f);
+    }
+
+    /// Return true when the results of the last scan did not fit in the memory budget and were spilled.
+    bool is_spilled() const noexcept
+    {
+        return spill_ != nullptr;
+    }
+
     std::size_t files_processed() const noexcept
     {
         return files_scanned_.load(std::memory_order_relaxed);
@@ -140,7 +240,15 @@ public:
     void start()
     {
         is_running_ = true;
-        fs_thread_ = std::jthread(std::bind_front(&file_matcher::run, this));
+        error_ = nullptr;
+        fs_thread_ = std::jthread([this](std::stop_token stop_token) {
+            try {
+                run(stop_token);
+            }
+            catch (...) {
+                error_ = std::current_exception();
+            }
+        });
     }
 
     bool is_running() const noexcept
@@ -148,16 +256,31 @@ public:
         return is_running_.load(std::memory_order_relaxed);
     }
 
-    [[nodiscard]] std::vector<fs::path> results()
+    [[nodiscard]] std::vector<fs::path> results();
+
+    /// Return the matched files together with their size and identity.
+    /// Must not be used when the results were spilled.
+    [[nodiscard]] scanned_file_list file_results()
     {
-        return std::move(results_);
+        Expects(!is_spilled());
+        return std::exchange(results_, {});
     }
 
+    /// Call a function with the path relative to the search root and the metadata of each matched file,
+    /// in sorted order. Spilled results are merged from the spill file while they are passed to the function.
+    /// @throws std::runtime_error if the spill file could not be read.
+    void for_each_result(const std::function<void(std::string_view, const scanned_file&)>& f);
+
+    /// Wait for the scan to complete.
+    /// @throws std::filesystem::filesystem_error if a directory could not be scanned.
     void wait()
     {
         if (fs_thread_.joinable()) {
             fs_thread_.join();
         }
+        if (error_) {
+            std::rethrow_exception(std::exchange(error_, nullptr));
+        }
     }
 
     void stop()
@@ -166,54 +289,23 @@ public:
         fs_thread_.join();
     }
 
-    void run(std::stop_token stop_token)
-    {
-        is_running_ = true;
-        std::vector<fs::path> results {};
-        auto out = std::back_inserter(results);
-
-        if (!is_compiled_)
-            compile();
+    /// Scan the search root on the calling thread and the scanning threads and store the sorted results.
+    void run(std::stop_token stop_token);
 
-        for (auto it = fs::recursive_directory_iterator(search_root_); it != fs::end(it); ++it) {
-            if (stop_token.stop_possible() && stop_token.stop_requested()) {
-                is_running_.store(false, std::memory_order_relaxed);
-                return;
-            }
+private:
+    struct directory_task;
+    struct scan_state;
+    struct spill_file;
 
-            if (it->is_directory()) {
-                if (directory_exclude_list_.contains(it->path().lexically_relative(search_root_))) {
-                    it.disable_recursion_pending();
-                }
-            }
-            else if (it->is_regular_file()) {
-                files_scanned_.fetch_add(1, std::memory_order_relaxed);
-                auto s = it->path().string();
-                if (file_include_list_empty_) {
-                    if (!include_hidden_files_ && is_hidden_file(*it)) {
-                        continue;
-                    }
-                    if (file_exclude_list_empty_ || !file_exclude_list_.Match(s, nullptr)) {
-                        *out++ = it->path();
-                        files_included_.fetch_add(1, std::memory_order_relaxed);
-                    }
-                } else if (file_include_list_.Match(s, nullptr)) {
-                    if (file_exclude_list_empty_ || !file_exclude_list_.Match(s, nullptr)) {
-                        *out++ = it->path();
-                        files_included_.fetch_add(1, std::memory_order_relaxed);
-                    }
-                }
-            }
-        }
+    /// Scan the entries of a single directory and queue its subdirectories on the queue of the worker.
+    void scan_directory(const directory_task& directory, std::size_t worker, scan_state& state);
 
-        results_ = std::move(results);
-        is_running_.store(false, std::memory_order_relaxed);
-    };
+    /// Return true if a regular file passes the filters.
+    bool matches(std::string_view path, std::string_view filename) const;
 
-private:
-    static bool is_hidden_file(const fs::directory_entry& entry)
+    static bool is_hidden_file(std::string_view filename)
     {
-        return entry.path().filename().string().starts_with(".");
+        return filename.starts_with(".");
     }
 
     static re2::RE2::Options make_default_options()
@@ -234,7 +326,14 @@ private:
     bool is_compiled_ = false;
 
     fs::path search_root_;
-    std::vector<fs::path> results_;
+    scanned_file_list results_;
+    std::size_t thread_count_ = default_thread_count;
+    std::size_t max_memory_ = 0;
+    std::function<void(std::string_view, const scanned_file&)> match_callback_ {};
+    /// Sorted runs of the results of the last scan, when they did not fit in the memory budget.
+    std::unique_ptr<spill_file> spill_ {};
+    /// Error that stopped the scan, rethrown by wait().
+    std::exception_ptr error_ {};
 
     std::jthread fs_thread_;
     std::atomic_bool is_running_ = false;
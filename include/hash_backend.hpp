@@ -0,0 +1,86 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <dottorrent/hash_function.hpp>
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+/// Library used to compute SHA-1 piece hashes and SHA-256 merkle leaves.
+enum class hash_backend
+{
+    /// OpenSSL libcrypto, uses SHA-NI when the CPU supports it.
+    openssl,
+    /// Intel ISA-L multi-buffer hashing, hashes multiple blocks in parallel SIMD lanes (AVX2, AVX-512).
+    isal,
+    /// Built-in multi-buffer SHA-256 hashing 8 (AVX2) or 16 (AVX-512) blocks of equal size per SIMD pass.
+    /// Only supports sha256, sha1 falls back to openssl.
+    simd,
+};
+
+std::string_view to_string(hash_backend backend) noexcept;
+
+std::optional<hash_backend> make_hash_backend(std::string_view name) noexcept;
+
+/// Return true if the backend is supported by this build and CPU.
+bool is_available(hash_backend backend) noexcept;
+
+/// Return true if the backend can compute the given hash function.
+bool supports(hash_backend backend, dt::hash_function function) noexcept;
+
+/// Return all backends supported by this build and CPU.
+std::vector<hash_backend> available_hash_backends();
+
+
+/// Hashes batches of independent messages with a single hash function.
+/// Instances are not thread safe, every thread must use its own block_hasher.
+class block_hasher
+{
+public:
+    virtual ~block_hasher() = default;
+
+    virtual hash_backend backend() const noexcept = 0;
+
+    virtual dt::hash_function function() const noexcept = 0;
+
+    virtual std::size_t digest_size() const noexcept = 0;
+
+    /// Hash every input and store the digests consecutively in out.
+    /// @param out buffer of at least inputs.size() * digest_size() bytes.
+    virtual void hash(std::span<const std::span<const std::byte>> inputs, std::span<std::byte> out) = 0;
+};
+
+/// Create a block hasher for sha1 or sha256.
+/// Backends hashing multiple messages in parallel are most efficient when inputs have equal sizes.
+/// @throws std::invalid_argument if the backend is not available or does not support the function.
+std::unique_ptr<block_hasher> make_block_hasher(hash_backend backend, dt::hash_function function);
+
+
+/// Backends used for v1 pieces and v2 leaves.
+struct hash_backend_selection
+{
+    hash_backend sha1 = hash_backend::openssl;
+    hash_backend sha256 = hash_backend::openssl;
+};
+
+/// Measure the throughput of all available backends by hashing a few MiB of data
+/// and return the fastest backend for each hash function.
+hash_backend_selection calibrate_hash_backends();
+
+/// Return the backends to use for hashing.
+/// When no backend is forced the result of calibrate_hash_backends() is used.
+/// A forced backend that does not support a hash function is replaced by openssl for that function.
+/// Calibration results are read from and written to cache_file, the cache is discarded
+/// when the CPU or the available backends change.
+hash_backend_selection select_hash_backends(std::optional<hash_backend> forced,
+                                            const std::optional<fs::path>& cache_file = std::nullopt);
+
+} // namespace torrenttools
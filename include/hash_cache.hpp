@@ -0,0 +1,107 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <dottorrent/hash.hpp>
+#include <dottorrent/hash_function.hpp>
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+/// Identifies the contents of a file on disk.
+/// A file is assumed to be unchanged as long as none of these fields change.
+struct file_identity
+{
+    std::uint64_t device;
+    std::uint64_t inode;
+    std::uint64_t size;
+    /// Modification time in nanoseconds since the epoch.
+    std::int64_t mtime;
+
+    bool operator==(const file_identity&) const = default;
+};
+
+/// Return the identity of a file, or std::nullopt when it can not be determined.
+std::optional<file_identity> read_file_identity(const fs::path& path);
+
+
+/// Key of the hashes of a file for a given piece size and position in the v1 data stream.
+struct hash_cache_key
+{
+    file_identity file;
+    std::size_t piece_size;
+    /// Offset of the file in the v1 data stream modulo the piece size, 0 for v2 only storage.
+    std::size_t alignment;
+};
+
+
+/// Hashes of a single file.
+struct hash_cache_entry
+{
+    /// v1 hashes of the pieces that lie completely within the file,
+    /// starting with the first piece that starts in the file.
+    std::vector<dt::sha1_hash> pieces {};
+    /// v1 hash of the last partial piece of a file padded with zeros to the piece size, as in hybrid storage.
+    std::optional<dt::sha1_hash> padded_tail_piece {};
+    std::optional<dt::sha256_hash> pieces_root {};
+    /// v2 piece layer, empty for files smaller or equal to the piece size.
+    std::vector<dt::sha256_hash> piece_layer {};
+    std::vector<std::pair<dt::hash_function, std::vector<std::byte>>> checksums {};
+
+    /// Return the checksum for the given function or nullptr when it was not computed.
+    const std::vector<std::byte>* find_checksum(dt::hash_function function) const noexcept;
+};
+
+
+/// Write the hashes of an entry as lines of `<prefix><field> <value>`.
+void write_hash_cache_fields(std::ostream& os, const hash_cache_entry& entry, std::string_view prefix = {});
+
+/// Parse a line written by write_hash_cache_fields, without its prefix, into entry.
+/// Unknown fields are ignored.
+/// @returns false if the line is malformed.
+bool parse_hash_cache_field(std::string_view line, hash_cache_entry& entry);
+
+
+/// Directory with the hashes of previously hashed files.
+/// Each entry is stored in a separate file named after a hash of its key,
+/// entries are replaced atomically so multiple processes can share a cache.
+///
+/// A cache created without a directory keeps its entries in memory.
+/// Copies of an in-memory cache share the same entries.
+class hash_cache
+{
+public:
+    /// Create an in-memory cache.
+    hash_cache();
+
+    explicit hash_cache(fs::path directory);
+
+    /// Return the directory of the cache, an empty path for an in-memory cache.
+    const fs::path& directory() const noexcept;
+
+    /// Return the entry for key, or std::nullopt when there is no valid entry.
+    std::optional<hash_cache_entry> load(const hash_cache_key& key) const;
+
+    /// Add the hashes in entry to the entry stored for key.
+    /// Failures to write the cache are ignored.
+    void store(const hash_cache_key& key, const hash_cache_entry& entry);
+
+private:
+    struct memory_store;
+
+    fs::path entry_path(const std::string& key_line) const;
+
+    fs::path directory_;
+    std::shared_ptr<memory_store> memory_ {};
+};
+
+} // namespace torrenttools
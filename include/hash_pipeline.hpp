@@ -0,0 +1,383 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+#include <dottorrent/general.hpp>
+#include <dottorrent/hash.hpp>
+#include <dottorrent/hash_function.hpp>
+
+#include "buffer_pool.hpp"
+#include "cpu_info.hpp"
+#include "file_copier.hpp"
+#include "hash_backend.hpp"
+#include "rate_limiter.hpp"
+#include "read_backend.hpp"
+#include "work_queue.hpp"
+
+namespace torrenttools {
+
+namespace { namespace dt = dottorrent; }
+
+struct hash_pipeline_options
+{
+    dt::protocol protocol_version = dt::protocol::v1;
+    /// Per file checksums to compute.
+    std::unordered_set<dt::hash_function> checksums = {};
+    /// Size of the blocks read from storage, rounded up to a multiple of the piece size.
+    std::optional<std::size_t> min_io_block_size = std::nullopt;
+    std::size_t threads = 2;
+    io_engine engine = io_engine::sync;
+    /// Number of reads in flight for asynchronous io engines.
+    std::size_t queue_depth = 32;
+    /// Read with O_DIRECT to bypass the page cache.
+    bool direct_io = false;
+    /// Order in which files are read, results are still stored in storage order.
+    read_order order = read_order::storage;
+    /// Tune the number of hashing threads, up to threads, and the io block size
+    /// while hashing the first few hundred MiB of data.
+    bool adaptive = false;
+    /// Pin each hashing thread to a separate physical core.
+    bool cpu_affinity = false;
+    /// Keep all threads on a single NUMA node and allocate the read buffers on that node.
+    bool numa = false;
+    /// Backends used to hash v1 pieces and v2 leaves.
+    hash_backend_selection hash_backends = {};
+    /// Read the data of all regular files back to back from this stream, eg. standard input, instead of from disk.
+    /// Files are read in storage order. Requires the sync io engine without direct io.
+    std::istream* input = nullptr;
+    /// Copy the data of all regular files to this directory while hashing, see file_copier.
+    /// Files skipped by prepare() are not read and can not be copied.
+    std::optional<std::filesystem::path> copy_to = std::nullopt;
+    /// Clone files on filesystems with reflinks instead of writing the data that was hashed.
+    bool clone_copies = true;
+    /// Drop data that was read from the page cache after it is hashed, except data that was already cached.
+    bool drop_cache = false;
+    /// Maximum number of bytes read from storage per second by all readers, 0 for no limit.
+    std::size_t max_read_rate = 0;
+    /// Maximum number of read operations per second by all readers, 0 for no limit.
+    std::size_t max_read_operations = 0;
+};
+
+
+/// Result of hashing the data of a single file for v2 metafiles.
+struct merkle_result
+{
+    dt::sha256_hash pieces_root;
+    /// Piece layer of the merkle tree, empty for files smaller or equal to the piece size.
+    std::vector<dt::sha256_hash> piece_layer;
+    /// Per file piece index of pieces for which the data could not be read.
+    std::vector<std::size_t> unavailable_pieces;
+};
+
+
+class hash_pipeline;
+
+
+/// Reader, hashing, checksum and copy threads and the read buffers shared by the hash_pipelines of several storages.
+///
+/// Pipelines started on a scheduler are read one after the other in the order they were started,
+/// so the next pipeline is read while the workers hash the last blocks of the previous one
+/// and no threads or buffers are set up between pipelines.
+/// Each pipeline keeps its own hashes, progress, errors and completion.
+/// The options of the scheduler that concern threads and reading, ie. threads, engine, queue_depth, adaptive,
+/// cpu_affinity, numa, hash_backends, max_read_rate and max_read_operations, apply to all its pipelines.
+/// The scheduler must outlive all pipelines started on it.
+class hash_scheduler
+{
+public:
+    explicit hash_scheduler(const hash_pipeline_options& options);
+
+    hash_scheduler(const hash_scheduler&) = delete;
+    hash_scheduler& operator=(const hash_scheduler&) = delete;
+
+    ~hash_scheduler();
+
+    /// Number of threads hashing concurrently.
+    std::size_t thread_count() const noexcept;
+
+    /// CPUs and NUMA node the threads are bound to.
+    /// Empty when neither cpu_affinity nor numa is enabled or the topology could not be read.
+    const thread_placement& placement() const noexcept;
+
+private:
+    friend class hash_pipeline;
+
+    /// A chunk read for a pipeline.
+    struct work_item
+    {
+        hash_pipeline* job;
+        std::shared_ptr<const data_chunk> chunk;
+    };
+
+    /// Data of a hashed chunk to write to the copy destination of a pipeline.
+    struct copy_job
+    {
+        hash_pipeline* job;
+        std::shared_ptr<const data_chunk> chunk;
+        std::vector<data_range> ranges;
+    };
+
+    /// Start the checksum and copy threads if the pipeline needs them and queue it
+    /// to be read after the pipelines started before it.
+    void submit(hash_pipeline& job);
+
+    /// Called by the reader before reading a pipeline.
+    /// The buffer pool is replaced when it is smaller than requested,
+    /// once the pipelines read before are completed and returned their buffers.
+    buffer_pool& begin_reading(std::size_t buffer_size, std::size_t buffer_count);
+
+    /// Called when a pipeline that was passed to begin_reading is completed.
+    void end_reading();
+
+    void run_reader();
+    void run_worker(std::size_t index);
+    void run_checksums();
+    void run_copier();
+
+    void set_thread_limit(std::size_t n);
+
+    hash_pipeline_options options_;
+    thread_placement placement_ {};
+    std::unique_ptr<rate_limiter> limiter_;
+    /// Only accessed from the reader thread.
+    std::unique_ptr<buffer_pool> pool_;
+    /// Pipelines that were passed to begin_reading and are not completed.
+    std::atomic_size_t reading_jobs_ = 0;
+
+    work_queue<hash_pipeline*> jobs_;
+    work_queue<work_item> work_queue_;
+    work_queue<work_item> checksum_queue_;
+    work_queue<copy_job> copy_queue_;
+    /// Workers that did not finish yet, the last one closes the copy queue.
+    std::atomic_size_t running_hashers_ = 0;
+
+    /// Limits the number of workers hashing concurrently when tuning the number of threads.
+    std::atomic_size_t thread_limit_ = 0;
+    std::size_t running_workers_ = 0;
+    std::mutex gate_mutex_;
+    std::condition_variable gate_cv_;
+
+    std::jthread reader_thread_;
+    std::vector<std::jthread> worker_threads_;
+    /// The checksum and copy threads are started with the first pipeline that needs them.
+    std::mutex start_mutex_;
+    std::jthread checksum_thread_;
+    std::jthread copy_thread_;
+};
+
+
+/// Reads the data of a file_storage with a read_backend and hashes it on a pool of worker threads.
+///
+/// v1 pieces are hashed over the concatenated data stream.
+/// v2 merkle trees are built per file from 16 KiB leaf blocks. Files are read independently
+/// with the largest files first, small files are packed together in a single block.
+/// Hybrid storage requires every file to start on a piece boundary,
+/// with padding files filling the gaps in the v1 data stream.
+///
+/// The threads and buffers are owned by a hash_scheduler, which can be shared by several pipelines.
+/// Derived classes decide what to do with the results by implementing the on_* hooks.
+/// Hooks are called concurrently from the worker threads.
+class hash_pipeline
+{
+public:
+    hash_pipeline(dt::file_storage& storage, const hash_pipeline_options& options, bool allow_missing_files);
+
+    hash_pipeline(const hash_pipeline&) = delete;
+    hash_pipeline& operator=(const hash_pipeline&) = delete;
+
+    virtual ~hash_pipeline();
+
+    /// Start hashing on a scheduler of its own, with the threads and buffers set by the options.
+    void start();
+
+    /// Start hashing on a scheduler shared with other pipelines.
+    /// The data is read once the pipelines started on the scheduler before are read.
+    void start(hash_scheduler& scheduler);
+
+    bool started() const noexcept;
+
+    /// Request hashing to stop as soon as possible.
+    void cancel();
+
+    bool cancelled() const noexcept;
+
+    /// Block until all data is hashed or hashing was stopped.
+    /// @throws the first exception thrown while reading or hashing.
+    void wait();
+
+    /// Return true when all data is hashed or hashing was stopped, successfully or not.
+    bool done() const noexcept;
+
+    /// Block until the reader has passed all data to the hashing threads or was stopped.
+    /// Blocks may still be hashed when this returns.
+    void wait_for_reading() const;
+
+    dt::protocol protocol() const noexcept;
+
+    /// Number of bytes hashed.
+    /// v1 counts padding files, v2 and hybrid only count regular files.
+    std::size_t bytes_done() const noexcept;
+
+    /// Return the index of the first incomplete file and the number of bytes done for that file.
+    std::pair<std::size_t, std::size_t> current_file_progress() const noexcept;
+
+    /// Number of bytes written to the copy destination, excluding cloned files.
+    std::size_t bytes_copied() const noexcept;
+
+    /// Number of bytes of regular files that were not copied.
+    std::size_t bytes_not_copied() const noexcept;
+
+    /// Size of the blocks read from storage.
+    std::size_t io_block_size() const noexcept;
+
+    /// Number of threads hashing concurrently.
+    std::size_t thread_count() const noexcept;
+
+    /// CPUs and NUMA node the threads are bound to.
+    /// Empty when neither cpu_affinity nor numa is enabled or the topology could not be read.
+    const thread_placement& placement() const noexcept;
+
+protected:
+    /// Called before the read plan is made.
+    virtual void prepare() {}
+
+    /// Do not read a file of which the hashes are already known, eg. from a cache.
+    /// No merkle tree or checksums are computed for skipped files.
+    /// v1 pieces of the file are still read unless they are skipped with skip_piece,
+    /// pieces shared with other files must be read in any case.
+    /// Must be called from prepare().
+    void skip_file(std::size_t file_index);
+
+    /// Do not read or hash a v1 piece of which the hash is already known.
+    /// In v2 and hybrid storage all files containing the piece must be skipped instead.
+    /// Must be called from prepare().
+    void skip_piece(std::size_t piece_index);
+
+    /// Return true if the file was skipped by prepare().
+    bool is_skipped(std::size_t file_index) const noexcept;
+
+    /// Pass the device id of a file, known from an earlier stat, to the reader so it does not stat the file again.
+    /// Must be called from prepare().
+    void set_file_device(std::size_t file_index, std::uint64_t device);
+
+    virtual void on_piece_hash(std::size_t piece_index, const dt::sha1_hash& hash) = 0;
+
+    /// Called for v1 pieces of which some data could not be read from storage.
+    virtual void on_piece_unavailable(std::size_t /*piece_index*/) {}
+
+    virtual void on_file_hash(std::size_t file_index, merkle_result&& result) = 0;
+
+    /// Called for each piece layer node of a v2 file as soon as the piece is hashed,
+    /// before on_file_hash. Not called for files without a piece layer or pieces with unavailable data.
+    virtual void on_piece_layer_hash(std::size_t /*file_index*/, std::size_t /*piece_index*/,
+                                     const dt::sha256_hash& /*hash*/) {}
+
+    /// Select the parts of a hashed chunk to copy to options.copy_to, as ranges of chunk.data.
+    /// Called from the worker that hashed the chunk after its on_* hooks, the rest of the chunk is not copied.
+    /// All data is copied by default.
+    virtual void select_copy_ranges(const data_chunk& chunk, std::vector<data_range>& ranges)
+    {
+        ranges.push_back({ .offset = 0, .length = chunk.data.size() });
+    }
+
+    virtual void on_file_checksum(std::size_t /*file_index*/, dt::hash_function /*function*/,
+                                  std::span<const std::byte> /*value*/) {}
+
+    dt::file_storage& storage_;
+    hash_pipeline_options options_;
+
+private:
+    friend class hash_scheduler;
+
+    struct file_state;
+    struct tuning_state;
+    struct worker_hashers;
+    struct checksum_state;
+
+    void run_reader();
+    void hash_chunk(const std::shared_ptr<const data_chunk>& chunk, worker_hashers& hashers);
+    void update_checksums(const std::shared_ptr<const data_chunk>& chunk);
+    void copy_chunk(const hash_scheduler::copy_job& job);
+
+    void process_chunk(const data_chunk& chunk, worker_hashers& hashers);
+    void hash_v1_stream_block(const data_chunk& chunk, worker_hashers& hashers);
+    void hash_v1_file_block(const data_chunk& chunk, worker_hashers& hashers);
+    void hash_v2_file_block(const data_chunk& chunk, worker_hashers& hashers);
+    void emit_piece_hashes(worker_hashers& hashers);
+    void complete_file(std::size_t file_index, worker_hashers& hashers);
+    void finalize_empty_file_checksums();
+
+    void tune(const data_chunk& chunk);
+    std::size_t tuned_block_size() const;
+
+    /// Called when a chunk is passed to the next stage or a stage is done with a chunk.
+    /// The pipeline is completed when all tasks are released.
+    void release_task();
+    void complete();
+    void wait_until_done() const;
+
+    void set_exception(std::exception_ptr e);
+
+    bool v1_ = false;
+    bool v2_ = false;
+    bool allow_missing_files_;
+    std::atomic_size_t block_size_ = 0;
+    /// Offset of each file in the v1 data stream.
+    std::vector<std::size_t> file_offsets_;
+    /// Files and v1 pieces skipped by prepare(), empty when nothing is skipped.
+    std::vector<char> skipped_files_;
+    std::vector<char> skipped_pieces_;
+    /// Device id of each file set by prepare(), empty when no devices are known.
+    std::vector<std::uint64_t> file_devices_;
+    std::unique_ptr<file_state[]> file_states_;
+    std::vector<read_request> plan_;
+    /// Remainder of the plan read with the tuned block size.
+    std::vector<read_request> tuned_plan_;
+    /// Only set when adaptive tuning is enabled, only accessed from the reader thread.
+    std::unique_ptr<tuning_state> tuning_;
+    /// Only accessed from the checksum thread.
+    std::unique_ptr<checksum_state> checksum_state_;
+
+    /// Scheduler created by start(), destroyed after this pipeline is done.
+    std::unique_ptr<hash_scheduler> own_scheduler_;
+    hash_scheduler* scheduler_ = nullptr;
+    std::unique_ptr<read_backend> reader_;
+    std::unique_ptr<file_copier> copier_;
+    std::stop_source stop_source_ {};
+    /// Set when the reader took buffers from the scheduler for this pipeline.
+    bool reading_ = false;
+    /// Reading plus the chunks queued for or being processed by the workers, checksum and copy threads.
+    std::atomic_size_t tasks_ = 0;
+
+    std::atomic_bool started_ = false;
+    std::atomic_bool cancelled_ = false;
+    std::atomic_bool reading_done_ = false;
+    std::atomic_bool done_ = false;
+    mutable std::mutex done_mutex_;
+    mutable std::condition_variable done_cv_;
+    std::atomic_size_t bytes_done_ = 0;
+    /// Bytes done per file, used to report per file progress.
+    std::unique_ptr<std::atomic_size_t[]> file_bytes_done_;
+    /// Bytes to be done per file, zero for files that are not counted.
+    std::vector<std::size_t> file_bytes_total_;
+    mutable std::atomic_size_t progress_index_ = 0;
+
+    std::mutex exception_mutex_;
+    std::exception_ptr exception_;
+};
+
+} // namespace torrenttools
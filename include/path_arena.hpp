@@ -0,0 +1,87 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace torrenttools {
+
+/// Return true if path lhs comes before path rhs in the file list of a metafile.
+/// Paths are compared char by char, as std::ranges::lexicographical_compare compares them.
+inline bool path_less(std::string_view lhs, std::string_view rhs) noexcept
+{
+    return std::ranges::lexicographical_compare(lhs, rhs);
+}
+
+/// Paths stored back to back in a single contiguous buffer.
+///
+/// Each path is described by a record with its offset and length in the buffer and a sort key
+/// holding its first bytes, so most comparisons while sorting are a single integer comparison
+/// and sorting does not allocate.
+/// Paths are identified by the order in which they were added, which does not change when sorting.
+class path_arena
+{
+public:
+    using id_type = std::uint32_t;
+
+    /// Add a path and return its id.
+    id_type push_back(std::string_view path);
+
+    /// Add all paths of another arena.
+    /// The ids of the added paths are offset by the number of paths in this arena.
+    void append(const path_arena& other);
+
+    /// Sort the paths in the order of path_less.
+    void sort();
+
+    void reserve(std::size_t path_count, std::size_t byte_count);
+
+    void clear() noexcept;
+
+    /// Return the path at a position.
+    std::string_view operator[](std::size_t index) const noexcept
+    {
+        const auto& r = records_[index];
+        return {buffer_.data() + r.offset, r.length};
+    }
+
+    /// Return the id of the path at a position.
+    id_type id(std::size_t index) const noexcept
+    { return records_[index].id; }
+
+    std::size_t size() const noexcept
+    { return records_.size(); }
+
+    bool empty() const noexcept
+    { return records_.empty(); }
+
+    /// Number of bytes of all paths.
+    std::size_t byte_size() const noexcept
+    { return buffer_.size(); }
+
+    /// Number of bytes used by the paths and their records.
+    std::size_t memory_usage() const noexcept
+    { return buffer_.capacity() + records_.capacity() * sizeof(record); }
+
+private:
+    struct record
+    {
+        /// First bytes of the path, see make_sort_key.
+        std::uint64_t sort_key;
+        std::uint64_t offset;
+        std::uint32_t length;
+        id_type id;
+    };
+
+    /// Pack the first 8 bytes of a path big endian, ordered as char is ordered on this platform,
+    /// and pad shorter paths with zeros, so comparing keys is consistent with comparing the paths.
+    /// Paths with equal keys are compared in full.
+    static std::uint64_t make_sort_key(std::string_view path) noexcept;
+
+    std::vector<char> buffer_ {};
+    std::vector<record> records_ {};
+};
+
+} // namespace torrenttools
@@ -0,0 +1,112 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "file_matcher.hpp"
+#include "hash_cache.hpp"
+#include "hash_pipeline.hpp"
+#include "work_queue.hpp"
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+class storage_hasher;
+
+/// Hashes the files of a v2 or hybrid torrent while the target directory is still being scanned.
+///
+/// Files are queued as the file_matcher finds them and hashed in batches, each batch as a separate storage.
+/// All batches are hashed on the same hash_scheduler, so its threads and buffers are set up once.
+/// The hashes of each file are stored in a hash cache. v2 hashes and, with the padding of hybrid torrents,
+/// v1 hashes of a file do not depend on the other files, so the storage_hasher of the complete storage
+/// takes them from the cache and the metafile is identical to the one created without prehashing.
+/// v1 only torrents can not be prehashed since pieces span files in the final sort order.
+class prehasher
+{
+public:
+    /// Batches are hashed as soon as they reach this size, or max_batch_delay after their first file was queued
+    /// when files are found slowly. finish() waits for the batch that is being hashed, so batches are kept small.
+    static constexpr std::size_t max_batch_bytes = 64 * 1024 * 1024;
+    static constexpr std::size_t max_batch_files = 4096;
+    static constexpr std::chrono::milliseconds max_batch_delay {500};
+
+    /// @param root the search root of the file_matcher.
+    /// @param piece_size the piece size of the metafile.
+    /// @param options options of the storage_hasher of the complete storage.
+    /// @param cache cache to store the hashes in.
+    prehasher(fs::path root, std::size_t piece_size, const hash_pipeline_options& options, hash_cache cache);
+
+    prehasher(const prehasher&) = delete;
+    prehasher& operator=(const prehasher&) = delete;
+
+    ~prehasher();
+
+    /// Queue a file found by the file_matcher. Can be called concurrently.
+    void add_file(std::string_view relative_path, const scanned_file& file);
+
+    /// Block until all files queued before this call are hashed or could not be hashed.
+    /// Files are queued for up to max_batch_delay before they are hashed.
+    void wait_idle();
+
+    /// Stop hashing new batches and wait for the batch that is being hashed to complete.
+    /// Queued files that were not hashed are left to the storage_hasher of the complete storage.
+    void finish();
+
+    /// Number of files that were hashed.
+    std::size_t hashed_file_count() const noexcept
+    { return hashed_file_count_.load(std::memory_order_relaxed); }
+
+    /// Number of batches that could not be hashed.
+    std::size_t failed_batch_count() const noexcept;
+
+    /// Message of the first error that occurred while hashing a batch, empty if there was none.
+    std::string first_error() const;
+
+private:
+    struct queued_file
+    {
+        fs::path path;
+        scanned_file file;
+    };
+
+    void run(std::stop_token stop_token);
+
+    void hash_batch(std::vector<queued_file>& batch, std::stop_token stop_token);
+
+    /// Mark files as processed and wake up wait_idle().
+    void set_processed(std::size_t file_count);
+
+    fs::path root_;
+    std::size_t piece_size_;
+    hash_pipeline_options options_;
+    hash_cache cache_;
+    hash_scheduler scheduler_;
+
+    work_queue<queued_file> queue_ {};
+    /// Files that were queued and files of which the batch is done, hashed or not.
+    std::mutex idle_mutex_ {};
+    std::condition_variable idle_cv_ {};
+    std::size_t queued_file_count_ = 0;
+    std::size_t processed_file_count_ = 0;
+    bool stopped_ = false;
+    std::mutex current_mutex_ {};
+    /// The hasher of the batch that is being hashed, cancelled when finishing.
+    storage_hasher* current_ = nullptr;
+    std::atomic_size_t hashed_file_count_ = 0;
+    mutable std::mutex error_mutex_ {};
+    std::size_t failed_batch_count_ = 0;
+    std::string first_error_ {};
+    std::jthread thread_ {};
+};
+
+} // namespace torrenttools
@@ -0,0 +1,108 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <stop_token>
+
+namespace torrenttools {
+
+/// Token bucket that limits the number of bytes and read operations per second.
+/// A single limiter is shared by all threads reading from storage, so the limits apply to the process as a whole.
+/// Buckets hold up to one second of tokens. A request larger than the bucket is allowed once the bucket is full
+/// and leaves the bucket in debt, so the average rate never exceeds the limit.
+class rate_limiter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    /// @param bytes_per_second maximum number of bytes per second, 0 for no limit.
+    /// @param operations_per_second maximum number of read operations per second, 0 for no limit.
+    rate_limiter(std::size_t bytes_per_second, std::size_t operations_per_second)
+        : bytes_(bytes_per_second)
+        , operations_(operations_per_second)
+    {}
+
+    rate_limiter(const rate_limiter&) = delete;
+    rate_limiter& operator=(const rate_limiter&) = delete;
+
+    /// Block until bytes can be read in the given number of operations.
+    /// @returns false if a stop was requested while waiting.
+    bool acquire(std::size_t bytes, std::size_t operations, std::stop_token stop_token = {})
+    {
+        std::unique_lock lck(mutex_);
+        for (;;) {
+            const auto now = clock::now();
+            bytes_.refill(now);
+            operations_.refill(now);
+
+            auto wait = std::max(bytes_.time_until_available(), operations_.time_until_available());
+            if (wait <= clock::duration::zero()) {
+                bytes_.take(bytes);
+                operations_.take(operations);
+                return true;
+            }
+            // nothing notifies the condition variable, it is only used to wake up on a stop request
+            cv_.wait_for(lck, stop_token, wait, []() { return false; });
+            if (stop_token.stop_requested()) {
+                return false;
+            }
+        }
+    }
+
+    std::size_t bytes_per_second() const noexcept
+    { return bytes_.rate; }
+
+    std::size_t operations_per_second() const noexcept
+    { return operations_.rate; }
+
+private:
+    struct bucket
+    {
+        std::size_t rate;
+        /// Available tokens, negative while the bucket is in debt.
+        double tokens;
+        clock::time_point last_refill;
+
+        explicit bucket(std::size_t rate)
+            : rate(rate)
+            , tokens(static_cast<double>(rate))
+            , last_refill(clock::now())
+        {}
+
+        void refill(clock::time_point now) noexcept
+        {
+            if (rate == 0) {
+                return;
+            }
+            std::chrono::duration<double> elapsed = now - last_refill;
+            tokens = std::min(static_cast<double>(rate), tokens + elapsed.count() * static_cast<double>(rate));
+            last_refill = now;
+        }
+
+        /// Time until the bucket is out of debt, zero or negative if tokens can be taken now.
+        clock::duration time_until_available() const noexcept
+        {
+            if (rate == 0 || tokens >= 0) {
+                return clock::duration::zero();
+            }
+            return std::chrono::ceil<clock::duration>(
+                    std::chrono::duration<double>(-tokens / static_cast<double>(rate)));
+        }
+
+        void take(std::size_t count) noexcept
+        {
+            if (rate != 0) {
+                tokens -= static_cast<double>(count);
+            }
+        }
+    };
+
+    std::mutex mutex_ {};
+    std::condition_variable_any cv_ {};
+    bucket bytes_;
+    bucket operations_;
+};
+
+} // namespace torrenttools
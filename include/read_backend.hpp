@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string_view>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+
+#include "buffer_pool.hpp"
+#include "rate_limiter.hpp"
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+/// Strategy used to read file data from storage.
+enum class io_engine
+{
+    /// Blocking reads from a single reader thread.
+    sync,
+    /// Batched asynchronous reads submitted through io_uring (linux only).
+    uring,
+    /// Files are memory mapped in windows and hashed without copying the data.
+    mmap,
+};
+
+std::string_view to_string(io_engine engine) noexcept;
+
+std::optional<io_engine> make_io_engine(std::string_view name) noexcept;
+
+/// Return true if the engine is supported by this build.
+bool is_available(io_engine engine) noexcept;
+
+
+/// Order in which the files of a storage are read.
+/// The order of the files in the metafile does not depend on the read order.
+enum class read_order
+{
+    /// The order of the read plan, based on the order of the files in the metafile.
+    storage,
+    /// The order of the files on disk, to reduce seeking on rotational disks.
+    physical,
+    /// Files of which the data is in the page cache first, then the other files in storage order.
+    cached,
+};
+
+std::string_view to_string(read_order order) noexcept;
+
+std::optional<read_order> make_read_order(std::string_view name) noexcept;
+
+
+/// A contiguous range of a file that is part of a read_request.
+struct file_segment
+{
+    std::size_t file_index;
+    std::size_t file_offset;
+    std::size_t length;
+};
+
+/// A block of data to read from storage into a single buffer.
+struct read_request
+{
+    /// Offset of the block in the v1 data stream when reading the storage as a stream,
+    /// or the offset in the file when reading per file.
+    std::size_t offset;
+    std::vector<file_segment> segments;
+
+    std::size_t size() const noexcept
+    {
+        std::size_t total = 0;
+        for (const auto& s : segments) {
+            total += s.length;
+        }
+        return total;
+    }
+};
+
+/// Split all entries of the storage, including padding files, in blocks of block_size bytes
+/// of the concatenated v1 data stream. Blocks can span multiple files.
+/// Pieces for which skipped_pieces is non-zero are not read, a block ends before a skipped piece
+/// and the next block starts at the first piece that is not skipped.
+std::vector<read_request> make_stream_read_plan(const dt::file_storage& storage, std::size_t block_size,
+                                                std::span<const char> skipped_pieces = {});
+
+/// Split each non-empty regular file in blocks of block_size bytes to hash files independently.
+/// Files larger than block_size are read first, largest first, so the tail of the plan is not held up
+/// by a single large file. Smaller files follow in storage order and are packed together
+/// in blocks of up to block_size bytes, every file of such a block is read as a whole.
+/// Files for which skipped_files is non-zero are not read.
+/// With storage_order all files are read in storage order instead, as required to read from a stream.
+std::vector<read_request> make_file_read_plan(const dt::file_storage& storage, std::size_t block_size,
+                                              std::span<const char> skipped_files = {},
+                                              bool storage_order = false);
+
+/// Merge consecutive requests of a plan into requests of up to block_size bytes.
+/// Contiguous segments of the same file are joined into a single segment.
+/// block_size must be a multiple of the block size the plan was made with.
+std::vector<read_request> merge_read_plan(std::span<const read_request> plan, std::size_t block_size);
+
+/// Sort key of files of which the location on disk is not known.
+constexpr std::uint64_t unknown_physical_offset = static_cast<std::uint64_t>(-1);
+
+/// Return the physical offset of the first extent of each file, as reported by FIEMAP (linux only).
+/// Padding files, empty files and files of which the location is not known get unknown_physical_offset.
+std::vector<std::uint64_t> physical_file_offsets(const dt::file_storage& storage);
+
+/// Return the number of bytes of each file that are in the page cache, as reported by mincore.
+/// Linux only reports the page cache of files the user owns or can write to, other files count as not cached.
+/// Padding files and files that can not be read get zero.
+std::vector<std::size_t> cached_file_bytes(const dt::file_storage& storage);
+
+/// Return the sort keys to read files that are completely in the page cache first,
+/// followed by files that are partially in the page cache.
+std::vector<std::uint64_t> page_cache_file_keys(const dt::file_storage& storage);
+
+/// Sort the requests of a plan by the key of the files they read, files with equal keys keep their order.
+/// Consecutive requests that continue reading the same file are moved together and stay in order.
+/// A request that reads from several files starts a new group, so v1 stream plans are reordered per file.
+void sort_read_plan(std::vector<read_request>& plan, std::span<const std::uint64_t> file_keys);
+
+/// Device of files that are not on any device, eg. padding files.
+constexpr std::size_t no_device = static_cast<std::size_t>(-1);
+
+/// Device id of files of which the device was not read while scanning.
+constexpr std::uint64_t unknown_device_id = static_cast<std::uint64_t>(-1);
+
+/// Assign each request of a plan to the device holding most of its data, given the device of each file.
+/// Consecutive requests that continue reading the same file are assigned to the same device,
+/// so they are read by the same queue in plan order.
+/// A request that reads from several files starts a new group, so the blocks of a v1 stream plan
+/// are spread over the devices of their files. The tail of the first file of such a request
+/// can then be passed before the rest of that file.
+std::vector<std::size_t> assign_request_devices(std::span<const read_request> plan,
+                                                std::span<const std::size_t> file_devices);
+
+/// Return the order to read requests in so the requests of different devices alternate.
+/// The requests of each device keep their relative order.
+std::vector<std::size_t> interleave_by_device(std::span<const std::size_t> request_devices);
+
+
+/// A read request filled with data.
+struct data_chunk
+{
+    const read_request* request;
+    std::span<const std::byte> data;
+    /// For each segment of the request, false if the data could not be read from storage.
+    std::vector<bool> available;
+    buffer_pool::buffer_handle buffer;
+
+    bool is_complete() const noexcept
+    {
+        return std::find(available.begin(), available.end(), false) == available.end();
+    }
+};
+
+using chunk_sink = std::function<void(std::shared_ptr<const data_chunk>)>;
+
+
+/// Alignment of buffers, file offsets and read sizes required for direct io.
+constexpr std::size_t direct_io_alignment = 4096;
+
+
+struct read_backend_options
+{
+    /// Maximum number of read operations in flight for asynchronous engines.
+    std::size_t queue_depth = 32;
+    /// Report files that could not be read as unavailable data instead of throwing.
+    bool allow_missing_files = false;
+    /// Bypass the page cache with O_DIRECT. Requires buffers aligned to direct_io_alignment.
+    bool direct_io = false;
+    /// Drop the pages that were read from the page cache once the data is no longer needed,
+    /// so reading does not evict the data other processes work with (linux only).
+    /// Pages that were cached before they were read are kept, if the page cache of the file can be probed,
+    /// otherwise all pages that were read are dropped. Read ahead stays enabled. Has no effect with direct_io.
+    bool drop_cache = false;
+    /// Limits the read rate of all backends sharing it, nullptr for no limit.
+    /// Every segment of a regular file counts as one read operation.
+    rate_limiter* limiter = nullptr;
+    /// Read the regular files back to back in storage order from this stream instead of from disk.
+    /// Requests must read the data sequentially.
+    std::istream* input = nullptr;
+    /// Device id of each file, eg. from scanning the directory, or unknown_device_id.
+    /// Only files of which the device is not known are stat'ed to find files on different devices.
+    /// Empty when no devices are known. Must outlive the backend.
+    std::span<const std::uint64_t> file_devices {};
+};
+
+
+class read_backend
+{
+public:
+    read_backend(const dt::file_storage& storage, buffer_pool& pool, const read_backend_options& options)
+        : storage_(storage)
+        , pool_(pool)
+        , options_(options)
+    {}
+
+    virtual ~read_backend() = default;
+
+    /// Read all requests in the order of the plan and pass each filled chunk to sink.
+    /// Chunks are passed to the sink in the same order as the requests in the plan,
+    /// except when files on several devices are read concurrently. Requests are then interleaved by device,
+    /// requests of the same group, see assign_request_devices, are still passed in plan order.
+    virtual void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) = 0;
+
+protected:
+    fs::path file_path(std::size_t file_index) const;
+
+    /// Wait until the rate limiter allows the data of a request to be read.
+    /// @returns false if a stop was requested while waiting.
+    bool throttle(const read_request& request, std::stop_token stop_token);
+
+    const dt::file_storage& storage_;
+    buffer_pool& pool_;
+    read_backend_options options_;
+};
+
+
+std::unique_ptr<read_backend> make_read_backend(
+        io_engine engine,
+        const dt::file_storage& storage,
+        buffer_pool& pool,
+        const read_backend_options& options);
+
+} // namespace torrenttools
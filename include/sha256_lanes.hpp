@@ -0,0 +1,16 @@
+#pragma once
+#include <cstddef>
+
+namespace torrenttools {
+
+/// Return the number of messages sha256_lanes hashes in a single SIMD pass on this CPU:
+/// 16 with AVX-512, 8 with AVX2, or 0 when the CPU supports neither.
+std::size_t sha256_lane_count() noexcept;
+
+/// Hash sha256_lane_count() messages of equal length in parallel SIMD lanes.
+/// @param messages pointers to sha256_lane_count() messages of `length` bytes.
+/// @param out buffer of sha256_lane_count() * 32 bytes receiving the digests in message order.
+/// @pre sha256_lane_count() > 0
+void sha256_lanes(const std::byte* const* messages, std::size_t length, std::byte* out) noexcept;
+
+} // namespace torrenttools
@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+
+#include "checkpoint.hpp"
+#include "hash_cache.hpp"
+#include "hash_pipeline.hpp"
+
+namespace torrenttools {
+
+/// Where and how often a storage_hasher saves its progress.
+struct checkpoint_options
+{
+    fs::path path;
+    /// Interval between appending newly completed pieces and files to the checkpoint.
+    std::chrono::seconds interval = std::chrono::seconds(10);
+    /// Continue from an existing checkpoint at path, if there is one.
+    bool resume = false;
+};
+
+
+/// Hash all files of a file_storage and store the piece hashes, v2 merkle roots, piece layers
+/// and per file checksums in the storage.
+/// Padding files are inserted in hybrid storage on construction when the storage does not contain any.
+///
+/// When a hash cache is given, the hashes of unchanged files are taken from the cache and these files
+/// are not read, except for v1 pieces they share with other files.
+///
+/// With checkpoint options, completed pieces and files are periodically appended to a checkpoint file.
+/// When resuming, the checkpoint must match the storage and the hashes in it are not computed again.
+class storage_hasher : public hash_pipeline
+{
+public:
+    storage_hasher(dt::file_storage& storage, const hash_pipeline_options& options,
+                   std::optional<hash_cache> cache = std::nullopt,
+                   std::optional<checkpoint_options> checkpoint = std::nullopt);
+
+    ~storage_hasher() override;
+
+    /// Set the identities of the files read while scanning, in the order of the files in the storage
+    /// without padding files. They are used to look up files in the hash cache instead of reading
+    /// the identity of each file again. Must be called before start().
+    void set_file_identities(std::vector<std::optional<file_identity>> identities);
+
+    /// Number of files of which the hashes were taken from the cache.
+    std::size_t cached_file_count() const noexcept;
+
+    /// Store the hashes of all files that were read in the cache.
+    /// Must only be called after wait() returned without error.
+    void update_cache();
+
+    /// Number of files and v1 pieces restored from the checkpoint.
+    std::size_t resumed_file_count() const noexcept;
+    std::size_t resumed_piece_count() const noexcept;
+
+    /// Append all pieces and files completed since the last write to the checkpoint.
+    /// Can be called while hashing.
+    /// @throws std::runtime_error if the checkpoint could not be written.
+    void write_checkpoint();
+
+    /// Stop writing checkpoints and delete the checkpoint file.
+    void remove_checkpoint();
+
+protected:
+    void prepare() override;
+
+    void on_piece_hash(std::size_t piece_index, const dt::sha1_hash& hash) override;
+
+    void on_file_hash(std::size_t file_index, merkle_result&& result) override;
+
+    void on_file_checksum(std::size_t file_index, dt::hash_function function,
+                          std::span<const std::byte> value) override;
+
+private:
+    /// Insert padding files to align each regular file to a piece boundary.
+    void add_padding_files();
+
+    /// Pass the devices of the files read while scanning to the reader.
+    void set_scanned_file_devices();
+
+    /// Set the hashes of all files found in the cache and skip reading them.
+    /// The devices of all files of which the identity is read are passed to the reader.
+    void load_from_cache();
+
+    /// Set the hashes of a file from a cache entry.
+    /// @returns false, without modifying the storage, if the entry does not contain all hashes needed.
+    bool apply_cache_entry(std::size_t file_index, std::size_t stream_offset, const hash_cache_entry& cached);
+
+    /// Return the range of v1 pieces that lie completely within a file.
+    std::pair<std::size_t, std::size_t> interior_pieces(std::size_t stream_offset, std::size_t file_size) const;
+
+    /// Restore the hashes of a checkpoint when resuming, open the checkpoint and start writing it periodically.
+    void open_checkpoint();
+
+    /// Set the hashes of completed pieces and files from a checkpoint and skip reading them.
+    void resume_from(const checkpoint_state& state);
+
+    /// Number of results of a file: its merkle tree and each checksum.
+    std::size_t expected_results(std::size_t file_index) const;
+
+    std::mutex file_entry_mutex_;
+    std::optional<hash_cache> cache_;
+    /// Cache key of each file, std::nullopt for files that are not cached.
+    std::vector<std::optional<hash_cache_key>> cache_keys_ {};
+    /// Identities of the non padding files read while scanning, empty when not known.
+    std::vector<std::optional<file_identity>> file_identities_ {};
+    /// Results of files that were read, kept to update the cache and the checkpoint.
+    std::vector<hash_cache_entry> computed_ {};
+    std::size_t cached_file_count_ = 0;
+
+    std::optional<checkpoint_options> checkpoint_options_;
+    std::optional<checkpoint_writer> checkpoint_ {};
+    std::mutex checkpoint_mutex_;
+    /// State of each v1 piece: 0 when not hashed, 1 when hashed and 2 when written to the checkpoint.
+    std::unique_ptr<std::atomic<char>[]> piece_states_ {};
+    /// Number of results done per file.
+    std::unique_ptr<std::atomic_size_t[]> file_results_ {};
+    /// Files written to the checkpoint, only accessed with checkpoint_mutex_ held.
+    std::vector<char> file_written_ {};
+    std::size_t resumed_file_count_ = 0;
+    std::size_t resumed_piece_count_ = 0;
+    std::jthread checkpoint_thread_ {};
+};
+
+} // namespace torrenttools
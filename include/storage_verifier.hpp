@@ -0,0 +1,54 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+
+#include "hash_pipeline.hpp"
+
+namespace torrenttools {
+
+/// Hash the data of a file_storage and compare it against the hashes stored in the storage.
+/// Files that are missing or too short are reported as unavailable pieces instead of errors.
+/// With options.copy_to only the pieces that pass verification are copied.
+class storage_verifier : public hash_pipeline
+{
+public:
+    storage_verifier(dt::file_storage& storage, const hash_pipeline_options& options);
+
+    /// Return the fraction of the pieces of a file that passed verification.
+    /// v2 piece layers are used when the protocol includes v2, v1 pieces otherwise.
+    double percentage(const dt::file_entry& entry) const;
+
+    /// Return the fraction of the pieces of the file with given index that passed verification.
+    double percentage(std::size_t file_index) const;
+
+    /// Return the v1 pieces that passed verification.
+    const std::vector<char>& pieces_done() const noexcept;
+
+    /// Return the pieces of the file with given index that failed verification.
+    /// These are the indices in the piece layer of the file when the protocol includes v2,
+    /// otherwise the indices of the v1 pieces overlapping the file.
+    std::vector<std::size_t> failed_pieces(std::size_t file_index) const;
+
+protected:
+    void on_piece_hash(std::size_t piece_index, const dt::sha1_hash& hash) override;
+
+    void on_file_hash(std::size_t file_index, merkle_result&& result) override;
+
+    void on_piece_layer_hash(std::size_t file_index, std::size_t piece_index, const dt::sha256_hash& hash) override;
+
+    void select_copy_ranges(const data_chunk& chunk, std::vector<data_range>& ranges) override;
+
+private:
+    double v1_percentage(std::size_t file_index) const;
+    double v2_percentage(std::size_t file_index) const;
+
+    std::unordered_map<const dt::file_entry*, std::size_t> file_indices_;
+    std::vector<std::size_t> file_offsets_;
+    std::vector<char> pieces_done_;
+    /// Per file v2 pieces that passed verification.
+    std::vector<std::vector<char>> file_pieces_done_;
+};
+
+} // namespace torrenttools
@@ -0,0 +1,108 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include <dottorrent/file_storage.hpp>
+#include <dottorrent/hash.hpp>
+
+#include "hash_backend.hpp"
+#include "hash_cache.hpp"
+#include "hash_pipeline.hpp"
+#include "tar_reader.hpp"
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; namespace dt = dottorrent; }
+
+/// Hashes the regular files of a tar archive in a single pass over the archive,
+/// so archives can be hashed from a pipe without extracting them.
+///
+/// The file list is built from the headers of the archive, in archive order, while the data is hashed.
+/// The piece size must therefore be known before the first member is read.
+/// Tar headers and padding are not part of the hashed data, in hybrid storage padding files are
+/// inserted between members as usual. Directories, links and special files are skipped.
+///
+/// Hashing runs on the calling thread, v1 pieces and v2 leaves are hashed in batches with the
+/// selected hash backends.
+class tar_hasher
+{
+public:
+    /// Only the protocol, checksums and hash backends of options are used.
+    tar_hasher(std::istream& input, std::size_t piece_size, const hash_pipeline_options& options);
+
+    tar_hasher(const tar_hasher&) = delete;
+    tar_hasher& operator=(const tar_hasher&) = delete;
+
+    /// Read and hash the whole archive.
+    /// @throws std::runtime_error if the archive is corrupt or truncated.
+    void run();
+
+    /// Number of member bytes hashed and the number of bytes read from the archive, including headers.
+    std::size_t bytes_done() const noexcept;
+    std::size_t bytes_read() const noexcept;
+
+    /// Number of regular files hashed.
+    std::size_t files_done() const noexcept;
+
+    /// Number of links and special files that were skipped.
+    std::size_t skipped_member_count() const noexcept;
+
+    /// Return the top level directory that contains all files, or std::nullopt if there is none.
+    std::optional<fs::path> common_root() const;
+
+    /// Add all files and their hashes to an empty storage and set its piece size.
+    /// @param strip_root remove the common root directory from the path of all files.
+    void set_files(dt::file_storage& storage, bool strip_root) const;
+
+private:
+    using sha256_digest = std::array<std::byte, dt::sha256_hash::size_bytes>;
+
+    struct file_record
+    {
+        fs::path path;
+        std::size_t size;
+        bool is_padding_file;
+        hash_cache_entry hashes;
+    };
+
+    void hash_member(tar_reader& reader, const tar_member& member);
+    void add_v1_data(std::span<const std::byte> data);
+    void finish_v1_piece();
+    /// Append the piece layer node of a piece of a file to nodes,
+    /// or the leaves for files without a piece layer.
+    void hash_v2_piece(std::span<const std::byte> data, bool has_piece_layer, std::vector<sha256_digest>& nodes);
+    /// Replace layer by the nodes `levels` layers above it.
+    void reduce_layer(std::vector<sha256_digest>& layer, std::size_t levels);
+
+    std::istream& input_;
+    std::size_t piece_size_;
+    hash_pipeline_options options_;
+    bool v1_;
+    bool v2_;
+    bool hybrid_;
+    std::unique_ptr<block_hasher> sha1_;
+    std::unique_ptr<block_hasher> sha256_;
+
+    std::vector<file_record> files_ {};
+    std::vector<dt::sha1_hash> pieces_ {};
+    /// Offset in the v1 data stream, including padding files.
+    std::size_t stream_offset_ = 0;
+    /// Data of the v1 piece that is being filled.
+    std::vector<std::byte> piece_buffer_ {};
+    std::size_t piece_fill_ = 0;
+    std::vector<std::byte> read_buffer_ {};
+
+    std::atomic_size_t bytes_done_ = 0;
+    std::atomic_size_t bytes_read_ = 0;
+    std::atomic_size_t files_done_ = 0;
+    std::size_t skipped_member_count_ = 0;
+};
+
+} // namespace torrenttools
@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <filesystem>
+#include <iosfwd>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace torrenttools {
+
+namespace { namespace fs = std::filesystem; }
+
+/// A member of a tar archive.
+struct tar_member
+{
+    enum class kind
+    {
+        regular_file,
+        directory,
+        /// Links, devices and fifos, these have no data in the archive.
+        other,
+    };
+
+    /// Relative path of the member, without leading "./" and trailing slashes.
+    fs::path path;
+    kind type;
+    /// Size of the data of the member.
+    std::size_t size;
+};
+
+
+/// Reads the members of a ustar, GNU or pax tar archive sequentially from a stream, eg. a pipe.
+/// Headers, pax extended headers and the padding after each member are consumed by the reader,
+/// only the data of the members is returned by read().
+class tar_reader
+{
+public:
+    explicit tar_reader(std::istream& input);
+
+    /// Advance to the next member, the data of the current member that was not read is skipped.
+    /// @returns std::nullopt at the end of the archive.
+    /// @throws std::runtime_error if the archive is corrupt or truncated, or a path leaves the archive root.
+    std::optional<tar_member> next();
+
+    /// Read the data of the current member.
+    /// @returns the number of bytes read, less than data.size() only at the end of the member.
+    /// @throws std::runtime_error if the archive is truncated.
+    std::size_t read(std::span<std::byte> data);
+
+    /// Number of bytes consumed from the stream.
+    std::size_t position() const noexcept;
+
+private:
+    using header_block = std::array<char, 512>;
+
+    /// Read a header block, returns false at the end of the stream.
+    bool read_header(header_block& header);
+    /// Read exactly data.size() bytes.
+    void read_exact(std::span<char> data);
+    void skip(std::size_t count);
+    /// Read the data of a member holding metadata of the next member, eg. a long name.
+    std::string read_metadata(std::size_t size);
+
+    std::istream& input_;
+    std::size_t position_ = 0;
+    /// Data and padding left of the current member.
+    std::size_t remaining_ = 0;
+    std::size_t padding_ = 0;
+};
+
+} // namespace torrenttools
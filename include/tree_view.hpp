@@ -17,11 +17,11 @@
 #include <termcontrol/detail/display_width.hpp>
 
 #include <dottorrent/metafile.hpp>
-#include <dottorrent/storage_verifier.hpp>
 
 #include "natural_sort.hpp"
 #include "formatters.hpp"
 #include "ls_colors.hpp"
+#include "storage_verifier.hpp"
 
 
 namespace fs = std::filesystem;
@@ -251,7 +251,7 @@ std::string format_file_tree(const dottorrent::metafile& m,
 
 std::string format_verify_file_tree(
         const dottorrent::metafile& m,
-        const dottorrent::storage_verifier& verifier,
+        const torrenttools::storage_verifier& verifier,
         std::string_view prefix = ""sv,
         const tree_options& options = {});
 
@@ -3,14 +3,15 @@
 #include <string>
 #include <chrono>
 #include <filesystem>
+#include <optional>
 
 #include <dottorrent/metafile.hpp>
-#include <dottorrent/storage_verifier.hpp>
 
 #include <CLI/CLI.hpp>
 
 #include "argument_parsers.hpp"
 #include "common.hpp"
+#include "read_backend.hpp"
 
 namespace fs = std::filesystem;
 
@@ -20,8 +21,29 @@ struct verify_app_options
 {
     fs::path metafile;
     fs::path files_root_directory;
-    std::uint8_t threads;
+    /// Number of hashing threads, std::nullopt to tune the number of threads automatically.
+    std::optional<std::size_t> threads = 2;
     dottorrent::protocol protocol_version;
+    std::optional<std::size_t> io_block_size;
+    torrenttools::io_engine io_engine = torrenttools::io_engine::sync;
+    std::size_t io_queue_depth = 32;
+    bool direct_io = false;
+    bool cpu_affinity = false;
+    bool numa = false;
+    /// Hash backend to use, std::nullopt to select the fastest backend.
+    std::optional<torrenttools::hash_backend> hash_backend = std::nullopt;
+    /// Order in which the files are read.
+    torrenttools::read_order read_order = torrenttools::read_order::storage;
+    /// Directory to copy the pieces that pass verification to.
+    std::optional<fs::path> copy_to = std::nullopt;
+    /// Drop data that was read from the page cache after it is hashed.
+    bool drop_cache = false;
+    /// Maximum number of bytes read per second, 0 for no limit.
+    std::size_t max_read_rate = 0;
+    /// Maximum number of read operations per second, 0 for no limit.
+    std::size_t max_iops = 0;
+    /// Run with idle cpu and io priority.
+    bool background = false;
 };
 
 
@@ -0,0 +1,92 @@
+#pragma once
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+
+namespace torrenttools {
+
+/// Unbounded multi-producer multi-consumer queue.
+/// Consumers block in pop() until an item is available or the queue is closed.
+template <typename T>
+class work_queue
+{
+public:
+    void push(T value)
+    {
+        {
+            std::unique_lock lck(mutex_);
+            items_.push_back(std::move(value));
+        }
+        cv_.notify_one();
+    }
+
+    /// @returns the next item or std::nullopt when the queue is closed and drained.
+    std::optional<T> pop()
+    {
+        std::unique_lock lck(mutex_);
+        cv_.wait(lck, [this]() { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(items_.front());
+        items_.pop_front();
+        return value;
+    }
+
+    /// @returns the next item, or std::nullopt when the queue is closed and drained
+    /// or no item became available before the deadline.
+    template <typename Clock, typename Duration>
+    std::optional<T> pop_until(const std::chrono::time_point<Clock, Duration>& deadline)
+    {
+        std::unique_lock lck(mutex_);
+        cv_.wait_until(lck, deadline, [this]() { return !items_.empty() || closed_; });
+        if (items_.empty()) {
+            return std::nullopt;
+        }
+        T value = std::move(items_.front());
+        items_.pop_front();
+        return value;
+    }
+
+    /// Wake up all consumers. Items already in the queue are still returned by pop().
+    void close()
+    {
+        {
+            std::unique_lock lck(mutex_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
+
+    /// Drop all pending items.
+    void clear()
+    {
+        std::deque<T> items {};
+        {
+            std::unique_lock lck(mutex_);
+            items.swap(items_);
+        }
+    }
+
+    bool closed() const
+    {
+        std::unique_lock lck(mutex_);
+        return closed_;
+    }
+
+    std::size_t size() const
+    {
+        std::unique_lock lck(mutex_);
+        return items_.size();
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<T> items_;
+    bool closed_ = false;
+};
+
+} // namespace torrenttools
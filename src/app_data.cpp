@@ -29,6 +29,35 @@ fs::path get_user_data_dir()
     return home_dir;
 }
 
+fs::path get_user_cache_dir()
+{
+    fs::path cache_dir;
+
+#if defined(__linux__)
+    char* r = std::getenv("HOME");
+    char* xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+
+    if (xdg_cache_home) {
+        cache_dir = fs::path(xdg_cache_home)/"torrenttools";
+    } else if (r) {
+        cache_dir = fs::path(r)/".cache/torrenttools";
+    }
+
+#elif defined(__APPLE__)
+    char* r = std::getenv("HOME");
+    if (r) {
+        cache_dir = fs::path(r) /"Library/Caches/torrenttools";
+    }
+#elif defined(_WIN32)
+    char* r = std::getenv("LOCALAPPDATA");
+    if (r) {
+        cache_dir = fs::path(r) / "torrenttools";
+    }
+#endif
+
+    return cache_dir;
+}
+
 std::vector<fs::path> get_app_data_search_path()
 {
     static std::vector<fs::path> data_dirs {
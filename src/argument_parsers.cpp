@@ -3,6 +3,7 @@
 #include <algorithm>
 #include <functional>
 #include <charconv>
+#include <limits>
 #include <unordered_set>
 #include <chrono>
 #include <date/date.h>
@@ -90,6 +91,192 @@ std::optional<std::size_t> io_block_size_transformer(const std::vector<std::stri
     return res;
 }
 
+
+tt::io_engine io_engine_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    auto engine = tt::make_io_engine(v.at(0));
+    if (!engine) {
+        throw std::invalid_argument(fmt::format(err_msg, v.at(0), "io-engine", "expected sync, uring or mmap"));
+    }
+    if (!tt::is_available(*engine)) {
+        throw std::invalid_argument(fmt::format(
+                "io engine {} is not supported by this build", tt::to_string(*engine)));
+    }
+    return *engine;
+}
+
+
+tt::read_order read_order_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    auto order = tt::make_read_order(v.at(0));
+    if (!order) {
+        throw std::invalid_argument(fmt::format(err_msg, v.at(0), "read-order", "expected storage, physical or cached"));
+    }
+    return *order;
+}
+
+
+std::size_t io_queue_depth_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    std::size_t depth = 0;
+    const auto& s = v.at(0);
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), depth);
+
+    if (ec != std::errc{} || ptr != s.data() + s.size()) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "io-queue-depth", "expected an integer"));
+    }
+    if (depth == 0 || depth > 4096) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "io-queue-depth", "must be between 1 and 4096"));
+    }
+    return depth;
+}
+
+
+/// Parse a size with an optional K, M or G suffix.
+static std::size_t parse_size(std::string_view option, const std::string& v)
+{
+    std::string s {};
+    rng::transform(v, std::back_inserter(s), [](const char c) { return std::tolower(c); });
+
+    std::size_t value = 0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (ec != std::errc{}) {
+        throw std::invalid_argument(fmt::format(err_msg, v, option, "expected an integer"));
+    }
+    auto suffix = std::string(ptr, (s.data() + s.size() - ptr));
+    trim(suffix);
+
+    std::size_t multiplier = 1;
+    if (suffix == "k" || suffix == "ki" || suffix == "kib") {
+        multiplier = 1024;
+    }
+    else if (suffix == "m" || suffix == "mi" || suffix == "mib") {
+        multiplier = 1024 * 1024;
+    }
+    else if (suffix == "g" || suffix == "gi" || suffix == "gib") {
+        multiplier = 1024 * 1024 * 1024;
+    }
+    else if (!suffix.empty() && suffix != "b") {
+        throw std::invalid_argument(fmt::format(err_msg, v, option, "expected a K, M or G suffix"));
+    }
+    if (value > std::numeric_limits<std::size_t>::max() / multiplier) {
+        throw std::invalid_argument(fmt::format(err_msg, v, option, "value too large"));
+    }
+    return value * multiplier;
+}
+
+
+std::size_t data_size_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    return parse_size("size", v.at(0));
+}
+
+
+std::size_t max_read_rate_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    // allow rates written as eg. 50M/s
+    auto s = v.at(0);
+    if (s.size() > 2 && (s.ends_with("/s") || s.ends_with("/S"))) {
+        s.resize(s.size() - 2);
+    }
+    auto rate = parse_size("max-read-rate", s);
+    if (rate == 0) {
+        throw std::invalid_argument(fmt::format(err_msg, v.at(0), "max-read-rate", "must be larger than zero"));
+    }
+    return rate;
+}
+
+
+std::size_t max_iops_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    std::size_t iops = 0;
+    const auto& s = v.at(0);
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), iops);
+
+    if (ec != std::errc{} || ptr != s.data() + s.size()) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "max-iops", "expected an integer"));
+    }
+    if (iops == 0) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "max-iops", "must be larger than zero"));
+    }
+    return iops;
+}
+
+
+std::size_t max_memory_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    auto size = parse_size("max-memory", v.at(0));
+    if (size < 1024 * 1024) {
+        throw std::invalid_argument(fmt::format(err_msg, v.at(0), "max-memory", "must be at least 1M"));
+    }
+    return size;
+}
+
+
+std::optional<std::size_t> threads_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    const auto& s = v.at(0);
+    if (s == "auto") {
+        return std::nullopt;
+    }
+
+    std::size_t threads = 0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), threads);
+
+    if (ec != std::errc{} || ptr != s.data() + s.size()) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "threads", "expected an integer or auto"));
+    }
+    if (threads == 0) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "threads", "must be larger than zero"));
+    }
+    return threads;
+}
+
+std::optional<tt::hash_backend> hash_backend_transformer(const std::vector<std::string>& v)
+{
+    if (v.size() > 1)
+        throw std::invalid_argument("Multiple values not supported.");
+
+    const auto& s = v.at(0);
+    if (s == "auto") {
+        return std::nullopt;
+    }
+
+    auto backend = tt::make_hash_backend(s);
+    if (!backend) {
+        throw std::invalid_argument(fmt::format(err_msg, s, "hash-backend", "expected auto, openssl, isal or simd"));
+    }
+    if (!tt::is_available(*backend)) {
+        throw std::invalid_argument(fmt::format(
+                "hash backend {} is not supported by this build or CPU", tt::to_string(*backend)));
+    }
+    return backend;
+}
+
 std::vector<std::vector<std::string>> announce_transformer(const std::vector<std::string>& args)
 {
     std::vector<std::vector<std::string>> res {};
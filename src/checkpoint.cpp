@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+
+#include <dottorrent/file_entry.hpp>
+#include <dottorrent/hasher/factory.hpp>
+
+#include "checkpoint.hpp"
+
+namespace torrenttools {
+
+namespace {
+
+constexpr std::string_view checkpoint_header = "torrenttools-checkpoint 1";
+
+/// Split the first space separated word of a line.
+std::pair<std::string_view, std::string_view> split_word(std::string_view line)
+{
+    auto space = line.find(' ');
+    if (space == std::string_view::npos) {
+        return {line, {}};
+    }
+    return {line.substr(0, space), line.substr(space + 1)};
+}
+
+std::optional<std::size_t> parse_index(std::string_view s)
+{
+    std::size_t value = 0;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    if (ec != std::errc{} || ptr != s.data() + s.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+} // namespace
+
+
+std::string make_checkpoint_signature(const dt::file_storage& storage, dt::protocol protocol,
+                                      const std::unordered_set<dt::hash_function>& checksums)
+{
+    std::vector<std::string_view> checksum_names {};
+    for (auto f : checksums) {
+        checksum_names.push_back(to_string(f));
+    }
+    std::sort(checksum_names.begin(), checksum_names.end());
+
+    std::string description = fmt::format("protocol {} piece-size {} checksums {}\n",
+                                          int(protocol), storage.piece_size(), fmt::join(checksum_names, ","));
+    for (const auto& entry : storage) {
+        std::int64_t mtime = -1;
+        if (!entry.is_padding_file()) {
+            if (auto identity = read_file_identity(storage.root_directory() / entry.path()); identity) {
+                mtime = identity->mtime;
+            }
+        }
+        description += fmt::format("{} {} {} {}\n", entry.file_size(), entry.is_padding_file(), mtime,
+                                   entry.path().string());
+    }
+
+    auto hasher = dt::make_hasher(dt::hash_function::sha1);
+    hasher->update(std::as_bytes(std::span(description)));
+    std::array<std::byte, dt::sha1_hash::size_bytes> digest {};
+    hasher->finalize_to(digest);
+    std::string signature {};
+    for (auto b : digest) {
+        signature += fmt::format("{:02x}", std::to_integer<unsigned>(b));
+    }
+    return signature;
+}
+
+
+checkpoint_state read_checkpoint(const fs::path& path, std::string_view signature)
+{
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+        throw std::invalid_argument(fmt::format("could not open checkpoint {}", path.string()));
+    }
+    std::stringstream buffer {};
+    buffer << f.rdbuf();
+    const std::string content = buffer.str();
+
+    // Only complete lines are records, the last line may have been cut off while writing.
+    std::vector<std::string_view> lines {};
+    for (std::size_t pos = 0; pos < content.size();) {
+        auto end = content.find('\n', pos);
+        if (end == std::string::npos) {
+            break;
+        }
+        lines.push_back(std::string_view(content).substr(pos, end - pos));
+        pos = end + 1;
+    }
+
+    if (lines.size() < 2 || lines[0] != checkpoint_header) {
+        throw std::invalid_argument(fmt::format("{} is not a checkpoint file", path.string()));
+    }
+    if (lines[1] != fmt::format("signature {}", signature)) {
+        throw std::invalid_argument(fmt::format(
+                "checkpoint {} does not match the target: files or hashing options changed since it was written",
+                path.string()));
+    }
+
+    auto malformed = [&](std::size_t line_index) {
+        return std::invalid_argument(fmt::format("checkpoint {} is corrupt at line {}", path.string(), line_index + 1));
+    };
+
+    checkpoint_state state {};
+    std::map<std::size_t, hash_cache_entry> partial_files {};
+
+    for (std::size_t i = 2; i < lines.size(); ++i) {
+        auto [record, rest] = split_word(lines[i]);
+        auto [index_string, fields] = split_word(rest);
+        auto index = parse_index(index_string);
+        if (!index) {
+            throw malformed(i);
+        }
+
+        if (record == "run") {
+            hash_cache_entry run {};
+            if (!parse_hash_cache_field(fields, run)) {
+                throw malformed(i);
+            }
+            for (std::size_t n = 0; n < run.pieces.size(); ++n) {
+                state.pieces.emplace_back(*index + n, run.pieces[n]);
+            }
+        }
+        else if (record == "file") {
+            // a file is complete once all its hashes are written
+            if (fields == "done") {
+                state.files[*index] = std::move(partial_files[*index]);
+                partial_files.erase(*index);
+            }
+            else if (!parse_hash_cache_field(fields, partial_files[*index])) {
+                throw malformed(i);
+            }
+        }
+        else {
+            throw malformed(i);
+        }
+    }
+    return state;
+}
+
+
+checkpoint_writer::checkpoint_writer(const fs::path& path, std::string_view signature, bool append)
+    : path_(path)
+{
+    if (append) {
+        file_.open(path_, std::ios::binary | std::ios::app);
+    }
+    else {
+        file_.open(path_, std::ios::binary | std::ios::trunc);
+        file_ << checkpoint_header << '\n' << "signature " << signature << '\n';
+    }
+    if (!file_) {
+        throw std::runtime_error(fmt::format("could not open checkpoint {}", path_.string()));
+    }
+    flush();
+}
+
+const fs::path& checkpoint_writer::path() const noexcept
+{
+    return path_;
+}
+
+void checkpoint_writer::add_pieces(std::size_t first_piece, std::span<const dt::sha1_hash> hashes)
+{
+    hash_cache_entry run {};
+    run.pieces.assign(hashes.begin(), hashes.end());
+    write_hash_cache_fields(file_, run, fmt::format("run {} ", first_piece));
+}
+
+void checkpoint_writer::add_file(std::size_t file_index, const hash_cache_entry& entry)
+{
+    auto prefix = fmt::format("file {} ", file_index);
+    write_hash_cache_fields(file_, entry, prefix);
+    file_ << prefix << "done\n";
+}
+
+void checkpoint_writer::flush()
+{
+    if (!file_.flush()) {
+        throw std::runtime_error(fmt::format("could not write checkpoint {}", path_.string()));
+    }
+}
+
+void checkpoint_writer::remove()
+{
+    file_.close();
+    std::error_code ec;
+    fs::remove(path_, ec);
+}
+
+} // namespace torrenttools
@@ -1,6 +1,7 @@
 #include <ranges>
 
 #include <gsl-lite/gsl-lite.hpp>
+#include "app_data.hpp"
 #include "common.hpp"
 #include "config_parser.hpp"
 
@@ -207,4 +208,14 @@ std::filesystem::path get_destination_path(dottorrent::metafile& m, std::optiona
         }
     }
     return destination_directory / destination_name;
-}
\ No newline at end of file
+}
+
+
+tt::hash_backend_selection get_hash_backends(std::optional<tt::hash_backend> forced)
+{
+    std::optional<fs::path> cache_file {};
+    if (auto cache_dir = get_user_cache_dir(); !cache_dir.empty()) {
+        cache_file = cache_dir / "hash-backends";
+    }
+    return tt::select_hash_backends(forced, cache_file);
+}
@@ -0,0 +1,487 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <set>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#define TORRENTTOOLS_HAS_CPUID
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+#include "cpu_info.hpp"
+
+namespace torrenttools {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+#ifdef __linux__
+
+constexpr auto cgroup_root = "/sys/fs/cgroup";
+
+/// Return true if a comma separated controller list of /proc/self/cgroup contains controller.
+bool has_controller(std::string_view controllers, std::string_view controller)
+{
+    while (!controllers.empty()) {
+        auto end = controllers.find(',');
+        if (controllers.substr(0, end) == controller) {
+            return true;
+        }
+        controllers = end == std::string_view::npos ? std::string_view{} : controllers.substr(end + 1);
+    }
+    return false;
+}
+
+/// Return the path of the cgroup of this process relative to the cgroup root
+/// for the given v1 controller, or for the unified v2 hierarchy when controller is empty.
+std::optional<fs::path> cgroup_path(std::string_view controller)
+{
+    std::ifstream f("/proc/self/cgroup");
+    std::string line;
+
+    // lines have the form: hierarchy-ID:controller-list:cgroup-path
+    while (std::getline(f, line)) {
+        auto first = line.find(':');
+        auto second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos) {
+            continue;
+        }
+        std::string_view controllers(line.data() + first + 1, second - first - 1);
+        auto path = line.substr(second + 1);
+
+        if (controller.empty() && controllers.empty()) {
+            return fs::path(path).relative_path();
+        }
+        // "cpu" must not match the "cpuset" hierarchy
+        if (!controller.empty() && has_controller(controllers, controller)) {
+            return fs::path(path).relative_path();
+        }
+    }
+    return std::nullopt;
+}
+
+/// Read the first line of a file.
+std::optional<std::string> read_line(const fs::path& path)
+{
+    std::ifstream f(path);
+    if (std::string line; f && std::getline(f, line)) {
+        return line;
+    }
+    return std::nullopt;
+}
+
+/// Return the cgroup directories of this process and all its parents up to base.
+std::vector<fs::path> cgroup_ancestors(const fs::path& base, const fs::path& relative)
+{
+    std::vector<fs::path> dirs {};
+    for (auto p = relative; ; p = p.parent_path()) {
+        dirs.push_back(base / p);
+        if (p.empty()) {
+            break;
+        }
+    }
+    return dirs;
+}
+
+/// Keep the smallest of two quotas.
+void apply_quota(std::optional<double>& result, double quota)
+{
+    if (!result || quota < *result) {
+        result = quota;
+    }
+}
+
+std::optional<double> cgroup_v2_cpu_quota()
+{
+    auto path = cgroup_path("");
+    if (!path) {
+        return std::nullopt;
+    }
+    // The limits of all ancestors apply, a looser limit on the leaf does not lift a stricter limit on a parent.
+    std::optional<double> result {};
+    for (const auto& dir : cgroup_ancestors(cgroup_root, *path)) {
+        // cpu.max has the form "$MAX $PERIOD" with $MAX "max" when there is no limit.
+        auto line = read_line(dir / "cpu.max");
+        if (!line || line->starts_with("max")) {
+            continue;
+        }
+        try {
+            std::size_t pos = 0;
+            double quota = std::stod(*line, &pos);
+            double period = std::stod(line->substr(pos));
+            if (quota > 0 && period > 0) {
+                apply_quota(result, quota / period);
+            }
+        }
+        catch (const std::exception&) {}
+    }
+    return result;
+}
+
+std::optional<double> cgroup_v1_cpu_quota()
+{
+    auto path = cgroup_path("cpu");
+    if (!path) {
+        return std::nullopt;
+    }
+    for (const auto* hierarchy : {"cpu", "cpu,cpuacct"}) {
+        auto base = fs::path(cgroup_root) / hierarchy;
+        if (!fs::exists(base)) {
+            continue;
+        }
+        std::optional<double> result {};
+        for (const auto& dir : cgroup_ancestors(base, *path)) {
+            auto quota = read_line(dir / "cpu.cfs_quota_us");
+            auto period = read_line(dir / "cpu.cfs_period_us");
+            if (!quota || !period) {
+                continue;
+            }
+            try {
+                double q = std::stod(*quota);
+                double p = std::stod(*period);
+                // a quota of -1 means no limit
+                if (q > 0 && p > 0) {
+                    apply_quota(result, q / p);
+                }
+            }
+            catch (const std::exception&) {}
+        }
+        return result;
+    }
+    return std::nullopt;
+}
+
+/// Parse a cpu list as used in sysfs, eg. "0-3,8-11".
+std::vector<int> parse_cpu_list(std::string_view list)
+{
+    std::vector<int> cpus;
+
+    while (!list.empty()) {
+        auto end = list.find(',');
+        auto item = list.substr(0, end);
+        list = end == std::string_view::npos ? std::string_view{} : list.substr(end + 1);
+
+        try {
+            auto dash = item.find('-');
+            int first = std::stoi(std::string(item.substr(0, dash)));
+            int last = dash == std::string_view::npos ? first : std::stoi(std::string(item.substr(dash + 1)));
+            for (int i = first; i <= last; ++i) {
+                cpus.push_back(i);
+            }
+        }
+        catch (const std::exception&) {}
+    }
+    return cpus;
+}
+
+std::optional<int> read_int(const fs::path& path)
+{
+    std::ifstream f(path);
+    int value;
+    if (f >> value) {
+        return value;
+    }
+    return std::nullopt;
+}
+
+#endif
+
+} // namespace
+
+
+std::size_t cpuset_cpu_count()
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        if (auto n = CPU_COUNT(&set); n > 0) {
+            return static_cast<std::size_t>(n);
+        }
+    }
+#endif
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+std::optional<double> cgroup_cpu_quota()
+{
+#ifdef __linux__
+    if (auto quota = cgroup_v2_cpu_quota(); quota) {
+        return quota;
+    }
+    return cgroup_v1_cpu_quota();
+#else
+    return std::nullopt;
+#endif
+}
+
+
+std::size_t available_cpu_count()
+{
+    std::size_t count = cpuset_cpu_count();
+
+    if (auto quota = cgroup_cpu_quota(); quota) {
+        auto quota_count = static_cast<std::size_t>(std::ceil(*quota));
+        count = std::min(count, std::max<std::size_t>(quota_count, 1));
+    }
+    return count;
+}
+
+
+cpu_features detect_cpu_features()
+{
+    cpu_features features {};
+#ifdef TORRENTTOOLS_HAS_CPUID
+    // __builtin_cpu_supports also checks that the OS saves the AVX registers
+    features.avx2 = __builtin_cpu_supports("avx2");
+    features.avx512 = __builtin_cpu_supports("avx512f");
+
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        features.sha_ni = (ebx & (1u << 29)) != 0;
+    }
+#endif
+    return features;
+}
+
+
+std::string cpu_model_name()
+{
+#ifdef TORRENTTOOLS_HAS_CPUID
+    unsigned int max_leaf = __get_cpuid_max(0x80000000, nullptr);
+    if (max_leaf >= 0x80000004) {
+        std::array<unsigned int, 12> brand {};
+        for (unsigned int i = 0; i < 3; ++i) {
+            __get_cpuid(0x80000002 + i, &brand[4*i], &brand[4*i+1], &brand[4*i+2], &brand[4*i+3]);
+        }
+        std::string name(reinterpret_cast<const char*>(brand.data()), sizeof(brand));
+        name.erase(name.find_last_not_of(std::string_view(" \0", 2)) + 1);
+        name.erase(0, name.find_first_not_of(' '));
+        return name;
+    }
+#endif
+#ifdef __linux__
+    std::ifstream f("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(f, line)) {
+        if (line.starts_with("model name") || line.starts_with("Model")) {
+            if (auto pos = line.find(':'); pos != std::string::npos) {
+                return line.substr(line.find_first_not_of(' ', pos + 1));
+            }
+        }
+    }
+#endif
+    return {};
+}
+
+
+std::vector<cpu_info> read_cpu_topology()
+{
+    std::vector<cpu_info> cpus {};
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return cpus;
+    }
+
+    // map logical cpus to numa nodes, systems without numa support have no node directories
+    std::map<int, int> cpu_nodes;
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator("/sys/devices/system/node", ec)) {
+        auto name = entry.path().filename().string();
+        if (!name.starts_with("node")) {
+            continue;
+        }
+        std::ifstream f(entry.path() / "cpulist");
+        std::string line;
+        if (!std::getline(f, line)) {
+            continue;
+        }
+        try {
+            int node = std::stoi(name.substr(4));
+            for (int cpu : parse_cpu_list(line)) {
+                cpu_nodes[cpu] = node;
+            }
+        }
+        catch (const std::exception&) {}
+    }
+
+    const fs::path cpu_root = "/sys/devices/system/cpu";
+
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (!CPU_ISSET(i, &set)) {
+            continue;
+        }
+        auto topology = cpu_root / ("cpu" + std::to_string(i)) / "topology";
+        auto core_id = read_int(topology / "core_id");
+        auto package_id = read_int(topology / "physical_package_id");
+        auto node = cpu_nodes.find(i);
+
+        cpus.push_back({
+            .id = i,
+            // without topology information every logical cpu is its own core
+            .core_id = core_id.value_or(i),
+            .package_id = package_id.value_or(0),
+            .numa_node = node != cpu_nodes.end() ? node->second : 0,
+        });
+    }
+#endif
+    return cpus;
+}
+
+
+thread_placement make_thread_placement(std::size_t thread_count, bool numa_local)
+{
+    thread_placement placement {};
+    auto cpus = read_cpu_topology();
+
+    if (cpus.empty() || thread_count == 0) {
+        return placement;
+    }
+
+    if (numa_local) {
+        // pick the node with the most physical cores
+        std::map<int, std::size_t> node_cores;
+        std::set<std::tuple<int, int, int>> cores;
+        for (const auto& cpu : cpus) {
+            if (cores.emplace(cpu.numa_node, cpu.package_id, cpu.core_id).second) {
+                ++node_cores[cpu.numa_node];
+            }
+        }
+        auto node = std::max_element(node_cores.begin(), node_cores.end(),
+                [](const auto& lhs, const auto& rhs) { return lhs.second < rhs.second; })->first;
+
+        std::erase_if(cpus, [=](const cpu_info& cpu) { return cpu.numa_node != node; });
+        placement.numa_node = node;
+
+        for (const auto& cpu : cpus) {
+            placement.reader_cpus.push_back(cpu.id);
+        }
+    }
+
+    // Order cpus by SMT sibling rank first so the first logical cpu of every physical core
+    // is used before a second hardware thread is put on the same core.
+    std::map<std::tuple<int, int, int>, int> sibling_count;
+    std::vector<std::pair<int, const cpu_info*>> ranked;
+    for (const auto& cpu : cpus) {
+        int rank = sibling_count[{cpu.numa_node, cpu.package_id, cpu.core_id}]++;
+        ranked.emplace_back(rank, &cpu);
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const auto& lhs, const auto& rhs) {
+        if (lhs.first != rhs.first) return lhs.first < rhs.first;
+        return lhs.second->numa_node < rhs.second->numa_node;
+    });
+
+    for (std::size_t i = 0; i < thread_count; ++i) {
+        placement.hasher_cpus.push_back(ranked[i % ranked.size()].second->id);
+    }
+    return placement;
+}
+
+
+bool set_current_thread_affinity(std::span<const int> cpus)
+{
+#ifdef __linux__
+    if (cpus.empty()) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+
+bool bind_memory_to_node(void* address, std::size_t length, int node)
+{
+#if defined(__linux__) && defined(SYS_mbind)
+    constexpr std::size_t bits_per_word = 8 * sizeof(unsigned long);
+    if (node < 0) {
+        return false;
+    }
+    std::vector<unsigned long> mask(node / bits_per_word + 1, 0);
+    mask[node / bits_per_word] |= 1ul << (node % bits_per_word);
+
+    // mbind requires a page aligned start address
+    auto page_size = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto start = reinterpret_cast<std::uintptr_t>(address);
+    auto aligned_start = start & ~(page_size - 1);
+    length += start - aligned_start;
+
+    auto res = syscall(SYS_mbind, aligned_start, length, MPOL_PREFERRED,
+                       mask.data(), mask.size() * bits_per_word + 1, 0);
+    return res == 0;
+#else
+    return false;
+#endif
+}
+
+
+bool set_background_priority()
+{
+#ifdef __linux__
+    sched_param param {};
+    param.sched_priority = 0;
+    bool cpu_set = sched_setscheduler(0, SCHED_IDLE, &param) == 0;
+
+    // glibc has no wrapper for ioprio_set, constants from linux/ioprio.h
+    constexpr int ioprio_who_process = 1;
+    constexpr int ioprio_class_idle = 3;
+    constexpr int ioprio_class_shift = 13;
+    bool io_set = syscall(SYS_ioprio_set, ioprio_who_process, 0, ioprio_class_idle << ioprio_class_shift) == 0;
+    return cpu_set && io_set;
+#else
+    return false;
+#endif
+}
+
+
+std::string format_cpu_list(std::span<const int> cpus)
+{
+    std::vector<int> sorted(cpus.begin(), cpus.end());
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::string result;
+    for (std::size_t i = 0; i < sorted.size(); ) {
+        std::size_t j = i;
+        while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) {
+            ++j;
+        }
+        if (!result.empty()) {
+            result += ',';
+        }
+        result += std::to_string(sorted[i]);
+        if (j > i) {
+            result += '-';
+            result += std::to_string(sorted[j]);
+        }
+        i = j + 1;
+    }
+    return result;
+}
+
+} // namespace torrenttools
@@ -1,26 +1,29 @@
 
 #include <algorithm>
+#include <csignal>
+#include <fstream>
 #include <functional>
 #include <vector>
 #include <string>
 #include <ranges>
 #include <optional>
 #include <iostream>
-
-#if defined(TORRENTTOOLS_USE_TBB)
-#include <execution>
-#endif
+#include <semaphore>
+#include <thread>
 
 #include <fmt/format.h>
 #include <fmt/ranges.h>
+#include <gsl-lite/gsl-lite.hpp>
 #include <CLI/CLI.hpp>
 #include <CLI/Error.hpp>
 
 #include <dottorrent/literals.hpp>
 #include <termcontrol/termcontrol.hpp>
+#include <yaml-cpp/yaml.h>
 
 #include "create.hpp"
 #include "file_matcher.hpp"
+#include "prehasher.hpp"
 #include "formatters.hpp"
 #include "info.hpp"
 #include "argument_parsers.hpp"
@@ -29,6 +32,10 @@
 #include "progress.hpp"
 #include "common.hpp"
 #include "exceptions.hpp"
+#include "cpu_info.hpp"
+#include "profile.hpp"
+#include "work_queue.hpp"
+#include "tar_hasher.hpp"
 
 #ifdef __linux__
 #include <unistd.h>
@@ -113,6 +120,58 @@ void configure_create_app(CLI::App* app, create_app_options& options)
         options.io_block_size = io_block_size_transformer(v);
         return true;
     };
+    CLI::callback_t threads_parser = [&](const CLI::results_t& v) -> bool {
+        options.threads = threads_transformer(v);
+        return true;
+    };
+    CLI::callback_t io_engine_parser = [&](const CLI::results_t& v) -> bool {
+        options.io_engine = io_engine_transformer(v);
+        return true;
+    };
+    CLI::callback_t read_order_parser = [&](const CLI::results_t& v) -> bool {
+        options.read_order = read_order_transformer(v);
+        return true;
+    };
+    CLI::callback_t io_queue_depth_parser = [&](const CLI::results_t& v) -> bool {
+        options.io_queue_depth = io_queue_depth_transformer(v);
+        return true;
+    };
+    CLI::callback_t max_read_rate_parser = [&](const CLI::results_t& v) -> bool {
+        options.max_read_rate = max_read_rate_transformer(v);
+        return true;
+    };
+    CLI::callback_t max_memory_parser = [&](const CLI::results_t& v) -> bool {
+        options.max_memory = max_memory_transformer(v);
+        return true;
+    };
+    CLI::callback_t max_iops_parser = [&](const CLI::results_t& v) -> bool {
+        options.max_iops = max_iops_transformer(v);
+        return true;
+    };
+    CLI::callback_t hash_backend_parser = [&](const CLI::results_t& v) -> bool {
+        options.hash_backend = hash_backend_transformer(v);
+        return true;
+    };
+    CLI::callback_t hash_cache_parser = [&](const CLI::results_t& v) -> bool {
+        options.hash_cache = path_transformer(v, /*check_exists=*/false);
+        return true;
+    };
+    CLI::callback_t checkpoint_parser = [&](const CLI::results_t& v) -> bool {
+        options.checkpoint = path_transformer(v, /*check_exists=*/false);
+        return true;
+    };
+    CLI::callback_t data_size_parser = [&](const CLI::results_t& v) -> bool {
+        options.data_size = data_size_transformer(v);
+        return true;
+    };
+    CLI::callback_t tar_archive_parser = [&](const CLI::results_t& v) -> bool {
+        options.tar_archive = path_transformer(v);
+        return true;
+    };
+    CLI::callback_t copy_to_parser = [&](const CLI::results_t& v) -> bool {
+        options.copy_to = path_transformer(v, /*check_exists=*/false);
+        return true;
+    };
     CLI::callback_t private_flag_parser = [&](const CLI::results_t& v) -> bool {
         options.is_private = parse_explicit_flag("--private", v);
         return true;
@@ -128,13 +187,25 @@ void configure_create_app(CLI::App* app, create_app_options& options)
         return true;
     };
 
+    CLI::callback_t batch_parser = [&](const CLI::results_t& v) -> bool {
+        options.batch_manifest = path_transformer(v);
+        return true;
+    };
+
     const auto max_size = 1U << 20U;
 
-    app->add_option("target", target_parser, "Target filename or directory")
-       ->required()
+    auto* target_option = app->add_option("target", target_parser, "Target filename or directory")
        ->type_name("<path>")
        ->expected(1);
 
+    auto* batch_option = app->add_option("--batch", batch_parser,
+               "Create a metafile for every entry of a YAML or JSON manifest.\n"
+               "Each entry sets a target and options for that target.")
+       ->type_name("<manifest>")
+       ->expected(1);
+
+    batch_option->excludes(target_option);
+
     options.protocol_version = dt::protocol::v1;
     app->add_option("-v,--protocol", protocol_parser,
                "Set the bittorrent protocol to use.\n "
@@ -233,9 +304,10 @@ void configure_create_app(CLI::App* app, create_app_options& options)
     // Set default;
 
     options.threads = 2;
-    app->add_option("-t, --threads", options.threads,
-               "Set the number of threads to use for hashing pieces. [default: 2]")
-       ->type_name("<n>")
+    app->add_option("-t, --threads", threads_parser,
+               "Set the number of threads to use for hashing pieces.\n"
+               "Use auto to tune the number of threads to the available CPUs. [default: 2]")
+       ->type_name("<n|auto>")
        ->expected(1);
 
     app->add_option("--checksum", checksum_parser,
@@ -280,12 +352,136 @@ void configure_create_app(CLI::App* app, create_app_options& options)
             [&]() { options.include_hidden_files = true; },
             "Do not skip hidden files.");
 
+    app->add_option("--max-memory", max_memory_parser,
+               "Limit the memory used for the file list while scanning, eg. 512M.\n"
+               "Larger file lists are sorted in a temporary file.")
+       ->type_name("<size[K|M|G]>")
+       ->expected(1);
+
     app->add_option("--io-block-size", io_block_size_parser,
                "The size of blocks read from storage.\n"
                "Must be larger or equal to the piece size.")
        ->type_name("<size[K|M]>")
        ->expected(1);
 
+    app->add_option("--io-engine", io_engine_parser,
+               "The method used to read data from storage.\n"
+               "Options are sync, uring or mmap. [default: sync]")
+       ->type_name("<engine>")
+       ->expected(1);
+
+    app->add_option("--io-queue-depth", io_queue_depth_parser,
+               "The number of reads kept in flight by asynchronous io engines. [default: 32]")
+       ->type_name("<n>")
+       ->expected(1);
+
+    app->add_option("--read-order", read_order_parser,
+               "The order in which files are read.\n"
+               "Options are storage, physical or cached. Physical reads files in the order of their location on disk,\n"
+               "cached reads files that are in the page cache first. [default: storage]")
+       ->type_name("<order>")
+       ->expected(1);
+
+    app->add_flag_callback("--direct-io",
+            [&]() { options.direct_io = true; },
+            "Bypass the page cache when reading data from storage.");
+
+    app->add_flag_callback("--drop-cache",
+            [&]() { options.drop_cache = true; },
+            "Drop data that was read from the page cache after it is hashed, except data that was cached before.");
+
+    app->add_option("--max-read-rate", max_read_rate_parser,
+               "Limit the number of bytes read from storage per second, eg. 50M.")
+       ->type_name("<size[K|M|G]>")
+       ->expected(1);
+
+    app->add_option("--max-iops", max_iops_parser,
+               "Limit the number of read operations per second.")
+       ->type_name("<n>")
+       ->expected(1);
+
+    app->add_flag_callback("--background",
+            [&]() { options.background = true; },
+            "Run with idle cpu and io priority, so other processes are not slowed down.");
+
+    app->add_flag_callback("--pipeline",
+            [&]() { options.pipeline = true; },
+            "Start hashing files while the target directory is scanned.\n"
+            "Requires --piece-size and protocol v2 or hybrid.");
+
+    app->add_option("--hash-backend", hash_backend_parser,
+               "The library used to compute piece hashes.\n"
+               "Options are auto, openssl, isal or simd. [default: auto]")
+       ->type_name("<backend>")
+       ->expected(1);
+
+    app->add_option("--hash-cache", hash_cache_parser,
+               "Directory to store piece hashes and checksums of hashed files in.\n"
+               "Unchanged files are not read again when hashed with the same piece size.")
+       ->type_name("<dir>")
+       ->expected(1);
+
+    auto* checkpoint_option = app->add_option("--checkpoint", checkpoint_parser,
+               "Periodically save the hashing progress to a file.\n"
+               "The checkpoint is removed when the metafile is written.")
+       ->type_name("<file>")
+       ->expected(1);
+
+    auto* resume_option = app->add_flag_callback("--resume",
+            [&]() { options.resume = true; },
+            "Continue hashing from the checkpoint of an interrupted run.");
+
+    checkpoint_option->excludes(batch_option);
+    resume_option->excludes(batch_option);
+
+    auto* stdin_data_option = app->add_flag_callback("--stdin-data",
+            [&]() { options.read_data_from_stdin = true; },
+            "Hash the contents of a single file read from standard input instead of a target.\n"
+            "Requires --name and --size.");
+
+    auto* data_size_option = app->add_option("--size", data_size_parser,
+               "The number of bytes to read from standard input with --stdin-data.")
+       ->type_name("<size[K|M|G]>")
+       ->expected(1);
+
+    stdin_data_option->excludes(target_option);
+    stdin_data_option->excludes(batch_option);
+    stdin_data_option->excludes(checkpoint_option);
+    stdin_data_option->excludes(resume_option);
+    data_size_option->needs(stdin_data_option);
+
+    auto* tar_option = app->add_option("--from-tar", tar_archive_parser,
+               "Create a metafile for the files in a tar archive without extracting it.\n"
+               "Use - to read the archive from standard input.\n"
+               "The archive is hashed on a single thread, --threads is ignored.")
+       ->type_name("<archive>")
+       ->expected(1);
+
+    tar_option->excludes(target_option);
+    tar_option->excludes(batch_option);
+    tar_option->excludes(stdin_data_option);
+    tar_option->excludes(checkpoint_option);
+    tar_option->excludes(resume_option);
+
+    auto* copy_to_option = app->add_option("--copy-to", copy_to_parser,
+               "Copy the files to a directory while they are hashed.\n"
+               "Each file is read only once, files are cloned on filesystems with reflinks.")
+       ->type_name("<dir>")
+       ->expected(1);
+
+    copy_to_option->excludes(batch_option);
+    copy_to_option->excludes(tar_option);
+    copy_to_option->excludes(checkpoint_option);
+    copy_to_option->excludes(resume_option);
+
+    app->add_flag_callback("--cpu-affinity",
+            [&]() { options.cpu_affinity = true; },
+            "Pin each hashing thread to a separate physical core.");
+
+    app->add_flag_callback("--numa",
+            [&]() { options.numa = true; },
+            "Keep all threads on a single NUMA node and allocate read buffers on that node.");
+
     app->add_option("--profile,-P", options.profile,
             "Read options form a config profile.")
         ->type_name("<profile-name>")
@@ -310,16 +506,49 @@ void configure_matcher(torrenttools::file_matcher& matcher, const create_app_opt
         matcher.exclude_pattern(pattern);
     }
     matcher.include_hidden_files(options.include_hidden_files);
+    matcher.set_max_memory(options.max_memory);
     matcher.compile();
 }
 
 
 
-/// Select files and add the to the metafile
-void set_files_with_progress(dottorrent::metafile& m, const create_app_options& options, std::ostream& os)
+namespace {
+
+/// Add the files found by a file_matcher to the storage with the sizes read while scanning,
+/// so the files are not stat'ed again. Spilled results are merged while they are added.
+/// @returns the identity of each file in the order of the storage,
+///     empty when the results were spilled to stay within the memory budget.
+std::vector<std::optional<tt::file_identity>>
+add_scanned_files(dt::file_storage& storage, tt::file_matcher& matcher)
+{
+    std::vector<std::optional<tt::file_identity>> identities {};
+    const bool keep_identities = !matcher.is_spilled();
+    matcher.for_each_result([&](std::string_view relative_path, const tt::scanned_file& file) {
+        storage.add_file(dt::file_entry(fs::path(relative_path), file.file_size));
+        if (keep_identities) {
+            identities.push_back(file.identity);
+        }
+    });
+    return identities;
+}
+
+} // namespace
+
+std::vector<std::optional<tt::file_identity>>
+set_files_with_progress(dottorrent::metafile& m, const create_app_options& options, std::ostream& os,
+                        tt::prehasher* prehasher)
 {
     auto out = std::ostreambuf_iterator(os);
     dottorrent::file_storage& storage = m.storage();
+    std::vector<std::optional<tt::file_identity>> identities {};
+
+    // the data is read from standard input while hashing
+    if (options.read_data_from_stdin) {
+        storage.set_file_mode(dt::file_mode::single);
+        storage.add_file(dt::file_entry(fs::path(*options.name), *options.data_size));
+        m.set_name(*options.name);
+        return identities;
+    }
 
     // scan files and m
     if (fs::is_directory(options.target)) {
@@ -327,38 +556,33 @@ void set_files_with_progress(dottorrent::metafile& m, const create_app_options&
         configure_matcher(matcher, options);
 
         matcher.set_search_root(options.target);
+        if (prehasher) {
+            matcher.set_match_callback([prehasher](std::string_view path, const tt::scanned_file& file) {
+                prehasher->add_file(path, file);
+            });
+        }
         matcher.start();
 
         while (matcher.is_running()) {
             fmt::format_to(out, "\rScanning target directory: {} files processed", matcher.files_processed());
+            if (prehasher) {
+                fmt::format_to(out, ", {} files hashed", prehasher->hashed_file_count());
+            }
             std::flush(os);
             std::this_thread::sleep_for(50ms);
         }
-        // wait for the thread to close and results to become available
+        // wait for the threads to close and results to become available
         matcher.wait();
+        if (prehasher) {
+            prehasher->finish();
+        }
         std::cout << std::endl;
+        if (prehasher && prehasher->failed_batch_count() != 0) {
+            fmt::format_to(out, "Warning: could not hash {} batches of files while scanning, "
+                                "these files are hashed again: {}\n",
+                           prehasher->failed_batch_count(), prehasher->first_error());
+        }
 
-        auto files = matcher.results();
-
-        fmt::format_to(out, "Sorting file list...");
-        std::flush(os);
-
-        #if defined(TORRENTTOOLS_USE_TBB)
-            std::sort(std::execution::par_unseq, files.begin(), files.end(),
-                    [](const fs::path& lhs, const fs::path& rhs) {
-                        return rng::lexicographical_compare(lhs.string(), rhs.string());
-                    }
-            );
-        #else
-            std::sort(files.begin(), files.end(),
-                    [](const fs::path& lhs, const fs::path& rhs) {
-                        return rng::lexicographical_compare(lhs.string(), rhs.string());
-                    }
-            );
-        #endif
-
-        fmt::format_to(out, "\rSorting file list... Done.\n");
-        std::flush(os);
 
         storage.set_root_directory(options.target);
         // target was a directory so if the torrent contains only a single file we will
@@ -368,7 +592,8 @@ void set_files_with_progress(dottorrent::metafile& m, const create_app_options&
         fmt::format_to(out, "Adding files to metafile...");
         std::flush(os);
 
-        storage.add_files(files.begin(), files.end());
+        // results are sorted by path
+        identities = add_scanned_files(storage, matcher);
         fmt::format_to(out, "\rAdding files to metafile... Done.\n");
         std::flush(os);
     }
@@ -378,10 +603,24 @@ void set_files_with_progress(dottorrent::metafile& m, const create_app_options&
         storage.add_file(options.target);
     }
     m.set_name(options.target.filename().string());
+    return identities;
 }
 
 void postprocess_create_app(const CLI::App* app, const main_app_options& main_options, create_app_options& options)
 {
+    if (!options.batch_manifest.has_value() && !options.read_data_from_stdin && !options.tar_archive.has_value() &&
+        app->get_option("target")->empty()) {
+        throw CLI::RequiredError("target");
+    }
+    if (options.read_data_from_stdin) {
+        if (!options.name) {
+            throw CLI::RequiredError("--name");
+        }
+        if (!options.data_size) {
+            throw CLI::RequiredError("--size");
+        }
+    }
+
     auto [config_ptr, tracker_db_ptr] = load_config_and_tracker_db(main_options);
 
     if (config_ptr == nullptr && options.profile.has_value()) {
@@ -391,34 +630,50 @@ void postprocess_create_app(const CLI::App* app, const main_app_options& main_op
     if (options.profile.has_value() && config_ptr != nullptr) {
         merge_create_profile(*config_ptr, *options.profile, app, options);
     }
-}
 
-void run_create_app(const main_app_options& main_options, create_app_options& options)
-{
-    namespace dt = dottorrent;
-    using namespace dottorrent::literals;
+    // the size of an archive read from a pipe is not known before hashing starts
+    if (options.tar_archive && !options.piece_size && !fs::is_regular_file(*options.tar_archive)) {
+        throw std::invalid_argument("--piece-size is required when the tar archive is not a regular file.");
+    }
+    if (options.pipeline) {
+        // v1 pieces span files, so they can only be hashed once the complete file list is known
+        if ((options.protocol_version & dt::protocol::v2) != dt::protocol::v2) {
+            throw std::invalid_argument("--pipeline requires protocol v2 or hybrid.");
+        }
+        // the piece size chosen automatically depends on the total size of all files
+        if (!options.piece_size) {
+            throw std::invalid_argument("--pipeline requires --piece-size.");
+        }
+        if (options.copy_to || options.read_data_from_stdin || options.tar_archive || options.batch_manifest) {
+            throw std::invalid_argument(
+                    "--pipeline can not be combined with --copy-to, --stdin-data, --from-tar or --batch.");
+        }
+    }
+}
 
-    std::ostream& os = options.write_to_stdout ? std::cerr : std::cout;
+namespace {
 
-    // create a new metafile
-    dt::metafile m{};
-
-    // add files to the file_storage
+/// Set the piece size and all fields of the metafile except the file list and piece hashes.
+void set_metafile_fields(dt::metafile& m, const create_app_options& options,
+                         const tt::tracker_database* tracker_db, const tt::config* config)
+{
     auto& file_storage = m.storage();
 
-    set_files_with_progress(m, options, os);
-
     if (options.piece_size) {
         file_storage.set_piece_size(*options.piece_size);
     } else {
         dottorrent::choose_piece_size(file_storage);
     }
 
+    if (options.io_block_size && *options.io_block_size < file_storage.piece_size()) {
+        throw std::invalid_argument("io-block-size must be larger or equal to the piece size.");
+    }
+
     // announces
     if (!options.announce_group_list.empty()) {
-        set_tracker_group(m, options.announce_group_list, tt::load_tracker_database(), tt::load_config());
+        set_tracker_group(m, options.announce_group_list, tracker_db, config);
     } else {
-        set_trackers(m, options.announce_list, tt::load_tracker_database(), tt::load_config());
+        set_trackers(m, options.announce_list, tracker_db, config);
     }
 
     // web seeds (GetRight-style)
@@ -489,6 +744,235 @@ void run_create_app(const main_app_options& main_options, create_app_options& op
             m.add_collection(s);
         }
     }
+}
+
+tt::hash_pipeline_options make_hasher_options(const create_app_options& options)
+{
+    return {
+            .protocol_version = options.protocol_version,
+            .checksums = {options.checksums},
+            .min_io_block_size = options.io_block_size,
+            .threads = options.threads.value_or(tt::available_cpu_count()),
+            .engine = options.io_engine,
+            .queue_depth = options.io_queue_depth,
+            .direct_io = options.direct_io,
+            .order = options.read_order,
+            .adaptive = !options.threads.has_value(),
+            .cpu_affinity = options.cpu_affinity,
+            .numa = options.numa,
+            .hash_backends = get_hash_backends(options.hash_backend),
+            .input = options.read_data_from_stdin ? &std::cin : nullptr,
+            .drop_cache = options.drop_cache,
+            .max_read_rate = options.max_read_rate,
+            .max_read_operations = options.max_iops,
+    };
+}
+
+std::optional<tt::checkpoint_options> make_checkpoint_options(const create_app_options& options,
+                                                              const fs::path& destination)
+{
+    if (!options.checkpoint && !options.resume) {
+        return std::nullopt;
+    }
+    if (!options.checkpoint && options.write_to_stdout) {
+        throw std::invalid_argument("--checkpoint is required to resume when writing to standard output");
+    }
+    auto path = options.checkpoint.value_or(fs::path(destination) += ".checkpoint");
+    return tt::checkpoint_options{ .path = path, .resume = options.resume };
+}
+
+/// Signal received while an interrupt_guard was active, zero if none.
+volatile std::sig_atomic_t interrupt_signal = 0;
+
+extern "C" void handle_interrupt(int signal)
+{
+    interrupt_signal = signal;
+}
+
+/// Cancel a hash pipeline on SIGINT and SIGTERM instead of terminating the process.
+/// Signal handlers can not safely cancel the pipeline, so a thread polls for received signals.
+class interrupt_guard
+{
+public:
+    explicit interrupt_guard(tt::hash_pipeline& pipeline)
+    {
+        interrupt_signal = 0;
+        previous_sigint_ = std::signal(SIGINT, handle_interrupt);
+        previous_sigterm_ = std::signal(SIGTERM, handle_interrupt);
+
+        watcher_ = std::jthread([&pipeline](std::stop_token stop_token) {
+            while (!stop_token.stop_requested()) {
+                if (interrupt_signal != 0) {
+                    pipeline.cancel();
+                    return;
+                }
+                std::this_thread::sleep_for(100ms);
+            }
+        });
+    }
+
+    interrupt_guard(const interrupt_guard&) = delete;
+    interrupt_guard& operator=(const interrupt_guard&) = delete;
+
+    ~interrupt_guard()
+    {
+        watcher_.request_stop();
+        watcher_.join();
+        std::signal(SIGINT, previous_sigint_);
+        std::signal(SIGTERM, previous_sigterm_);
+    }
+
+private:
+    using signal_handler = void (*)(int);
+    signal_handler previous_sigint_;
+    signal_handler previous_sigterm_;
+    std::jthread watcher_;
+};
+
+std::optional<tt::hash_cache> make_hash_cache(const create_app_options& options)
+{
+    // data read from standard input has no file identity to cache it by,
+    // files are only copied when they are read
+    if (!options.hash_cache || options.read_data_from_stdin || options.copy_to) {
+        return std::nullopt;
+    }
+    return tt::hash_cache(*options.hash_cache);
+}
+
+/// Hash the files of a tar archive and create a metafile for them.
+/// The file list is only known when the whole archive is read,
+/// so the metafile information is printed after hashing.
+void run_create_from_tar(create_app_options options, std::ostream& os)
+{
+    const auto& archive = *options.tar_archive;
+    const bool from_stdin = archive == "-";
+
+    std::ifstream archive_file {};
+    if (!from_stdin) {
+        archive_file.open(archive, std::ios::binary);
+        if (!archive_file) {
+            throw std::invalid_argument(fmt::format("could not open tar archive {}", archive.string()));
+        }
+    }
+    std::istream& input = from_stdin ? std::cin : archive_file;
+
+    // choose the piece size for the size of the archive, which is slightly larger than the size of the files
+    if (!options.piece_size) {
+        dt::file_storage estimate {};
+        estimate.add_file(dt::file_entry(archive.filename(), fs::file_size(archive)));
+        dt::choose_piece_size(estimate);
+        options.piece_size = estimate.piece_size();
+    }
+
+    auto hasher_options = make_hasher_options(options);
+    tt::tar_hasher hasher(input, *options.piece_size, hasher_options);
+
+    auto out = std::ostreambuf_iterator(os);
+    auto start_time = std::chrono::system_clock::now();
+    {
+        std::jthread progress([&](std::stop_token stop_token) {
+            while (!stop_token.stop_requested()) {
+                fmt::format_to(out, "\rHashing tar archive: {} files, {} hashed",
+                               hasher.files_done(), tt::format_size(hasher.bytes_done()));
+                std::flush(os);
+                std::this_thread::sleep_for(200ms);
+            }
+        });
+        hasher.run();
+    }
+    fmt::format_to(out, "\rHashing tar archive: {} files, {} hashed\n",
+                   hasher.files_done(), tt::format_size(hasher.bytes_done()));
+    if (auto skipped = hasher.skipped_member_count(); skipped != 0) {
+        fmt::format_to(out, "Skipped {} links and special files.\n", skipped);
+    }
+    auto total_duration = std::chrono::system_clock::now() - start_time;
+
+    dt::metafile m {};
+    auto& storage = m.storage();
+    set_metafile_fields(m, options, tt::load_tracker_database(), tt::load_config());
+
+    // An archive of a single directory is a multi-file torrent named after that directory,
+    // an archive of a single file is a single file torrent.
+    auto root = hasher.common_root();
+    hasher.set_files(storage, /*strip_root=*/true);
+    if (storage.file_count() == 0) {
+        throw std::invalid_argument(fmt::format("tar archive {} does not contain any files", archive.string()));
+    }
+    if (root) {
+        storage.set_file_mode(dt::file_mode::multi);
+    }
+    else if (storage.file_count() == 1) {
+        storage.set_file_mode(dt::file_mode::single);
+        root = storage.at(0).path();
+    }
+    else {
+        if (from_stdin && !options.name) {
+            throw std::invalid_argument("--name is required for a tar archive read from standard input "
+                                        "that does not contain a single top level directory.");
+        }
+        storage.set_file_mode(dt::file_mode::multi);
+        root = archive.stem();
+    }
+    m.set_name(options.name.value_or(root->string()));
+
+    fs::path destination_file = get_destination_path(m, options.destination);
+
+    formatting_options fmt_options = {};
+#ifdef __unix__
+    if (!isatty(options.write_to_stdout ? STDERR_FILENO : STDOUT_FILENO)) {
+        fmt_options.use_color = false;
+    }
+#endif
+    os << '\n';
+    create_general_info(os, m, destination_file, options.protocol_version, fmt_options);
+    os << '\n';
+    print_completion_statistics(os, m, total_duration);
+
+    if (!options.write_to_stdout) {
+        dt::save_metafile(destination_file, m, options.protocol_version);
+        os << fmt::format("Metafile written to: {}\n", destination_file.string());
+    } else {
+        os << fmt::format("Metafile written to standard output.");
+        dt::write_metafile_to(std::cout, m, options.protocol_version);
+    }
+}
+
+} // namespace
+
+void run_create_app(const main_app_options& main_options, create_app_options& options)
+{
+    namespace dt = dottorrent;
+    using namespace dottorrent::literals;
+
+    std::ostream& os = options.write_to_stdout ? std::cerr : std::cout;
+
+    if (options.background && !tt::set_background_priority()) {
+        throw std::runtime_error("could not lower the cpu and io priority for --background");
+    }
+
+    if (options.tar_archive) {
+        run_create_from_tar(options, os);
+        return;
+    }
+
+    // create a new metafile
+    dt::metafile m{};
+
+    // add files to the file_storage
+    auto& file_storage = m.storage();
+
+    auto cache = make_hash_cache(options);
+    // hash files into the cache while the target is scanned, the hasher of the complete storage skips them
+    std::optional<tt::prehasher> prehasher {};
+    if (options.pipeline && fs::is_directory(options.target)) {
+        if (!cache) {
+            cache.emplace();
+        }
+        prehasher.emplace(options.target, *options.piece_size, make_hasher_options(options), *cache);
+    }
+
+    auto identities = set_files_with_progress(m, options, os, prehasher ? &*prehasher : nullptr);
+    set_metafile_fields(m, options, tt::load_tracker_database(), tt::load_config());
 
     fs::path destination_file = get_destination_path(m, options.destination);
 
@@ -512,26 +996,55 @@ void run_create_app(const main_app_options& main_options, create_app_options& op
     create_general_info(os, m, destination_file, options.protocol_version, fmt_options);
     os << '\n';
 
-    if (options.io_block_size && *options.io_block_size < file_storage.piece_size()) {
-        throw std::invalid_argument("io-block-size must be larger or equal to the piece size.");
-    }
-
     // hash checking
-    dt::storage_hasher_options hasher_options {
-            .protocol_version = options.protocol_version,
-            .checksums = {options.checksums},
-            .min_io_block_size = options.io_block_size,
-            .threads = options.threads
-    };
-
-    auto hasher = dt::storage_hasher(file_storage, hasher_options);
+    auto checkpoint = make_checkpoint_options(options, destination_file);
+    auto hasher_options = make_hasher_options(options);
+    if (options.copy_to) {
+        // multi-file torrents are copied to a directory named after the torrent, as clients download them
+        hasher_options.copy_to = file_storage.file_mode() == dt::file_mode::multi
+                ? *options.copy_to / m.name() : *options.copy_to;
+    }
+    auto hasher = tt::storage_hasher(file_storage, hasher_options, std::move(cache), checkpoint);
+    hasher.set_file_identities(std::move(identities));
 
     os << "Hashing files..." << std::endl;
 
-    if (simple_progress) {
-        run_with_simple_progress(os, hasher, m);
-    } else {
-        run_with_progress(os, hasher, m);
+    {
+        // Stop hashing on SIGINT and SIGTERM so the final checkpoint can be written.
+        std::optional<interrupt_guard> guard {};
+        if (checkpoint) {
+            guard.emplace(hasher);
+        }
+        try {
+            if (simple_progress) {
+                run_with_simple_progress(os, hasher, m);
+            } else {
+                run_with_progress(os, hasher, m);
+            }
+        }
+        catch (...) {
+            if (checkpoint) {
+                try { hasher.write_checkpoint(); } catch (...) {}
+            }
+            throw;
+        }
+    }
+    if (checkpoint && hasher.cancelled()) {
+        hasher.write_checkpoint();
+        throw std::runtime_error(fmt::format(
+                "Hashing interrupted, progress saved to checkpoint {}. Use --resume to continue.",
+                checkpoint->path.string()));
+    }
+    if (options.read_data_from_stdin && std::cin.peek() != std::char_traits<char>::eof()) {
+        throw std::runtime_error(fmt::format(
+                "standard input contains more than the {} bytes given by --size", *options.data_size));
+    }
+    // the in-memory cache of a pipelined run is discarded
+    if (options.hash_cache) {
+        hasher.update_cache();
+    }
+    if (options.copy_to) {
+        os << fmt::format("Files copied to: {}\n", hasher_options.copy_to->string());
     }
 
     // Join all threads and block until completed.
@@ -542,6 +1055,236 @@ void run_create_app(const main_app_options& main_options, create_app_options& op
         os << fmt::format("Metafile written to standard output.");
         dt::write_metafile_to(std::cout, m, options.protocol_version);
     }
+    hasher.remove_checkpoint();
+}
+
+namespace {
+
+/// Number of jobs of a batch that are scanned ahead of the job being hashed.
+constexpr std::ptrdiff_t batch_scan_ahead = 4;
+
+/// Return the key of an option in a batch manifest entry.
+std::string manifest_key(std::string_view option_name)
+{
+    if (option_name == "no-created-by") {
+        return "set-created-by";
+    }
+    if (option_name == "no-creation-date") {
+        return "set-creation-date";
+    }
+    return std::string(option_name);
+}
+
+create_app_options parse_batch_job(const YAML::Node& entry, const CLI::App* app, const tt::config* config,
+                                   const create_app_options& options)
+{
+    if (!entry.IsMap()) {
+        throw std::invalid_argument("entry must be a map");
+    }
+    const auto target = entry["target"];
+    if (!target) {
+        throw std::invalid_argument("missing key target");
+    }
+
+    // All other keys are the same as the options of a create profile.
+    YAML::Node job_data(YAML::NodeType::Map);
+    for (const auto& p : entry) {
+        auto key = p.first.as<std::string>();
+        if (key != "target" && key != "profile") {
+            job_data[key] = p.second;
+        }
+    }
+    auto job = std::get<create_app_options>(tt::parse_create_profile(job_data).options);
+
+    // options from the command line, merged with the profile of the entry instead of the profile on the command line
+    auto defaults = options;
+    if (const auto profile = entry["profile"]; profile) {
+        if (config == nullptr) {
+            throw tt::profile_error("no configuration was found, but a profile was requested.");
+        }
+        merge_create_profile(*config, profile.as<std::string>(), app, defaults);
+    }
+    merge_create_options(defaults,
+                         [&](std::string_view name) { return entry[manifest_key(name)].IsDefined(); },
+                         job);
+
+    if (job.write_to_stdout) {
+        throw std::invalid_argument("writing to standard output is not supported for batches");
+    }
+    job.target = path_transformer({target.as<std::string>()});
+    job.read_from_stdin = false;
+    job.simple_progress = true;
+    job.batch_manifest = std::nullopt;
+    return job;
+}
+
+} // namespace
+
+std::vector<create_app_options> load_create_batch(const CLI::App* app, const tt::config* config,
+                                                  const create_app_options& options)
+{
+    Expects(options.batch_manifest.has_value());
+    const auto& manifest_path = *options.batch_manifest;
+
+    YAML::Node manifest;
+    try {
+        // JSON is a subset of YAML
+        manifest = YAML::LoadFile(manifest_path.string());
+    }
+    catch (const YAML::Exception& err) {
+        throw std::invalid_argument(fmt::format("could not parse batch manifest {}: {}", manifest_path.string(), err.what()));
+    }
+    if (!manifest.IsSequence()) {
+        throw std::invalid_argument("batch manifest must be a list of targets");
+    }
+
+    std::vector<create_app_options> jobs {};
+    jobs.reserve(manifest.size());
+    for (std::size_t i = 0; i < manifest.size(); ++i) {
+        try {
+            jobs.push_back(parse_batch_job(manifest[i], app, config, options));
+        }
+        catch (const std::exception& err) {
+            throw std::invalid_argument(fmt::format("batch manifest entry {}: {}", i + 1, err.what()));
+        }
+    }
+    return jobs;
+}
+
+
+namespace {
+
+struct batch_job
+{
+    const create_app_options* options;
+    dt::metafile metafile {};
+    fs::path destination {};
+    std::unique_ptr<tt::storage_hasher> hasher {};
+    /// Identities of the files read while scanning the target.
+    std::vector<std::optional<tt::file_identity>> identities {};
+    std::exception_ptr error {};
+};
+
+/// Scan the target of a job and set up its metafile.
+void prepare_batch_job(batch_job& job, const tt::tracker_database* tracker_db, const tt::config* config)
+{
+    const auto& options = *job.options;
+    auto& m = job.metafile;
+    auto& storage = m.storage();
+
+    try {
+        if (fs::is_directory(options.target)) {
+            tt::file_matcher matcher{};
+            configure_matcher(matcher, options);
+            matcher.set_search_root(options.target);
+            matcher.start();
+            matcher.wait();
+
+            storage.set_root_directory(options.target);
+            storage.set_file_mode(dt::file_mode::multi);
+            job.identities = add_scanned_files(storage, matcher);
+        }
+        else {
+            storage.set_root_directory(options.target.parent_path());
+            storage.set_file_mode(dt::file_mode::single);
+            storage.add_file(options.target);
+        }
+        m.set_name(options.target.filename().string());
+
+        set_metafile_fields(m, options, tracker_db, config);
+        job.destination = get_destination_path(m, options.destination);
+    }
+    catch (...) {
+        job.error = std::current_exception();
+    }
+}
+
+} // namespace
+
+void run_create_batch(const std::vector<create_app_options>& jobs, const tt::config* config,
+                      const tt::tracker_database* tracker_db, std::ostream& os)
+{
+    // Threads and read buffers shared by all jobs, created with the options of the first job that is hashed.
+    // Declared before the jobs so it outlives their hashers.
+    std::optional<tt::hash_scheduler> scheduler {};
+
+    std::vector<batch_job> batch(jobs.size());
+    for (std::size_t i = 0; i < jobs.size(); ++i) {
+        batch[i].options = &jobs[i];
+    }
+
+    // Scan targets on a separate thread, a few jobs ahead of the job being hashed.
+    std::counting_semaphore<> scan_slots(batch_scan_ahead);
+    tt::work_queue<std::size_t> prepared {};
+
+    std::jthread scan_thread([&](std::stop_token stop_token) {
+        for (std::size_t i = 0; i < batch.size() && !stop_token.stop_requested(); ++i) {
+            scan_slots.acquire();
+            prepare_batch_job(batch[i], tracker_db, config);
+            prepared.push(i);
+        }
+        prepared.close();
+    });
+
+    std::size_t failed = 0;
+
+    auto finish = [&](std::size_t index) {
+        auto& job = batch[index];
+        const auto& options = *job.options;
+        try {
+            if (job.error) {
+                std::rethrow_exception(job.error);
+            }
+            job.hasher->wait();
+            job.hasher->update_cache();
+            dt::save_metafile(job.destination, job.metafile, options.protocol_version);
+            os << fmt::format("[{}/{}] {} -> {}\n", index + 1, batch.size(),
+                              options.target.string(), job.destination.string());
+        }
+        catch (const std::exception& err) {
+            os << fmt::format("[{}/{}] {}: Error: {}\n", index + 1, batch.size(), options.target.string(), err.what());
+            ++failed;
+        }
+        std::flush(os);
+        // release the file list and piece hashes
+        job.hasher.reset();
+        job.metafile = {};
+    };
+
+    std::optional<std::size_t> previous {};
+
+    while (auto index = prepared.pop()) {
+        auto& job = batch[*index];
+        scan_slots.release();
+
+        if (!job.error) {
+            try {
+                job.hasher = std::make_unique<tt::storage_hasher>(
+                        job.metafile.storage(), make_hasher_options(*job.options), make_hash_cache(*job.options));
+                job.hasher->set_file_identities(std::move(job.identities));
+                if (!scheduler) {
+                    scheduler.emplace(make_hasher_options(*job.options));
+                }
+                // The scheduler reads this job once the previous job has read all its data,
+                // so reads of this job overlap with hashing the last blocks of the previous job.
+                job.hasher->start(*scheduler);
+            }
+            catch (...) {
+                job.error = std::current_exception();
+            }
+        }
+        if (previous) {
+            finish(*previous);
+        }
+        previous = index;
+    }
+    if (previous) {
+        finish(*previous);
+    }
+
+    if (failed != 0) {
+        throw std::runtime_error(fmt::format("{} of {} batch jobs failed", failed, batch.size()));
+    }
 }
 
 
@@ -566,84 +1309,136 @@ void merge_create_profile(const tt::config& cfg, std::string_view profile_name,
     const auto& profile_options = std::get<create_app_options>(profile.options);
 
     // Replace all options that are not set from the commandline with the profile defaults.
-    if (app->get_option("--announce")->empty()) {
-        options.announce_list = profile_options.announce_list;
+    merge_create_options(profile_options,
+                         [&](std::string_view name) { return !app->get_option(fmt::format("--{}", name))->empty(); },
+                         options);
+}
+
+
+void merge_create_options(const create_app_options& defaults,
+                          const std::function<bool(std::string_view)>& is_set,
+                          create_app_options& options)
+{
+    if (!is_set("announce")) {
+        options.announce_list = defaults.announce_list;
+    }
+    if (!is_set("announce-group")) {
+        options.announce_group_list = defaults.announce_group_list;
+    }
+    if (!is_set("checksum")) {
+        options.checksums = defaults.checksums;
+    }
+    if (!is_set("collection")) {
+        options.collections = defaults.collections;
+    }
+    if (!is_set("comment")) {
+        options.comment = defaults.comment;
+    }
+    if (!is_set("created-by")) {
+        options.created_by = defaults.created_by;
+    }
+    if (!is_set("creation-date")) {
+        options.creation_date = defaults.creation_date;
+    }
+    if (!is_set("output")) {
+        options.destination = defaults.destination;
+        options.write_to_stdout = defaults.write_to_stdout;
+    }
+    if (!is_set("dht-node")) {
+        options.dht_nodes = defaults.dht_nodes;
+    }
+    if (!is_set("exclude")) {
+        options.exclude_patterns = defaults.exclude_patterns;
+    }
+    if (!is_set("http-seed")) {
+        options.http_seeds = defaults.http_seeds;
+    }
+    if (!is_set("include")) {
+        options.include_patterns = defaults.include_patterns;
+    }
+    if (!is_set("include-hidden")) {
+        options.include_hidden_files = defaults.include_hidden_files;
+    }
+    if (!is_set("io-block-size")) {
+        options.io_block_size = defaults.io_block_size;
+    }
+    if (!is_set("io-engine")) {
+        options.io_engine = defaults.io_engine;
     }
-    if (app->get_option("--announce-group")->empty()) {
-        options.announce_group_list = profile_options.announce_group_list;
+    if (!is_set("io-queue-depth")) {
+        options.io_queue_depth = defaults.io_queue_depth;
     }
-    if (app->get_option("--checksum")->empty()) {
-        options.checksums = profile_options.checksums;
+    if (!is_set("direct-io")) {
+        options.direct_io = defaults.direct_io;
     }
-    if (app->get_option("--collection")->empty()) {
-        options.collections = profile_options.collections;
+    if (!is_set("read-order")) {
+        options.read_order = defaults.read_order;
     }
-    if (app->get_option("--comment")->empty()) {
-        options.comment = profile_options.comment;
+    if (!is_set("drop-cache")) {
+        options.drop_cache = defaults.drop_cache;
     }
-    if (app->get_option("--created-by")->empty()) {
-        options.created_by = profile_options.created_by;
+    if (!is_set("max-read-rate")) {
+        options.max_read_rate = defaults.max_read_rate;
     }
-    if (app->get_option("--creation-date")->empty()) {
-        options.creation_date = profile_options.creation_date;
+    if (!is_set("max-iops")) {
+        options.max_iops = defaults.max_iops;
     }
-    if (app->get_option("--output")->empty()) {
-        options.destination = profile_options.destination;
-        options.write_to_stdout = profile_options.write_to_stdout;
+    if (!is_set("background")) {
+        options.background = defaults.background;
     }
-    if (app->get_option("--dht-node")->empty()) {
-        options.dht_nodes = profile_options.dht_nodes;
+    if (!is_set("max-memory")) {
+        options.max_memory = defaults.max_memory;
     }
-    if (app->get_option("--exclude")->empty()) {
-        options.exclude_patterns = profile_options.exclude_patterns;
+    if (!is_set("pipeline")) {
+        options.pipeline = defaults.pipeline;
     }
-    if (app->get_option("--http-seed")->empty()) {
-        options.http_seeds = profile_options.http_seeds;
+    if (!is_set("cpu-affinity")) {
+        options.cpu_affinity = defaults.cpu_affinity;
     }
-    if (app->get_option("--include")->empty()) {
-        options.include_patterns = profile_options.include_patterns;
+    if (!is_set("numa")) {
+        options.numa = defaults.numa;
     }
-    if (app->get_option("--include-hidden")->empty()) {
-        options.include_hidden_files = profile_options.include_hidden_files;
+    if (!is_set("hash-backend")) {
+        options.hash_backend = defaults.hash_backend;
     }
-    if (app->get_option("--io-block-size")->empty()) {
-        options.io_block_size = profile_options.io_block_size;
+    if (!is_set("hash-cache")) {
+        options.hash_cache = defaults.hash_cache;
     }
-    if (app->get_option("--name")->empty()) {
-        options.name = profile_options.name;
+    if (!is_set("name")) {
+        options.name = defaults.name;
     }
-    if (app->get_option("--output")->empty()) {
-        options.destination = profile_options.destination;
+    if (!is_set("output")) {
+        options.destination = defaults.destination;
     }
-    if (app->get_option("--piece-size")->empty()) {
-        options.piece_size = profile_options.piece_size;
+    if (!is_set("piece-size")) {
+        options.piece_size = defaults.piece_size;
     }
-    if (app->get_option("--private")->empty()) {
-        options.is_private = profile_options.is_private;
+    if (!is_set("private")) {
+        options.is_private = defaults.is_private;
     }
-    if (app->get_option("--protocol")->empty()) {
-        options.protocol_version = profile_options.protocol_version;
+    if (!is_set("protocol")) {
+        options.protocol_version = defaults.protocol_version;
     }
-    if (app->get_option("--no-created-by")->empty()) {
-        options.set_created_by = profile_options.set_created_by;
+    if (!is_set("no-created-by")) {
+        options.set_created_by = defaults.set_created_by;
     }
-    if (app->get_option("--no-creation-date")->empty()) {
-        options.set_creation_date = profile_options.set_creation_date;
+    if (!is_set("no-creation-date")) {
+        options.set_creation_date = defaults.set_creation_date;
     }
-    if (app->get_option("--no-cross-seed")->empty()) {
-        options.enable_cross_seeding = profile_options.enable_cross_seeding;
+    if (!is_set("no-cross-seed")) {
+        options.enable_cross_seeding = defaults.enable_cross_seeding;
     }
-    if (app->get_option("--similar")->empty()) {
-        options.similar_torrents = profile_options.similar_torrents;
+    if (!is_set("similar")) {
+        options.similar_torrents = defaults.similar_torrents;
     }
-    if (app->get_option("--source")->empty()) {
-        options.source = profile_options.source;
+    if (!is_set("source")) {
+        options.source = defaults.source;
     }
-    if (app->get_option("--threads")->empty()) {
-        options.threads = profile_options.threads;
+    if (!is_set("threads")) {
+        options.threads = defaults.threads;
     }
-    if (app->get_option("--web-seed")->empty()) {
-        options.web_seeds = profile_options.web_seeds;
+    if (!is_set("web-seed")) {
+        options.web_seeds = defaults.web_seeds;
     }
 }
 
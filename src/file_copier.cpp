@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <fmt/format.h>
+
+#include "file_copier.hpp"
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace torrenttools {
+
+namespace {
+
+/// Suffix of the temporary file a file is written to until it is complete.
+constexpr std::string_view partial_suffix = ".part";
+
+fs::path partial_path(const fs::path& destination)
+{
+    auto path = destination;
+    path += partial_suffix;
+    return path;
+}
+
+#if defined(__linux__)
+[[noreturn]] void throw_write_error(const fs::path& path)
+{
+    throw std::runtime_error(fmt::format("could not write {}: {}", path.string(), std::strerror(errno)));
+}
+#endif
+
+} // namespace
+
+
+struct file_copier::open_file
+{
+    fs::path path;
+#if defined(__linux__)
+    int fd = -1;
+#else
+    std::ofstream stream;
+#endif
+    /// The file was cloned from its source, the data does not have to be written.
+    bool cloned = false;
+
+    ~open_file()
+    {
+#if defined(__linux__)
+        if (fd != -1) {
+            ::close(fd);
+        }
+#endif
+    }
+};
+
+
+file_copier::file_copier(const dt::file_storage& storage, fs::path destination, bool clone)
+    : storage_(storage)
+    , destination_(std::move(destination))
+    , clone_(clone)
+    , bytes_remaining_(storage.file_count())
+    , open_files_(storage.file_count())
+{
+    // Check all destinations before anything is written.
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        const auto& entry = storage_.at(i);
+        if (entry.is_padding_file()) {
+            continue;
+        }
+        auto path = destination_path(i);
+        if (fs::exists(path) || fs::exists(partial_path(path))) {
+            throw std::runtime_error(fmt::format("destination file {} already exists", path.string()));
+        }
+    }
+
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        const auto& entry = storage_.at(i);
+        if (entry.is_padding_file()) {
+            continue;
+        }
+        auto path = destination_path(i);
+        fs::create_directories(path.parent_path());
+        bytes_remaining_[i] = entry.file_size();
+
+        // Empty files are never read.
+        if (entry.file_size() == 0) {
+            std::ofstream f(path, std::ios::binary);
+            if (!f) {
+                throw std::runtime_error(fmt::format("could not create {}", path.string()));
+            }
+        }
+    }
+}
+
+file_copier::~file_copier()
+{
+    // remove the temporary files of incomplete copies
+    for (std::size_t i = 0; i < open_files_.size(); ++i) {
+        if (open_files_[i]) {
+            auto path = open_files_[i]->path;
+            open_files_[i].reset();
+            std::error_code ec {};
+            fs::remove(path, ec);
+        }
+    }
+}
+
+fs::path file_copier::destination_path(std::size_t file_index) const
+{
+    return destination_ / storage_.at(file_index).path();
+}
+
+void file_copier::write(const data_chunk& chunk)
+{
+    const data_range all { .offset = 0, .length = chunk.data.size() };
+    write(chunk, std::span(&all, 1));
+}
+
+void file_copier::write(const data_chunk& chunk, std::span<const data_range> ranges)
+{
+    std::size_t pos = 0;
+    auto range = ranges.begin();
+
+    for (std::size_t i = 0; i < chunk.request->segments.size(); ++i) {
+        const auto& segment = chunk.request->segments[i];
+        const auto segment_end = pos + segment.length;
+
+        if (!storage_.at(segment.file_index).is_padding_file()) {
+            std::size_t written = 0;
+            for (; chunk.available[i] && range != ranges.end() && range->offset < segment_end; ++range) {
+                auto first = std::max(range->offset, pos);
+                auto last = std::min(range->offset + range->length, segment_end);
+                if (first < last) {
+                    file_segment part { .file_index = segment.file_index,
+                                        .file_offset = segment.file_offset + (first - pos),
+                                        .length = last - first };
+                    write_segment(part, chunk.data.subspan(first, last - first));
+                    written += part.length;
+                }
+                // the range continues in the next segment
+                if (range->offset + range->length > segment_end) {
+                    break;
+                }
+            }
+            bytes_discarded_.fetch_add(segment.length - written, std::memory_order_relaxed);
+
+            bytes_remaining_[segment.file_index] -= segment.length;
+            if (bytes_remaining_[segment.file_index] == 0 && open_files_[segment.file_index]) {
+                complete(segment.file_index);
+            }
+        }
+        // skip ranges that end within this segment
+        while (range != ranges.end() && range->offset + range->length <= segment_end) {
+            ++range;
+        }
+        pos = segment_end;
+    }
+}
+
+void file_copier::finish()
+{
+    for (std::size_t i = 0; i < bytes_remaining_.size(); ++i) {
+        if (bytes_remaining_[i] != 0) {
+            throw std::runtime_error(fmt::format(
+                    "copy of {} is incomplete: {} bytes were not written",
+                    destination_path(i).string(), bytes_remaining_[i]));
+        }
+    }
+}
+
+std::size_t file_copier::bytes_written() const noexcept
+{
+    return bytes_written_.load(std::memory_order_relaxed);
+}
+
+std::size_t file_copier::bytes_discarded() const noexcept
+{
+    return bytes_discarded_.load(std::memory_order_relaxed);
+}
+
+std::size_t file_copier::cloned_file_count() const noexcept
+{
+    return cloned_file_count_;
+}
+
+void file_copier::write_segment(const file_segment& segment, std::span<const std::byte> data)
+{
+    auto& file = open(segment.file_index);
+    if (file.cloned) {
+        return;
+    }
+#if defined(__linux__)
+    auto offset = static_cast<off_t>(segment.file_offset);
+    while (!data.empty()) {
+        auto n = ::pwrite(file.fd, data.data(), data.size(), offset);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw_write_error(file.path);
+        }
+        data = data.subspan(static_cast<std::size_t>(n));
+        offset += n;
+    }
+#else
+    file.stream.seekp(static_cast<std::streamoff>(segment.file_offset));
+    file.stream.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    if (!file.stream) {
+        throw std::runtime_error(fmt::format("could not write {}", file.path.string()));
+    }
+#endif
+    bytes_written_.fetch_add(segment.length, std::memory_order_relaxed);
+}
+
+file_copier::open_file& file_copier::open(std::size_t file_index)
+{
+    if (open_files_[file_index]) {
+        return *open_files_[file_index];
+    }
+    const auto& entry = storage_.at(file_index);
+    auto file = std::make_unique<open_file>();
+    file->path = partial_path(destination_path(file_index));
+
+#if defined(__linux__)
+    file->fd = ::open(file->path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (file->fd == -1) {
+        throw_write_error(file->path);
+    }
+    if (clone_) {
+        // Share the extents of the source on filesystems with reflinks, the data is then only hashed.
+        auto source_path = storage_.root_directory() / entry.path();
+        int source = ::open(source_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source != -1) {
+            file->cloned = ::ioctl(file->fd, FICLONE, source) == 0;
+            ::close(source);
+        }
+    }
+    if (!file->cloned) {
+        // Reserve the space up front so the file is written in large contiguous extents.
+        // Filesystems without fallocate support are written without preallocation.
+        (void) ::posix_fallocate(file->fd, 0, static_cast<off_t>(entry.file_size()));
+    }
+#else
+    file->stream.open(file->path, std::ios::binary | std::ios::out);
+    if (!file->stream) {
+        throw std::runtime_error(fmt::format("could not create {}", file->path.string()));
+    }
+#endif
+
+    if (file->cloned) {
+        ++cloned_file_count_;
+    }
+    open_files_[file_index] = std::move(file);
+    return *open_files_[file_index];
+}
+
+void file_copier::complete(std::size_t file_index)
+{
+    auto& file = open_files_[file_index];
+    auto path = file->path;
+
+#if defined(__linux__)
+    int fd = std::exchange(file->fd, -1);
+    if (::close(fd) != 0) {
+        throw_write_error(path);
+    }
+#else
+    file->stream.close();
+    if (!file->stream) {
+        throw std::runtime_error(fmt::format("could not write {}", path.string()));
+    }
+#endif
+    fs::rename(path, destination_path(file_index));
+    file.reset();
+}
+
+} // namespace torrenttools
@@ -0,0 +1,739 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(TORRENTTOOLS_USE_TBB)
+#include <execution>
+#endif
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <dirent.h>
+#endif
+
+#include "file_matcher.hpp"
+
+namespace torrenttools {
+
+using namespace std::chrono_literals;
+
+#if defined(__linux__)
+namespace {
+
+/// Record returned by the getdents64 system call.
+struct linux_dirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+/// Open directory file descriptor, shared by the subdirectories that are opened relative to it.
+class directory_handle
+{
+public:
+    explicit directory_handle(int fd) noexcept
+        : fd_(fd)
+    {}
+
+    directory_handle(const directory_handle&) = delete;
+    directory_handle& operator=(const directory_handle&) = delete;
+
+    ~directory_handle()
+    {
+        ::close(fd_);
+    }
+
+    int fd() const noexcept
+    { return fd_; }
+
+private:
+    int fd_;
+};
+
+[[noreturn]] void throw_scan_error(std::string_view what, const fs::path& path, int error)
+{
+    throw fs::filesystem_error(std::string(what), path, std::error_code(error, std::system_category()));
+}
+
+/// Only the fields needed for the file size and the hash cache identity are requested.
+constexpr unsigned int statx_mask = STATX_TYPE | STATX_SIZE | STATX_MTIME | STATX_INO;
+
+file_identity make_file_identity(const struct ::statx& stx)
+{
+    return file_identity {
+        // encoded as st_dev, so identities compare equal to those read with stat
+        .device = std::uint64_t(makedev(stx.stx_dev_major, stx.stx_dev_minor)),
+        .inode = std::uint64_t(stx.stx_ino),
+        .size = std::uint64_t(stx.stx_size),
+        .mtime = std::int64_t(stx.stx_mtime.tv_sec) * 1'000'000'000 + stx.stx_mtime.tv_nsec,
+    };
+}
+
+} // namespace
+#endif
+
+
+struct file_matcher::directory_task
+{
+    fs::path path;
+#if defined(__linux__)
+    /// Parent directory, the directory is opened relative to it. Empty for the search root.
+    std::shared_ptr<const directory_handle> parent {};
+#endif
+};
+
+/// Temporary file with sorted runs of results.
+/// Each result is written as the path length, the path, the file size and the identity if it is known.
+struct file_matcher::spill_file
+{
+    /// Buffer size of the reader of each run when merging.
+    static constexpr std::size_t min_read_buffer_size = 4 * 1024;
+    static constexpr std::size_t max_read_buffer_size = 1024 * 1024;
+
+    struct run
+    {
+        std::uint64_t offset;
+        std::size_t count;
+    };
+
+    spill_file() = default;
+    spill_file(const spill_file&) = delete;
+    spill_file& operator=(const spill_file&) = delete;
+
+    ~spill_file()
+    {
+        out.close();
+        if (!path.empty()) {
+            std::error_code ec;
+            fs::remove(path, ec);
+        }
+    }
+
+    bool empty() const noexcept
+    {
+        return runs.empty();
+    }
+
+    /// Sort the results of a worker, append them as a run and clear them.
+    /// Can be called concurrently by the workers.
+    void write_run(path_arena& paths, std::vector<scanned_file>& files)
+    {
+        paths.sort();
+
+        std::unique_lock lck(mutex);
+        if (path.empty()) {
+            open();
+        }
+        runs.push_back(run { .offset = offset, .count = paths.size() });
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            write_entry(paths[i], files[paths.id(i)]);
+        }
+        if (!out) {
+            throw std::runtime_error(fmt::format("could not write spill file {}", path.string()));
+        }
+        paths.clear();
+        files.clear();
+    }
+
+    /// Stop writing, must be called before merging.
+    void finish()
+    {
+        out.close();
+        if (out.fail()) {
+            throw std::runtime_error(fmt::format("could not write spill file {}", path.string()));
+        }
+    }
+
+    /// Merge all runs and call a function for each result in sorted order.
+    /// When there are too many runs to give each a read buffer within the memory budget,
+    /// groups of runs are first merged into longer runs appended to the spill file.
+    /// @param memory_budget memory to divide over the read buffers of the runs.
+    void merge(std::size_t memory_budget, const std::function<void(std::string_view, const scanned_file&)>& f)
+    {
+        const auto max_runs = std::max<std::size_t>(2, memory_budget / min_read_buffer_size);
+        const auto buffer_size = [&](std::size_t run_count) {
+            return std::clamp(memory_budget / run_count, min_read_buffer_size, max_read_buffer_size);
+        };
+
+        while (runs.size() > max_runs) {
+            out.open(path, std::ios::binary | std::ios::app);
+            std::vector<run> merged {};
+            for (std::size_t first = 0; first < runs.size(); first += max_runs) {
+                auto group = std::span(runs).subspan(first, std::min(max_runs, runs.size() - first));
+                merged.push_back(run { .offset = offset, .count = 0 });
+                merge_runs(group, buffer_size(group.size()), [&](std::string_view p, const scanned_file& file) {
+                    write_entry(p, file);
+                    ++merged.back().count;
+                });
+            }
+            finish();
+            runs = std::move(merged);
+        }
+        merge_runs(runs, buffer_size(std::max<std::size_t>(runs.size(), 1)), f);
+    }
+
+    fs::path path {};
+    std::vector<run> runs {};
+
+private:
+    void open()
+    {
+        std::random_device rd;
+        auto id = (std::uint64_t(rd()) << 32) | rd();
+        path = fs::temp_directory_path() / fmt::format("torrenttools-scan-{:016x}.tmp", id);
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error(fmt::format("could not create spill file {}", path.string()));
+        }
+    }
+
+    template <typename T>
+    void write_value(const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        offset += sizeof(T);
+    }
+
+    void write_entry(std::string_view relative_path, const scanned_file& file)
+    {
+        write_value(std::uint32_t(relative_path.size()));
+        out.write(relative_path.data(), static_cast<std::streamsize>(relative_path.size()));
+        offset += relative_path.size();
+        write_value(file.file_size);
+        write_value(std::uint8_t(file.identity.has_value()));
+        if (file.identity) {
+            write_value(*file.identity);
+        }
+    }
+
+    /// Buffered reader of a single run. All readers share the input stream of the spill file,
+    /// so the number of runs is not limited by the number of open files.
+    struct reader
+    {
+        std::istream* in;
+        std::vector<char> buffer;
+        std::size_t position = 0;
+        std::size_t end = 0;
+        /// Offset in the spill file of the data after the buffer.
+        std::uint64_t file_offset;
+        /// Number of entries of the run that were not read.
+        std::size_t remaining;
+        std::string path {};
+        scanned_file file {};
+
+        bool read(char* data, std::size_t size)
+        {
+            while (size > 0) {
+                if (position == end) {
+                    in->clear();
+                    in->seekg(static_cast<std::streamoff>(file_offset));
+                    in->read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+                    end = static_cast<std::size_t>(in->gcount());
+                    position = 0;
+                    file_offset += end;
+                    if (end == 0) {
+                        return false;
+                    }
+                }
+                auto n = std::min(size, end - position);
+                std::copy_n(buffer.data() + position, n, data);
+                position += n;
+                data += n;
+                size -= n;
+            }
+            return true;
+        }
+
+        template <typename T>
+        bool read_value(T& value)
+        {
+            return read(reinterpret_cast<char*>(&value), sizeof(T));
+        }
+
+        /// Read the next entry of the run.
+        /// @returns false at the end of the run.
+        bool next()
+        {
+            if (remaining == 0) {
+                return false;
+            }
+            std::uint32_t length = 0;
+            std::uint8_t has_identity = 0;
+            if (!read_value(length)) {
+                throw_read_error();
+            }
+            path.resize(length);
+            if (!read(path.data(), length) || !read_value(file.file_size) || !read_value(has_identity)) {
+                throw_read_error();
+            }
+            file.identity.reset();
+            if (has_identity) {
+                file_identity identity {};
+                if (!read_value(identity)) {
+                    throw_read_error();
+                }
+                file.identity = identity;
+            }
+            --remaining;
+            return true;
+        }
+
+        [[noreturn]] static void throw_read_error()
+        {
+            throw std::runtime_error("could not read the file list from the spill file");
+        }
+    };
+
+    /// Merge runs and call a function for each entry in sorted order.
+    void merge_runs(std::span<const run> merged_runs, std::size_t buffer_size,
+                    const std::function<void(std::string_view, const scanned_file&)>& f) const
+    {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error(fmt::format("could not open spill file {}", path.string()));
+        }
+
+        std::vector<reader> readers {};
+        readers.reserve(merged_runs.size());
+        for (const auto& r : merged_runs) {
+            readers.push_back(reader {
+                    .in = &in, .buffer = std::vector<char>(buffer_size), .file_offset = r.offset, .remaining = r.count });
+        }
+
+        // min heap on the current path of each reader
+        auto greater = [&](std::size_t lhs, std::size_t rhs) {
+            return path_less(readers[rhs].path, readers[lhs].path);
+        };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(greater)> heap(greater);
+
+        for (std::size_t i = 0; i < readers.size(); ++i) {
+            if (readers[i].next()) {
+                heap.push(i);
+            }
+        }
+        while (!heap.empty()) {
+            auto i = heap.top();
+            heap.pop();
+            f(readers[i].path, readers[i].file);
+            if (readers[i].next()) {
+                heap.push(i);
+            }
+        }
+    }
+
+    std::mutex mutex {};
+    std::ofstream out {};
+    std::uint64_t offset = 0;
+};
+
+
+struct file_matcher::scan_state
+{
+    /// Directories found by a worker. The owner takes directories from the back to scan depth first,
+    /// other workers steal from the front to take the directories closest to the root.
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<directory_task> directories;
+    };
+
+    /// Files matched by a worker, the metadata is indexed by path id.
+    struct worker_results
+    {
+        path_arena paths;
+        std::vector<scanned_file> files;
+    };
+
+    scan_state(std::size_t worker_count, const fs::path& search_root)
+        : queues(worker_count)
+        , results(worker_count)
+        , root_length(search_root.string().size())
+    {
+        // paths are stored without the search root and the separator following it
+        if (!search_root.string().ends_with(fs::path::preferred_separator)) {
+            ++root_length;
+        }
+    }
+
+    /// Add a matched file to the results of a worker.
+    /// The results are spilled when the worker exceeds its share of the memory budget.
+    void add(std::size_t worker, std::string_view relative_path, const scanned_file& file)
+    {
+        if (on_match) {
+            on_match(relative_path, file);
+        }
+        auto& r = results[worker];
+        r.paths.push_back(relative_path);
+        r.files.push_back(file);
+        if (spill && memory_usage(r) > worker_memory_limit) {
+            spill->write_run(r.paths, r.files);
+        }
+    }
+
+    static std::size_t memory_usage(const worker_results& r) noexcept
+    {
+        return r.paths.memory_usage() + r.files.capacity() * sizeof(scanned_file);
+    }
+
+    void push(std::size_t worker, directory_task directory)
+    {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::unique_lock lck(queues[worker].mutex);
+            queues[worker].directories.push_back(std::move(directory));
+        }
+        idle_cv.notify_one();
+    }
+
+    std::optional<directory_task> pop(std::size_t worker)
+    {
+        {
+            auto& own = queues[worker];
+            std::unique_lock lck(own.mutex);
+            if (!own.directories.empty()) {
+                auto directory = std::move(own.directories.back());
+                own.directories.pop_back();
+                return directory;
+            }
+        }
+        for (std::size_t i = 1; i < queues.size(); ++i) {
+            auto& victim = queues[(worker + i) % queues.size()];
+            std::unique_lock lck(victim.mutex);
+            if (!victim.directories.empty()) {
+                auto directory = std::move(victim.directories.front());
+                victim.directories.pop_front();
+                return directory;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::vector<queue> queues;
+    std::vector<worker_results> results;
+    /// Length of the search root prefix of the paths of files.
+    std::size_t root_length;
+    /// Spill file when a memory budget is set.
+    spill_file* spill = nullptr;
+    std::size_t worker_memory_limit = 0;
+    std::function<void(std::string_view, const scanned_file&)> on_match {};
+    /// Directories that are queued or being scanned, the scan is complete when no directories are pending.
+    std::atomic_size_t pending = 0;
+    std::mutex idle_mutex;
+    std::condition_variable_any idle_cv;
+    std::stop_source stop_source;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+
+file_matcher::file_matcher()
+    : directory_exclude_list_()
+    , file_include_list_(make_default_options(), re2::RE2::Anchor::ANCHOR_START)
+    , file_exclude_list_(make_default_options(), re2::RE2::Anchor::ANCHOR_START)
+    , include_hidden_files_()
+{}
+
+// defined here, where spill_file is complete
+file_matcher::~file_matcher() = default;
+
+
+void file_matcher::run(std::stop_token stop_token)
+{
+    is_running_ = true;
+    // reset the running flag when the scan fails as well
+    struct running_guard
+    {
+        std::atomic_bool& flag;
+        ~running_guard() { flag.store(false, std::memory_order_relaxed); }
+    } guard { is_running_ };
+
+    if (!is_compiled_)
+        compile();
+
+    results_ = {};
+    spill_.reset();
+
+    scan_state state(thread_count_, search_root_);
+    state.on_match = match_callback_;
+    std::unique_ptr<spill_file> spill {};
+    if (max_memory_ != 0) {
+        spill = std::make_unique<spill_file>();
+        state.spill = spill.get();
+        state.worker_memory_limit = max_memory_ / thread_count_;
+    }
+    std::stop_callback forward_stop(stop_token, [&]() { state.stop_source.request_stop(); });
+
+    auto work = [&](std::size_t worker) {
+        auto stop = state.stop_source.get_token();
+        while (!stop.stop_requested()) {
+            auto directory = state.pop(worker);
+            if (!directory) {
+                if (state.pending.load(std::memory_order_acquire) == 0) {
+                    return;
+                }
+                // wait for other workers to find more directories, the timeout covers missed notifications
+                std::unique_lock lck(state.idle_mutex);
+                state.idle_cv.wait_for(lck, stop, 1ms, [&]() {
+                    return state.pending.load(std::memory_order_acquire) == 0;
+                });
+                continue;
+            }
+
+            try {
+                scan_directory(*directory, worker, state);
+            }
+            catch (...) {
+                {
+                    std::unique_lock lck(state.error_mutex);
+                    if (!state.error) {
+                        state.error = std::current_exception();
+                    }
+                }
+                state.stop_source.request_stop();
+                return;
+            }
+
+            if (state.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                state.idle_cv.notify_all();
+            }
+        }
+    };
+
+    state.push(0, directory_task { .path = search_root_ });
+    {
+        std::vector<std::jthread> workers {};
+        for (std::size_t i = 1; i < thread_count_; ++i) {
+            workers.emplace_back(work, i);
+        }
+        work(0);
+    }
+
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+    if (stop_token.stop_requested()) {
+        return;
+    }
+
+    // once any worker spilled, the remaining results are spilled too and merged when they are read
+    if (spill && !spill->empty()) {
+        for (auto& r : state.results) {
+            if (!r.paths.empty()) {
+                spill->write_run(r.paths, r.files);
+            }
+        }
+        spill->finish();
+        spill_ = std::move(spill);
+        return;
+    }
+
+    path_arena paths {};
+    std::vector<scanned_file> files {};
+    std::size_t count = 0;
+    std::size_t byte_count = 0;
+    for (const auto& r : state.results) {
+        count += r.paths.size();
+        byte_count += r.paths.byte_size();
+    }
+    paths.reserve(count, byte_count);
+    files.reserve(count);
+    // path ids are offset by the number of paths before them, which keeps them aligned with the metadata
+    for (auto& r : state.results) {
+        paths.append(r.paths);
+        files.insert(files.end(), r.files.begin(), r.files.end());
+        r = {};
+    }
+
+    // sort so the output does not depend on which worker scanned which directory
+    paths.sort();
+
+    results_ = scanned_file_list(search_root_, std::move(paths), std::move(files));
+}
+
+
+#if defined(__linux__)
+
+void file_matcher::scan_directory(const directory_task& directory, std::size_t worker, scan_state& state)
+{
+    auto stop = state.stop_source.get_token();
+
+    const int parent_fd = directory.parent ? directory.parent->fd() : AT_FDCWD;
+    const auto open_path = directory.parent ? directory.path.filename() : directory.path;
+    int fd = ::openat(parent_fd, open_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        throw_scan_error("cannot open directory", directory.path, errno);
+    }
+    auto handle = std::make_shared<const directory_handle>(fd);
+
+    // full path of the current entry, the directory prefix is reused for all entries
+    std::string path = directory.path.string();
+    if (!path.ends_with('/')) {
+        path.push_back('/');
+    }
+    const auto prefix_length = path.size();
+
+    alignas(linux_dirent64) std::array<char, 32 * 1024> buffer;
+    for (;;) {
+        auto n = ::syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (n < 0) {
+            throw_scan_error("cannot read directory", directory.path, errno);
+        }
+        if (n == 0) {
+            return;
+        }
+
+        for (long offset = 0; offset < n;) {
+            const auto* entry = reinterpret_cast<const linux_dirent64*>(buffer.data() + offset);
+            offset += entry->d_reclen;
+
+            if (stop.stop_requested()) {
+                return;
+            }
+            const std::string_view name = entry->d_name;
+            if (name == "." || name == "..") {
+                continue;
+            }
+
+            auto type = entry->d_type;
+            struct ::statx stx {};
+            bool has_statx = false;
+
+            // filesystems that do not report the type and symlinks need a stat to find the type,
+            // symlinks to files are followed, symlinks to directories are not
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                int flags = (type == DT_LNK) ? 0 : AT_SYMLINK_NOFOLLOW;
+                if (::statx(fd, entry->d_name, flags, statx_mask, &stx) != 0) {
+                    // removed while scanning or a broken symlink
+                    if (errno == ENOENT) {
+                        continue;
+                    }
+                    throw_scan_error("cannot stat file", directory.path / name, errno);
+                }
+                if (S_ISREG(stx.stx_mode)) {
+                    type = DT_REG;
+                    has_statx = true;
+                }
+                else if (S_ISDIR(stx.stx_mode) && type == DT_UNKNOWN) {
+                    type = DT_DIR;
+                }
+                else {
+                    continue;
+                }
+            }
+
+            path.resize(prefix_length);
+            path.append(name);
+
+            if (type == DT_DIR) {
+                auto relative_path = fs::path(std::string_view(path).substr(state.root_length));
+                if (!directory_exclude_list_.contains(relative_path)) {
+                    state.push(worker, directory_task { .path = fs::path(path), .parent = handle });
+                }
+            }
+            else if (type == DT_REG) {
+                files_scanned_.fetch_add(1, std::memory_order_relaxed);
+                if (!matches(path, name)) {
+                    continue;
+                }
+                if (!has_statx && ::statx(fd, entry->d_name, AT_SYMLINK_NOFOLLOW, statx_mask, &stx) != 0) {
+                    if (errno == ENOENT) {
+                        continue;
+                    }
+                    throw_scan_error("cannot stat file", path, errno);
+                }
+                state.add(worker, std::string_view(path).substr(state.root_length), scanned_file {
+                        .file_size = std::uint64_t(stx.stx_size),
+                        .identity = make_file_identity(stx) });
+                files_included_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+#else
+
+void file_matcher::scan_directory(const directory_task& directory, std::size_t worker, scan_state& state)
+{
+    auto stop = state.stop_source.get_token();
+
+    for (const auto& entry : fs::directory_iterator(directory.path)) {
+        if (stop.stop_requested()) {
+            return;
+        }
+        if (entry.is_directory()) {
+            // symlinks to directories are not followed
+            if (!entry.is_symlink() &&
+                !directory_exclude_list_.contains(entry.path().lexically_relative(search_root_))) {
+                state.push(worker, directory_task { .path = entry.path() });
+            }
+        }
+        else if (entry.is_regular_file()) {
+            files_scanned_.fetch_add(1, std::memory_order_relaxed);
+            const auto path = entry.path().string();
+            if (matches(path, entry.path().filename().string())) {
+                state.add(worker, std::string_view(path).substr(state.root_length),
+                          scanned_file { .file_size = entry.file_size() });
+                files_included_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+#endif
+
+
+std::vector<fs::path> file_matcher::results()
+{
+    std::vector<fs::path> paths {};
+    for_each_result([&](std::string_view relative_path, const scanned_file&) {
+        paths.push_back(search_root_ / fs::path(relative_path));
+    });
+    results_ = {};
+    spill_.reset();
+    return paths;
+}
+
+
+void file_matcher::for_each_result(const std::function<void(std::string_view, const scanned_file&)>& f)
+{
+    if (spill_) {
+        spill_->merge(max_memory_, f);
+        return;
+    }
+    for (std::size_t i = 0; i < results_.size(); ++i) {
+        f(results_.relative_path(i), results_.file(i));
+    }
+}
+
+
+bool file_matcher::matches(std::string_view path, std::string_view filename) const
+{
+    const re2::StringPiece s(path.data(), path.size());
+    if (file_include_list_empty_) {
+        if (!include_hidden_files_ && is_hidden_file(filename)) {
+            return false;
+        }
+        return file_exclude_list_empty_ || !file_exclude_list_.Match(s, nullptr);
+    }
+    return file_include_list_.Match(s, nullptr) &&
+           (file_exclude_list_empty_ || !file_exclude_list_.Match(s, nullptr));
+}
+
+} // namespace torrenttools
@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <fmt/format.h>
+#include <gsl-lite/gsl-lite.hpp>
+#include <openssl/evp.h>
+
+#ifdef TORRENTTOOLS_USE_ISAL
+#include <isa-l_crypto.h>
+#endif
+
+#include "cpu_info.hpp"
+#include "hash_backend.hpp"
+#include "sha256_lanes.hpp"
+
+namespace torrenttools {
+
+namespace {
+
+constexpr std::size_t sha1_digest_size = 20;
+constexpr std::size_t sha256_digest_size = 32;
+
+std::size_t digest_size_of(dt::hash_function function)
+{
+    switch (function) {
+    case dt::hash_function::sha1:   return sha1_digest_size;
+    case dt::hash_function::sha256: return sha256_digest_size;
+    default:
+        throw std::invalid_argument(fmt::format(
+                "hash function {} is not supported for block hashing", dt::to_string(function)));
+    }
+}
+
+
+class openssl_block_hasher : public block_hasher
+{
+public:
+    explicit openssl_block_hasher(dt::hash_function function)
+        : function_(function)
+        , digest_size_(digest_size_of(function))
+        , md_(function == dt::hash_function::sha1 ? EVP_sha1() : EVP_sha256())
+        , ctx_(EVP_MD_CTX_new())
+    {
+        if (!ctx_) {
+            throw std::bad_alloc();
+        }
+    }
+
+    ~openssl_block_hasher() override
+    {
+        EVP_MD_CTX_free(ctx_);
+    }
+
+    hash_backend backend() const noexcept override
+    { return hash_backend::openssl; }
+
+    dt::hash_function function() const noexcept override
+    { return function_; }
+
+    std::size_t digest_size() const noexcept override
+    { return digest_size_; }
+
+    void hash(std::span<const std::span<const std::byte>> inputs, std::span<std::byte> out) override
+    {
+        Expects(out.size() >= inputs.size() * digest_size_);
+
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            unsigned int size = 0;
+            auto* digest = reinterpret_cast<unsigned char*>(out.data() + i * digest_size_);
+            if (EVP_DigestInit_ex(ctx_, md_, nullptr) != 1 ||
+                EVP_DigestUpdate(ctx_, inputs[i].data(), inputs[i].size()) != 1 ||
+                EVP_DigestFinal_ex(ctx_, digest, &size) != 1) {
+                throw std::runtime_error("openssl: failed to compute digest");
+            }
+        }
+    }
+
+private:
+    dt::hash_function function_;
+    std::size_t digest_size_;
+    const EVP_MD* md_;
+    EVP_MD_CTX* ctx_;
+};
+
+
+#ifdef TORRENTTOOLS_USE_ISAL
+
+/// Store the digest words of an isa-l job in big endian byte order.
+template <std::size_t N>
+void store_digest(const std::uint32_t (&words)[N], std::byte* out)
+{
+    for (std::size_t i = 0; i < N; ++i) {
+        auto w = words[i];
+        out[4*i]   = std::byte(w >> 24);
+        out[4*i+1] = std::byte(w >> 16);
+        out[4*i+2] = std::byte(w >> 8);
+        out[4*i+3] = std::byte(w);
+    }
+}
+
+/// Submits all inputs to an isa-l multi-buffer context manager which hashes up to 16 jobs in parallel
+/// using the widest SIMD instructions supported by the CPU.
+template <typename Traits>
+class isal_block_hasher : public block_hasher
+{
+    using manager_type = typename Traits::manager_type;
+    using context_type = typename Traits::context_type;
+
+public:
+    isal_block_hasher()
+    {
+        void* p = nullptr;
+        // the context manager requires 16 byte alignment, use 64 bytes for AVX-512
+        if (posix_memalign(&p, 64, sizeof(manager_type)) != 0) {
+            throw std::bad_alloc();
+        }
+        manager_.reset(static_cast<manager_type*>(p));
+        Traits::init(manager_.get());
+    }
+
+    hash_backend backend() const noexcept override
+    { return hash_backend::isal; }
+
+    dt::hash_function function() const noexcept override
+    { return Traits::function; }
+
+    std::size_t digest_size() const noexcept override
+    { return Traits::digest_size; }
+
+    void hash(std::span<const std::span<const std::byte>> inputs, std::span<std::byte> out) override
+    {
+        Expects(out.size() >= inputs.size() * Traits::digest_size);
+
+        contexts_.resize(inputs.size());
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            auto& ctx = contexts_[i];
+            hash_ctx_init(&ctx);
+            ctx.user_data = reinterpret_cast<void*>(i);
+            // returns a completed job or nullptr, all jobs are collected after flushing
+            Traits::submit(manager_.get(), &ctx, inputs[i].data(), static_cast<std::uint32_t>(inputs[i].size()));
+        }
+        while (Traits::flush(manager_.get())) {}
+
+        for (std::size_t i = 0; i < inputs.size(); ++i) {
+            auto& ctx = contexts_[i];
+            if (ctx.error != HASH_CTX_ERROR_NONE) {
+                throw std::runtime_error("isa-l: failed to compute digest");
+            }
+            store_digest(ctx.job.result_digest, out.data() + i * Traits::digest_size);
+        }
+    }
+
+private:
+    struct free_deleter
+    {
+        void operator()(manager_type* p) const noexcept { std::free(p); }
+    };
+
+    std::unique_ptr<manager_type, free_deleter> manager_;
+    std::vector<context_type> contexts_;
+};
+
+struct isal_sha1_traits
+{
+    using manager_type = SHA1_HASH_CTX_MGR;
+    using context_type = SHA1_HASH_CTX;
+    static constexpr auto function = dt::hash_function::sha1;
+    static constexpr std::size_t digest_size = sha1_digest_size;
+
+    static void init(manager_type* mgr)
+    { sha1_ctx_mgr_init(mgr); }
+
+    static context_type* submit(manager_type* mgr, context_type* ctx, const std::byte* data, std::uint32_t len)
+    { return sha1_ctx_mgr_submit(mgr, ctx, data, len, HASH_ENTIRE); }
+
+    static context_type* flush(manager_type* mgr)
+    { return sha1_ctx_mgr_flush(mgr); }
+};
+
+struct isal_sha256_traits
+{
+    using manager_type = SHA256_HASH_CTX_MGR;
+    using context_type = SHA256_HASH_CTX;
+    static constexpr auto function = dt::hash_function::sha256;
+    static constexpr std::size_t digest_size = sha256_digest_size;
+
+    static void init(manager_type* mgr)
+    { sha256_ctx_mgr_init(mgr); }
+
+    static context_type* submit(manager_type* mgr, context_type* ctx, const std::byte* data, std::uint32_t len)
+    { return sha256_ctx_mgr_submit(mgr, ctx, data, len, HASH_ENTIRE); }
+
+    static context_type* flush(manager_type* mgr)
+    { return sha256_ctx_mgr_flush(mgr); }
+};
+
+#endif // TORRENTTOOLS_USE_ISAL
+
+
+/// Hashes runs of equally sized inputs in SIMD lanes with sha256_lanes.
+/// Inputs that do not fill a lane group, e.g. the last leaf of a file, are hashed with openssl.
+class simd_block_hasher : public block_hasher
+{
+public:
+    simd_block_hasher()
+        : lanes_(sha256_lane_count())
+        , fallback_(dt::hash_function::sha256)
+    {
+        Expects(lanes_ > 0);
+        scratch_.resize(lanes_ * sha256_digest_size);
+    }
+
+    hash_backend backend() const noexcept override
+    { return hash_backend::simd; }
+
+    dt::hash_function function() const noexcept override
+    { return dt::hash_function::sha256; }
+
+    std::size_t digest_size() const noexcept override
+    { return sha256_digest_size; }
+
+    void hash(std::span<const std::span<const std::byte>> inputs, std::span<std::byte> out) override
+    {
+        Expects(out.size() >= inputs.size() * sha256_digest_size);
+
+        std::size_t i = 0;
+        while (i < inputs.size()) {
+            // find the run of inputs with the same length as inputs[i]
+            const auto length = inputs[i].size();
+            std::size_t run_end = i + 1;
+            while (run_end < inputs.size() && inputs[run_end].size() == length) {
+                ++run_end;
+            }
+
+            for (; i + lanes_ <= run_end; i += lanes_) {
+                for (std::size_t lane = 0; lane < lanes_; ++lane) {
+                    messages_[lane] = inputs[i + lane].data();
+                }
+                sha256_lanes(messages_.data(), length, out.data() + i * sha256_digest_size);
+            }
+
+            const auto remaining = run_end - i;
+            if (remaining == 0) {
+                continue;
+            }
+            if (remaining * 4 >= lanes_) {
+                // A partially filled pass is still faster than hashing a quarter of the lanes one by one.
+                // Unused lanes hash the last input again.
+                for (std::size_t lane = 0; lane < lanes_; ++lane) {
+                    messages_[lane] = inputs[std::min(i + lane, run_end - 1)].data();
+                }
+                sha256_lanes(messages_.data(), length, scratch_.data());
+                std::copy_n(scratch_.begin(), remaining * sha256_digest_size, out.begin() + i * sha256_digest_size);
+            }
+            else {
+                fallback_.hash(inputs.subspan(i, remaining), out.subspan(i * sha256_digest_size));
+            }
+            i = run_end;
+        }
+    }
+
+private:
+    std::size_t lanes_;
+    std::array<const std::byte*, 16> messages_ {};
+    std::vector<std::byte> scratch_;
+    openssl_block_hasher fallback_;
+};
+
+
+/// Return the throughput of a backend in bytes per second.
+double measure_throughput(hash_backend backend, dt::hash_function function, std::size_t message_size)
+{
+    // Large enough to amortize timer resolution, small enough to keep startup fast.
+    constexpr std::size_t sample_size = 8 * 1024 * 1024;
+    constexpr int repetitions = 3;
+
+    auto hasher = make_block_hasher(backend, function);
+    std::vector<std::byte> data(sample_size);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = std::byte(i * 31 + 7);
+    }
+    std::vector<std::span<const std::byte>> inputs;
+    for (std::size_t pos = 0; pos < data.size(); pos += message_size) {
+        inputs.emplace_back(std::span(data).subspan(pos, message_size));
+    }
+    std::vector<std::byte> digests(inputs.size() * hasher->digest_size());
+
+    double best = 0;
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        hasher->hash(inputs, digests);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (seconds > 0) {
+            best = std::max(best, double(sample_size) / seconds);
+        }
+    }
+    return best;
+}
+
+/// Identifies the hardware and build a calibration result is valid for.
+std::string calibration_signature()
+{
+    auto features = detect_cpu_features();
+    std::string backends {};
+    for (auto b : available_hash_backends()) {
+        if (!backends.empty()) backends += ',';
+        backends += to_string(b);
+    }
+    return fmt::format("{}|sha-ni={:d},avx2={:d},avx512={:d}|{}",
+                       cpu_model_name(), features.sha_ni, features.avx2, features.avx512, backends);
+}
+
+std::optional<hash_backend_selection> read_calibration_cache(const fs::path& cache_file)
+{
+    std::ifstream f(cache_file);
+    std::string signature, sha1, sha256;
+    if (!std::getline(f, signature) || !std::getline(f, sha1) || !std::getline(f, sha256)) {
+        return std::nullopt;
+    }
+    if (signature != calibration_signature()) {
+        return std::nullopt;
+    }
+    auto sha1_backend = make_hash_backend(sha1);
+    auto sha256_backend = make_hash_backend(sha256);
+    if (!sha1_backend || !sha256_backend || !is_available(*sha1_backend) || !is_available(*sha256_backend) ||
+        !supports(*sha1_backend, dt::hash_function::sha1)) {
+        return std::nullopt;
+    }
+    return hash_backend_selection{.sha1 = *sha1_backend, .sha256 = *sha256_backend};
+}
+
+void write_calibration_cache(const fs::path& cache_file, const hash_backend_selection& selection)
+{
+    // the cache is an optimization, failures to write it are ignored
+    std::error_code ec;
+    fs::create_directories(cache_file.parent_path(), ec);
+    std::ofstream f(cache_file, std::ios::trunc);
+    f << calibration_signature() << '\n'
+      << to_string(selection.sha1) << '\n'
+      << to_string(selection.sha256) << '\n';
+}
+
+} // namespace
+
+
+std::string_view to_string(hash_backend backend) noexcept
+{
+    switch (backend) {
+    case hash_backend::openssl: return "openssl";
+    case hash_backend::isal:    return "isal";
+    case hash_backend::simd:    return "simd";
+    }
+    return "";
+}
+
+std::optional<hash_backend> make_hash_backend(std::string_view name) noexcept
+{
+    if (name == "openssl") {
+        return hash_backend::openssl;
+    }
+    if (name == "isal" || name == "isa-l") {
+        return hash_backend::isal;
+    }
+    if (name == "simd") {
+        return hash_backend::simd;
+    }
+    return std::nullopt;
+}
+
+bool is_available(hash_backend backend) noexcept
+{
+    switch (backend) {
+    case hash_backend::openssl:
+        return true;
+    case hash_backend::isal:
+#ifdef TORRENTTOOLS_USE_ISAL
+        return true;
+#else
+        return false;
+#endif
+    case hash_backend::simd:
+        return sha256_lane_count() > 0;
+    }
+    return false;
+}
+
+bool supports(hash_backend backend, dt::hash_function function) noexcept
+{
+    if (function != dt::hash_function::sha1 && function != dt::hash_function::sha256) {
+        return false;
+    }
+    return backend != hash_backend::simd || function == dt::hash_function::sha256;
+}
+
+std::vector<hash_backend> available_hash_backends()
+{
+    std::vector<hash_backend> backends {};
+    for (auto b : {hash_backend::openssl, hash_backend::isal, hash_backend::simd}) {
+        if (is_available(b)) {
+            backends.push_back(b);
+        }
+    }
+    return backends;
+}
+
+
+std::unique_ptr<block_hasher> make_block_hasher(hash_backend backend, dt::hash_function function)
+{
+    if (!is_available(backend)) {
+        throw std::invalid_argument(fmt::format(
+                "hash backend {} is not supported by this build or CPU", to_string(backend)));
+    }
+    if (!supports(backend, function)) {
+        throw std::invalid_argument(fmt::format(
+                "hash backend {} does not support {}", to_string(backend), dt::to_string(function)));
+    }
+
+    switch (backend) {
+    case hash_backend::openssl:
+        return std::make_unique<openssl_block_hasher>(function);
+    case hash_backend::isal:
+#ifdef TORRENTTOOLS_USE_ISAL
+        if (function == dt::hash_function::sha1) {
+            return std::make_unique<isal_block_hasher<isal_sha1_traits>>();
+        }
+        return std::make_unique<isal_block_hasher<isal_sha256_traits>>();
+#else
+        break;
+#endif
+    case hash_backend::simd:
+        return std::make_unique<simd_block_hasher>();
+    }
+    throw std::invalid_argument("invalid hash backend");
+}
+
+
+hash_backend_selection calibrate_hash_backends()
+{
+    // Message sizes are representative for v1 pieces and v2 leaves.
+    constexpr std::size_t piece_size = 256 * 1024;
+    constexpr std::size_t leaf_size = 16 * 1024;
+
+    hash_backend_selection selection {};
+    double sha1_rate = 0;
+    double sha256_rate = 0;
+
+    for (auto backend : available_hash_backends()) {
+        if (supports(backend, dt::hash_function::sha1)) {
+            if (auto rate = measure_throughput(backend, dt::hash_function::sha1, piece_size); rate > sha1_rate) {
+                sha1_rate = rate;
+                selection.sha1 = backend;
+            }
+        }
+        if (auto rate = measure_throughput(backend, dt::hash_function::sha256, leaf_size); rate > sha256_rate) {
+            sha256_rate = rate;
+            selection.sha256 = backend;
+        }
+    }
+    return selection;
+}
+
+
+hash_backend_selection select_hash_backends(std::optional<hash_backend> forced,
+                                            const std::optional<fs::path>& cache_file)
+{
+    if (forced) {
+        if (!is_available(*forced)) {
+            throw std::invalid_argument(fmt::format(
+                    "hash backend {} is not supported by this build or CPU", to_string(*forced)));
+        }
+        hash_backend_selection selection {.sha256 = *forced};
+        if (supports(*forced, dt::hash_function::sha1)) {
+            selection.sha1 = *forced;
+        }
+        return selection;
+    }
+    // nothing to choose from
+    if (available_hash_backends().size() == 1) {
+        return {};
+    }
+    if (cache_file) {
+        if (auto cached = read_calibration_cache(*cache_file); cached) {
+            return *cached;
+        }
+    }
+    auto selection = calibrate_hash_backends();
+    if (cache_file) {
+        write_calibration_cache(*cache_file, selection);
+    }
+    return selection;
+}
+
+} // namespace torrenttools
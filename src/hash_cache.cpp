@@ -0,0 +1,351 @@
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <span>
+#include <system_error>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include <dottorrent/hasher/factory.hpp>
+
+#include "hash_cache.hpp"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+namespace torrenttools {
+
+namespace {
+
+constexpr std::string_view cache_header = "torrenttools-hash-cache 1";
+
+std::string to_hex(std::span<const std::byte> data)
+{
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string result {};
+    result.reserve(data.size() * 2);
+    for (auto b : data) {
+        result.push_back(digits[std::to_integer<unsigned>(b) >> 4]);
+        result.push_back(digits[std::to_integer<unsigned>(b) & 0xF]);
+    }
+    return result;
+}
+
+std::optional<std::vector<std::byte>> from_hex(std::string_view hex)
+{
+    auto nibble = [](char c) -> int {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    if (hex.size() % 2 != 0) {
+        return std::nullopt;
+    }
+    std::vector<std::byte> result(hex.size() / 2);
+    for (std::size_t i = 0; i < result.size(); ++i) {
+        auto hi = nibble(hex[2 * i]);
+        auto lo = nibble(hex[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return std::nullopt;
+        }
+        result[i] = std::byte((hi << 4) | lo);
+    }
+    return result;
+}
+
+template <typename Hash>
+std::span<const std::byte> hash_bytes(const Hash& hash)
+{
+    return std::span<const std::byte>(reinterpret_cast<const std::byte*>(hash.data()), Hash::size_bytes);
+}
+
+template <typename Hash>
+std::string hashes_to_hex(const std::vector<Hash>& hashes)
+{
+    std::string result {};
+    for (const auto& h : hashes) {
+        result += to_hex(hash_bytes(h));
+    }
+    return result;
+}
+
+/// Parse a concatenation of hex encoded hashes.
+template <typename Hash>
+std::optional<std::vector<Hash>> hashes_from_hex(std::string_view hex)
+{
+    auto data = from_hex(hex);
+    if (!data || data->size() % Hash::size_bytes != 0) {
+        return std::nullopt;
+    }
+    std::vector<Hash> result {};
+    for (std::size_t pos = 0; pos < data->size(); pos += Hash::size_bytes) {
+        result.emplace_back(std::string_view(reinterpret_cast<const char*>(data->data() + pos), Hash::size_bytes));
+    }
+    return result;
+}
+
+template <typename Hash>
+std::optional<Hash> hash_from_hex(std::string_view hex)
+{
+    auto hashes = hashes_from_hex<Hash>(hex);
+    if (!hashes || hashes->size() != 1) {
+        return std::nullopt;
+    }
+    return hashes->front();
+}
+
+std::string format_key(const hash_cache_key& key)
+{
+    return fmt::format("key {} {} {} {} {} {}", key.file.device, key.file.inode, key.file.size,
+                       key.file.mtime, key.piece_size, key.alignment);
+}
+
+std::optional<hash_cache_entry> parse_entry(std::istream& is, const std::string& key_line)
+{
+    std::string line {};
+    if (!std::getline(is, line) || line != cache_header) {
+        return std::nullopt;
+    }
+    // the file name is a hash of the key, compare the full key to rule out collisions
+    if (!std::getline(is, line) || line != key_line) {
+        return std::nullopt;
+    }
+
+    hash_cache_entry entry {};
+    while (std::getline(is, line)) {
+        if (!parse_hash_cache_field(line, entry)) {
+            return std::nullopt;
+        }
+    }
+    return entry;
+}
+
+void write_entry(std::ostream& os, const std::string& key_line, const hash_cache_entry& entry)
+{
+    os << cache_header << '\n' << key_line << '\n';
+    write_hash_cache_fields(os, entry);
+}
+
+} // namespace
+
+
+std::optional<file_identity> read_file_identity(const fs::path& path)
+{
+#if defined(__linux__)
+    struct ::stat st {};
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return std::nullopt;
+    }
+    return file_identity {
+        .device = std::uint64_t(st.st_dev),
+        .inode = std::uint64_t(st.st_ino),
+        .size = std::uint64_t(st.st_size),
+        .mtime = std::int64_t(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec,
+    };
+#elif defined(__APPLE__)
+    struct ::stat st {};
+    if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return std::nullopt;
+    }
+    return file_identity {
+        .device = std::uint64_t(st.st_dev),
+        .inode = std::uint64_t(st.st_ino),
+        .size = std::uint64_t(st.st_size),
+        .mtime = std::int64_t(st.st_mtimespec.tv_sec) * 1'000'000'000 + st.st_mtimespec.tv_nsec,
+    };
+#else
+    // there is no stable file identity without inode numbers
+    return std::nullopt;
+#endif
+}
+
+
+void write_hash_cache_fields(std::ostream& os, const hash_cache_entry& entry, std::string_view prefix)
+{
+    if (!entry.pieces.empty()) {
+        os << prefix << "pieces " << hashes_to_hex(entry.pieces) << '\n';
+    }
+    if (entry.padded_tail_piece) {
+        os << prefix << "padded-tail-piece " << to_hex(hash_bytes(*entry.padded_tail_piece)) << '\n';
+    }
+    if (entry.pieces_root) {
+        os << prefix << "pieces-root " << to_hex(hash_bytes(*entry.pieces_root)) << '\n';
+    }
+    if (!entry.piece_layer.empty()) {
+        os << prefix << "piece-layer " << hashes_to_hex(entry.piece_layer) << '\n';
+    }
+    for (const auto& [function, digest] : entry.checksums) {
+        os << prefix << "checksum " << to_string(function) << ' ' << to_hex(digest) << '\n';
+    }
+}
+
+bool parse_hash_cache_field(std::string_view line, hash_cache_entry& entry)
+{
+    auto space = line.find(' ');
+    if (space == std::string_view::npos) {
+        return false;
+    }
+    auto field = line.substr(0, space);
+    auto value = line.substr(space + 1);
+
+    if (field == "pieces") {
+        auto pieces = hashes_from_hex<dt::sha1_hash>(value);
+        if (!pieces) return false;
+        entry.pieces = std::move(*pieces);
+    }
+    else if (field == "padded-tail-piece") {
+        entry.padded_tail_piece = hash_from_hex<dt::sha1_hash>(value);
+        if (!entry.padded_tail_piece) return false;
+    }
+    else if (field == "pieces-root") {
+        entry.pieces_root = hash_from_hex<dt::sha256_hash>(value);
+        if (!entry.pieces_root) return false;
+    }
+    else if (field == "piece-layer") {
+        auto layer = hashes_from_hex<dt::sha256_hash>(value);
+        if (!layer) return false;
+        entry.piece_layer = std::move(*layer);
+    }
+    else if (field == "checksum") {
+        auto sep = value.find(' ');
+        if (sep == std::string_view::npos) return false;
+        auto function = dt::make_hash_function(value.substr(0, sep));
+        auto digest = from_hex(value.substr(sep + 1));
+        if (!function || !digest) return false;
+        entry.checksums.emplace_back(*function, std::move(*digest));
+    }
+    // ignore unknown fields written by newer versions
+    return true;
+}
+
+
+const std::vector<std::byte>* hash_cache_entry::find_checksum(dt::hash_function function) const noexcept
+{
+    auto it = std::find_if(checksums.begin(), checksums.end(),
+                           [=](const auto& c) { return c.first == function; });
+    return it == checksums.end() ? nullptr : &it->second;
+}
+
+
+namespace {
+
+/// Add the hashes of entry to merged, keeping hashes computed for other protocol versions or checksums.
+void merge_entry(hash_cache_entry& merged, const hash_cache_entry& entry)
+{
+    if (!entry.pieces.empty()) {
+        merged.pieces = entry.pieces;
+    }
+    if (entry.padded_tail_piece) {
+        merged.padded_tail_piece = entry.padded_tail_piece;
+    }
+    if (entry.pieces_root) {
+        merged.pieces_root = entry.pieces_root;
+        merged.piece_layer = entry.piece_layer;
+    }
+    for (const auto& [function, digest] : entry.checksums) {
+        auto it = std::find_if(merged.checksums.begin(), merged.checksums.end(),
+                               [f = function](const auto& c) { return c.first == f; });
+        if (it != merged.checksums.end()) {
+            it->second = digest;
+        }
+        else {
+            merged.checksums.emplace_back(function, digest);
+        }
+    }
+}
+
+} // namespace
+
+
+struct hash_cache::memory_store
+{
+    std::mutex mutex;
+    std::unordered_map<std::string, hash_cache_entry> entries;
+};
+
+
+hash_cache::hash_cache()
+    : memory_(std::make_shared<memory_store>())
+{}
+
+hash_cache::hash_cache(fs::path directory)
+    : directory_(std::move(directory))
+{}
+
+const fs::path& hash_cache::directory() const noexcept
+{
+    return directory_;
+}
+
+std::optional<hash_cache_entry> hash_cache::load(const hash_cache_key& key) const
+{
+    auto key_line = format_key(key);
+    if (memory_) {
+        std::unique_lock lck(memory_->mutex);
+        auto it = memory_->entries.find(key_line);
+        if (it == memory_->entries.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+    std::ifstream f(entry_path(key_line));
+    if (!f) {
+        return std::nullopt;
+    }
+    return parse_entry(f, key_line);
+}
+
+void hash_cache::store(const hash_cache_key& key, const hash_cache_entry& entry)
+{
+    auto key_line = format_key(key);
+    if (memory_) {
+        std::unique_lock lck(memory_->mutex);
+        merge_entry(memory_->entries[key_line], entry);
+        return;
+    }
+    auto path = entry_path(key_line);
+
+    // keep hashes computed for other protocol versions or checksums
+    hash_cache_entry merged = load(key).value_or(hash_cache_entry{});
+    merge_entry(merged, entry);
+
+    // the cache is an optimization, failures to write it are ignored
+    std::error_code ec;
+    fs::create_directories(path.parent_path(), ec);
+    if (ec) {
+        return;
+    }
+    // write to a temporary file and rename it so readers never see a partial entry
+    auto temp_path = path;
+    temp_path += fmt::format(".{:x}.tmp", std::random_device{}());
+    {
+        std::ofstream f(temp_path, std::ios::binary | std::ios::trunc);
+        write_entry(f, key_line, merged);
+        if (!f.flush()) {
+            f.close();
+            fs::remove(temp_path, ec);
+            return;
+        }
+    }
+    fs::rename(temp_path, path, ec);
+    if (ec) {
+        fs::remove(temp_path, ec);
+    }
+}
+
+fs::path hash_cache::entry_path(const std::string& key_line) const
+{
+    auto hasher = dt::make_hasher(dt::hash_function::sha1);
+    hasher->update(std::as_bytes(std::span(key_line)));
+    std::array<std::byte, dt::sha1_hash::size_bytes> digest {};
+    hasher->finalize_to(digest);
+    auto name = to_hex(digest);
+    // spread entries over subdirectories to keep directories small
+    return directory_ / name.substr(0, 2) / name.substr(2);
+}
+
+} // namespace torrenttools
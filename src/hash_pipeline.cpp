@@ -0,0 +1,1174 @@
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include <dottorrent/hasher/factory.hpp>
+
+#include "hash_pipeline.hpp"
+
+namespace torrenttools {
+
+namespace {
+
+constexpr std::size_t v2_block_size = 16 * 1024;
+constexpr std::size_t default_io_block_size = 1024 * 1024;
+
+// adaptive tuning parameters
+constexpr std::size_t tuning_sample_size = 256 * 1024 * 1024;
+constexpr std::size_t tuning_interval = 32 * 1024 * 1024;
+constexpr std::size_t max_block_size_scale = 4;
+
+using sha1_digest = std::array<std::byte, dt::sha1_hash::size_bytes>;
+using sha256_digest = std::array<std::byte, dt::sha256_hash::size_bytes>;
+
+template <typename Hash, std::size_t N>
+Hash to_hash(const std::array<std::byte, N>& digest)
+{
+    return Hash(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size()));
+}
+
+/// Hash a v1 piece, followed by `padding` zero bytes for pieces at the end of a file in hybrid storage.
+sha1_digest hash_piece(std::span<const std::byte> data, std::size_t padding = 0)
+{
+    static const std::array<std::byte, v2_block_size> zeros {};
+
+    auto hasher = dt::make_hasher(dt::hash_function::sha1);
+    hasher->update(data);
+    for (; padding > 0; padding -= std::min(padding, zeros.size())) {
+        hasher->update(std::span(zeros).first(std::min(padding, zeros.size())));
+    }
+    sha1_digest digest {};
+    hasher->finalize_to(digest);
+    return digest;
+}
+
+sha256_digest hash_node(const sha256_digest& lhs, const sha256_digest& rhs)
+{
+    auto hasher = dt::make_hasher(dt::hash_function::sha256);
+    hasher->update(lhs);
+    hasher->update(rhs);
+    sha256_digest digest {};
+    hasher->finalize_to(digest);
+    return digest;
+}
+
+/// Return the root of a merkle tree of the given height with only zero leaves.
+sha256_digest zero_subtree_root(std::size_t height)
+{
+    sha256_digest node {};
+    for (std::size_t i = 0; i < height; ++i) {
+        node = hash_node(node, node);
+    }
+    return node;
+}
+
+/// Return true if none of the unavailable segments of chunk overlap with [offset, offset+length).
+bool is_range_available(const data_chunk& chunk, std::size_t offset, std::size_t length)
+{
+    std::size_t segment_offset = 0;
+    for (std::size_t i = 0; i < chunk.request->segments.size(); ++i) {
+        const auto segment_length = chunk.request->segments[i].length;
+        if (!chunk.available[i] && segment_offset < offset + length && offset < segment_offset + segment_length) {
+            return false;
+        }
+        segment_offset += segment_length;
+    }
+    return true;
+}
+
+/// Merge the requests of a v1 stream plan into requests of up to block_size bytes.
+/// Requests separated by skipped pieces are not merged since a request must be contiguous in the stream.
+std::vector<read_request> merge_stream_read_plan(std::span<const read_request> plan, std::size_t block_size)
+{
+    std::vector<read_request> merged {};
+    std::size_t first = 0;
+    for (std::size_t i = 1; i <= plan.size(); ++i) {
+        if (i == plan.size() || plan[i - 1].offset + plan[i - 1].size() != plan[i].offset) {
+            auto run = merge_read_plan(plan.subspan(first, i - first), block_size);
+            std::move(run.begin(), run.end(), std::back_inserter(merged));
+            first = i;
+        }
+    }
+    return merged;
+}
+
+/// Check the options that concern the threads of a hash_scheduler.
+void check_thread_options(const hash_pipeline_options& options)
+{
+    if (options.threads == 0) {
+        throw std::invalid_argument("number of threads must be larger than zero");
+    }
+    if (options.queue_depth == 0) {
+        throw std::invalid_argument("queue depth must be larger than zero");
+    }
+    for (auto backend : {options.hash_backends.sha1, options.hash_backends.sha256}) {
+        if (!is_available(backend)) {
+            throw std::invalid_argument(fmt::format(
+                    "hash backend {} is not supported by this build or CPU", to_string(backend)));
+        }
+    }
+    if (!supports(options.hash_backends.sha1, dt::hash_function::sha1)) {
+        throw std::invalid_argument(fmt::format(
+                "hash backend {} does not support sha1", to_string(options.hash_backends.sha1)));
+    }
+}
+
+} // namespace
+
+
+/// Merkle tree state of a file that is being hashed for v2 metafiles.
+struct hash_pipeline::file_state
+{
+    /// Leaf layer for files of at most one piece, otherwise the piece layer.
+    /// Workers reduce the leaves of each block to its piece nodes, so only the
+    /// layers above the piece layer are left when the last block of a file is hashed.
+    std::vector<sha256_digest> nodes;
+    std::vector<char> unavailable_pieces;
+    std::atomic_size_t bytes_remaining = 0;
+};
+
+
+/// Block hashers and scratch space owned by a single worker thread.
+struct hash_pipeline::worker_hashers
+{
+    std::unique_ptr<block_hasher> sha1;
+    std::unique_ptr<block_hasher> sha256;
+    /// Pieces to hash in a single batch and their piece index.
+    std::vector<std::span<const std::byte>> inputs;
+    std::vector<std::size_t> indices;
+    std::vector<std::byte> digests;
+    /// Leaf hashes of the current block.
+    std::vector<sha256_digest> leaves;
+    /// Merkle tree layer being reduced and its parent layer.
+    std::vector<sha256_digest> layer;
+    std::vector<sha256_digest> parents;
+
+    void clear()
+    {
+        inputs.clear();
+        indices.clear();
+    }
+
+    /// Replace layer by the nodes `levels` layers above it, hashing each layer in one batch.
+    /// The size of layer must be a multiple of 2^levels.
+    void reduce_layer(std::size_t levels)
+    {
+        for (std::size_t level = 0; level < levels; ++level) {
+            clear();
+            for (std::size_t i = 0; i < layer.size(); i += 2) {
+                inputs.push_back(std::as_bytes(std::span(layer).subspan(i, 2)));
+            }
+            parents.resize(layer.size() / 2);
+            sha256->hash(inputs, std::as_writable_bytes(std::span(parents)));
+            std::swap(layer, parents);
+        }
+    }
+};
+
+
+/// Checksums of the files that are being read, only accessed from the checksum thread.
+struct hash_pipeline::checksum_state
+{
+    using hasher_list = std::vector<std::pair<dt::hash_function, std::unique_ptr<dt::hasher>>>;
+
+    // Data of a file that arrived ahead of the data that is hashed next.
+    // The chunk is kept alive until the data is hashed, instead of copying it.
+    struct pending_data
+    {
+        std::shared_ptr<const data_chunk> chunk;
+        std::span<const std::byte> data;
+    };
+
+    // Checksums of a file that is being read.
+    // Requests that are interleaved by device can pass the tail of a file before its other data.
+    // Only the request that reads the tail of a file together with the start of the next file
+    // can arrive early, so at most a few chunks per device are pending at a time.
+    struct file_checksums
+    {
+        hasher_list hashers;
+        std::size_t offset = 0;
+        std::map<std::size_t, pending_data> pending {};
+    };
+
+    hash_pipeline& pipeline;
+    std::unordered_map<std::size_t, file_checksums> files {};
+
+    hasher_list make_hashers() const
+    {
+        hasher_list hashers {};
+        for (auto f : pipeline.options_.checksums) {
+            hashers.emplace_back(f, dt::make_hasher(f));
+        }
+        return hashers;
+    }
+
+    void finalize(std::size_t file_index, hasher_list& hashers)
+    {
+        for (auto& [f, hasher] : hashers) {
+            std::vector<std::byte> digest(hasher->digest_size());
+            hasher->finalize_to(digest);
+            pipeline.on_file_checksum(file_index, f, digest);
+        }
+    }
+};
+
+
+/// Throughput measurements used to tune the number of threads and the block size.
+struct hash_pipeline::tuning_state
+{
+    bool active = true;
+    /// Stop adding threads, more threads did not increase the throughput.
+    bool settled = false;
+    bool tune_block_size = false;
+    std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now();
+    std::size_t bytes_read = 0;
+    std::size_t bytes_done = 0;
+    double rate = 0;
+    /// Thread limit before the last increase, zero if the limit was not increased in the last interval.
+    std::size_t previous_limit = 0;
+    std::size_t samples = 0;
+    /// Number of samples in which the hashers were waiting for data.
+    std::size_t reader_bound_samples = 0;
+};
+
+
+hash_pipeline::hash_pipeline(dt::file_storage& storage, const hash_pipeline_options& options, bool allow_missing_files)
+    : storage_(storage)
+    , options_(options)
+    , allow_missing_files_(allow_missing_files)
+{
+    v1_ = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    v2_ = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+
+    if (!v1_ && !v2_) {
+        throw std::invalid_argument("invalid protocol version");
+    }
+    check_thread_options(options_);
+}
+
+hash_scheduler::hash_scheduler(const hash_pipeline_options& options)
+    : options_(options)
+{
+    check_thread_options(options_);
+
+    thread_limit_ = options_.threads;
+    if (options_.adaptive) {
+        // start small and add threads while the hashers can not keep up with the reader
+        thread_limit_ = std::min<std::size_t>(2, options_.threads);
+    }
+
+    if (options_.cpu_affinity || options_.numa) {
+        placement_ = make_thread_placement(options_.threads, options_.numa);
+        if (!options_.cpu_affinity) {
+            // only restrict the workers to the cpus of the numa node
+            placement_.hasher_cpus.clear();
+        }
+    }
+
+    if (options_.max_read_rate != 0 || options_.max_read_operations != 0) {
+        limiter_ = std::make_unique<rate_limiter>(options_.max_read_rate, options_.max_read_operations);
+    }
+
+    running_hashers_ = options_.threads;
+    for (std::size_t i = 0; i < options_.threads; ++i) {
+        worker_threads_.emplace_back(&hash_scheduler::run_worker, this, i);
+    }
+    reader_thread_ = std::jthread(&hash_scheduler::run_reader, this);
+}
+
+hash_scheduler::~hash_scheduler()
+{
+    // All pipelines are done, the threads stop once the queues are drained.
+    jobs_.close();
+    if (reader_thread_.joinable()) {
+        reader_thread_.join();
+    }
+    for (auto& t : worker_threads_) {
+        if (t.joinable()) {
+            t.join();
+        }
+    }
+    if (checksum_thread_.joinable()) {
+        checksum_thread_.join();
+    }
+    if (copy_thread_.joinable()) {
+        copy_thread_.join();
+    }
+}
+
+std::size_t hash_scheduler::thread_count() const noexcept
+{
+    return thread_limit_.load(std::memory_order_relaxed);
+}
+
+const thread_placement& hash_scheduler::placement() const noexcept
+{
+    return placement_;
+}
+
+void hash_scheduler::submit(hash_pipeline& job)
+{
+    {
+        std::unique_lock lck(start_mutex_);
+        if (!job.options_.checksums.empty() && !checksum_thread_.joinable()) {
+            checksum_thread_ = std::jthread(&hash_scheduler::run_checksums, this);
+        }
+        if (job.copier_ && !copy_thread_.joinable()) {
+            copy_thread_ = std::jthread(&hash_scheduler::run_copier, this);
+        }
+    }
+    job.scheduler_ = this;
+    job.started_ = true;
+    jobs_.push(&job);
+}
+
+buffer_pool& hash_scheduler::begin_reading(std::size_t buffer_size, std::size_t buffer_count)
+{
+    if (!pool_ || pool_->buffer_size() < buffer_size || pool_->buffer_count() < buffer_count) {
+        // Buffers of the pipelines read before are still being hashed.
+        for (auto n = reading_jobs_.load(std::memory_order_acquire); n != 0;
+                  n = reading_jobs_.load(std::memory_order_acquire)) {
+            reading_jobs_.wait(n, std::memory_order_acquire);
+        }
+        if (pool_) {
+            buffer_size = std::max(buffer_size, pool_->buffer_size());
+            buffer_count = std::max(buffer_count, pool_->buffer_count());
+            pool_.reset();
+        }
+        pool_ = std::make_unique<buffer_pool>(buffer_size, buffer_count, direct_io_alignment);
+
+        if (placement_.numa_node) {
+            // the placement is a hint, a failure to bind only costs remote memory accesses
+            bind_memory_to_node(pool_->data(), pool_->size_bytes(), *placement_.numa_node);
+        }
+    }
+    reading_jobs_.fetch_add(1, std::memory_order_relaxed);
+    return *pool_;
+}
+
+void hash_scheduler::end_reading()
+{
+    reading_jobs_.fetch_sub(1, std::memory_order_release);
+    reading_jobs_.notify_all();
+}
+
+void hash_scheduler::run_reader()
+{
+    if (!placement_.reader_cpus.empty()) {
+        set_current_thread_affinity(placement_.reader_cpus);
+    }
+    while (auto job = jobs_.pop()) {
+        (*job)->run_reader();
+    }
+    work_queue_.close();
+    checksum_queue_.close();
+}
+
+void hash_scheduler::run_worker(std::size_t index)
+{
+    if (!placement_.hasher_cpus.empty()) {
+        set_current_thread_affinity(std::span(&placement_.hasher_cpus.at(index), 1));
+    }
+    else if (!placement_.reader_cpus.empty()) {
+        set_current_thread_affinity(placement_.reader_cpus);
+    }
+    hash_pipeline::worker_hashers hashers {};
+
+    while (auto item = work_queue_.pop()) {
+        auto* job = item->job;
+        // keep draining the queue so the reader does not block
+        if (!job->cancelled()) {
+            if (options_.adaptive) {
+                std::unique_lock lck(gate_mutex_);
+                gate_cv_.wait(lck, [this]() { return running_workers_ < thread_limit_; });
+                ++running_workers_;
+            }
+            job->hash_chunk(item->chunk, hashers);
+            if (options_.adaptive) {
+                {
+                    std::unique_lock lck(gate_mutex_);
+                    --running_workers_;
+                }
+                gate_cv_.notify_one();
+            }
+        }
+        // return the buffer before the pipeline can complete
+        item->chunk.reset();
+        job->release_task();
+    }
+    if (running_hashers_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        copy_queue_.close();
+    }
+}
+
+void hash_scheduler::run_checksums()
+{
+    if (!placement_.reader_cpus.empty()) {
+        set_current_thread_affinity(placement_.reader_cpus);
+    }
+    while (auto item = checksum_queue_.pop()) {
+        auto* job = item->job;
+        if (!job->cancelled()) {
+            job->update_checksums(item->chunk);
+        }
+        item->chunk.reset();
+        job->release_task();
+    }
+}
+
+void hash_scheduler::run_copier()
+{
+    while (auto item = copy_queue_.pop()) {
+        auto* job = item->job;
+        if (!job->cancelled()) {
+            job->copy_chunk(*item);
+        }
+        item->chunk.reset();
+        job->release_task();
+    }
+}
+
+void hash_scheduler::set_thread_limit(std::size_t n)
+{
+    {
+        std::unique_lock lck(gate_mutex_);
+        thread_limit_ = n;
+    }
+    gate_cv_.notify_all();
+}
+
+
+hash_pipeline::~hash_pipeline()
+{
+    if (started_ && !done()) {
+        cancel();
+    }
+    wait_until_done();
+}
+
+void hash_pipeline::start()
+{
+    Expects(!started_);
+    own_scheduler_ = std::make_unique<hash_scheduler>(options_);
+    start(*own_scheduler_);
+}
+
+void hash_pipeline::start(hash_scheduler& scheduler)
+{
+    Expects(!started_);
+
+    prepare();
+
+    const auto piece_size = storage_.piece_size();
+    const auto file_count = storage_.file_count();
+
+    // blocks must contain whole pieces so each piece is hashed from a single buffer
+    block_size_ = std::max(options_.min_io_block_size.value_or(default_io_block_size), piece_size);
+    block_size_ = (block_size_ + piece_size - 1) / piece_size * piece_size;
+    if (options_.direct_io) {
+        // piece sizes are at least 16 KiB so this only matters for unusual alignments
+        block_size_ = (block_size_ + direct_io_alignment - 1) / direct_io_alignment * direct_io_alignment;
+    }
+
+    file_offsets_.resize(file_count);
+    file_bytes_total_.resize(file_count);
+    file_bytes_done_ = std::make_unique<std::atomic_size_t[]>(file_count);
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < file_count; ++i) {
+        const auto& entry = storage_.at(i);
+        file_offsets_[i] = offset;
+        offset += entry.file_size();
+
+        if (v2_) {
+            file_bytes_total_[i] = entry.is_padding_file() ? 0 : entry.file_size();
+        } else {
+            file_bytes_total_[i] = entry.file_size();
+        }
+        if (v1_ && v2_ && !entry.is_padding_file() && entry.file_size() != 0 && file_offsets_[i] % piece_size != 0) {
+            throw std::invalid_argument(fmt::format(
+                    "hybrid storage requires padding files: {} is not aligned to a piece boundary",
+                    entry.path().string()));
+        }
+    }
+
+    if (v2_) {
+        file_states_ = std::make_unique<file_state[]>(file_count);
+        for (std::size_t i = 0; i < file_count; ++i) {
+            const auto& entry = storage_.at(i);
+            if (entry.is_padding_file() || entry.file_size() == 0) {
+                continue;
+            }
+            if (is_skipped(i)) {
+                continue;
+            }
+            auto& state = file_states_[i];
+            const auto piece_count = (entry.file_size() + piece_size - 1) / piece_size;
+            state.nodes.resize(piece_count > 1 ? piece_count : (entry.file_size() + v2_block_size - 1) / v2_block_size);
+            state.unavailable_pieces.resize(piece_count);
+            state.bytes_remaining = entry.file_size();
+        }
+        plan_ = make_file_read_plan(storage_, block_size_, skipped_files_, /*storage_order=*/options_.input != nullptr);
+    }
+    else {
+        plan_ = make_stream_read_plan(storage_, block_size_, skipped_pieces_);
+    }
+    // Piece hashes and merkle trees are stored by index, so the plan can be read in any order.
+    // Data read from a stream can only be read in storage order.
+    if (options_.order == read_order::physical && options_.input == nullptr) {
+        sort_read_plan(plan_, physical_file_offsets(storage_));
+    }
+    else if (options_.order == read_order::cached && options_.input == nullptr) {
+        sort_read_plan(plan_, page_cache_file_keys(storage_));
+    }
+
+    // Data that is not read is done from the start.
+    if (!skipped_files_.empty() || !skipped_pieces_.empty()) {
+        std::vector<std::size_t> bytes_planned(file_count);
+        for (const auto& request : plan_) {
+            for (const auto& segment : request.segments) {
+                bytes_planned[segment.file_index] += segment.length;
+            }
+        }
+        for (std::size_t i = 0; i < file_count; ++i) {
+            if (file_bytes_total_[i] != 0) {
+                file_bytes_done_[i] = file_bytes_total_[i] - bytes_planned[i];
+                bytes_done_ += file_bytes_total_[i] - bytes_planned[i];
+            }
+        }
+    }
+
+    if (scheduler.options_.adaptive) {
+        tuning_ = std::make_unique<tuning_state>();
+        tuning_->tune_block_size = !options_.min_io_block_size.has_value();
+    }
+
+    if (options_.copy_to) {
+        if (!skipped_files_.empty() || !skipped_pieces_.empty()) {
+            throw std::invalid_argument("files of which the hashes are not computed can not be copied");
+        }
+        // cloning requires a source file
+        copier_ = std::make_unique<file_copier>(
+                storage_, *options_.copy_to, /*clone=*/options_.clone_copies && options_.input == nullptr);
+    }
+
+    if (!options_.checksums.empty()) {
+        checksum_state_ = std::make_unique<checksum_state>(checksum_state { .pipeline = *this });
+        finalize_empty_file_checksums();
+    }
+
+    // the reader holds a task until it has passed all data to the other threads
+    tasks_ = 1;
+    scheduler.submit(*this);
+}
+
+void hash_pipeline::skip_file(std::size_t file_index)
+{
+    Expects(!started_);
+    if (skipped_files_.empty()) {
+        skipped_files_.resize(storage_.file_count());
+    }
+    skipped_files_.at(file_index) = 1;
+}
+
+void hash_pipeline::skip_piece(std::size_t piece_index)
+{
+    Expects(!started_);
+    if (skipped_pieces_.empty()) {
+        skipped_pieces_.resize(storage_.piece_count());
+    }
+    skipped_pieces_.at(piece_index) = 1;
+}
+
+bool hash_pipeline::is_skipped(std::size_t file_index) const noexcept
+{
+    return file_index < skipped_files_.size() && skipped_files_[file_index];
+}
+
+void hash_pipeline::set_file_device(std::size_t file_index, std::uint64_t device)
+{
+    Expects(!started_);
+    if (file_devices_.empty()) {
+        file_devices_.resize(storage_.file_count(), unknown_device_id);
+    }
+    file_devices_.at(file_index) = device;
+}
+
+bool hash_pipeline::started() const noexcept
+{
+    return started_.load(std::memory_order_relaxed);
+}
+
+void hash_pipeline::cancel()
+{
+    cancelled_ = true;
+    stop_source_.request_stop();
+}
+
+bool hash_pipeline::cancelled() const noexcept
+{
+    return cancelled_.load(std::memory_order_relaxed);
+}
+
+void hash_pipeline::wait()
+{
+    wait_until_done();
+
+    std::unique_lock lck(exception_mutex_);
+    if (exception_) {
+        std::rethrow_exception(exception_);
+    }
+}
+
+bool hash_pipeline::done() const noexcept
+{
+    return started() && done_.load(std::memory_order_acquire);
+}
+
+void hash_pipeline::wait_for_reading() const
+{
+    reading_done_.wait(false, std::memory_order_acquire);
+}
+
+dt::protocol hash_pipeline::protocol() const noexcept
+{
+    return options_.protocol_version;
+}
+
+std::size_t hash_pipeline::bytes_done() const noexcept
+{
+    return bytes_done_.load(std::memory_order_relaxed);
+}
+
+std::pair<std::size_t, std::size_t> hash_pipeline::current_file_progress() const noexcept
+{
+    if (!started()) {
+        return {0, 0};
+    }
+    const auto file_count = file_bytes_total_.size();
+    auto index = progress_index_.load(std::memory_order_relaxed);
+
+    while (index < file_count &&
+           file_bytes_done_[index].load(std::memory_order_relaxed) >= file_bytes_total_[index]) {
+        ++index;
+    }
+    progress_index_.store(index, std::memory_order_relaxed);
+
+    if (index == file_count) {
+        return {index, 0};
+    }
+    return {index, file_bytes_done_[index].load(std::memory_order_relaxed)};
+}
+
+std::size_t hash_pipeline::bytes_copied() const noexcept
+{
+    return copier_ ? copier_->bytes_written() : 0;
+}
+
+std::size_t hash_pipeline::bytes_not_copied() const noexcept
+{
+    return copier_ ? copier_->bytes_discarded() : 0;
+}
+
+std::size_t hash_pipeline::io_block_size() const noexcept
+{
+    return block_size_.load(std::memory_order_relaxed);
+}
+
+std::size_t hash_pipeline::thread_count() const noexcept
+{
+    return scheduler_ ? scheduler_->thread_count() : 0;
+}
+
+const thread_placement& hash_pipeline::placement() const noexcept
+{
+    static const thread_placement no_placement {};
+    return scheduler_ ? scheduler_->placement() : no_placement;
+}
+
+void hash_pipeline::run_reader()
+{
+    auto& scheduler = *scheduler_;
+    const bool compute_checksums = checksum_state_ != nullptr;
+    const auto stop_token = stop_source_.get_token();
+
+    auto sink = [&](std::shared_ptr<const data_chunk> chunk) {
+        if (tuning_ && tuning_->active) {
+            tune(*chunk);
+        }
+        tasks_.fetch_add(compute_checksums ? 2 : 1, std::memory_order_relaxed);
+        if (compute_checksums) {
+            scheduler.checksum_queue_.push({ .job = this, .chunk = chunk });
+        }
+        scheduler.work_queue_.push({ .job = this, .chunk = std::move(chunk) });
+    };
+
+    try {
+        if (!cancelled()) {
+            const auto& scheduler_options = scheduler.options_;
+            std::size_t buffer_size = block_size_;
+            if (tuning_ && tuning_->tune_block_size) {
+                buffer_size *= max_block_size_scale;
+            }
+            // Enough buffers to keep all workers busy while the reader fills the next blocks.
+            auto buffer_count = scheduler_options.threads * 2 +
+                    (scheduler_options.engine == io_engine::uring ? scheduler_options.queue_depth : 2);
+            if (copier_) {
+                // let the reader run ahead of a slow destination
+                buffer_count += 2;
+            }
+            auto& pool = scheduler.begin_reading(buffer_size, buffer_count);
+            reading_ = true;
+
+            reader_ = make_read_backend(scheduler_options.engine, storage_, pool, {
+                    .queue_depth = scheduler_options.queue_depth,
+                    .allow_missing_files = allow_missing_files_,
+                    .direct_io = options_.direct_io,
+                    .drop_cache = options_.drop_cache,
+                    .limiter = scheduler.limiter_.get(),
+                    .input = options_.input,
+                    .file_devices = file_devices_,
+            });
+
+            if (!tuning_) {
+                reader_->run(plan_, sink, stop_token);
+            }
+            else {
+                // Read the first part of the data with the initial block size while tuning the number of threads
+                // and read the remainder with the tuned block size.
+                std::size_t sample_end = 0;
+                for (std::size_t bytes = 0; sample_end < plan_.size() && bytes < tuning_sample_size; ++sample_end) {
+                    bytes += plan_[sample_end].size();
+                }
+                reader_->run(std::span(plan_).first(sample_end), sink, stop_token);
+                tuning_->active = false;
+
+                if (sample_end < plan_.size() && !stop_token.stop_requested()) {
+                    auto block_size = tuned_block_size();
+
+                    if (block_size == block_size_) {
+                        reader_->run(std::span(plan_).subspan(sample_end), sink, stop_token);
+                    }
+                    else if (!v2_) {
+                        tuned_plan_ = merge_stream_read_plan(std::span(plan_).subspan(sample_end), block_size);
+                        block_size_ = block_size;
+                        reader_->run(tuned_plan_, sink, stop_token);
+                    }
+                    else {
+                        tuned_plan_ = merge_read_plan(std::span(plan_).subspan(sample_end), block_size);
+                        block_size_ = block_size;
+                        reader_->run(tuned_plan_, sink, stop_token);
+                    }
+                }
+            }
+        }
+    }
+    catch (...) {
+        set_exception(std::current_exception());
+    }
+
+    reader_.reset();
+    reading_done_.store(true, std::memory_order_release);
+    reading_done_.notify_all();
+    release_task();
+}
+
+void hash_pipeline::hash_chunk(const std::shared_ptr<const data_chunk>& chunk, worker_hashers& hashers)
+{
+    try {
+        // workers hash chunks of any pipeline on the scheduler, hashers are made once they are needed
+        const auto& backends = scheduler_->options_.hash_backends;
+        if (v1_ && !hashers.sha1) {
+            hashers.sha1 = make_block_hasher(backends.sha1, dt::hash_function::sha1);
+        }
+        if (v2_ && !hashers.sha256) {
+            hashers.sha256 = make_block_hasher(backends.sha256, dt::hash_function::sha256);
+        }
+        process_chunk(*chunk, hashers);
+        if (copier_) {
+            // data is copied once it is hashed, so derived classes can copy only verified data
+            hash_scheduler::copy_job job { .job = this, .chunk = chunk, .ranges = {} };
+            select_copy_ranges(*chunk, job.ranges);
+            tasks_.fetch_add(1, std::memory_order_relaxed);
+            scheduler_->copy_queue_.push(std::move(job));
+        }
+    }
+    catch (...) {
+        set_exception(std::current_exception());
+    }
+}
+
+void hash_pipeline::tune(const data_chunk& chunk)
+{
+    auto& t = *tuning_;
+    t.bytes_read += chunk.data.size();
+    if (t.bytes_read < tuning_interval) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto seconds = std::chrono::duration<double>(now - t.time).count();
+    auto done = bytes_done();
+    double rate = seconds > 0 ? double(done - t.bytes_done) / seconds : 0;
+    auto& scheduler = *scheduler_;
+    const auto max_threads = scheduler.options_.threads;
+    auto limit = scheduler.thread_limit_.load();
+    auto queued = scheduler.work_queue_.size();
+
+    ++t.samples;
+    if (queued == 0) {
+        ++t.reader_bound_samples;
+    }
+
+    if (t.previous_limit != 0 && rate < t.rate * 0.95) {
+        // the last increase made things worse
+        scheduler.set_thread_limit(t.previous_limit);
+        t.previous_limit = 0;
+        t.settled = true;
+    }
+    else if (!t.settled && queued >= limit && limit < max_threads) {
+        // hashers can not keep up with the reader
+        t.previous_limit = limit;
+        scheduler.set_thread_limit(std::min(limit * 2, max_threads));
+    }
+    else {
+        t.previous_limit = 0;
+    }
+
+    t.time = now;
+    t.bytes_done = done;
+    t.bytes_read = 0;
+    t.rate = rate;
+}
+
+std::size_t hash_pipeline::tuned_block_size() const
+{
+    const auto& t = *tuning_;
+    // Larger reads help when the hashers are mostly waiting for data.
+    if (t.tune_block_size && t.samples > 0 && 2 * t.reader_bound_samples > t.samples) {
+        return block_size_ * max_block_size_scale;
+    }
+    return block_size_;
+}
+
+void hash_pipeline::process_chunk(const data_chunk& chunk, worker_hashers& hashers)
+{
+    if (v2_) {
+        if (v1_) {
+            hash_v1_file_block(chunk, hashers);
+        }
+        hash_v2_file_block(chunk, hashers);
+    }
+    else {
+        hash_v1_stream_block(chunk, hashers);
+    }
+
+    // update progress counters
+    for (const auto& segment : chunk.request->segments) {
+        if (file_bytes_total_[segment.file_index] != 0) {
+            file_bytes_done_[segment.file_index].fetch_add(segment.length, std::memory_order_relaxed);
+            bytes_done_.fetch_add(segment.length, std::memory_order_relaxed);
+        }
+    }
+}
+
+void hash_pipeline::hash_v1_stream_block(const data_chunk& chunk, worker_hashers& hashers)
+{
+    const auto piece_size = storage_.piece_size();
+    const auto data = chunk.data;
+    const bool complete = chunk.is_complete();
+    std::size_t piece_index = chunk.request->offset / piece_size;
+
+    hashers.clear();
+    for (std::size_t pos = 0; pos < data.size(); pos += piece_size, ++piece_index) {
+        auto length = std::min(piece_size, data.size() - pos);
+
+        if (!complete && !is_range_available(chunk, pos, length)) {
+            on_piece_unavailable(piece_index);
+            continue;
+        }
+        hashers.inputs.push_back(data.subspan(pos, length));
+        hashers.indices.push_back(piece_index);
+    }
+    emit_piece_hashes(hashers);
+}
+
+void hash_pipeline::hash_v1_file_block(const data_chunk& chunk, worker_hashers& hashers)
+{
+    const auto piece_size = storage_.piece_size();
+    const auto total_size = storage_.total_file_size();
+    const auto& segments = chunk.request->segments;
+
+    hashers.clear();
+    std::size_t data_offset = 0;
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        const auto& segment = segments[i];
+        const auto data = chunk.data.subspan(data_offset, segment.length);
+        const auto stream_offset = file_offsets_[segment.file_index] + segment.file_offset;
+        data_offset += segment.length;
+
+        for (std::size_t pos = 0; pos < data.size(); pos += piece_size) {
+            auto piece_index = (stream_offset + pos) / piece_size;
+
+            if (!chunk.available[i]) {
+                on_piece_unavailable(piece_index);
+                continue;
+            }
+            auto length = std::min(piece_size, data.size() - pos);
+            auto piece_length = std::min(piece_size, total_size - (stream_offset + pos));
+
+            if (piece_length == length) {
+                hashers.inputs.push_back(data.subspan(pos, length));
+                hashers.indices.push_back(piece_index);
+            }
+            else {
+                // The last piece of a file is completed with the padding file following it.
+                auto hash = hash_piece(data.subspan(pos, length), piece_length - length);
+                on_piece_hash(piece_index, to_hash<dt::sha1_hash>(hash));
+            }
+        }
+    }
+    emit_piece_hashes(hashers);
+}
+
+void hash_pipeline::emit_piece_hashes(worker_hashers& hashers)
+{
+    const auto digest_size = hashers.sha1->digest_size();
+    hashers.digests.resize(hashers.inputs.size() * digest_size);
+    hashers.sha1->hash(hashers.inputs, hashers.digests);
+
+    for (std::size_t i = 0; i < hashers.indices.size(); ++i) {
+        auto digest = std::span(hashers.digests).subspan(i * digest_size, digest_size);
+        on_piece_hash(hashers.indices[i], dt::sha1_hash(
+                std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size())));
+    }
+}
+
+void hash_pipeline::hash_v2_file_block(const data_chunk& chunk, worker_hashers& hashers)
+{
+    const auto piece_size = storage_.piece_size();
+    const auto piece_leaves = piece_size / v2_block_size;
+    const auto& segments = chunk.request->segments;
+
+    // hash the leaves of all segments in one batch, blocks can hold many small files
+    hashers.clear();
+    std::size_t data_offset = 0;
+    for (const auto& segment : segments) {
+        const auto data = chunk.data.subspan(data_offset, segment.length);
+        data_offset += segment.length;
+        for (std::size_t pos = 0; pos < data.size(); pos += v2_block_size) {
+            hashers.inputs.push_back(data.subspan(pos, std::min(v2_block_size, data.size() - pos)));
+        }
+    }
+    hashers.leaves.resize(hashers.inputs.size());
+    hashers.sha256->hash(hashers.inputs, std::as_writable_bytes(std::span(hashers.leaves)));
+
+    std::size_t leaf_offset = 0;
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        const auto& segment = segments[i];
+        const auto file_size = storage_.at(segment.file_index).file_size();
+        const auto leaf_count = (segment.length + v2_block_size - 1) / v2_block_size;
+        const auto leaves = std::span(hashers.leaves).subspan(leaf_offset, leaf_count);
+        auto& state = file_states_[segment.file_index];
+        leaf_offset += leaf_count;
+
+        if (file_size <= piece_size) {
+            // files of a single piece have no piece layer, the leaves are reduced when the file is complete
+            std::copy(leaves.begin(), leaves.end(), state.nodes.begin() + segment.file_offset / v2_block_size);
+        }
+        else {
+            // Segments start on piece boundaries, so every piece of the segment is a complete subtree
+            // of the merkle tree of the file and can be reduced independently of the rest of the file.
+            // The last piece of the file is padded with zero leaves.
+            const auto segment_pieces = (leaf_count + piece_leaves - 1) / piece_leaves;
+            hashers.layer.assign(leaves.begin(), leaves.end());
+            hashers.layer.resize(segment_pieces * piece_leaves, sha256_digest{});
+            hashers.reduce_layer(std::countr_zero(piece_leaves));
+            std::copy(hashers.layer.begin(), hashers.layer.end(),
+                      state.nodes.begin() + segment.file_offset / piece_size);
+            if (chunk.available[i]) {
+                for (std::size_t n = 0; n < hashers.layer.size(); ++n) {
+                    on_piece_layer_hash(segment.file_index, segment.file_offset / piece_size + n,
+                                        to_hash<dt::sha256_hash>(hashers.layer[n]));
+                }
+            }
+        }
+
+        if (!chunk.available[i]) {
+            auto first_piece = segment.file_offset / piece_size;
+            auto last_piece = (segment.file_offset + segment.length + piece_size - 1) / piece_size;
+            std::fill(state.unavailable_pieces.begin() + first_piece,
+                      state.unavailable_pieces.begin() + last_piece, 1);
+        }
+
+        // The thread that hashes the last block of a file builds the top of the merkle tree.
+        if (state.bytes_remaining.fetch_sub(segment.length) == segment.length) {
+            complete_file(segment.file_index, hashers);
+        }
+    }
+}
+
+void hash_pipeline::complete_file(std::size_t file_index, worker_hashers& hashers)
+{
+    const auto piece_size = storage_.piece_size();
+    const auto file_size = storage_.at(file_index).file_size();
+    const auto piece_layer_height = std::countr_zero(piece_size / v2_block_size);
+    const bool has_piece_layer = file_size > piece_size;
+
+    auto& state = file_states_[file_index];
+    merkle_result result {};
+
+    if (has_piece_layer) {
+        result.piece_layer.reserve(state.nodes.size());
+        for (const auto& node : state.nodes) {
+            result.piece_layer.push_back(to_hash<dt::sha256_hash>(node));
+        }
+    }
+
+    // Pad the layer to a power of two with the roots of subtrees of zero leaves and reduce it to the root.
+    auto padding = has_piece_layer ? zero_subtree_root(piece_layer_height) : sha256_digest{};
+    hashers.layer = std::move(state.nodes);
+    hashers.layer.resize(std::bit_ceil(hashers.layer.size()), padding);
+    hashers.reduce_layer(std::countr_zero(hashers.layer.size()));
+    result.pieces_root = to_hash<dt::sha256_hash>(hashers.layer.front());
+
+    for (std::size_t i = 0; i < state.unavailable_pieces.size(); ++i) {
+        if (state.unavailable_pieces[i]) {
+            result.unavailable_pieces.push_back(i);
+        }
+    }
+
+    // release memory of the merkle tree
+    state.nodes = {};
+    state.unavailable_pieces = {};
+
+    on_file_hash(file_index, std::move(result));
+}
+
+void hash_pipeline::finalize_empty_file_checksums()
+{
+    // Empty files are never read.
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        const auto& entry = storage_.at(i);
+        if (!entry.is_padding_file() && entry.file_size() == 0 && !is_skipped(i)) {
+            auto hashers = checksum_state_->make_hashers();
+            checksum_state_->finalize(i, hashers);
+        }
+    }
+}
+
+void hash_pipeline::update_checksums(const std::shared_ptr<const data_chunk>& chunk)
+{
+    using file_checksums = checksum_state::file_checksums;
+    using pending_data = checksum_state::pending_data;
+    auto& files = checksum_state_->files;
+
+    auto update = [](file_checksums& state, std::span<const std::byte> data) {
+        for (auto& [f, hasher] : state.hashers) {
+            hasher->update(data);
+        }
+        state.offset += data.size();
+    };
+
+    try {
+        std::size_t pos = 0;
+        for (const auto& segment : chunk->request->segments) {
+            const auto& entry = storage_.at(segment.file_index);
+            auto data = chunk->data.subspan(pos, segment.length);
+            pos += segment.length;
+
+            // pieces shared with skipped files are read for the v1 piece hashes only
+            if (entry.is_padding_file() || is_skipped(segment.file_index)) {
+                continue;
+            }
+            auto [it, inserted] = files.try_emplace(segment.file_index);
+            auto& state = it->second;
+            if (inserted) {
+                state.hashers = checksum_state_->make_hashers();
+            }
+            if (segment.file_offset != state.offset) {
+                state.pending.emplace(segment.file_offset, pending_data { .chunk = chunk, .data = data });
+                continue;
+            }
+            update(state, data);
+            for (auto p = state.pending.begin(); p != state.pending.end() && p->first == state.offset;) {
+                update(state, p->second.data);
+                p = state.pending.erase(p);
+            }
+            if (state.offset == entry.file_size()) {
+                checksum_state_->finalize(segment.file_index, state.hashers);
+                files.erase(it);
+            }
+        }
+    }
+    catch (...) {
+        set_exception(std::current_exception());
+    }
+}
+
+void hash_pipeline::copy_chunk(const hash_scheduler::copy_job& job)
+{
+    try {
+        copier_->write(*job.chunk, job.ranges);
+    }
+    catch (...) {
+        set_exception(std::current_exception());
+    }
+}
+
+void hash_pipeline::release_task()
+{
+    if (tasks_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        complete();
+    }
+}
+
+void hash_pipeline::complete()
+{
+    if (copier_ && !cancelled()) {
+        try {
+            copier_->finish();
+        }
+        catch (...) {
+            set_exception(std::current_exception());
+        }
+    }
+    // release chunks of pending checksum data before the buffers can be reused
+    checksum_state_.reset();
+    if (reading_) {
+        scheduler_->end_reading();
+    }
+    // the pipeline may be destroyed as soon as the mutex is released
+    std::unique_lock lck(done_mutex_);
+    done_ = true;
+    done_cv_.notify_all();
+}
+
+void hash_pipeline::wait_until_done() const
+{
+    if (!started_) {
+        return;
+    }
+    std::unique_lock lck(done_mutex_);
+    done_cv_.wait(lck, [this]() { return done_.load(std::memory_order_relaxed); });
+}
+
+void hash_pipeline::set_exception(std::exception_ptr e)
+{
+    {
+        std::unique_lock lck(exception_mutex_);
+        if (!exception_) {
+            exception_ = std::move(e);
+        }
+    }
+    cancel();
+}
+
+} // namespace torrenttools
@@ -61,7 +61,14 @@ int main(int argc, char** argv) {
 
         if (app.got_subcommand(create_app)) {
             postprocess_create_app(create_app, main_options, create_options);
-            run_create_app(main_options, create_options);
+            if (create_options.batch_manifest) {
+                auto [config, tracker_db] = load_config_and_tracker_db(main_options);
+                auto jobs = load_create_batch(create_app, config, create_options);
+                run_create_batch(jobs, config, tracker_db, std::cout);
+            }
+            else {
+                run_create_app(main_options, create_options);
+            }
         }
         else if (app.got_subcommand(edit_app)) {
             postprocess_edit_app(edit_app, main_options, edit_options);
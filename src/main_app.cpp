@@ -1,8 +1,15 @@
 #include <iostream>
+#include <string_view>
+#include <vector>
+
+#include <fmt/ranges.h>
+
 #include "config.hpp"
 #include "show.hpp"
 #include "argument_parsers.hpp"
 #include "help_formatter.hpp"
+#include "cpu_info.hpp"
+#include "hash_backend.hpp"
 
 #include <dottorrent/hasher/backend_info.hpp>
 
@@ -47,6 +54,21 @@ void print_version()
     for (auto [lib_name, lib_version] : dt::cryptographic_backends() ) {
         fmt::print("  {:<15} : {}\n", lib_name, lib_version);
     }
+
+    std::vector<std::string_view> backends {};
+    for (auto b : tt::available_hash_backends()) {
+        backends.push_back(tt::to_string(b));
+    }
+    auto features = tt::detect_cpu_features();
+    std::vector<std::string_view> feature_names {};
+    if (features.sha_ni) feature_names.push_back("sha-ni");
+    if (features.avx2)   feature_names.push_back("avx2");
+    if (features.avx512) feature_names.push_back("avx512");
+    if (feature_names.empty()) feature_names.push_back("none");
+
+    fmt::print("\nHash backends:\n");
+    fmt::print("  {:<15} : {}\n", "available", fmt::join(backends, ", "));
+    fmt::print("  {:<15} : {}\n", "cpu features", fmt::join(feature_names, ", "));
     std::cout << std::endl;
 }
 
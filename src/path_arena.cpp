@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(TORRENTTOOLS_USE_TBB)
+#include <execution>
+#endif
+
+#include "path_arena.hpp"
+
+namespace torrenttools {
+
+
+path_arena::id_type path_arena::push_back(std::string_view path)
+{
+    if (records_.size() >= std::numeric_limits<id_type>::max() ||
+        path.size() > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::length_error("too many paths");
+    }
+    const auto id = static_cast<id_type>(records_.size());
+    records_.push_back(record {
+            .sort_key = make_sort_key(path),
+            .offset = buffer_.size(),
+            .length = static_cast<std::uint32_t>(path.size()),
+            .id = id });
+    buffer_.insert(buffer_.end(), path.begin(), path.end());
+    return id;
+}
+
+
+void path_arena::append(const path_arena& other)
+{
+    if (records_.size() + other.records_.size() > std::numeric_limits<id_type>::max()) {
+        throw std::length_error("too many paths");
+    }
+    const auto offset = buffer_.size();
+    const auto first_id = static_cast<id_type>(records_.size());
+
+    buffer_.insert(buffer_.end(), other.buffer_.begin(), other.buffer_.end());
+    records_.reserve(records_.size() + other.records_.size());
+    for (auto r : other.records_) {
+        r.offset += offset;
+        r.id += first_id;
+        records_.push_back(r);
+    }
+}
+
+
+void path_arena::sort()
+{
+    auto compare = [this](const record& lhs, const record& rhs) {
+        if (lhs.sort_key != rhs.sort_key) {
+            return lhs.sort_key < rhs.sort_key;
+        }
+        std::string_view l {buffer_.data() + lhs.offset, lhs.length};
+        std::string_view r {buffer_.data() + rhs.offset, rhs.length};
+        return path_less(l, r);
+    };
+#if defined(TORRENTTOOLS_USE_TBB)
+    std::sort(std::execution::par_unseq, records_.begin(), records_.end(), compare);
+#else
+    std::sort(records_.begin(), records_.end(), compare);
+#endif
+}
+
+
+void path_arena::reserve(std::size_t path_count, std::size_t byte_count)
+{
+    records_.reserve(path_count);
+    buffer_.reserve(byte_count);
+}
+
+
+void path_arena::clear() noexcept
+{
+    records_.clear();
+    buffer_.clear();
+}
+
+
+std::uint64_t path_arena::make_sort_key(std::string_view path) noexcept
+{
+    std::uint64_t key = 0;
+    for (std::size_t i = 0; i < sizeof(key); ++i) {
+        key <<= 8;
+        if (i < path.size()) {
+            auto byte = static_cast<unsigned char>(path[i]);
+            // order bytes as char is ordered on this platform
+            if constexpr (std::is_signed_v<char>) {
+                byte ^= 0x80u;
+            }
+            key |= byte;
+        }
+    }
+    return key;
+}
+
+} // namespace torrenttools
@@ -0,0 +1,199 @@
+#include <exception>
+#include <string>
+
+#include <dottorrent/file_storage.hpp>
+
+#include "prehasher.hpp"
+#include "storage_hasher.hpp"
+
+namespace torrenttools {
+
+prehasher::prehasher(fs::path root, std::size_t piece_size, const hash_pipeline_options& options, hash_cache cache)
+    : root_(std::move(root))
+    , piece_size_(piece_size)
+    , options_(options)
+    , cache_(std::move(cache))
+    , scheduler_(options_)
+{
+    Expects((options_.protocol_version & dt::protocol::v2) == dt::protocol::v2);
+    Expects(!options_.copy_to && !options_.input);
+    thread_ = std::jthread([this](std::stop_token stop_token) { run(stop_token); });
+}
+
+prehasher::~prehasher()
+{
+    if (thread_.joinable()) {
+        thread_.request_stop();
+        {
+            std::unique_lock lck(current_mutex_);
+            if (current_) {
+                current_->cancel();
+            }
+        }
+        queue_.close();
+        thread_.join();
+    }
+}
+
+void prehasher::add_file(std::string_view relative_path, const scanned_file& file)
+{
+    {
+        std::unique_lock lck(idle_mutex_);
+        ++queued_file_count_;
+    }
+    queue_.push(queued_file { .path = fs::path(relative_path), .file = file });
+}
+
+void prehasher::wait_idle()
+{
+    std::unique_lock lck(idle_mutex_);
+    idle_cv_.wait(lck, [this]() { return processed_file_count_ == queued_file_count_ || stopped_; });
+}
+
+void prehasher::finish()
+{
+    if (!thread_.joinable()) {
+        return;
+    }
+    thread_.request_stop();
+    queue_.close();
+    queue_.clear();
+    thread_.join();
+}
+
+void prehasher::run(std::stop_token stop_token)
+{
+    std::vector<queued_file> batch {};
+    std::size_t batch_bytes = 0;
+    std::chrono::steady_clock::time_point deadline {};
+
+    auto flush = [&]() {
+        const auto file_count = batch.size();
+        hash_batch(batch, stop_token);
+        batch.clear();
+        batch_bytes = 0;
+        set_processed(file_count);
+    };
+
+    while (!stop_token.stop_requested()) {
+        // Wait for more files to hash larger batches, but do not keep the disks idle for long
+        // when the scan is slow.
+        auto item = batch.empty() ? queue_.pop() : queue_.pop_until(deadline);
+        if (!item) {
+            if (batch.empty() || queue_.closed()) {
+                break;
+            }
+            flush();
+            continue;
+        }
+        // empty files are never read
+        if (item->file.file_size == 0) {
+            set_processed(1);
+            continue;
+        }
+        if (batch.empty()) {
+            deadline = std::chrono::steady_clock::now() + max_batch_delay;
+        }
+        batch_bytes += item->file.file_size;
+        batch.push_back(std::move(*item));
+
+        if (batch_bytes >= max_batch_bytes || batch.size() >= max_batch_files) {
+            flush();
+        }
+    }
+
+    {
+        std::unique_lock lck(idle_mutex_);
+        stopped_ = true;
+    }
+    idle_cv_.notify_all();
+}
+
+void prehasher::set_processed(std::size_t file_count)
+{
+    {
+        std::unique_lock lck(idle_mutex_);
+        processed_file_count_ += file_count;
+    }
+    idle_cv_.notify_all();
+}
+
+void prehasher::hash_batch(std::vector<queued_file>& batch, std::stop_token stop_token)
+{
+    dt::file_storage storage {};
+    storage.set_root_directory(root_);
+    storage.set_file_mode(dt::file_mode::multi);
+    storage.set_piece_size(piece_size_);
+
+    // In hybrid storage the tail piece of a file is padded unless it is the last file of the storage.
+    // Padding the last file of the batch too caches its padded tail piece for the complete storage.
+    const bool hybrid = (options_.protocol_version & dt::protocol::hybrid) == dt::protocol::hybrid;
+
+    std::vector<std::optional<file_identity>> identities {};
+    identities.reserve(batch.size());
+    for (auto& f : batch) {
+        const auto file_size = f.file.file_size;
+        storage.add_file(dt::file_entry(std::move(f.path), file_size));
+        identities.push_back(f.file.identity);
+
+        if (hybrid && file_size % piece_size_ != 0) {
+            auto padding_size = piece_size_ - file_size % piece_size_;
+            storage.add_file(dt::file_entry(
+                    fs::path(".pad") / std::to_string(padding_size), padding_size,
+                    dt::file_attributes::padding_file));
+        }
+    }
+
+    try {
+        storage_hasher hasher(storage, options_, cache_);
+        hasher.set_file_identities(std::move(identities));
+
+        // clear the current hasher before it is destroyed, also when hashing fails
+        struct current_guard
+        {
+            prehasher& self;
+            ~current_guard()
+            {
+                std::unique_lock lck(self.current_mutex_);
+                self.current_ = nullptr;
+            }
+        } guard { *this };
+        {
+            std::unique_lock lck(current_mutex_);
+            if (stop_token.stop_requested()) {
+                return;
+            }
+            current_ = &hasher;
+            hasher.start(scheduler_);
+        }
+        hasher.wait();
+        // the hashes of a cancelled batch are incomplete
+        if (hasher.cancelled()) {
+            return;
+        }
+        hasher.update_cache();
+        hashed_file_count_.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+    catch (const std::exception& e) {
+        // Prehashing only fills the cache, files that could not be hashed are read again
+        // and errors are reported by the storage_hasher of the complete storage.
+        std::unique_lock lck(error_mutex_);
+        if (failed_batch_count_++ == 0) {
+            first_error_ = e.what();
+        }
+    }
+}
+
+std::size_t prehasher::failed_batch_count() const noexcept
+{
+    std::unique_lock lck(error_mutex_);
+    return failed_batch_count_;
+}
+
+std::string prehasher::first_error() const
+{
+    std::unique_lock lck(error_mutex_);
+    return first_error_;
+}
+
+} // namespace torrenttools
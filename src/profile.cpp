@@ -9,22 +9,36 @@ namespace torrenttools {
 static const std::set<std::string_view> create_config_keys {
         "announce",
         "announce-group",
+        "background",
         "checksum",
         "collection",
         "comment",
+        "cpu-affinity",
         "created-by",
         "creation-date",
         "dht-node",
+        "direct-io",
+        "drop-cache",
         "exclude",
+        "hash-backend",
+        "hash-cache",
         "http-seed",
         "include",
         "include-hidden",
         "io-block-size",
+        "io-engine",
+        "io-queue-depth",
+        "max-iops",
+        "max-memory",
+        "max-read-rate",
         "name",
+        "numa",
         "output",
         "piece-size",
+        "pipeline",
         "private",
         "protocol",
+        "read-order",
         "set-created-by",
         "set-creation-date",
         "similar",
@@ -90,6 +104,14 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // background
+    if (auto n = profile_data["background"]; n) {
+        try { options.background = n.as<bool>(); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key background must be a boolean");
+        }
+    }
+
     // checksum
     if (auto n = profile_data["checksum"]; n) {
         try {
@@ -116,6 +138,14 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // cpu-affinity
+    if (auto n = profile_data["cpu-affinity"]; n) {
+        try { options.cpu_affinity = n.as<bool>(); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key cpu-affinity must be a boolean");
+        }
+    }
+
     // created-by
     if (auto n = profile_data["created-by"]; n) {
         try  { options.created_by = n.as<std::string>(); }
@@ -140,6 +170,22 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // direct-io
+    if (auto n = profile_data["direct-io"]; n) {
+        try { options.direct_io = n.as<bool>(); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key direct-io must be a boolean");
+        }
+    }
+
+    // drop-cache
+    if (auto n = profile_data["drop-cache"]; n) {
+        try { options.drop_cache = n.as<bool>(); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key drop-cache must be a boolean");
+        }
+    }
+
     // exclude
     if (auto n = profile_data["exclude"]; n) {
         try { options.exclude_patterns =  n.as<std::vector<std::string>>(); }
@@ -148,6 +194,26 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // hash-backend
+    if (auto n = profile_data["hash-backend"]; n) {
+        try { options.hash_backend = hash_backend_transformer({n.as<std::string>()}); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key hash-backend must be a string");
+        }
+        catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
+    // hash-cache
+    if (auto n = profile_data["hash-cache"]; n) {
+        try {
+            options.hash_cache = path_transformer({n.as<std::string>()}, /*check_exists=*/false);
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key hash-cache must be a string");
+        }
+    }
+
     // http-seed
     if (auto n = profile_data["http-seed"]; n) {
         try {
@@ -183,6 +249,61 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // io-engine
+    if (auto n = profile_data["io-engine"]; n) {
+        try {
+            options.io_engine = io_engine_transformer({n.as<std::string>()});
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key io-engine must be a string");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
+    // io-queue-depth
+    if (auto n = profile_data["io-queue-depth"]; n) {
+        try {
+            options.io_queue_depth = io_queue_depth_transformer({n.as<std::string>()});
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key io-queue-depth must be an integer");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
+    // max-iops
+    if (auto n = profile_data["max-iops"]; n) {
+        try {
+            options.max_iops = max_iops_transformer({n.as<std::string>()});
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key max-iops must be an integer");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
+    // max-memory
+    if (auto n = profile_data["max-memory"]; n) {
+        try {
+            options.max_memory = max_memory_transformer({n.as<std::string>()});
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key max-memory must be a string");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
+    // max-read-rate
+    if (auto n = profile_data["max-read-rate"]; n) {
+        try {
+            options.max_read_rate = max_read_rate_transformer({n.as<std::string>()});
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key max-read-rate must be a string");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
     // name
     if (auto n = profile_data["name"]; n) {
         try { options.name = n.as<std::string>(); }
@@ -191,6 +312,14 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // numa
+    if (auto n = profile_data["numa"]; n) {
+        try { options.numa = n.as<bool>(); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key numa must be a boolean");
+        }
+    }
+
     // output
     if (auto n = profile_data["output"]; n) {
         try {
@@ -214,6 +343,14 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // pipeline
+    if (auto n = profile_data["pipeline"]; n) {
+        try { options.pipeline = n.as<bool>(); }
+        catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key pipeline must be a boolean");
+        }
+    }
+
     // private
     if (auto n = profile_data["private"]; n) {
         try {
@@ -232,6 +369,17 @@ profile parse_create_profile(const YAML::Node& profile_data)
         }
     }
 
+    // read-order
+    if (auto n = profile_data["read-order"]; n) {
+        try {
+            options.read_order = read_order_transformer({n.as<std::string>()});
+        } catch (const YAML::BadConversion& err) {
+            throw profile_error("value type for key read-order must be a string");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error(err.what());
+        }
+    }
+
     // set-created-by
     if (auto n = profile_data["set-created-by"]; n) {
         try {
@@ -270,9 +418,11 @@ profile parse_create_profile(const YAML::Node& profile_data)
     // threads
     if (auto n = profile_data["threads"]; n) {
         try {
-            options.threads = n.as<std::size_t>();
+            options.threads = threads_transformer({n.as<std::string>()});
         } catch (const YAML::BadConversion& err) {
-            throw profile_error("value type for key threads must be an integer");
+            throw profile_error("value type for key threads must be an integer or auto");
+        } catch (const std::invalid_argument& err) {
+            throw profile_error("value type for key threads must be an integer or auto");
         }
     }
 
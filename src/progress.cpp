@@ -35,7 +35,7 @@ namespace tc = termcontrol;
 // TODO: progress plugins for eta rate and timers
 
 
-void run_with_progress(std::ostream& os, dottorrent::storage_hasher& hasher, const dottorrent::metafile& m)
+void run_with_progress(std::ostream& os, tt::storage_hasher& hasher, const dottorrent::metafile& m)
 {
     using namespace std::chrono_literals;
 
@@ -61,7 +61,7 @@ void run_with_progress(std::ostream& os, dottorrent::storage_hasher& hasher, con
     hasher.start();
 
     if (storage.file_count() != 0) [[likely]] {
-        while (hasher.bytes_done() < total_file_size) {
+        while (hasher.bytes_done() < total_file_size && !hasher.done()) {
             auto[index, file_bytes_done] = hasher.current_file_progress();
             auto total_bytes_done = hasher.bytes_done();
 
@@ -92,12 +92,12 @@ void run_with_progress(std::ostream& os, dottorrent::storage_hasher& hasher, con
     auto stop_time = std::chrono::system_clock::now();
     auto total_duration = stop_time - start_time;
 
-    print_completion_statistics(os, m, total_duration);
+    print_completion_statistics(os, m, total_duration, hasher.placement());
 }
 
 
 /// Progress using only carriage return and newline characters.
-void run_with_simple_progress(std::ostream& os, dottorrent::storage_hasher& hasher, const dottorrent::metafile& m)
+void run_with_simple_progress(std::ostream& os, tt::storage_hasher& hasher, const dottorrent::metafile& m)
 {
     using namespace std::chrono_literals;
 
@@ -122,7 +122,7 @@ void run_with_simple_progress(std::ostream& os, dottorrent::storage_hasher& hash
         print_simple_indicator(os, storage, current_file_index, hasher.protocol());
         std::flush(os);
 
-        while (hasher.bytes_done() < total_file_size) {
+        while (hasher.bytes_done() < total_file_size && !hasher.done()) {
             auto[index, file_bytes_hashed] = hasher.current_file_progress();
 
             // Current file has been completed, update last entry for the previous file(s) and move to next one
@@ -147,10 +147,10 @@ void run_with_simple_progress(std::ostream& os, dottorrent::storage_hasher& hash
 
     auto stop_time = std::chrono::system_clock::now();
     auto total_duration = stop_time - start_time;
-    print_completion_statistics(os, m, total_duration);
+    print_completion_statistics(os, m, total_duration, hasher.placement());
 }
 
-void run_with_progress(std::ostream& os, dottorrent::storage_verifier& verifier, const dottorrent::metafile& m)
+void run_with_progress(std::ostream& os, tt::storage_verifier& verifier, const dottorrent::metafile& m)
 {
     using namespace std::chrono_literals;
 
@@ -176,7 +176,7 @@ void run_with_progress(std::ostream& os, dottorrent::storage_verifier& verifier,
     verifier.start();
 
     if (storage.file_count() != 0) [[likely]] {
-        while (verifier.bytes_done() < total_file_size) {
+        while (verifier.bytes_done() < total_file_size && !verifier.done()) {
             auto[index, file_bytes_done] = verifier.current_file_progress();
             auto total_bytes_done = verifier.bytes_done();
 
@@ -207,12 +207,12 @@ void run_with_progress(std::ostream& os, dottorrent::storage_verifier& verifier,
     auto stop_time = std::chrono::system_clock::now();
     auto total_duration = stop_time - start_time;
 
-    print_completion_statistics(os, m, total_duration);
+    print_completion_statistics(os, m, total_duration, verifier.placement());
 }
 
 
 /// Progress using only carriage return and newline characters.
-void run_with_simple_progress(std::ostream& os, dottorrent::storage_verifier& verifier, const dottorrent::metafile& m)
+void run_with_simple_progress(std::ostream& os, tt::storage_verifier& verifier, const dottorrent::metafile& m)
 {
     using namespace std::chrono_literals;
 
@@ -237,7 +237,7 @@ void run_with_simple_progress(std::ostream& os, dottorrent::storage_verifier& ve
         print_simple_indicator(os, storage, current_file_index, verifier.protocol());
         std::flush(os);
 
-        while (verifier.bytes_done() < total_file_size) {
+        while (verifier.bytes_done() < total_file_size && !verifier.done()) {
             auto[index, file_bytes_hashed] = verifier.current_file_progress();
 
             // Current file has been completed, update last entry for the previous file(s) and move to next one
@@ -262,11 +262,12 @@ void run_with_simple_progress(std::ostream& os, dottorrent::storage_verifier& ve
 
     auto stop_time = std::chrono::system_clock::now();
     auto total_duration = stop_time - start_time;
-    print_completion_statistics(os, m, total_duration);
+    print_completion_statistics(os, m, total_duration, verifier.placement());
 }
 
 
-void print_completion_statistics(std::ostream& os, const dottorrent::metafile& m, std::chrono::system_clock::duration duration)
+void print_completion_statistics(std::ostream& os, const dottorrent::metafile& m, std::chrono::system_clock::duration duration,
+                                 const torrenttools::thread_placement& placement)
 {
     auto& storage = m.storage();
     auto out = std::ostreambuf_iterator(os);
@@ -283,6 +284,14 @@ void print_completion_statistics(std::ostream& os, const dottorrent::metafile& m
 
     fmt::format_to(out, "Completed in:        {}\n", tt::format_duration(duration));
     fmt::format_to(out, "Average hash rate:   {}\n", average_hash_rate_str);
+    if (!placement.hasher_cpus.empty() || placement.numa_node) {
+        const auto& cpus = placement.hasher_cpus.empty() ? placement.reader_cpus : placement.hasher_cpus;
+        std::string node_str {};
+        if (placement.numa_node) {
+            node_str = fmt::format(" (NUMA node {})", *placement.numa_node);
+        }
+        fmt::format_to(out, "Thread placement:    cpus {}{}\n", tt::format_cpu_list(cpus), node_str);
+    }
     // Torrent file is hashed so we can return to infohash
     std::string info_hash_string {};
     if (auto protocol = m.storage().protocol(); protocol != dt::protocol::none) {
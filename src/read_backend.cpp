@@ -0,0 +1,1743 @@
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+
+#include <fmt/format.h>
+
+#include "read_backend.hpp"
+
+#if defined(__linux__) || defined(__APPLE__)
+#define TORRENTTOOLS_HAS_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#endif
+
+#if defined(TORRENTTOOLS_USE_IO_URING)
+#include <liburing.h>
+#endif
+
+namespace torrenttools {
+
+std::string_view to_string(io_engine engine) noexcept
+{
+    switch (engine) {
+    case io_engine::sync:  return "sync";
+    case io_engine::uring: return "uring";
+    case io_engine::mmap:  return "mmap";
+    }
+    return "unknown";
+}
+
+std::string_view to_string(read_order order) noexcept
+{
+    switch (order) {
+    case read_order::storage:  return "storage";
+    case read_order::physical: return "physical";
+    case read_order::cached:   return "cached";
+    }
+    return "unknown";
+}
+
+std::optional<read_order> make_read_order(std::string_view name) noexcept
+{
+    if (name == "storage") {
+        return read_order::storage;
+    }
+    if (name == "physical") {
+        return read_order::physical;
+    }
+    if (name == "cached") {
+        return read_order::cached;
+    }
+    return std::nullopt;
+}
+
+std::optional<io_engine> make_io_engine(std::string_view name) noexcept
+{
+    if (name == "sync") {
+        return io_engine::sync;
+    }
+    if (name == "uring" || name == "io_uring") {
+        return io_engine::uring;
+    }
+    if (name == "mmap") {
+        return io_engine::mmap;
+    }
+    return std::nullopt;
+}
+
+bool is_available(io_engine engine) noexcept
+{
+    switch (engine) {
+    case io_engine::sync:
+        return true;
+    case io_engine::uring:
+#if defined(TORRENTTOOLS_USE_IO_URING)
+        return true;
+#else
+        return false;
+#endif
+    case io_engine::mmap:
+#if defined(TORRENTTOOLS_HAS_MMAP)
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+
+std::vector<read_request> make_stream_read_plan(const dt::file_storage& storage, std::size_t block_size,
+                                                std::span<const char> skipped_pieces)
+{
+    const auto piece_size = storage.piece_size();
+    const auto total_size = storage.total_file_size();
+    auto is_skipped = [&](std::size_t piece) {
+        return piece < skipped_pieces.size() && skipped_pieces[piece];
+    };
+
+    std::vector<read_request> plan {};
+    std::size_t index = 0;
+    std::size_t file_start = 0;
+    std::size_t offset = 0;
+
+    while (offset < total_size) {
+        if (is_skipped(offset / piece_size)) {
+            offset = std::min(total_size, (offset / piece_size + 1) * piece_size);
+            continue;
+        }
+        auto end = std::min(total_size, offset + block_size);
+        for (auto piece = offset / piece_size + 1; piece * piece_size < end; ++piece) {
+            if (is_skipped(piece)) {
+                end = piece * piece_size;
+                break;
+            }
+        }
+
+        read_request request { .offset = offset, .segments = {} };
+        for (auto pos = offset; pos < end;) {
+            // empty files have no data in the stream
+            while (file_start + storage.at(index).file_size() <= pos) {
+                file_start += storage.at(index).file_size();
+                ++index;
+            }
+            auto length = std::min(end, file_start + storage.at(index).file_size()) - pos;
+            request.segments.push_back({.file_index = index, .file_offset = pos - file_start, .length = length});
+            pos += length;
+        }
+        plan.push_back(std::move(request));
+        offset = end;
+    }
+    return plan;
+}
+
+
+std::vector<read_request> make_file_read_plan(const dt::file_storage& storage, std::size_t block_size,
+                                              std::span<const char> skipped_files, bool storage_order)
+{
+    std::vector<std::size_t> large_files {};
+    std::vector<std::size_t> small_files {};
+
+    for (std::size_t index = 0; index < storage.file_count(); ++index) {
+        const auto& entry = storage.at(index);
+        if (entry.is_padding_file() || entry.file_size() == 0 ||
+            (index < skipped_files.size() && skipped_files[index])) {
+            continue;
+        }
+        (entry.file_size() > block_size && !storage_order ? large_files : small_files).push_back(index);
+    }
+    std::stable_sort(large_files.begin(), large_files.end(), [&](std::size_t lhs, std::size_t rhs) {
+        return storage.at(lhs).file_size() > storage.at(rhs).file_size();
+    });
+
+    std::vector<read_request> plan {};
+
+    auto add_large_file = [&](std::size_t index) {
+        const auto file_size = storage.at(index).file_size();
+        for (std::size_t offset = 0; offset < file_size; offset += block_size) {
+            auto length = std::min(file_size - offset, block_size);
+            plan.push_back({ .offset = offset,
+                             .segments = {{.file_index = index, .file_offset = offset, .length = length}} });
+        }
+    };
+
+    for (auto index : large_files) {
+        add_large_file(index);
+    }
+
+    // Small files stay in storage order, which is usually the order they are stored in on disk.
+    read_request batch { .offset = 0, .segments = {} };
+    std::size_t batch_size = 0;
+
+    auto flush_batch = [&]() {
+        if (batch_size != 0) {
+            plan.push_back(std::move(batch));
+            batch = { .offset = 0, .segments = {} };
+            batch_size = 0;
+        }
+    };
+
+    for (auto index : small_files) {
+        const auto file_size = storage.at(index).file_size();
+        // only when reading in storage order
+        if (file_size > block_size) {
+            flush_batch();
+            add_large_file(index);
+            continue;
+        }
+        if (batch_size + file_size > block_size) {
+            flush_batch();
+        }
+        batch.segments.push_back({.file_index = index, .file_offset = 0, .length = file_size});
+        batch_size += file_size;
+    }
+    flush_batch();
+    return plan;
+}
+
+
+std::vector<read_request> merge_read_plan(std::span<const read_request> plan, std::size_t block_size)
+{
+    std::vector<read_request> merged {};
+    std::size_t merged_size = block_size;
+
+    for (const auto& request : plan) {
+        const auto size = request.size();
+        if (merged_size + size > block_size) {
+            merged.push_back({ .offset = request.offset, .segments = {} });
+            merged_size = 0;
+        }
+        auto& segments = merged.back().segments;
+        for (const auto& segment : request.segments) {
+            if (!segments.empty() && segments.back().file_index == segment.file_index &&
+                segments.back().file_offset + segments.back().length == segment.file_offset) {
+                segments.back().length += segment.length;
+            }
+            else {
+                segments.push_back(segment);
+            }
+        }
+        merged_size += size;
+    }
+    return merged;
+}
+
+namespace {
+
+/// Return the end of the group of requests starting at first.
+/// A group continues with requests that read further into a single file.
+/// It ends before a request that starts a file at its beginning or that reads from several files,
+/// so the blocks of a v1 data stream, which span file boundaries, are split at each file boundary.
+std::size_t request_group_end(std::span<const read_request> plan, std::size_t first)
+{
+    auto continues_file = [](const read_request& request) {
+        const auto& segments = request.segments;
+        return !segments.empty() && segments.front().file_offset != 0 &&
+               std::all_of(segments.begin(), segments.end(), [&](const file_segment& s) {
+                   return s.file_index == segments.front().file_index;
+               });
+    };
+    auto last = first + 1;
+    while (last < plan.size() && continues_file(plan[last])) {
+        ++last;
+    }
+    return last;
+}
+
+} // namespace
+
+void sort_read_plan(std::vector<read_request>& plan, std::span<const std::uint64_t> file_keys)
+{
+    struct group
+    {
+        std::uint64_t key;
+        std::size_t first;
+        std::size_t last;
+    };
+    std::vector<group> groups {};
+    for (std::size_t first = 0; first < plan.size();) {
+        auto last = request_group_end(plan, first);
+        auto key = unknown_physical_offset;
+        for (auto i = first; i < last; ++i) {
+            for (const auto& segment : plan[i].segments) {
+                key = std::min(key, file_keys[segment.file_index]);
+            }
+        }
+        groups.push_back({ .key = key, .first = first, .last = last });
+        first = last;
+    }
+    std::stable_sort(groups.begin(), groups.end(), [](const group& lhs, const group& rhs) {
+        return lhs.key < rhs.key;
+    });
+
+    std::vector<read_request> sorted {};
+    sorted.reserve(plan.size());
+    for (const auto& g : groups) {
+        std::move(plan.begin() + g.first, plan.begin() + g.last, std::back_inserter(sorted));
+    }
+    plan = std::move(sorted);
+}
+
+std::vector<std::size_t> assign_request_devices(std::span<const read_request> plan,
+                                                std::span<const std::size_t> file_devices)
+{
+    std::vector<std::size_t> devices(plan.size());
+    std::vector<std::size_t> device_bytes {};
+
+    for (std::size_t first = 0; first < plan.size();) {
+        auto last = request_group_end(plan, first);
+
+        std::fill(device_bytes.begin(), device_bytes.end(), 0);
+        for (auto i = first; i < last; ++i) {
+            for (const auto& segment : plan[i].segments) {
+                auto device = file_devices[segment.file_index];
+                if (device == no_device) {
+                    continue;
+                }
+                if (device >= device_bytes.size()) {
+                    device_bytes.resize(device + 1);
+                }
+                device_bytes[device] += segment.length;
+            }
+        }
+        std::size_t device = 0;
+        if (!device_bytes.empty()) {
+            device = static_cast<std::size_t>(std::distance(
+                    device_bytes.begin(), std::max_element(device_bytes.begin(), device_bytes.end())));
+        }
+        std::fill(devices.begin() + first, devices.begin() + last, device);
+        first = last;
+    }
+    return devices;
+}
+
+std::vector<std::size_t> interleave_by_device(std::span<const std::size_t> request_devices)
+{
+    std::vector<std::vector<std::size_t>> queues {};
+    for (std::size_t i = 0; i < request_devices.size(); ++i) {
+        if (request_devices[i] >= queues.size()) {
+            queues.resize(request_devices[i] + 1);
+        }
+        queues[request_devices[i]].push_back(i);
+    }
+
+    std::vector<std::size_t> order {};
+    order.reserve(request_devices.size());
+    for (std::size_t round = 0; order.size() < request_devices.size(); ++round) {
+        for (const auto& queue : queues) {
+            if (round < queue.size()) {
+                order.push_back(queue[round]);
+            }
+        }
+    }
+    return order;
+}
+
+std::vector<std::uint64_t> physical_file_offsets(const dt::file_storage& storage)
+{
+    std::vector<std::uint64_t> offsets(storage.file_count(), unknown_physical_offset);
+#if defined(__linux__)
+    // room for the first extent only
+    alignas(struct fiemap) std::array<std::byte, sizeof(struct fiemap) + sizeof(struct fiemap_extent)> buffer {};
+    auto* map = reinterpret_cast<struct fiemap*>(buffer.data());
+
+    for (std::size_t i = 0; i < storage.file_count(); ++i) {
+        const auto& entry = storage.at(i);
+        if (entry.is_padding_file() || entry.file_size() == 0) {
+            continue;
+        }
+        auto path = storage.root_directory() / entry.path();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        buffer.fill(std::byte{});
+        map->fm_start = 0;
+        map->fm_length = FIEMAP_MAX_OFFSET;
+        map->fm_extent_count = 1;
+        if (::ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1 &&
+            (map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC)) == 0) {
+            offsets[i] = map->fm_extents[0].fe_physical;
+        }
+        ::close(fd);
+    }
+#endif
+    return offsets;
+}
+
+
+#if defined(__linux__)
+namespace {
+
+std::size_t page_size() noexcept
+{
+    static const auto size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+/// Return true if mincore reports which pages of the file are in the page cache.
+/// Linux only reports the page cache of files the user owns or can write to,
+/// for other files only the pages mapped by this process are reported.
+/// Write access through supplementary groups is not detected.
+bool can_probe_page_cache(int fd)
+{
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        return false;
+    }
+    const auto uid = ::geteuid();
+    return uid == 0 || st.st_uid == uid || (st.st_mode & S_IWOTH) != 0 ||
+           (st.st_gid == ::getegid() && (st.st_mode & S_IWGRP) != 0);
+}
+
+/// Return one byte per page of the mapped range, with the lowest bit set if the page is in the page cache.
+/// address must be aligned to the page size.
+/// @returns an empty vector if the residency could not be determined.
+std::vector<unsigned char> probe_mapped_pages(const void* address, std::size_t length)
+{
+    std::vector<unsigned char> pages((length + page_size() - 1) / page_size());
+    if (::mincore(const_cast<void*>(address), length, pages.data()) != 0) {
+        pages.clear();
+    }
+    return pages;
+}
+
+/// Return which pages of a range of a file are in the page cache, see probe_mapped_pages.
+/// The range is extended to the start of its first page.
+/// @returns an empty vector if the page cache of the file can not be probed.
+std::vector<unsigned char> probe_page_cache(int fd, std::size_t offset, std::size_t length)
+{
+    if (length == 0 || !can_probe_page_cache(fd)) {
+        return {};
+    }
+    const auto first = offset / page_size() * page_size();
+    const auto map_length = offset + length - first;
+    // mapping the file does not read it, pages are only faulted in when they are accessed
+    void* address = ::mmap(nullptr, map_length, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(first));
+    if (address == MAP_FAILED) {
+        return {};
+    }
+    auto pages = probe_mapped_pages(address, map_length);
+    ::munmap(address, map_length);
+    return pages;
+}
+
+/// Drop the pages of a range of a file that was read from the page cache,
+/// except pages that were cached before the range was read, which other processes may be using.
+/// POSIX_FADV_DONTNEED does not require write access to the file.
+/// @param cached the residency of the range before it was read, as returned by probe_page_cache.
+///               All pages of the range are dropped when it is empty.
+void drop_page_cache(int fd, std::size_t offset, std::size_t length, std::span<const unsigned char> cached)
+{
+    const auto first = offset / page_size() * page_size();
+    if (cached.empty()) {
+        (void) ::posix_fadvise(fd, static_cast<off_t>(first), static_cast<off_t>(offset + length - first),
+                               POSIX_FADV_DONTNEED);
+        return;
+    }
+    std::size_t run = 0;
+    for (std::size_t i = 0; i <= cached.size(); ++i) {
+        if (i < cached.size() && (cached[i] & 1) == 0) {
+            continue;
+        }
+        if (run < i) {
+            (void) ::posix_fadvise(fd, static_cast<off_t>(first + run * page_size()),
+                                   static_cast<off_t>((i - run) * page_size()), POSIX_FADV_DONTNEED);
+        }
+        run = i + 1;
+    }
+}
+
+/// Records which pages of a file were in the page cache before they were read.
+/// Pages are probed well ahead of the reads, before the read ahead of the kernel for earlier reads
+/// brings them into the page cache, so read ahead can stay enabled while reading with drop_cache.
+/// Ranges are expected in increasing order, a range before the probed pages is probed again.
+class page_cache_tracker
+{
+public:
+    /// Read ahead of the kernel stays well below this distance.
+    static constexpr std::size_t lookahead = 32 * 1024 * 1024;
+
+    explicit page_cache_tracker(int fd)
+        : fd_(fd)
+    {
+        struct stat st {};
+        if (can_probe_page_cache(fd) && ::fstat(fd, &st) == 0) {
+            file_size_ = static_cast<std::size_t>(st.st_size);
+        }
+    }
+
+    /// Return the residency of the pages of a range before it is read, see probe_page_cache.
+    /// @returns an empty vector if the page cache of the file can not be probed.
+    std::vector<unsigned char> before_read(std::size_t offset, std::size_t length)
+    {
+        const auto end = std::min(offset + length, file_size_);
+        if (offset >= end) {
+            return {};
+        }
+        const auto first = offset / page_size();
+        const auto last = (end + page_size() - 1) / page_size();
+
+        if (first < first_page_ || first > first_page_ + pages_.size()) {
+            pages_.clear();
+            first_page_ = first;
+        }
+        // forget the pages before the range
+        pages_.erase(pages_.begin(), pages_.begin() + static_cast<std::ptrdiff_t>(first - first_page_));
+        first_page_ = first;
+
+        // probe the next pages while the reads are still far away
+        const auto probed_end = (first_page_ + pages_.size()) * page_size();
+        if (probed_end < std::min(end + lookahead / 2, file_size_)) {
+            auto pages = probe_page_cache(fd_, probed_end, std::min(end + lookahead, file_size_) - probed_end);
+            if (pages.empty()) {
+                pages_.clear();
+                return {};
+            }
+            pages_.insert(pages_.end(), pages.begin(), pages.end());
+        }
+        if (pages_.size() < last - first) {
+            return {};
+        }
+        return {pages_.begin(), pages_.begin() + static_cast<std::ptrdiff_t>(last - first)};
+    }
+
+private:
+    int fd_;
+    /// Zero when the page cache of the file can not be probed.
+    std::size_t file_size_ = 0;
+    std::size_t first_page_ = 0;
+    /// Residency of the pages starting at first_page_.
+    std::vector<unsigned char> pages_ {};
+};
+
+} // namespace
+#endif
+
+std::vector<std::size_t> cached_file_bytes(const dt::file_storage& storage)
+{
+    std::vector<std::size_t> cached(storage.file_count(), 0);
+#if defined(__linux__)
+    // probe large files in windows to bound the size of the residency vector
+    constexpr std::size_t window_size = std::size_t(1) << 30;
+
+    for (std::size_t i = 0; i < storage.file_count(); ++i) {
+        const auto& entry = storage.at(i);
+        if (entry.is_padding_file() || entry.file_size() == 0) {
+            continue;
+        }
+        auto path = storage.root_directory() / entry.path();
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        struct stat st {};
+        const auto file_size = ::fstat(fd, &st) == 0 ? static_cast<std::size_t>(st.st_size) : 0;
+        std::size_t pages = 0;
+        for (std::size_t offset = 0; offset < file_size; offset += window_size) {
+            auto residency = probe_page_cache(fd, offset, std::min(window_size, file_size - offset));
+            pages += static_cast<std::size_t>(std::count_if(residency.begin(), residency.end(),
+                                                             [](unsigned char c) { return (c & 1) != 0; }));
+        }
+        cached[i] = std::min(pages * page_size(), file_size);
+        ::close(fd);
+    }
+#endif
+    return cached;
+}
+
+std::vector<std::uint64_t> page_cache_file_keys(const dt::file_storage& storage)
+{
+    const auto cached = cached_file_bytes(storage);
+    std::vector<std::uint64_t> keys(storage.file_count(), unknown_physical_offset);
+    for (std::size_t i = 0; i < storage.file_count(); ++i) {
+        if (cached[i] == 0) {
+            continue;
+        }
+        keys[i] = cached[i] == storage.at(i).file_size() ? 0 : 1;
+    }
+    return keys;
+}
+
+
+fs::path read_backend::file_path(std::size_t file_index) const
+{
+    return storage_.root_directory() / storage_.at(file_index).path();
+}
+
+bool read_backend::throttle(const read_request& request, std::stop_token stop_token)
+{
+    if (options_.limiter == nullptr) {
+        return true;
+    }
+    std::size_t bytes = 0;
+    std::size_t operations = 0;
+    for (const auto& segment : request.segments) {
+        // padding files are not read from storage
+        if (!storage_.at(segment.file_index).is_padding_file()) {
+            bytes += segment.length;
+            ++operations;
+        }
+    }
+    if (operations == 0) {
+        return true;
+    }
+    return options_.limiter->acquire(bytes, operations, stop_token);
+}
+
+
+namespace {
+
+/// Throw unless missing files are allowed.
+/// @returns false to mark the segment as unavailable.
+bool report_unavailable(const fs::path& path, std::string_view reason, bool allow_missing_files)
+{
+    if (!allow_missing_files) {
+        throw std::runtime_error(fmt::format("could not read file {}: {}", path.string(), reason));
+    }
+    return false;
+}
+
+
+#if defined(__linux__)
+
+constexpr bool is_aligned(std::size_t value) noexcept
+{
+    return value % direct_io_alignment == 0;
+}
+
+constexpr std::size_t align_down(std::size_t value) noexcept
+{
+    return value / direct_io_alignment * direct_io_alignment;
+}
+
+constexpr std::size_t align_up(std::size_t value) noexcept
+{
+    return align_down(value + direct_io_alignment - 1);
+}
+
+/// Open a file for reading, bypassing the page cache when direct is set.
+/// Falls back to buffered reads for filesystems that do not support O_DIRECT (eg. tmpfs).
+/// @returns a file descriptor or a negative errno value.
+int open_for_reading(const fs::path& path, bool direct)
+{
+    int fd = -1;
+    if (direct) {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+        if (fd >= 0 || errno != EINVAL) {
+            return fd < 0 ? -errno : fd;
+        }
+    }
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    return fd < 0 ? -errno : fd;
+}
+
+/// Read length bytes starting at offset, of which at least required bytes must be present.
+/// length may exceed required to keep O_DIRECT reads aligned at the end of a file.
+/// @returns 0 on success, a negative errno value on error, or 1 for an unexpected end of file.
+int read_at(int fd, std::byte* dst, std::size_t length, std::size_t offset, std::size_t required)
+{
+    std::size_t done = 0;
+    while (done < required) {
+        auto res = ::pread(fd, dst + done, length - done, static_cast<off_t>(offset + done));
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (res == 0) {
+            return 1;
+        }
+        done += static_cast<std::size_t>(res);
+    }
+    return 0;
+}
+
+/// Read a segment that is not aligned in the file or in the destination buffer
+/// through an aligned bounce buffer, as required by O_DIRECT.
+int read_through_bounce_buffer(int fd, std::byte* dst, const file_segment& segment, std::span<std::byte> bounce)
+{
+    std::size_t pos = 0;
+    while (pos < segment.length) {
+        auto offset = segment.file_offset + pos;
+        auto aligned_offset = align_down(offset);
+        auto skip = offset - aligned_offset;
+        auto length = std::min(segment.length - pos, bounce.size() - skip);
+
+        if (int ret = read_at(fd, bounce.data(), align_up(skip + length), aligned_offset, skip + length); ret != 0) {
+            return ret;
+        }
+        std::memcpy(dst + pos, bounce.data() + skip, length);
+        pos += length;
+    }
+    return 0;
+}
+
+std::string_view read_error_message(int ret)
+{
+    return ret < 0 ? std::string_view(std::strerror(-ret)) : "unexpected end of file";
+}
+
+
+/// Blocking reads with pread.
+/// With direct io the page cache is bypassed with O_DIRECT. Segments that are aligned to direct_io_alignment
+/// are read straight into the buffer, other segments are read through a small aligned bounce buffer.
+/// With drop_cache the pages a segment was read from are dropped from the page cache
+/// once the data is copied to the buffer, except pages that were cached before they were read.
+class posix_read_backend : public read_backend
+{
+public:
+    static constexpr std::size_t bounce_buffer_size = 1024 * 1024;
+
+    using read_backend::read_backend;
+
+    ~posix_read_backend() override
+    {
+        close_file();
+    }
+
+    void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) override
+    {
+        for (const auto& request : plan) {
+            auto buffer = pool_.acquire(stop_token);
+            if (!buffer || !throttle(request, stop_token)) {
+                return;
+            }
+
+            auto chunk = std::make_shared<data_chunk>();
+            chunk->request = &request;
+            chunk->available.assign(request.segments.size(), true);
+            std::byte* dst = buffer.get();
+
+            for (std::size_t i = 0; i < request.segments.size(); ++i) {
+                const auto& segment = request.segments[i];
+                if (storage_.at(segment.file_index).is_padding_file()) {
+                    std::memset(dst, 0, segment.length);
+                }
+                else {
+                    chunk->available[i] = read_segment(segment, dst);
+                }
+                dst += segment.length;
+            }
+
+            chunk->data = std::span<const std::byte>(buffer.get(), request.size());
+            chunk->buffer = std::move(buffer);
+            sink(std::move(chunk));
+        }
+        close_file();
+    }
+
+private:
+    bool read_segment(const file_segment& segment, std::byte* dst)
+    {
+        if (segment.file_index != file_index_ || fd_ == -1) {
+            close_file();
+            fd_ = open_for_reading(file_path(segment.file_index), options_.direct_io);
+            file_index_ = segment.file_index;
+            if (fd_ >= 0 && drop_cache()) {
+                cache_tracker_.emplace(fd_);
+            }
+        }
+        if (fd_ < 0) {
+            return report_unavailable(file_path(segment.file_index),
+                                      std::strerror(-fd_), options_.allow_missing_files);
+        }
+
+        int ret = 0;
+        if (!options_.direct_io) {
+            std::vector<unsigned char> cached {};
+            if (cache_tracker_) {
+                cached = cache_tracker_->before_read(segment.file_offset, segment.length);
+            }
+            ret = read_at(fd_, dst, segment.length, segment.file_offset, segment.length);
+            if (ret == 0 && cache_tracker_) {
+                drop_page_cache(fd_, segment.file_offset, segment.length, cached);
+            }
+        }
+        // Rounding up the read length is safe: only the last segment of a request can end
+        // before the end of its file, and buffers are sized to a multiple of the alignment.
+        else if (is_aligned(reinterpret_cast<std::uintptr_t>(dst)) && is_aligned(segment.file_offset)) {
+            ret = read_at(fd_, dst, align_up(segment.length), segment.file_offset, segment.length);
+        }
+        else {
+            ret = read_through_bounce_buffer(fd_, dst, segment, bounce_buffer());
+        }
+        if (ret != 0) {
+            return report_unavailable(file_path(segment.file_index),
+                                      read_error_message(ret), options_.allow_missing_files);
+        }
+        return true;
+    }
+
+    bool drop_cache() const noexcept
+    {
+        return options_.drop_cache && !options_.direct_io;
+    }
+
+    std::span<std::byte> bounce_buffer()
+    {
+        if (!bounce_) {
+            bounce_ = bounce_pool_.acquire();
+        }
+        return {bounce_.get(), bounce_pool_.buffer_size()};
+    }
+
+    void close_file()
+    {
+        cache_tracker_.reset();
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+    std::size_t file_index_ = 0;
+    /// Pages of the open file that were cached before they were read, with drop_cache.
+    std::optional<page_cache_tracker> cache_tracker_ {};
+    buffer_pool bounce_pool_ {bounce_buffer_size, 1, direct_io_alignment};
+    buffer_pool::buffer_handle bounce_ {};
+};
+
+#endif
+
+
+#if defined(TORRENTTOOLS_HAS_MMAP)
+
+/// Reads by mapping files in windows of window_size bytes.
+/// Requests that cover a single range of a file are passed to the hashers as a view
+/// of the mapped pages instead of being copied into a buffer.
+/// Requests that span multiple files are copied from the mappings into a pool buffer.
+/// Pool buffers are still acquired for every request to bound the number of chunks in flight.
+class mmap_read_backend : public read_backend
+{
+public:
+    static constexpr std::size_t window_size = 64 * 1024 * 1024;
+
+    mmap_read_backend(const dt::file_storage& storage, buffer_pool& pool, const read_backend_options& options)
+        : read_backend(storage, pool, options)
+        , page_size_(static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)))
+    {}
+
+    ~mmap_read_backend() override
+    {
+        close_file();
+    }
+
+    void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) override
+    {
+        for (const auto& request : plan) {
+            auto buffer = pool_.acquire(stop_token);
+            if (!buffer || !throttle(request, stop_token)) {
+                return;
+            }
+
+            auto chunk = std::make_shared<data_chunk>();
+            chunk->request = &request;
+            chunk->available.assign(request.segments.size(), true);
+
+            const auto& front = request.segments.front();
+            const std::byte* mapped = nullptr;
+
+            if (request.segments.size() == 1 && !storage_.at(front.file_index).is_padding_file()) {
+                mapped = map_segment(front);
+                chunk->available[0] = (mapped != nullptr);
+            }
+
+            if (mapped != nullptr) {
+                chunk->data = std::span<const std::byte>(mapped, front.length);
+                chunk->buffer = hold_mapping(std::move(buffer), mapped);
+            }
+            else {
+                copy_segments(request, *chunk, buffer.get());
+                chunk->data = std::span<const std::byte>(buffer.get(), request.size());
+                chunk->buffer = std::move(buffer);
+            }
+            sink(std::move(chunk));
+        }
+        close_file();
+    }
+
+private:
+    struct mapping
+    {
+        void* address;
+        std::size_t length;
+#if defined(__linux__)
+        /// Descriptor to drop the pages of the window from the page cache with, or -1.
+        int cache_fd = -1;
+        std::size_t file_offset = 0;
+        /// Pages of the window that were in the page cache before it was mapped.
+        std::vector<unsigned char> cached {};
+#endif
+
+        mapping(void* address, std::size_t length)
+            : address(address), length(length)
+        {}
+
+        mapping(const mapping&) = delete;
+        mapping& operator=(const mapping&) = delete;
+
+        ~mapping()
+        {
+            ::munmap(address, length);
+#if defined(__linux__)
+            // pages that are still mapped can not be dropped, all chunks of the window are hashed by now
+            if (cache_fd != -1) {
+                drop_page_cache(cache_fd, file_offset, length, cached);
+                ::close(cache_fd);
+            }
+#endif
+        }
+    };
+
+    void copy_segments(const read_request& request, data_chunk& chunk, std::byte* dst)
+    {
+        for (std::size_t i = 0; i < request.segments.size(); ++i) {
+            const auto& segment = request.segments[i];
+            if (storage_.at(segment.file_index).is_padding_file()) {
+                std::memset(dst, 0, segment.length);
+            }
+            else if (chunk.available[i]) {
+                if (auto* src = map_segment(segment); src != nullptr) {
+                    std::memcpy(dst, src, segment.length);
+                }
+                else {
+                    chunk.available[i] = false;
+                }
+            }
+            dst += segment.length;
+        }
+    }
+
+    /// Keep the pool buffer and the current window alive for as long as the chunk is in use.
+    buffer_pool::buffer_handle hold_mapping(buffer_pool::buffer_handle buffer, const std::byte* data)
+    {
+        struct holder
+        {
+            buffer_pool::buffer_handle buffer;
+            std::shared_ptr<mapping> window;
+        };
+        auto h = std::make_shared<holder>(holder{std::move(buffer), window_});
+        return buffer_pool::buffer_handle(std::move(h), const_cast<std::byte*>(data));
+    }
+
+    /// @returns a pointer to the mapped data of the segment or nullptr when it could not be mapped.
+    const std::byte* map_segment(const file_segment& segment)
+    {
+        if (segment.file_index != file_index_ || fd_ == -1) {
+            open_file(segment.file_index);
+        }
+        if (fd_ < 0) {
+            report_unavailable(file_path(segment.file_index), std::strerror(-fd_), options_.allow_missing_files);
+            return nullptr;
+        }
+        // Accessing a mapping past the end of the file raises SIGBUS.
+        if (segment.file_offset + segment.length > file_size_) {
+            report_unavailable(file_path(segment.file_index),
+                               "unexpected end of file", options_.allow_missing_files);
+            return nullptr;
+        }
+
+        const auto segment_end = segment.file_offset + segment.length;
+        if (!window_ || segment.file_offset < window_offset_ || segment_end > window_offset_ + window_->length) {
+            auto offset = segment.file_offset / page_size_ * page_size_;
+            auto length = std::min(std::max(window_size, segment_end - offset), file_size_ - offset);
+
+            void* address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd_, static_cast<off_t>(offset));
+            if (address == MAP_FAILED) {
+                report_unavailable(file_path(segment.file_index),
+                                   std::strerror(errno), options_.allow_missing_files);
+                return nullptr;
+            }
+            window_ = std::make_shared<mapping>(address, length);
+            window_offset_ = offset;
+#if defined(__linux__)
+            // probe before read ahead is started, which brings the whole window into the page cache
+            if (options_.drop_cache) {
+                if (can_probe_page_cache(fd_)) {
+                    window_->cached = probe_mapped_pages(address, length);
+                }
+                window_->file_offset = offset;
+                window_->cache_fd = ::fcntl(fd_, F_DUPFD_CLOEXEC, 0);
+            }
+#endif
+            if (!options_.drop_cache) {
+                // read ahead past the window would count as cached when the next window is probed
+                ::madvise(address, length, MADV_SEQUENTIAL);
+            }
+            ::madvise(address, length, MADV_WILLNEED);
+        }
+        return static_cast<const std::byte*>(window_->address) + (segment.file_offset - window_offset_);
+    }
+
+    void open_file(std::size_t file_index)
+    {
+        close_file();
+        file_index_ = file_index;
+        fd_ = ::open(file_path(file_index).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) {
+            fd_ = -errno;
+            return;
+        }
+        struct stat st {};
+        if (::fstat(fd_, &st) != 0) {
+            int err = errno;
+            close_file();
+            fd_ = -err;
+            return;
+        }
+        file_size_ = static_cast<std::size_t>(st.st_size);
+    }
+
+    /// Mappings stay valid after closing the file descriptor.
+    void close_file()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        fd_ = -1;
+        file_size_ = 0;
+        window_.reset();
+        window_offset_ = 0;
+    }
+
+    std::size_t page_size_;
+    int fd_ = -1;
+    std::size_t file_index_ = 0;
+    std::size_t file_size_ = 0;
+    std::shared_ptr<mapping> window_ {};
+    std::size_t window_offset_ = 0;
+};
+
+#endif
+
+
+/// Blocking reads using standard file streams.
+class sync_read_backend : public read_backend
+{
+public:
+    using read_backend::read_backend;
+
+    void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) override
+    {
+        for (const auto& request : plan) {
+            auto buffer = pool_.acquire(stop_token);
+            if (!buffer || !throttle(request, stop_token)) {
+                return;
+            }
+
+            auto chunk = std::make_shared<data_chunk>();
+            chunk->request = &request;
+            chunk->available.assign(request.segments.size(), true);
+            std::byte* dst = buffer.get();
+
+            for (std::size_t i = 0; i < request.segments.size(); ++i) {
+                const auto& segment = request.segments[i];
+                if (storage_.at(segment.file_index).is_padding_file()) {
+                    std::memset(dst, 0, segment.length);
+                }
+                else {
+                    chunk->available[i] = read_segment(segment, dst);
+                }
+                dst += segment.length;
+            }
+
+            chunk->data = std::span<const std::byte>(buffer.get(), request.size());
+            chunk->buffer = std::move(buffer);
+            sink(std::move(chunk));
+        }
+    }
+
+private:
+    bool read_segment(const file_segment& segment, std::byte* dst)
+    {
+        if (segment.file_index != file_index_ || !stream_.is_open()) {
+            stream_.close();
+            stream_.clear();
+            // disable stream buffering, we always read large blocks
+            stream_.rdbuf()->pubsetbuf(nullptr, 0);
+            stream_.open(file_path(segment.file_index), std::ios::binary);
+            file_index_ = segment.file_index;
+        }
+        if (!stream_.is_open()) {
+            return report_unavailable(file_path(segment.file_index),
+                                      "could not open file", options_.allow_missing_files);
+        }
+
+        stream_.seekg(static_cast<std::streamoff>(segment.file_offset));
+        stream_.read(reinterpret_cast<char*>(dst), static_cast<std::streamsize>(segment.length));
+
+        if (static_cast<std::size_t>(stream_.gcount()) != segment.length) {
+            stream_.clear();
+            return report_unavailable(file_path(segment.file_index),
+                                      "unexpected end of file", options_.allow_missing_files);
+        }
+        return true;
+    }
+
+    std::ifstream stream_ {};
+    std::size_t file_index_ = 0;
+};
+
+
+/// Reads the data of all regular files from a single input stream, eg. a pipe.
+/// The stream holds the files back to back in storage order, padding files are not part of the stream.
+/// Requests must be sequential, data that is not requested, eg. of skipped files, is discarded.
+class stream_read_backend : public read_backend
+{
+public:
+    stream_read_backend(const dt::file_storage& storage, buffer_pool& pool, const read_backend_options& options)
+        : read_backend(storage, pool, options)
+        , stream_offsets_(storage.file_count())
+    {
+        std::size_t offset = 0;
+        for (std::size_t i = 0; i < storage.file_count(); ++i) {
+            stream_offsets_[i] = offset;
+            if (!storage.at(i).is_padding_file()) {
+                offset += storage.at(i).file_size();
+            }
+        }
+    }
+
+    void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) override
+    {
+        for (const auto& request : plan) {
+            auto buffer = pool_.acquire(stop_token);
+            if (!buffer || !throttle(request, stop_token)) {
+                return;
+            }
+
+            auto chunk = std::make_shared<data_chunk>();
+            chunk->request = &request;
+            chunk->available.assign(request.segments.size(), true);
+            std::byte* dst = buffer.get();
+
+            for (const auto& segment : request.segments) {
+                if (storage_.at(segment.file_index).is_padding_file()) {
+                    std::memset(dst, 0, segment.length);
+                }
+                else {
+                    read_segment(segment, dst);
+                }
+                dst += segment.length;
+            }
+
+            chunk->data = std::span<const std::byte>(buffer.get(), request.size());
+            chunk->buffer = std::move(buffer);
+            sink(std::move(chunk));
+        }
+    }
+
+private:
+    void read_segment(const file_segment& segment, std::byte* dst)
+    {
+        auto& input = *options_.input;
+        const auto offset = stream_offsets_[segment.file_index] + segment.file_offset;
+
+        if (offset < position_) {
+            throw std::logic_error("data of an input stream must be read sequentially");
+        }
+        if (offset > position_) {
+            input.ignore(static_cast<std::streamsize>(offset - position_));
+            position_ += static_cast<std::size_t>(input.gcount());
+        }
+
+        std::size_t count = 0;
+        if (offset == position_) {
+            count = static_cast<std::size_t>(input.rdbuf()->sgetn(
+                    reinterpret_cast<char*>(dst), static_cast<std::streamsize>(segment.length)));
+            position_ += count;
+        }
+        if (position_ != offset + segment.length) {
+            throw std::runtime_error(fmt::format(
+                    "unexpected end of input: read {} bytes, expected {}", position_, total_size()));
+        }
+    }
+
+    std::size_t total_size() const noexcept
+    {
+        const auto last = storage_.file_count() - 1;
+        return stream_offsets_[last] + (storage_.at(last).is_padding_file() ? 0 : storage_.at(last).file_size());
+    }
+
+    /// Offset of each file in the input stream.
+    std::vector<std::size_t> stream_offsets_;
+    std::size_t position_ = 0;
+};
+
+
+
+#if defined(__linux__)
+
+/// Number of reader threads per device.
+/// Rotational disks are read sequentially, solid state drives benefit from a few reads in flight.
+constexpr std::size_t rotational_queue_depth = 1;
+constexpr std::size_t solid_state_queue_depth = 4;
+
+/// Return true if the block device is a rotational disk.
+/// Devices without a request queue in sysfs, eg. network filesystems, count as solid state.
+bool is_rotational_device(dev_t device)
+{
+    const auto sysfs_path = fmt::format("/sys/dev/block/{}:{}", major(device), minor(device));
+    // partitions have no queue of their own, it is found on the parent device
+    for (const auto& path : { sysfs_path + "/queue/rotational", sysfs_path + "/../queue/rotational" }) {
+        std::ifstream f(path);
+        int value = 0;
+        if (f >> value) {
+            return value == 1;
+        }
+    }
+    return false;
+}
+
+
+/// Reads files that are spread over several block devices, eg. a JBOD, with a queue per device
+/// so all devices are busy at the same time.
+/// Requests are interleaved by device and each device is read by its own reader threads.
+/// Chunks are passed to the sink in the interleaved order, at most buffer_count requests ahead of the sink,
+/// so the request that is passed next can always get a buffer.
+class device_read_backend : public read_backend
+{
+public:
+    using reader_factory = std::function<std::unique_ptr<read_backend>()>;
+
+    /// @param file_devices device index of each file, no_device for padding files.
+    /// @param queue_depths number of reader threads of each device.
+    device_read_backend(const dt::file_storage& storage, buffer_pool& pool, const read_backend_options& options,
+                        std::vector<std::size_t> file_devices, std::vector<std::size_t> queue_depths,
+                        reader_factory make_reader)
+        : read_backend(storage, pool, options)
+        , file_devices_(std::move(file_devices))
+        , queue_depths_(std::move(queue_depths))
+        , make_reader_(std::move(make_reader))
+    {}
+
+    void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) override
+    {
+        const auto request_devices = assign_request_devices(plan, file_devices_);
+        const auto order = interleave_by_device(request_devices);
+
+        // positions in the read order of the requests of each device
+        std::vector<std::vector<std::size_t>> queues(queue_depths_.size());
+        for (std::size_t pos = 0; pos < order.size(); ++pos) {
+            queues[request_devices[order[pos]]].push_back(pos);
+        }
+
+        std::vector<std::shared_ptr<const data_chunk>> chunks(order.size());
+        std::vector<std::size_t> next(queues.size());
+        std::size_t passed = 0;
+        std::exception_ptr error {};
+        std::mutex mutex {};
+        std::condition_variable_any cv {};
+        const auto window = pool_.buffer_count();
+
+        std::stop_source stop_source {};
+        std::stop_callback forward_stop(stop_token, [&]() { stop_source.request_stop(); });
+
+        auto read_device = [&](std::size_t device) {
+            auto stop = stop_source.get_token();
+            try {
+                auto reader = make_reader_();
+                for (;;) {
+                    std::size_t pos = 0;
+                    {
+                        std::unique_lock lck(mutex);
+                        if (next[device] == queues[device].size()) {
+                            return;
+                        }
+                        pos = queues[device][next[device]++];
+                        if (!cv.wait(lck, stop, [&]() { return pos < passed + window; })) {
+                            return;
+                        }
+                    }
+                    reader->run(std::span(&plan[order[pos]], 1), [&](std::shared_ptr<const data_chunk> chunk) {
+                        {
+                            std::unique_lock lck(mutex);
+                            chunks[pos] = std::move(chunk);
+                        }
+                        cv.notify_all();
+                    }, stop);
+                }
+            }
+            catch (...) {
+                {
+                    std::unique_lock lck(mutex);
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                }
+                stop_source.request_stop();
+            }
+        };
+
+        std::vector<std::jthread> threads {};
+        for (std::size_t device = 0; device < queues.size(); ++device) {
+            auto count = std::min(queue_depths_[device], queues[device].size());
+            for (std::size_t i = 0; i < count; ++i) {
+                threads.emplace_back(read_device, device);
+            }
+        }
+
+        for (std::size_t pos = 0; pos < order.size(); ++pos) {
+            std::shared_ptr<const data_chunk> chunk {};
+            {
+                std::unique_lock lck(mutex);
+                if (!cv.wait(lck, stop_source.get_token(), [&]() { return chunks[pos] != nullptr; })) {
+                    break;
+                }
+                chunk = std::move(chunks[pos]);
+                ++passed;
+            }
+            cv.notify_all();
+            sink(std::move(chunk));
+        }
+
+        stop_source.request_stop();
+        threads.clear();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    /// Return a device_read_backend if the regular files of the storage are on more than one device.
+    static std::unique_ptr<read_backend> make_if_multi_device(
+            const dt::file_storage& storage, buffer_pool& pool, const read_backend_options& options,
+            reader_factory make_reader)
+    {
+        std::vector<std::size_t> file_devices(storage.file_count(), no_device);
+        std::vector<dev_t> devices {};
+        std::vector<std::size_t> queue_depths {};
+
+        for (std::size_t i = 0; i < storage.file_count(); ++i) {
+            const auto& entry = storage.at(i);
+            if (entry.is_padding_file() || entry.file_size() == 0) {
+                continue;
+            }
+            dev_t device {};
+            if (i < options.file_devices.size() && options.file_devices[i] != unknown_device_id) {
+                device = static_cast<dev_t>(options.file_devices[i]);
+            }
+            else {
+                struct stat st {};
+                auto path = storage.root_directory() / entry.path();
+                if (::stat(path.c_str(), &st) != 0) {
+                    // missing files are reported by the reader
+                    continue;
+                }
+                device = st.st_dev;
+            }
+            auto it = std::find(devices.begin(), devices.end(), device);
+            if (it == devices.end()) {
+                devices.push_back(device);
+                queue_depths.push_back(is_rotational_device(device) ? rotational_queue_depth
+                                                                    : solid_state_queue_depth);
+                it = std::prev(devices.end());
+            }
+            file_devices[i] = static_cast<std::size_t>(std::distance(devices.begin(), it));
+        }
+
+        if (devices.size() < 2) {
+            return nullptr;
+        }
+        return std::make_unique<device_read_backend>(
+                storage, pool, options, std::move(file_devices), std::move(queue_depths), std::move(make_reader));
+    }
+
+private:
+    std::vector<std::size_t> file_devices_;
+    std::vector<std::size_t> queue_depths_;
+    reader_factory make_reader_;
+};
+
+#endif
+
+#if defined(TORRENTTOOLS_USE_IO_URING)
+
+/// Asynchronous reads submitted in batches through io_uring.
+/// Up to queue_depth reads are kept in flight, possibly spanning multiple files,
+/// while completed requests are passed to the sink in plan order.
+class uring_read_backend : public read_backend
+{
+public:
+    uring_read_backend(const dt::file_storage& storage, buffer_pool& pool, const read_backend_options& options)
+        : read_backend(storage, pool, options)
+    {
+        if (int ret = io_uring_queue_init(options_.queue_depth, &ring_, 0); ret < 0) {
+            throw std::system_error(-ret, std::system_category(), "could not initialize io_uring");
+        }
+    }
+
+    ~uring_read_backend() override
+    {
+        io_uring_queue_exit(&ring_);
+    }
+
+    void run(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token) override
+    {
+        try {
+            run_impl(plan, sink, stop_token);
+        }
+        catch (...) {
+            drain();
+            throw;
+        }
+        drain();
+    }
+
+private:
+    struct request_state;
+
+    struct read_operation
+    {
+        request_state* state;
+        std::size_t segment_index;
+        int fd;
+        std::byte* dst;
+        /// Bytes still needed to complete the segment.
+        std::size_t remaining;
+        std::uint64_t file_offset;
+        /// Pages of the segment that were in the page cache before it was read, see drop_page_cache.
+        std::vector<unsigned char> cached {};
+    };
+
+    struct request_state
+    {
+        const read_request* request;
+        std::shared_ptr<data_chunk> chunk;
+        std::vector<read_operation> operations;
+        std::size_t pending_reads = 0;
+    };
+
+    void run_impl(std::span<const read_request> plan, const chunk_sink& sink, std::stop_token stop_token)
+    {
+        // count the segments per file so we know when a file descriptor can be closed.
+        for (const auto& request : plan) {
+            for (const auto& segment : request.segments) {
+                if (!storage_.at(segment.file_index).is_padding_file()) {
+                    ++segments_left_[segment.file_index];
+                }
+            }
+        }
+
+        auto next = plan.begin();
+
+        while (next != plan.end() || !window_.empty()) {
+            if (stop_token.stop_requested()) {
+                return;
+            }
+
+            // Queue new requests as long as there are free buffers and room in the submission queue.
+            while (next != plan.end() && in_flight_ < options_.queue_depth) {
+                auto buffer = window_.empty() ? pool_.acquire(stop_token) : pool_.try_acquire();
+                if (!buffer) {
+                    break;
+                }
+                if (!throttle(*next, stop_token)) {
+                    return;
+                }
+                window_.push_back(start_request(*next, std::move(buffer)));
+                ++next;
+            }
+            io_uring_submit(&ring_);
+
+            // Pass completed requests to the sink in plan order.
+            while (!window_.empty() && window_.front()->pending_reads == 0) {
+                sink(std::move(window_.front()->chunk));
+                window_.pop_front();
+            }
+
+            if (!window_.empty()) {
+                reap(/*wait=*/true);
+            }
+        }
+    }
+
+    std::unique_ptr<request_state> start_request(const read_request& request, buffer_pool::buffer_handle buffer)
+    {
+        auto state = std::make_unique<request_state>();
+        state->request = &request;
+        state->chunk = std::make_shared<data_chunk>();
+        state->chunk->request = &request;
+        state->chunk->data = std::span<const std::byte>(buffer.get(), request.size());
+        state->chunk->available.assign(request.segments.size(), true);
+        // reserve so pointers to operations stay valid while they are in flight
+        state->operations.reserve(request.segments.size());
+
+        std::byte* dst = buffer.get();
+        state->chunk->buffer = std::move(buffer);
+
+        for (std::size_t i = 0; i < request.segments.size(); ++i) {
+            const auto& segment = request.segments[i];
+
+            if (storage_.at(segment.file_index).is_padding_file()) {
+                std::memset(dst, 0, segment.length);
+            }
+            else if (int fd = get_file_descriptor(segment.file_index); fd < 0) {
+                state->chunk->available[i] = report_unavailable(
+                        file_path(segment.file_index), std::strerror(-fd), options_.allow_missing_files);
+                release_segment(segment.file_index);
+            }
+            else if (options_.direct_io &&
+                     !(is_aligned(reinterpret_cast<std::uintptr_t>(dst)) && is_aligned(segment.file_offset))) {
+                // O_DIRECT can not read unaligned segments, read them synchronously through a bounce buffer.
+                if (!bounce_) {
+                    bounce_ = bounce_pool_.acquire();
+                }
+                int ret = read_through_bounce_buffer(
+                        fd, dst, segment, {bounce_.get(), bounce_pool_.buffer_size()});
+                if (ret != 0) {
+                    state->chunk->available[i] = report_unavailable(
+                            file_path(segment.file_index), read_error_message(ret), options_.allow_missing_files);
+                }
+                release_segment(segment.file_index);
+            }
+            else {
+                auto& op = state->operations.emplace_back(read_operation{
+                        .state = state.get(),
+                        .segment_index = i,
+                        .fd = fd,
+                        .dst = dst,
+                        .remaining = segment.length,
+                        .file_offset = segment.file_offset
+                });
+                if (auto it = cache_trackers_.find(segment.file_index); it != cache_trackers_.end()) {
+                    op.cached = it->second.before_read(segment.file_offset, segment.length);
+                }
+                ++state->pending_reads;
+                submit_read(&op);
+            }
+            dst += segment.length;
+        }
+        return state;
+    }
+
+    void submit_read(read_operation* op)
+    {
+        while (in_flight_ >= options_.queue_depth) {
+            io_uring_submit(&ring_);
+            reap(/*wait=*/true);
+        }
+
+        io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+        while (sqe == nullptr) {
+            io_uring_submit(&ring_);
+            sqe = io_uring_get_sqe(&ring_);
+        }
+        // O_DIRECT reads must have an aligned length. Only the last segment of a request can end
+        // before the end of its file, so rounding up never touches the data of other segments.
+        auto length = options_.direct_io ? align_up(op->remaining) : op->remaining;
+        io_uring_prep_read(sqe, op->fd, op->dst, static_cast<unsigned>(length), op->file_offset);
+        io_uring_sqe_set_data(sqe, op);
+        ++in_flight_;
+    }
+
+    /// Process completions. Blocks for at least one completion if wait is true.
+    void reap(bool wait)
+    {
+        io_uring_cqe* cqe = nullptr;
+        int ret = 0;
+
+        if (wait) {
+            do {
+                ret = io_uring_wait_cqe(&ring_, &cqe);
+            } while (ret == -EINTR);
+
+            if (ret < 0) {
+                throw std::system_error(-ret, std::system_category(), "io_uring_wait_cqe failed");
+            }
+        }
+        else {
+            ret = io_uring_peek_cqe(&ring_, &cqe);
+        }
+
+        while (ret == 0 && cqe != nullptr) {
+            auto* op = static_cast<read_operation*>(io_uring_cqe_get_data(cqe));
+            int res = cqe->res;
+            io_uring_cqe_seen(&ring_, cqe);
+            --in_flight_;
+            complete(op, res);
+
+            ret = io_uring_peek_cqe(&ring_, &cqe);
+        }
+    }
+
+    void complete(read_operation* op, int res)
+    {
+        if (draining_) {
+            return;
+        }
+        const auto& segment = op->state->request->segments[op->segment_index];
+
+        if (res <= 0) {
+            op->state->chunk->available[op->segment_index] = report_unavailable(
+                    file_path(segment.file_index), read_error_message(res < 0 ? res : 1),
+                    options_.allow_missing_files);
+        }
+        else if (static_cast<std::size_t>(res) < op->remaining) {
+            // short read, submit a new read for the remainder
+            op->dst += res;
+            op->remaining -= res;
+            op->file_offset += res;
+            submit_read(op);
+            return;
+        }
+        else if (options_.drop_cache && !options_.direct_io) {
+            drop_page_cache(op->fd, segment.file_offset, segment.length, op->cached);
+        }
+        --op->state->pending_reads;
+        release_segment(segment.file_index);
+    }
+
+    /// @returns a file descriptor or a negative errno value
+    int get_file_descriptor(std::size_t file_index)
+    {
+        if (auto it = open_files_.find(file_index); it != open_files_.end()) {
+            return it->second;
+        }
+        int fd = open_for_reading(file_path(file_index), options_.direct_io);
+        if (fd >= 0 && options_.drop_cache && !options_.direct_io) {
+            cache_trackers_.emplace(file_index, page_cache_tracker(fd));
+        }
+        open_files_.emplace(file_index, fd);
+        return fd;
+    }
+
+    void release_segment(std::size_t file_index)
+    {
+        if (--segments_left_[file_index] != 0) {
+            return;
+        }
+        if (auto it = open_files_.find(file_index); it != open_files_.end()) {
+            if (it->second >= 0) {
+                ::close(it->second);
+            }
+            open_files_.erase(it);
+        }
+        cache_trackers_.erase(file_index);
+        segments_left_.erase(file_index);
+    }
+
+    /// Wait for all reads in flight to complete before buffers are released.
+    void drain()
+    {
+        draining_ = true;
+        io_uring_submit(&ring_);
+
+        while (in_flight_ > 0) {
+            io_uring_cqe* cqe = nullptr;
+            if (int ret = io_uring_wait_cqe(&ring_, &cqe); ret < 0) {
+                if (ret == -EINTR) continue;
+                break;
+            }
+            io_uring_cqe_seen(&ring_, cqe);
+            --in_flight_;
+        }
+        for (auto [index, fd] : open_files_) {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+        open_files_.clear();
+        segments_left_.clear();
+        window_.clear();
+        draining_ = false;
+    }
+
+    io_uring ring_ {};
+    /// Requests in flight in plan order.
+    std::deque<std::unique_ptr<request_state>> window_ {};
+    std::size_t in_flight_ = 0;
+    bool draining_ = false;
+    std::unordered_map<std::size_t, int> open_files_ {};
+    /// Pages of the open files that were cached before they were read, with drop_cache.
+    std::unordered_map<std::size_t, page_cache_tracker> cache_trackers_ {};
+    std::unordered_map<std::size_t, std::size_t> segments_left_ {};
+    buffer_pool bounce_pool_ {posix_read_backend::bounce_buffer_size, 1, direct_io_alignment};
+    buffer_pool::buffer_handle bounce_ {};
+};
+
+#endif
+
+} // namespace
+
+
+std::unique_ptr<read_backend> make_read_backend(
+        io_engine engine,
+        const dt::file_storage& storage,
+        buffer_pool& pool,
+        const read_backend_options& options)
+{
+    if (options.direct_io && pool.alignment() % direct_io_alignment != 0) {
+        throw std::invalid_argument("direct io requires buffers aligned to the direct io alignment");
+    }
+    if (options.direct_io && engine == io_engine::mmap) {
+        throw std::invalid_argument("direct io can not be combined with the mmap io engine");
+    }
+
+    if (options.input != nullptr) {
+        if (engine != io_engine::sync || options.direct_io) {
+            throw std::invalid_argument("reading from an input stream requires the sync io engine without direct io");
+        }
+        return std::make_unique<stream_read_backend>(storage, pool, options);
+    }
+
+    switch (engine) {
+    case io_engine::sync: {
+#if defined(__linux__)
+        // files spread over several disks are read from all disks concurrently
+        auto make_reader = [&storage, &pool, options]() -> std::unique_ptr<read_backend> {
+            if (options.direct_io || options.drop_cache) {
+                return std::make_unique<posix_read_backend>(storage, pool, options);
+            }
+            return std::make_unique<sync_read_backend>(storage, pool, options);
+        };
+        if (auto reader = device_read_backend::make_if_multi_device(storage, pool, options, make_reader)) {
+            return reader;
+        }
+        return make_reader();
+#else
+        if (options.direct_io) {
+            throw std::invalid_argument("direct io is not supported on this platform");
+        }
+        return std::make_unique<sync_read_backend>(storage, pool, options);
+#endif
+    }
+    case io_engine::uring:
+#if defined(TORRENTTOOLS_USE_IO_URING)
+        return std::make_unique<uring_read_backend>(storage, pool, options);
+#else
+        throw std::invalid_argument("io_uring support is not enabled in this build");
+#endif
+    case io_engine::mmap:
+#if defined(TORRENTTOOLS_HAS_MMAP)
+        return std::make_unique<mmap_read_backend>(storage, pool, options);
+#else
+        throw std::invalid_argument("the mmap io engine is not supported on this platform");
+#endif
+    }
+    throw std::invalid_argument("invalid io engine");
+}
+
+} // namespace torrenttools
@@ -0,0 +1,211 @@
+#include <cstdint>
+#include <cstring>
+
+#include "cpu_info.hpp"
+#include "sha256_lanes.hpp"
+
+// The SIMD implementation relies on GCC/Clang vector extensions and target attributes.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TORRENTTOOLS_HAS_SHA256_LANES
+#endif
+
+namespace torrenttools {
+
+namespace {
+
+#ifdef TORRENTTOOLS_HAS_SHA256_LANES
+
+// Vectors are only passed between always inlined functions, so the ABI of vector arguments does not matter.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+using u32 = std::uint32_t;
+
+// One lane per 32-bit element.
+// The generic code below is compiled with the instruction set of the function it is inlined in.
+typedef u32 u32x8 __attribute__((vector_size(32)));
+typedef u32 u32x16 __attribute__((vector_size(64)));
+
+constexpr u32 round_constants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+constexpr u32 initial_state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+inline u32 load_be32(const std::byte* p) noexcept
+{
+    return (u32(p[0]) << 24) | (u32(p[1]) << 16) | (u32(p[2]) << 8) | u32(p[3]);
+}
+
+inline void store_be32(std::byte* p, u32 v) noexcept
+{
+    p[0] = std::byte(v >> 24);
+    p[1] = std::byte(v >> 16);
+    p[2] = std::byte(v >> 8);
+    p[3] = std::byte(v);
+}
+
+// A macro rather than a function, so GCC does not warn at the end of the file,
+// outside of the diagnostic scope, about returning vectors from a function without a vector target.
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+/// Compress one 64 byte block of every lane.
+/// @param blocks pointer to the block of each lane.
+template <typename V, std::size_t Lanes>
+[[gnu::always_inline]] inline void compress(V (&state)[8], const std::byte* const (&blocks)[Lanes]) noexcept
+{
+    // Transpose the message words so each vector holds the same word of all lanes.
+    alignas(V) u32 words[16][Lanes];
+    for (std::size_t lane = 0; lane < Lanes; ++lane) {
+        for (int t = 0; t < 16; ++t) {
+            words[t][lane] = load_be32(blocks[lane] + 4 * t);
+        }
+    }
+    V w[16];
+    std::memcpy(w, words, sizeof(w));
+
+    V a = state[0], b = state[1], c = state[2], d = state[3];
+    V e = state[4], f = state[5], g = state[6], h = state[7];
+
+#pragma GCC unroll 64
+    for (int t = 0; t < 64; ++t) {
+        V wt;
+        if (t < 16) {
+            wt = w[t];
+        }
+        else {
+            // message schedule in a ring buffer of 16 words
+            V w15 = w[(t - 15) & 15];
+            V w2 = w[(t - 2) & 15];
+            V s0 = SHA256_ROTR(w15, 7) ^ SHA256_ROTR(w15, 18) ^ (w15 >> 3);
+            V s1 = SHA256_ROTR(w2, 17) ^ SHA256_ROTR(w2, 19) ^ (w2 >> 10);
+            wt = w[t & 15] + s0 + w[(t - 7) & 15] + s1;
+            w[t & 15] = wt;
+        }
+        V s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+        V ch = (e & f) ^ (~e & g);
+        V t1 = h + s1 + ch + round_constants[t] + wt;
+        V s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+        V maj = (a & b) ^ (a & c) ^ (b & c);
+        V t2 = s0 + maj;
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+template <typename V>
+[[gnu::always_inline]] inline void hash_lanes(const std::byte* const* messages, std::size_t length, std::byte* out) noexcept
+{
+    constexpr std::size_t lanes = sizeof(V) / sizeof(u32);
+
+    V state[8];
+    for (int i = 0; i < 8; ++i) {
+        state[i] = V{} + initial_state[i];
+    }
+
+    const std::byte* blocks[lanes];
+    const std::size_t full_blocks = length / 64;
+    for (std::size_t i = 0; i < full_blocks; ++i) {
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            blocks[lane] = messages[lane] + i * 64;
+        }
+        compress(state, blocks);
+    }
+
+    // The remainder, the 0x80 terminator and the bit length take one or two blocks,
+    // which is the same for all lanes since all messages have the same length.
+    const std::size_t remainder = length % 64;
+    const std::size_t tail_size = remainder + 9 > 64 ? 128 : 64;
+    const std::uint64_t bit_length = std::uint64_t(length) * 8;
+    std::byte tails[lanes][128];
+
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        auto* tail = tails[lane];
+        std::memcpy(tail, messages[lane] + full_blocks * 64, remainder);
+        tail[remainder] = std::byte(0x80);
+        std::memset(tail + remainder + 1, 0, tail_size - remainder - 1);
+        store_be32(tail + tail_size - 8, u32(bit_length >> 32));
+        store_be32(tail + tail_size - 4, u32(bit_length));
+    }
+    for (std::size_t offset = 0; offset < tail_size; offset += 64) {
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            blocks[lane] = tails[lane] + offset;
+        }
+        compress(state, blocks);
+    }
+
+    for (std::size_t lane = 0; lane < lanes; ++lane) {
+        for (int i = 0; i < 8; ++i) {
+            store_be32(out + lane * 32 + 4 * i, state[i][lane]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void sha256_x8_avx2(const std::byte* const* messages, std::size_t length, std::byte* out) noexcept
+{
+    hash_lanes<u32x8>(messages, length, out);
+}
+
+__attribute__((target("avx512f")))
+void sha256_x16_avx512(const std::byte* const* messages, std::size_t length, std::byte* out) noexcept
+{
+    hash_lanes<u32x16>(messages, length, out);
+}
+
+#undef SHA256_ROTR
+#pragma GCC diagnostic pop
+
+#endif // TORRENTTOOLS_HAS_SHA256_LANES
+
+std::size_t detect_lane_count() noexcept
+{
+#ifdef TORRENTTOOLS_HAS_SHA256_LANES
+    auto features = detect_cpu_features();
+    if (features.avx512) {
+        return 16;
+    }
+    if (features.avx2) {
+        return 8;
+    }
+#endif
+    return 0;
+}
+
+} // namespace
+
+
+std::size_t sha256_lane_count() noexcept
+{
+    static const std::size_t lanes = detect_lane_count();
+    return lanes;
+}
+
+
+void sha256_lanes(const std::byte* const* messages, std::size_t length, std::byte* out) noexcept
+{
+#ifdef TORRENTTOOLS_HAS_SHA256_LANES
+    switch (sha256_lane_count()) {
+    case 16:
+        sha256_x16_avx512(messages, length, out);
+        return;
+    case 8:
+        sha256_x8_avx2(messages, length, out);
+        return;
+    }
+#endif
+}
+
+} // namespace torrenttools
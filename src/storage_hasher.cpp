@@ -0,0 +1,525 @@
+#include <algorithm>
+#include <condition_variable>
+
+#include <fmt/format.h>
+
+#include <dottorrent/checksum.hpp>
+#include <dottorrent/file_entry.hpp>
+
+#include "storage_hasher.hpp"
+
+namespace torrenttools {
+
+storage_hasher::storage_hasher(dt::file_storage& storage, const hash_pipeline_options& options,
+                               std::optional<hash_cache> cache, std::optional<checkpoint_options> checkpoint)
+    : hash_pipeline(storage, options, false)
+    , cache_(std::move(cache))
+    , checkpoint_options_(std::move(checkpoint))
+{
+    // Padding files are added before hashing starts so progress reporting sees the final file list.
+    if ((options_.protocol_version & dt::protocol::hybrid) == dt::protocol::hybrid) {
+        auto has_padding = std::any_of(storage_.begin(), storage_.end(),
+                [](const dt::file_entry& e) { return e.is_padding_file(); });
+        if (!has_padding) {
+            add_padding_files();
+        }
+    }
+}
+
+storage_hasher::~storage_hasher()
+{
+    // Stop all threads before the members used by the hooks are destroyed.
+    if (started() && !done()) {
+        cancel();
+    }
+    try {
+        wait();
+    }
+    catch (...) {}
+    if (checkpoint_thread_.joinable()) {
+        checkpoint_thread_.request_stop();
+        checkpoint_thread_.join();
+    }
+}
+
+void storage_hasher::prepare()
+{
+    if ((options_.protocol_version & dt::protocol::v1) == dt::protocol::v1) {
+        storage_.allocate_pieces();
+    }
+    if (cache_ || checkpoint_options_) {
+        computed_.assign(storage_.file_count(), {});
+    }
+    if (cache_) {
+        load_from_cache();
+    }
+    else {
+        set_scanned_file_devices();
+    }
+    if (checkpoint_options_) {
+        open_checkpoint();
+    }
+}
+
+std::size_t storage_hasher::cached_file_count() const noexcept
+{
+    return cached_file_count_;
+}
+
+std::pair<std::size_t, std::size_t> storage_hasher::interior_pieces(std::size_t stream_offset,
+                                                                    std::size_t file_size) const
+{
+    const auto piece_size = storage_.piece_size();
+    auto first = (stream_offset + piece_size - 1) / piece_size;
+    auto last = (stream_offset + file_size) / piece_size;
+    return {first, std::max(first, last)};
+}
+
+void storage_hasher::set_file_identities(std::vector<std::optional<file_identity>> identities)
+{
+    file_identities_ = std::move(identities);
+}
+
+void storage_hasher::set_scanned_file_devices()
+{
+    // index of the file among the non padding files, in which file identities are given
+    std::size_t regular_index = 0;
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        if (storage_.at(i).is_padding_file()) {
+            continue;
+        }
+        const auto j = regular_index++;
+        if (j < file_identities_.size() && file_identities_[j]) {
+            set_file_device(i, file_identities_[j]->device);
+        }
+    }
+}
+
+void storage_hasher::load_from_cache()
+{
+    const bool v1 = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    const auto piece_size = storage_.piece_size();
+    const auto file_count = storage_.file_count();
+    cache_keys_.assign(file_count, std::nullopt);
+
+    std::size_t offset = 0;
+    // index of the file among the non padding files, in which file identities are given
+    std::size_t regular_index = 0;
+    for (std::size_t i = 0; i < file_count; ++i) {
+        const auto& entry = storage_.at(i);
+        const auto stream_offset = offset;
+        offset += entry.file_size();
+
+        if (entry.is_padding_file()) {
+            continue;
+        }
+        const auto j = regular_index++;
+        // empty files are never read
+        if (entry.file_size() == 0) {
+            continue;
+        }
+        auto identity = j < file_identities_.size() && file_identities_[j]
+                ? file_identities_[j]
+                : read_file_identity(storage_.root_directory() / entry.path());
+        if (!identity) {
+            continue;
+        }
+        set_file_device(i, identity->device);
+        if (identity->size != entry.file_size()) {
+            continue;
+        }
+        // v2 hashes do not depend on the position of the file in the v1 data stream
+        cache_keys_[i] = hash_cache_key{
+                .file = *identity, .piece_size = piece_size, .alignment = v1 ? stream_offset % piece_size : 0};
+
+        if (auto cached = cache_->load(*cache_keys_[i]); cached && apply_cache_entry(i, stream_offset, *cached)) {
+            skip_file(i);
+            ++cached_file_count_;
+        }
+    }
+}
+
+bool storage_hasher::apply_cache_entry(std::size_t file_index, std::size_t stream_offset,
+                                       const hash_cache_entry& cached)
+{
+    const bool v1 = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    const bool v2 = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+    const auto piece_size = storage_.piece_size();
+    auto& entry = storage_.at(file_index);
+    const auto file_size = entry.file_size();
+    const auto [first_piece, last_piece] = interior_pieces(stream_offset, file_size);
+
+    for (auto f : options_.checksums) {
+        if (!cached.find_checksum(f)) {
+            return false;
+        }
+    }
+    if (v1 && cached.pieces.size() != last_piece - first_piece) {
+        return false;
+    }
+    // In hybrid storage the last piece of a file is padded, except for the last file.
+    const bool has_tail_piece = v1 && v2 && file_size % piece_size != 0;
+    if (has_tail_piece && (!cached.padded_tail_piece || file_index + 1 == storage_.file_count())) {
+        return false;
+    }
+    if (v2) {
+        auto piece_count = (file_size + piece_size - 1) / piece_size;
+        if (!cached.pieces_root || cached.piece_layer.size() != (piece_count > 1 ? piece_count : 0)) {
+            return false;
+        }
+    }
+
+    if (v1) {
+        for (auto piece = first_piece; piece < last_piece; ++piece) {
+            storage_.set_piece_hash(piece, cached.pieces[piece - first_piece]);
+            if (!v2) {
+                skip_piece(piece);
+            }
+        }
+        if (has_tail_piece) {
+            storage_.set_piece_hash(last_piece, *cached.padded_tail_piece);
+        }
+    }
+    if (v2) {
+        entry.set_pieces_root(*cached.pieces_root);
+        entry.set_piece_layer(cached.piece_layer);
+    }
+    for (auto f : options_.checksums) {
+        entry.add_checksum(dt::make_checksum_from_hash(f, *cached.find_checksum(f)));
+    }
+    return true;
+}
+
+void storage_hasher::update_cache()
+{
+    if (!cache_) {
+        return;
+    }
+    const bool v1 = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    const bool v2 = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+    const auto piece_size = storage_.piece_size();
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        const auto& entry = storage_.at(i);
+        const auto stream_offset = offset;
+        offset += entry.file_size();
+
+        if (!cache_keys_[i] || is_skipped(i)) {
+            continue;
+        }
+        // Do not cache hashes of files that were modified while hashing.
+        // This needs a new stat of each file, the identity from the scan predates the read.
+        if (read_file_identity(storage_.root_directory() / entry.path()) != cache_keys_[i]->file) {
+            continue;
+        }
+        auto& result = computed_[i];
+        if (v1) {
+            const auto [first_piece, last_piece] = interior_pieces(stream_offset, entry.file_size());
+            for (auto piece = first_piece; piece < last_piece; ++piece) {
+                result.pieces.push_back(storage_.get_piece_hash(piece));
+            }
+            if (v2 && entry.file_size() % piece_size != 0 && i + 1 != storage_.file_count()) {
+                result.padded_tail_piece = storage_.get_piece_hash(last_piece);
+            }
+        }
+        cache_->store(*cache_keys_[i], result);
+        result = {};
+    }
+}
+
+std::size_t storage_hasher::resumed_file_count() const noexcept
+{
+    return resumed_file_count_;
+}
+
+std::size_t storage_hasher::resumed_piece_count() const noexcept
+{
+    return resumed_piece_count_;
+}
+
+std::size_t storage_hasher::expected_results(std::size_t file_index) const
+{
+    const auto& entry = storage_.at(file_index);
+    if (entry.is_padding_file()) {
+        return 0;
+    }
+    const bool v2 = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+    return (v2 && entry.file_size() != 0 ? 1 : 0) + options_.checksums.size();
+}
+
+void storage_hasher::open_checkpoint()
+{
+    const auto& options = *checkpoint_options_;
+    const auto signature = make_checkpoint_signature(storage_, options_.protocol_version, options_.checksums);
+
+    if ((options_.protocol_version & dt::protocol::v1) == dt::protocol::v1) {
+        piece_states_ = std::make_unique<std::atomic<char>[]>(storage_.piece_count());
+    }
+    file_results_ = std::make_unique<std::atomic_size_t[]>(storage_.file_count());
+    file_written_.assign(storage_.file_count(), 0);
+
+    const bool resume = options.resume && fs::exists(options.path);
+    if (resume) {
+        resume_from(read_checkpoint(options.path, signature));
+    }
+    checkpoint_.emplace(options.path, signature, resume);
+
+    checkpoint_thread_ = std::jthread([this, interval = options.interval](std::stop_token stop_token) {
+        std::mutex mutex;
+        std::condition_variable_any cv;
+        std::unique_lock lck(mutex);
+
+        while (!cv.wait_for(lck, stop_token, interval, [] { return false; }) && !stop_token.stop_requested()) {
+            try {
+                write_checkpoint();
+            }
+            catch (...) {
+                // checkpoints are best effort while hashing, errors are reported by the final write
+                break;
+            }
+            if (done()) {
+                break;
+            }
+        }
+    });
+}
+
+void storage_hasher::resume_from(const checkpoint_state& state)
+{
+    const bool v1 = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    const bool v2 = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+    const auto piece_size = storage_.piece_size();
+    const auto file_count = storage_.file_count();
+    const auto piece_count = v1 ? storage_.piece_count() : 0;
+
+    std::vector<const dt::sha1_hash*> pieces(piece_count, nullptr);
+    for (const auto& [index, hash] : state.pieces) {
+        if (index < piece_count) {
+            pieces[index] = &hash;
+        }
+    }
+
+    std::vector<std::size_t> offsets(file_count);
+    for (std::size_t i = 0, offset = 0; i < file_count; ++i) {
+        offsets[i] = offset;
+        offset += storage_.at(i).file_size();
+    }
+    // all v1 pieces containing data of a file
+    auto file_pieces = [&](std::size_t index) {
+        auto first = offsets[index] / piece_size;
+        auto last = (offsets[index] + storage_.at(index).file_size() + piece_size - 1) / piece_size;
+        return std::pair(first, last);
+    };
+
+    for (const auto& [index, cached] : state.files) {
+        if (index >= file_count || is_skipped(index) || storage_.at(index).is_padding_file()) {
+            continue;
+        }
+        auto& entry = storage_.at(index);
+        bool complete = !(v2 && entry.file_size() != 0 && !cached.pieces_root);
+        for (auto f : options_.checksums) {
+            complete = complete && cached.find_checksum(f);
+        }
+        // hybrid files are read as a whole, so all their pieces must be restored
+        if (v1 && v2) {
+            auto [first, last] = file_pieces(index);
+            complete = complete && std::all_of(pieces.begin() + first, pieces.begin() + last,
+                                               [](const auto* p) { return p != nullptr; });
+        }
+        if (!complete) {
+            continue;
+        }
+
+        if (v2 && entry.file_size() != 0) {
+            entry.set_pieces_root(*cached.pieces_root);
+            entry.set_piece_layer(cached.piece_layer);
+        }
+        for (auto f : options_.checksums) {
+            entry.add_checksum(dt::make_checksum_from_hash(f, *cached.find_checksum(f)));
+        }
+        if (v1 && v2) {
+            auto [first, last] = file_pieces(index);
+            for (auto piece = first; piece < last; ++piece) {
+                storage_.set_piece_hash(piece, *pieces[piece]);
+                piece_states_[piece] = 2;
+                ++resumed_piece_count_;
+            }
+        }
+        file_written_[index] = 1;
+        file_results_[index] = expected_results(index);
+        skip_file(index);
+        ++resumed_file_count_;
+    }
+
+    if (!v1 || v2) {
+        return;
+    }
+    // v1 pieces can be skipped, unless they contain data of a file of which the checksums are still needed.
+    std::vector<char> required(piece_count, 0);
+    if (!options_.checksums.empty()) {
+        for (std::size_t i = 0; i < file_count; ++i) {
+            const auto& entry = storage_.at(i);
+            if (entry.is_padding_file() || entry.file_size() == 0 || is_skipped(i)) {
+                continue;
+            }
+            auto [first, last] = file_pieces(i);
+            std::fill(required.begin() + first, required.begin() + last, 1);
+        }
+    }
+    for (std::size_t piece = 0; piece < piece_count; ++piece) {
+        if (pieces[piece] && !required[piece]) {
+            storage_.set_piece_hash(piece, *pieces[piece]);
+            piece_states_[piece] = 2;
+            skip_piece(piece);
+            ++resumed_piece_count_;
+        }
+    }
+}
+
+void storage_hasher::write_checkpoint()
+{
+    std::unique_lock lck(checkpoint_mutex_);
+    if (!checkpoint_) {
+        return;
+    }
+    const bool v1 = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    const bool v2 = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+    const auto piece_size = storage_.piece_size();
+
+    // append runs of consecutive pieces hashed since the last write
+    if (piece_states_) {
+        const auto piece_count = storage_.piece_count();
+        std::vector<dt::sha1_hash> run {};
+        std::size_t run_start = 0;
+
+        for (std::size_t piece = 0; piece <= piece_count; ++piece) {
+            if (piece < piece_count && piece_states_[piece].load(std::memory_order_acquire) == 1) {
+                if (run.empty()) {
+                    run_start = piece;
+                }
+                run.push_back(storage_.get_piece_hash(piece));
+                piece_states_[piece].store(2, std::memory_order_relaxed);
+            }
+            else if (!run.empty()) {
+                checkpoint_->add_pieces(run_start, run);
+                run.clear();
+            }
+        }
+    }
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        const auto& entry = storage_.at(i);
+        const auto stream_offset = offset;
+        offset += entry.file_size();
+
+        const auto expected = expected_results(i);
+        if (expected == 0 || file_written_[i] || file_results_[i].load(std::memory_order_acquire) != expected) {
+            continue;
+        }
+        // a hybrid file is only complete when all its pieces are in the checkpoint
+        if (v1 && v2) {
+            auto first = stream_offset / piece_size;
+            auto last = (stream_offset + entry.file_size() + piece_size - 1) / piece_size;
+            bool pieces_written = true;
+            for (auto piece = first; piece < last && pieces_written; ++piece) {
+                pieces_written = piece_states_[piece].load(std::memory_order_relaxed) == 2;
+            }
+            if (!pieces_written) {
+                continue;
+            }
+        }
+
+        hash_cache_entry result {};
+        {
+            std::unique_lock entry_lck(file_entry_mutex_);
+            result.pieces_root = computed_[i].pieces_root;
+            result.piece_layer = computed_[i].piece_layer;
+            result.checksums = computed_[i].checksums;
+        }
+        checkpoint_->add_file(i, result);
+        file_written_[i] = 1;
+    }
+    checkpoint_->flush();
+}
+
+void storage_hasher::remove_checkpoint()
+{
+    if (checkpoint_thread_.joinable()) {
+        checkpoint_thread_.request_stop();
+        checkpoint_thread_.join();
+    }
+    std::unique_lock lck(checkpoint_mutex_);
+    if (checkpoint_) {
+        checkpoint_->remove();
+        checkpoint_.reset();
+    }
+}
+
+void storage_hasher::add_padding_files()
+{
+    const auto piece_size = storage_.piece_size();
+
+    dt::file_storage padded_storage {};
+    padded_storage.set_piece_size(piece_size);
+    padded_storage.set_root_directory(storage_.root_directory());
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < storage_.file_count(); ++i) {
+        const auto& entry = storage_.at(i);
+        padded_storage.add_file(entry);
+        offset += entry.file_size();
+
+        // BEP 47: the last file is never padded
+        if (i + 1 == storage_.file_count() || offset % piece_size == 0) {
+            continue;
+        }
+        auto padding_size = piece_size - offset % piece_size;
+        padded_storage.add_file(dt::file_entry(
+                fs::path(".pad") / std::to_string(padding_size), padding_size,
+                dt::file_attributes::padding_file));
+        offset += padding_size;
+    }
+
+    padded_storage.set_file_mode(storage_.file_mode());
+    storage_ = std::move(padded_storage);
+}
+
+void storage_hasher::on_piece_hash(std::size_t piece_index, const dt::sha1_hash& hash)
+{
+    storage_.set_piece_hash(piece_index, hash);
+    if (piece_states_) {
+        piece_states_[piece_index].store(1, std::memory_order_release);
+    }
+}
+
+void storage_hasher::on_file_hash(std::size_t file_index, merkle_result&& result)
+{
+    std::unique_lock lck(file_entry_mutex_);
+    if (!computed_.empty()) {
+        computed_[file_index].pieces_root = result.pieces_root;
+        computed_[file_index].piece_layer = result.piece_layer;
+    }
+    if (file_results_) {
+        file_results_[file_index].fetch_add(1, std::memory_order_release);
+    }
+    auto& entry = storage_.at(file_index);
+    entry.set_pieces_root(result.pieces_root);
+    entry.set_piece_layer(std::move(result.piece_layer));
+}
+
+void storage_hasher::on_file_checksum(std::size_t file_index, dt::hash_function function,
+                                      std::span<const std::byte> value)
+{
+    std::unique_lock lck(file_entry_mutex_);
+    if (!computed_.empty()) {
+        computed_[file_index].checksums.emplace_back(function, std::vector<std::byte>(value.begin(), value.end()));
+    }
+    if (file_results_) {
+        file_results_[file_index].fetch_add(1, std::memory_order_release);
+    }
+    storage_.at(file_index).add_checksum(dt::make_checksum_from_hash(function, value));
+}
+
+} // namespace torrenttools
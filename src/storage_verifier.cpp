@@ -0,0 +1,174 @@
+#include <algorithm>
+
+#include <dottorrent/file_entry.hpp>
+
+#include "storage_verifier.hpp"
+
+namespace torrenttools {
+
+storage_verifier::storage_verifier(dt::file_storage& storage, const hash_pipeline_options& options)
+    : hash_pipeline(storage, options, true)
+{
+    // a clone would also copy the pieces that fail verification
+    options_.clone_copies = false;
+
+    const auto piece_size = storage_.piece_size();
+    const auto file_count = storage_.file_count();
+
+    file_offsets_.reserve(file_count);
+    file_pieces_done_.resize(file_count);
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < file_count; ++i) {
+        const auto& entry = storage_.at(i);
+        file_indices_.emplace(&entry, i);
+        file_offsets_.push_back(offset);
+        offset += entry.file_size();
+
+        if (!entry.is_padding_file()) {
+            file_pieces_done_[i].resize((entry.file_size() + piece_size - 1) / piece_size);
+        }
+    }
+    pieces_done_.resize((offset + piece_size - 1) / piece_size);
+}
+
+double storage_verifier::percentage(const dt::file_entry& entry) const
+{
+    return percentage(file_indices_.at(&entry));
+}
+
+double storage_verifier::percentage(std::size_t file_index) const
+{
+    if (storage_.at(file_index).file_size() == 0) {
+        return 1.0;
+    }
+    if ((protocol() & dt::protocol::v2) == dt::protocol::v2) {
+        return v2_percentage(file_index);
+    }
+    return v1_percentage(file_index);
+}
+
+const std::vector<char>& storage_verifier::pieces_done() const noexcept
+{
+    return pieces_done_;
+}
+
+std::vector<std::size_t> storage_verifier::failed_pieces(std::size_t file_index) const
+{
+    const auto& entry = storage_.at(file_index);
+    std::vector<std::size_t> failed {};
+    if (entry.is_padding_file() || entry.file_size() == 0) {
+        return failed;
+    }
+    if ((protocol() & dt::protocol::v2) == dt::protocol::v2) {
+        const auto& done = file_pieces_done_[file_index];
+        for (std::size_t i = 0; i < done.size(); ++i) {
+            if (!done[i]) {
+                failed.push_back(i);
+            }
+        }
+        return failed;
+    }
+    const auto piece_size = storage_.piece_size();
+    const auto offset = file_offsets_[file_index];
+    for (auto i = offset / piece_size; i < (offset + entry.file_size() + piece_size - 1) / piece_size; ++i) {
+        if (!pieces_done_[i]) {
+            failed.push_back(i);
+        }
+    }
+    return failed;
+}
+
+double storage_verifier::v1_percentage(std::size_t file_index) const
+{
+    const auto piece_size = storage_.piece_size();
+    const auto offset = file_offsets_[file_index];
+    const auto size = storage_.at(file_index).file_size();
+
+    auto first = pieces_done_.begin() + offset / piece_size;
+    auto last = pieces_done_.begin() + (offset + size + piece_size - 1) / piece_size;
+    return double(std::count(first, last, 1)) / double(std::distance(first, last));
+}
+
+double storage_verifier::v2_percentage(std::size_t file_index) const
+{
+    const auto& done = file_pieces_done_[file_index];
+    if (done.empty()) {
+        return 1.0;
+    }
+    return double(std::count(done.begin(), done.end(), 1)) / double(done.size());
+}
+
+void storage_verifier::on_piece_hash(std::size_t piece_index, const dt::sha1_hash& hash)
+{
+    pieces_done_[piece_index] = (storage_.get_piece_hash(piece_index) == hash);
+}
+
+void storage_verifier::on_file_hash(std::size_t file_index, merkle_result&& result)
+{
+    const auto& entry = storage_.at(file_index);
+    auto& done = file_pieces_done_[file_index];
+
+    // Pieces of files with a piece layer are verified by on_piece_layer_hash as they are hashed,
+    // other workers may still be copying those pieces.
+    if (entry.file_size() > storage_.piece_size() && !entry.piece_layer().empty()) {
+        return;
+    }
+    if (result.pieces_root == entry.pieces_root()) {
+        std::fill(done.begin(), done.end(), 1);
+    }
+    // a piece with missing data can not pass, even when the data happens to be all zeros
+    for (auto i : result.unavailable_pieces) {
+        done[i] = 0;
+    }
+}
+
+void storage_verifier::on_piece_layer_hash(std::size_t file_index, std::size_t piece_index,
+                                           const dt::sha256_hash& hash)
+{
+    const auto& expected = storage_.at(file_index).piece_layer();
+    if (piece_index < expected.size()) {
+        file_pieces_done_[file_index][piece_index] = (hash == expected[piece_index]);
+    }
+}
+
+void storage_verifier::select_copy_ranges(const data_chunk& chunk, std::vector<data_range>& ranges)
+{
+    const auto piece_size = storage_.piece_size();
+
+    // merge adjacent pieces so they are written in a single call
+    auto add_range = [&](std::size_t offset, std::size_t length) {
+        if (!ranges.empty() && ranges.back().offset + ranges.back().length == offset) {
+            ranges.back().length += length;
+        } else {
+            ranges.push_back({ .offset = offset, .length = length });
+        }
+    };
+
+    // all pieces of the chunk were verified by the worker that hashed it
+    if ((protocol() & dt::protocol::v2) == dt::protocol::v2) {
+        std::size_t pos = 0;
+        for (const auto& segment : chunk.request->segments) {
+            const auto& entry = storage_.at(segment.file_index);
+            if (!entry.is_padding_file()) {
+                const auto& done = file_pieces_done_[segment.file_index];
+                for (std::size_t offset = 0; offset < segment.length; offset += piece_size) {
+                    if (done[(segment.file_offset + offset) / piece_size]) {
+                        add_range(pos + offset, std::min(piece_size, segment.length - offset));
+                    }
+                }
+            }
+            pos += segment.length;
+        }
+    }
+    else {
+        const auto first_piece = chunk.request->offset / piece_size;
+        for (std::size_t offset = 0; offset < chunk.data.size(); offset += piece_size) {
+            if (pieces_done_[first_piece + offset / piece_size]) {
+                add_range(offset, std::min(piece_size, chunk.data.size() - offset));
+            }
+        }
+    }
+}
+
+} // namespace torrenttools
@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+
+#include <fmt/format.h>
+
+#include <dottorrent/checksum.hpp>
+#include <dottorrent/file_entry.hpp>
+#include <dottorrent/hasher/factory.hpp>
+
+#include "path_arena.hpp"
+#include "tar_hasher.hpp"
+
+namespace torrenttools {
+
+namespace {
+
+constexpr std::size_t v2_block_size = 16 * 1024;
+
+template <typename Hash, std::size_t N>
+Hash to_hash(const std::array<std::byte, N>& digest)
+{
+    return Hash(std::string_view(reinterpret_cast<const char*>(digest.data()), digest.size()));
+}
+
+/// Return the root of a merkle tree of the given height with only zero leaves.
+std::array<std::byte, dt::sha256_hash::size_bytes> zero_subtree_root(std::size_t height)
+{
+    std::array<std::byte, dt::sha256_hash::size_bytes> node {};
+    for (std::size_t i = 0; i < height; ++i) {
+        auto hasher = dt::make_hasher(dt::hash_function::sha256);
+        hasher->update(node);
+        hasher->update(node);
+        hasher->finalize_to(node);
+    }
+    return node;
+}
+
+} // namespace
+
+
+tar_hasher::tar_hasher(std::istream& input, std::size_t piece_size, const hash_pipeline_options& options)
+    : input_(input)
+    , piece_size_(piece_size)
+    , options_(options)
+{
+    v1_ = (options_.protocol_version & dt::protocol::v1) == dt::protocol::v1;
+    v2_ = (options_.protocol_version & dt::protocol::v2) == dt::protocol::v2;
+    hybrid_ = v1_ && v2_;
+
+    if (!v1_ && !v2_) {
+        throw std::invalid_argument("invalid protocol version");
+    }
+    if (piece_size_ < v2_block_size || !std::has_single_bit(piece_size_)) {
+        throw std::invalid_argument("piece size must be a power of two larger or equal to 16 KiB");
+    }
+    if (v1_) {
+        sha1_ = make_block_hasher(options_.hash_backends.sha1, dt::hash_function::sha1);
+        piece_buffer_.resize(piece_size_);
+    }
+    if (v2_) {
+        sha256_ = make_block_hasher(options_.hash_backends.sha256, dt::hash_function::sha256);
+    }
+    read_buffer_.resize(piece_size_);
+}
+
+void tar_hasher::run()
+{
+    tar_reader reader(input_);
+    std::unordered_set<std::string> paths {};
+    std::string previous_path {};
+
+    while (auto member = reader.next()) {
+        bytes_read_.store(reader.position(), std::memory_order_relaxed);
+
+        if (member->type == tar_member::kind::other) {
+            ++skipped_member_count_;
+            continue;
+        }
+        if (member->type != tar_member::kind::regular_file) {
+            continue;
+        }
+        if (member->path.empty()) {
+            throw std::runtime_error("tar archive contains a file without a name");
+        }
+        // appending to an archive can add a newer version of a file, which can not be represented in a torrent
+        if (!paths.insert(member->path.generic_string()).second) {
+            throw std::runtime_error(fmt::format(
+                    "tar archive contains {} more than once", member->path.string()));
+        }
+        // The v1 file list of hybrid torrents must be in the order of the v2 file tree,
+        // which is the order in which files of a target directory are added.
+        if (hybrid_ && path_less(member->path.string(), previous_path)) {
+            throw std::runtime_error(fmt::format(
+                    "hybrid torrents require the files of the tar archive to be sorted by path, "
+                    "{} follows {}: create the archive with tar --sort=name",
+                    member->path.string(), previous_path));
+        }
+        previous_path = member->path.string();
+        hash_member(reader, *member);
+    }
+    bytes_read_.store(reader.position(), std::memory_order_relaxed);
+
+    // the last piece of the v1 data stream is not padded
+    if (v1_ && piece_fill_ != 0) {
+        finish_v1_piece();
+    }
+}
+
+std::size_t tar_hasher::bytes_done() const noexcept
+{
+    return bytes_done_.load(std::memory_order_relaxed);
+}
+
+std::size_t tar_hasher::bytes_read() const noexcept
+{
+    return bytes_read_.load(std::memory_order_relaxed);
+}
+
+std::size_t tar_hasher::files_done() const noexcept
+{
+    return files_done_.load(std::memory_order_relaxed);
+}
+
+std::size_t tar_hasher::skipped_member_count() const noexcept
+{
+    return skipped_member_count_;
+}
+
+std::optional<fs::path> tar_hasher::common_root() const
+{
+    std::optional<fs::path> root {};
+    for (const auto& file : files_) {
+        if (file.is_padding_file) {
+            continue;
+        }
+        auto first = *file.path.begin();
+        // a file in the top level directory
+        if (first == file.path) {
+            return std::nullopt;
+        }
+        if (!root) {
+            root = first;
+        }
+        else if (*root != first) {
+            return std::nullopt;
+        }
+    }
+    return root;
+}
+
+void tar_hasher::set_files(dt::file_storage& storage, bool strip_root) const
+{
+    const auto root = strip_root ? common_root() : std::nullopt;
+    storage.set_piece_size(piece_size_);
+
+    for (const auto& file : files_) {
+        auto path = file.path;
+        if (root && !file.is_padding_file) {
+            path = file.path.lexically_relative(*root);
+        }
+        dt::file_entry entry(path, file.size,
+                             file.is_padding_file ? dt::file_attributes::padding_file : dt::file_attributes::none);
+        if (file.hashes.pieces_root) {
+            entry.set_pieces_root(*file.hashes.pieces_root);
+            entry.set_piece_layer(file.hashes.piece_layer);
+        }
+        for (const auto& [function, digest] : file.hashes.checksums) {
+            entry.add_checksum(dt::make_checksum_from_hash(function, digest));
+        }
+        storage.add_file(entry);
+    }
+
+    if (v1_) {
+        storage.allocate_pieces();
+        for (std::size_t i = 0; i < pieces_.size(); ++i) {
+            storage.set_piece_hash(i, pieces_[i]);
+        }
+    }
+}
+
+void tar_hasher::hash_member(tar_reader& reader, const tar_member& member)
+{
+    // BEP 47: align every file to a piece boundary, padding is only inserted between files
+    // so the last file is never padded
+    if (hybrid_ && stream_offset_ % piece_size_ != 0) {
+        const auto padding = piece_size_ - stream_offset_ % piece_size_;
+        files_.push_back({ .path = fs::path(".pad") / std::to_string(padding), .size = padding,
+                           .is_padding_file = true, .hashes = {} });
+        std::fill(piece_buffer_.begin() + piece_fill_, piece_buffer_.end(), std::byte{});
+        piece_fill_ = piece_size_;
+        finish_v1_piece();
+        stream_offset_ += padding;
+    }
+
+    file_record record { .path = member.path, .size = member.size, .is_padding_file = false, .hashes = {} };
+
+    std::vector<std::pair<dt::hash_function, std::unique_ptr<dt::hasher>>> checksum_hashers {};
+    for (auto f : options_.checksums) {
+        checksum_hashers.emplace_back(f, dt::make_hasher(f));
+    }
+
+    const bool has_piece_layer = member.size > piece_size_;
+    std::vector<sha256_digest> nodes {};
+
+    for (std::size_t remaining = member.size; remaining != 0;) {
+        auto data = std::span(read_buffer_).first(std::min(remaining, piece_size_));
+        reader.read(data);
+
+        if (v1_) {
+            add_v1_data(data);
+        }
+        if (v2_) {
+            hash_v2_piece(data, has_piece_layer, nodes);
+        }
+        for (auto& [f, hasher] : checksum_hashers) {
+            hasher->update(data);
+        }
+        remaining -= data.size();
+        bytes_done_.fetch_add(data.size(), std::memory_order_relaxed);
+        bytes_read_.store(reader.position(), std::memory_order_relaxed);
+    }
+    stream_offset_ += member.size;
+
+    // Pad the layer to a power of two with the roots of subtrees of zero leaves and reduce it to the root.
+    if (v2_ && member.size != 0) {
+        if (has_piece_layer) {
+            record.hashes.piece_layer.reserve(nodes.size());
+            for (const auto& node : nodes) {
+                record.hashes.piece_layer.push_back(to_hash<dt::sha256_hash>(node));
+            }
+        }
+        auto padding = has_piece_layer ? zero_subtree_root(std::countr_zero(piece_size_ / v2_block_size))
+                                       : sha256_digest{};
+        nodes.resize(std::bit_ceil(nodes.size()), padding);
+        reduce_layer(nodes, std::countr_zero(nodes.size()));
+        record.hashes.pieces_root = to_hash<dt::sha256_hash>(nodes.front());
+    }
+
+    for (auto& [f, hasher] : checksum_hashers) {
+        std::vector<std::byte> digest(hasher->digest_size());
+        hasher->finalize_to(digest);
+        record.hashes.checksums.emplace_back(f, std::move(digest));
+    }
+
+    files_.push_back(std::move(record));
+    files_done_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void tar_hasher::add_v1_data(std::span<const std::byte> data)
+{
+    while (!data.empty()) {
+        // hash whole pieces in place when the stream is aligned
+        if (piece_fill_ == 0 && data.size() >= piece_size_) {
+            std::array<std::byte, dt::sha1_hash::size_bytes> digest {};
+            std::span<const std::byte> input = data.first(piece_size_);
+            sha1_->hash(std::span(&input, 1), digest);
+            pieces_.push_back(to_hash<dt::sha1_hash>(digest));
+            data = data.subspan(piece_size_);
+            continue;
+        }
+        auto count = std::min(data.size(), piece_size_ - piece_fill_);
+        std::copy_n(data.begin(), count, piece_buffer_.begin() + piece_fill_);
+        piece_fill_ += count;
+        data = data.subspan(count);
+        if (piece_fill_ == piece_size_) {
+            finish_v1_piece();
+        }
+    }
+}
+
+void tar_hasher::finish_v1_piece()
+{
+    std::array<std::byte, dt::sha1_hash::size_bytes> digest {};
+    std::span<const std::byte> input = std::span(piece_buffer_).first(piece_fill_);
+    sha1_->hash(std::span(&input, 1), digest);
+    pieces_.push_back(to_hash<dt::sha1_hash>(digest));
+    piece_fill_ = 0;
+}
+
+void tar_hasher::hash_v2_piece(std::span<const std::byte> data, bool has_piece_layer, std::vector<sha256_digest>& nodes)
+{
+    std::vector<std::span<const std::byte>> inputs {};
+    for (std::size_t pos = 0; pos < data.size(); pos += v2_block_size) {
+        inputs.push_back(data.subspan(pos, std::min(v2_block_size, data.size() - pos)));
+    }
+    std::vector<sha256_digest> leaves(inputs.size());
+    sha256_->hash(inputs, std::as_writable_bytes(std::span(leaves)));
+
+    if (!has_piece_layer) {
+        // files of a single piece have no piece layer, the leaves are reduced when the file is complete
+        nodes.insert(nodes.end(), leaves.begin(), leaves.end());
+        return;
+    }
+    // the last piece of the file is padded with zero leaves
+    const auto piece_leaves = piece_size_ / v2_block_size;
+    leaves.resize(piece_leaves, sha256_digest{});
+    reduce_layer(leaves, std::countr_zero(piece_leaves));
+    nodes.push_back(leaves.front());
+}
+
+void tar_hasher::reduce_layer(std::vector<sha256_digest>& layer, std::size_t levels)
+{
+    std::vector<std::span<const std::byte>> inputs {};
+    std::vector<sha256_digest> parents {};
+    for (std::size_t level = 0; level < levels; ++level) {
+        inputs.clear();
+        for (std::size_t i = 0; i < layer.size(); i += 2) {
+            inputs.push_back(std::as_bytes(std::span(layer).subspan(i, 2)));
+        }
+        parents.resize(layer.size() / 2);
+        sha256_->hash(inputs, std::as_writable_bytes(std::span(parents)));
+        std::swap(layer, parents);
+    }
+}
+
+} // namespace torrenttools
@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <charconv>
+#include <istream>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+
+#include <fmt/format.h>
+
+#include "tar_reader.hpp"
+
+namespace torrenttools {
+
+namespace {
+
+constexpr std::size_t block_size = 512;
+
+// ustar header fields
+constexpr std::size_t name_offset = 0;
+constexpr std::size_t name_size = 100;
+constexpr std::size_t size_offset = 124;
+constexpr std::size_t size_size = 12;
+constexpr std::size_t checksum_offset = 148;
+constexpr std::size_t checksum_size = 8;
+constexpr std::size_t type_offset = 156;
+constexpr std::size_t magic_offset = 257;
+constexpr std::size_t prefix_offset = 345;
+constexpr std::size_t prefix_size = 155;
+
+/// Return a NUL terminated string field.
+std::string_view string_field(std::string_view field)
+{
+    return field.substr(0, std::min(field.find('\0'), field.size()));
+}
+
+/// Parse an octal number field, or a base-256 number as written by GNU tar for large values.
+std::optional<std::size_t> number_field(std::string_view field)
+{
+    if (!field.empty() && (static_cast<unsigned char>(field.front()) & 0x80) != 0) {
+        std::size_t value = static_cast<unsigned char>(field.front()) & 0x7f;
+        for (auto c : field.substr(1)) {
+            if (value > (std::numeric_limits<std::size_t>::max() >> 8)) {
+                return std::nullopt;
+            }
+            value = (value << 8) | static_cast<unsigned char>(c);
+        }
+        return value;
+    }
+
+    auto first = field.find_first_not_of(' ');
+    if (first == std::string_view::npos) {
+        return 0;
+    }
+    field = field.substr(first);
+    field = field.substr(0, std::min(field.find_first_of(std::string_view(" \0", 2)), field.size()));
+    if (field.empty()) {
+        return 0;
+    }
+    std::size_t value = 0;
+    auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value, 8);
+    if (ec != std::errc{} || ptr != field.data() + field.size()) {
+        return std::nullopt;
+    }
+    return value;
+}
+
+bool is_zero_block(std::span<const char> block)
+{
+    return std::all_of(block.begin(), block.end(), [](char c) { return c == '\0'; });
+}
+
+bool has_valid_checksum(std::span<const char> block)
+{
+    auto expected = number_field(std::string_view(block.data() + checksum_offset, checksum_size));
+    if (!expected) {
+        return false;
+    }
+    // the checksum field itself counts as spaces
+    std::size_t sum = checksum_size * ' ';
+    for (std::size_t i = 0; i < block.size(); ++i) {
+        if (i < checksum_offset || i >= checksum_offset + checksum_size) {
+            sum += static_cast<unsigned char>(block[i]);
+        }
+    }
+    return sum == *expected;
+}
+
+/// Convert a member name to a relative path.
+fs::path make_member_path(std::string_view name)
+{
+    auto path = fs::path(name).lexically_normal();
+    if (path.has_root_path()) {
+        throw std::runtime_error(fmt::format("tar member {} has an absolute path", name));
+    }
+    fs::path result {};
+    for (const auto& part : path) {
+        if (part == "..") {
+            throw std::runtime_error(fmt::format("tar member {} is outside of the archive root", name));
+        }
+        if (part != "." && !part.empty()) {
+            result /= part;
+        }
+    }
+    return result;
+}
+
+} // namespace
+
+
+tar_reader::tar_reader(std::istream& input)
+    : input_(input)
+{}
+
+std::optional<tar_member> tar_reader::next()
+{
+    skip(remaining_ + padding_);
+    remaining_ = 0;
+    padding_ = 0;
+
+    // metadata of the next member from GNU long name and pax extended headers
+    std::optional<std::string> long_name {};
+    std::optional<std::string> pax_path {};
+    std::optional<std::size_t> pax_size {};
+
+    header_block header {};
+    for (;;) {
+        const auto header_position = position_;
+        // the archive ends with zero blocks, archives that are cut off after a member are accepted as well
+        if (!read_header(header) || is_zero_block(header)) {
+            return std::nullopt;
+        }
+        if (!has_valid_checksum(header)) {
+            throw std::runtime_error(fmt::format("invalid tar header at offset {}", header_position));
+        }
+        auto size = number_field(std::string_view(header.data() + size_offset, size_size));
+        if (!size) {
+            throw std::runtime_error(fmt::format("invalid member size in tar header at offset {}", header_position));
+        }
+        const char type = header[type_offset];
+
+        if (type == 'x') {
+            auto records = read_metadata(*size);
+            // records of the form "<length> <key>=<value>\n"
+            for (std::size_t pos = 0; pos < records.size();) {
+                auto space = records.find(' ', pos);
+                std::size_t length = 0;
+                auto [ptr, ec] = std::from_chars(records.data() + pos, records.data() + records.size(), length);
+                if (space == std::string::npos || ec != std::errc{} || ptr != records.data() + space ||
+                    pos + length > records.size() || space + 2 > pos + length) {
+                    throw std::runtime_error(fmt::format("invalid pax header at offset {}", header_position));
+                }
+                auto record = std::string_view(records).substr(space + 1, pos + length - space - 2);
+                pos += length;
+
+                auto equals = record.find('=');
+                if (equals == std::string_view::npos) {
+                    continue;
+                }
+                auto key = record.substr(0, equals);
+                auto value = record.substr(equals + 1);
+                if (key == "path") {
+                    pax_path = std::string(value);
+                }
+                else if (key == "size") {
+                    std::size_t parsed = 0;
+                    auto [p, e] = std::from_chars(value.data(), value.data() + value.size(), parsed);
+                    if (e != std::errc{} || p != value.data() + value.size()) {
+                        throw std::runtime_error(fmt::format("invalid pax size at offset {}", header_position));
+                    }
+                    pax_size = parsed;
+                }
+            }
+            continue;
+        }
+        if (type == 'L') {
+            long_name = std::string(string_field(read_metadata(*size)));
+            continue;
+        }
+        if (type == 'g' || type == 'K') {
+            // global pax headers and long link names do not affect the file list
+            skip(*size + (block_size - *size % block_size) % block_size);
+            continue;
+        }
+        if (type == 'S') {
+            throw std::runtime_error("GNU sparse files in tar archives are not supported");
+        }
+
+        std::string name {};
+        if (pax_path) {
+            name = *pax_path;
+        }
+        else if (long_name) {
+            name = *long_name;
+        }
+        else {
+            name = string_field(std::string_view(header.data() + name_offset, name_size));
+            // POSIX ustar archives split long names in a prefix and a name
+            if (std::string_view(header.data() + magic_offset, 6) == std::string_view("ustar\0", 6)) {
+                auto prefix = string_field(std::string_view(header.data() + prefix_offset, prefix_size));
+                if (!prefix.empty()) {
+                    name = fmt::format("{}/{}", prefix, name);
+                }
+            }
+        }
+        if (pax_size) {
+            size = pax_size;
+        }
+
+        tar_member member { .path = make_member_path(name), .type = tar_member::kind::other, .size = *size };
+        switch (type) {
+        case '0':
+        case '\0':
+        case '7':
+            member.type = tar_member::kind::regular_file;
+            break;
+        case '5':
+            member.type = tar_member::kind::directory;
+            break;
+        case '1':
+        case '2':
+        case '3':
+        case '4':
+        case '6':
+            // links and special files have no data, the size field may hold the size of the link target
+            member.size = 0;
+            break;
+        default:
+            break;
+        }
+
+        remaining_ = member.size;
+        padding_ = (block_size - member.size % block_size) % block_size;
+        return member;
+    }
+}
+
+std::size_t tar_reader::read(std::span<std::byte> data)
+{
+    auto count = std::min(data.size(), remaining_);
+    read_exact(std::span(reinterpret_cast<char*>(data.data()), count));
+    remaining_ -= count;
+    return count;
+}
+
+std::size_t tar_reader::position() const noexcept
+{
+    return position_;
+}
+
+bool tar_reader::read_header(header_block& header)
+{
+    auto count = static_cast<std::size_t>(input_.rdbuf()->sgetn(header.data(), header.size()));
+    position_ += count;
+    if (count == 0) {
+        return false;
+    }
+    if (count != header.size()) {
+        throw std::runtime_error("unexpected end of tar archive");
+    }
+    return true;
+}
+
+void tar_reader::read_exact(std::span<char> data)
+{
+    auto count = static_cast<std::size_t>(input_.rdbuf()->sgetn(data.data(), static_cast<std::streamsize>(data.size())));
+    position_ += count;
+    if (count != data.size()) {
+        throw std::runtime_error("unexpected end of tar archive");
+    }
+}
+
+void tar_reader::skip(std::size_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    input_.ignore(static_cast<std::streamsize>(count));
+    auto skipped = static_cast<std::size_t>(input_.gcount());
+    position_ += skipped;
+    if (skipped != count) {
+        throw std::runtime_error("unexpected end of tar archive");
+    }
+}
+
+std::string tar_reader::read_metadata(std::size_t size)
+{
+    // metadata larger than this is not a path or a set of pax records
+    constexpr std::size_t max_metadata_size = 1024 * 1024;
+    if (size > max_metadata_size) {
+        throw std::runtime_error(fmt::format("tar metadata of {} bytes at offset {} is too large", size, position_));
+    }
+    std::string data(size, '\0');
+    read_exact(data);
+    skip((block_size - size % block_size) % block_size);
+    return data;
+}
+
+} // namespace torrenttools
@@ -159,7 +159,7 @@ std::string format_file_tree(const dottorrent::metafile& m, std::string_view pre
 
 std::string format_verify_file_tree(
         const dottorrent::metafile& m,
-        const dottorrent::storage_verifier& verifier,
+        const torrenttools::storage_verifier& verifier,
         std::string_view prefix,
         const tree_options& options)
 {
@@ -11,6 +11,7 @@
 
 #include "create.hpp"
 #include "progress.hpp"
+#include "cpu_info.hpp"
 
 
 void configure_verify_app(CLI::App* app, verify_app_options& options)
@@ -27,6 +28,42 @@ void configure_verify_app(CLI::App* app, verify_app_options& options)
         options.files_root_directory = path_transformer(v);
         return true;
     };
+    CLI::callback_t io_block_size_parser = [&](const CLI::results_t& v) -> bool {
+        options.io_block_size = io_block_size_transformer(v);
+        return true;
+    };
+    CLI::callback_t threads_parser = [&](const CLI::results_t& v) -> bool {
+        options.threads = threads_transformer(v);
+        return true;
+    };
+    CLI::callback_t io_engine_parser = [&](const CLI::results_t& v) -> bool {
+        options.io_engine = io_engine_transformer(v);
+        return true;
+    };
+    CLI::callback_t io_queue_depth_parser = [&](const CLI::results_t& v) -> bool {
+        options.io_queue_depth = io_queue_depth_transformer(v);
+        return true;
+    };
+    CLI::callback_t max_read_rate_parser = [&](const CLI::results_t& v) -> bool {
+        options.max_read_rate = max_read_rate_transformer(v);
+        return true;
+    };
+    CLI::callback_t max_iops_parser = [&](const CLI::results_t& v) -> bool {
+        options.max_iops = max_iops_transformer(v);
+        return true;
+    };
+    CLI::callback_t hash_backend_parser = [&](const CLI::results_t& v) -> bool {
+        options.hash_backend = hash_backend_transformer(v);
+        return true;
+    };
+    CLI::callback_t read_order_parser = [&](const CLI::results_t& v) -> bool {
+        options.read_order = read_order_transformer(v);
+        return true;
+    };
+    CLI::callback_t copy_to_parser = [&](const CLI::results_t& v) -> bool {
+        options.copy_to = path_transformer(v, /*check_exists=*/false);
+        return true;
+    };
 
     app->add_option("metafile", metafile_transformer,
                "Metafile path.")
@@ -43,16 +80,130 @@ void configure_verify_app(CLI::App* app, verify_app_options& options)
                "Options are 1, 2 or hybrid. [default: highest available]")
        ->type_name("<protocol>");
 
-    app->add_option("-t, --threads", options.threads,
-               "Set the number of threads to use for hashing. [default: 2]")
+    options.threads = 2;
+    app->add_option("-t, --threads", threads_parser,
+               "Set the number of threads to use for hashing.\n"
+               "Use auto to tune the number of threads to the available CPUs. [default: 2]")
+       ->type_name("<n|auto>")
+       ->expected(1);
+
+    app->add_option("--io-block-size", io_block_size_parser,
+               "The size of blocks read from storage.\n"
+               "Must be larger or equal to the piece size.")
+       ->type_name("<size[K|M]>")
+       ->expected(1);
+
+    app->add_option("--io-engine", io_engine_parser,
+               "The method used to read data from storage.\n"
+               "Options are sync, uring or mmap. [default: sync]")
+       ->type_name("<engine>")
+       ->expected(1);
+
+    app->add_option("--io-queue-depth", io_queue_depth_parser,
+               "The number of reads kept in flight by asynchronous io engines. [default: 32]")
+       ->type_name("<n>")
+       ->expected(1);
+
+    app->add_option("--read-order", read_order_parser,
+               "The order in which files are read.\n"
+               "Options are storage, physical or cached. Physical reads files in the order of their location on disk,\n"
+               "cached reads files that are in the page cache first. [default: storage]")
+       ->type_name("<order>")
+       ->expected(1);
+
+    app->add_flag_callback("--direct-io",
+            [&]() { options.direct_io = true; },
+            "Bypass the page cache when reading data from storage.");
+
+    app->add_flag_callback("--drop-cache",
+            [&]() { options.drop_cache = true; },
+            "Drop data that was read from the page cache after it is hashed, except data that was cached before.");
+
+    app->add_option("--max-read-rate", max_read_rate_parser,
+               "Limit the number of bytes read from storage per second, eg. 50M.")
+       ->type_name("<size[K|M|G]>")
+       ->expected(1);
+
+    app->add_option("--max-iops", max_iops_parser,
+               "Limit the number of read operations per second.")
        ->type_name("<n>")
-       ->default_val(2);
+       ->expected(1);
+
+    app->add_flag_callback("--background",
+            [&]() { options.background = true; },
+            "Run with idle cpu and io priority, so other processes are not slowed down.");
+
+    app->add_option("--hash-backend", hash_backend_parser,
+               "The library used to compute piece hashes.\n"
+               "Options are auto, openssl, isal or simd. [default: auto]")
+       ->type_name("<backend>")
+       ->expected(1);
+
+    app->add_flag_callback("--cpu-affinity",
+            [&]() { options.cpu_affinity = true; },
+            "Pin each hashing thread to a separate physical core.");
+
+    app->add_flag_callback("--numa",
+            [&]() { options.numa = true; },
+            "Keep all threads on a single NUMA node and allocate read buffers on that node.");
+
+    app->add_option("--copy-to,--restore-to", copy_to_parser,
+               "Copy the pieces that pass verification to a directory.\n"
+               "Files are read only once, failed pieces are left as holes.")
+       ->type_name("<dir>")
+       ->expected(1);
 }
 
+namespace {
+
+/// Format piece indices as a list of ranges, eg. "0-3, 7".
+std::string format_piece_ranges(const std::vector<std::size_t>& pieces)
+{
+    std::string out {};
+    for (std::size_t i = 0; i < pieces.size();) {
+        auto j = i;
+        while (j + 1 < pieces.size() && pieces[j + 1] == pieces[j] + 1) {
+            ++j;
+        }
+        if (!out.empty()) {
+            out += ", ";
+        }
+        out += (i == j) ? fmt::format("{}", pieces[i]) : fmt::format("{}-{}", pieces[i], pieces[j]);
+        i = j + 1;
+    }
+    return out;
+}
+
+/// Print the pieces that were not copied for each file with failed pieces.
+void print_failed_pieces(std::ostream& os, const dottorrent::metafile& m,
+                         const torrenttools::storage_verifier& verifier)
+{
+    const auto& storage = m.storage();
+    std::string out {};
+    for (std::size_t i = 0; i < storage.file_count(); ++i) {
+        auto failed = verifier.failed_pieces(i);
+        if (failed.empty()) {
+            continue;
+        }
+        out += fmt::format("  {}: {} failed pieces: {}\n",
+                           storage.at(i).path().string(), failed.size(), format_piece_ranges(failed));
+    }
+    if (out.empty()) {
+        os << "\nAll pieces passed verification and were copied.\n";
+    } else {
+        os << "\nFailed pieces, not copied:\n" << out;
+    }
+}
+
+} // namespace
+
 
 void run_verify_app(const main_app_options& main_options, const verify_app_options& options)
 {
     verify_metafile(options.metafile);
+    if (options.background && !torrenttools::set_background_priority()) {
+        throw std::runtime_error("could not lower the cpu and io priority for --background");
+    }
 
     auto m = dottorrent::load_metafile(options.metafile);
 
@@ -61,15 +212,36 @@ void run_verify_app(const main_app_options& main_options, const verify_app_optio
     file_storage.set_root_directory(options.files_root_directory);
 
 
-    dottorrent::storage_verifier_options verifier_options {
+    if (options.io_block_size && *options.io_block_size < file_storage.piece_size()) {
+        throw std::invalid_argument("io-block-size must be larger or equal to the piece size.");
+    }
+
+    torrenttools::hash_pipeline_options verifier_options {
             .protocol_version = options.protocol_version,
-            .threads = options.threads,
+            .min_io_block_size = options.io_block_size,
+            .threads = options.threads.value_or(torrenttools::available_cpu_count()),
+            .engine = options.io_engine,
+            .queue_depth = options.io_queue_depth,
+            .direct_io = options.direct_io,
+            .order = options.read_order,
+            .adaptive = !options.threads.has_value(),
+            .cpu_affinity = options.cpu_affinity,
+            .numa = options.numa,
+            .hash_backends = get_hash_backends(options.hash_backend),
+            .drop_cache = options.drop_cache,
+            .max_read_rate = options.max_read_rate,
+            .max_read_operations = options.max_iops,
     };
 
     // no explicit protocol version given
     if (verifier_options.protocol_version == dottorrent::protocol::none) {
         verifier_options.protocol_version = m.storage().protocol();
     }
+    if (options.copy_to) {
+        // multi-file torrents are restored to a directory named after the torrent, as clients download them
+        verifier_options.copy_to = file_storage.file_mode() == dottorrent::file_mode::multi
+                ? *options.copy_to / m.name() : *options.copy_to;
+    }
 
     bool simple_progress = false;
 #ifdef __unix__
@@ -81,7 +253,7 @@ void run_verify_app(const main_app_options& main_options, const verify_app_optio
     }
 #endif
 
-    auto verifier = dottorrent::storage_verifier(file_storage, verifier_options);
+    auto verifier = torrenttools::storage_verifier(file_storage, verifier_options);
 
     std::cout << "Verifying files...\n";
 
@@ -104,6 +276,11 @@ void run_verify_app(const main_app_options& main_options, const verify_app_optio
 
     std::cout << "\nFiles:\n";
     std::cout << verify_file_tree;
+
+    if (options.copy_to) {
+        print_failed_pieces(std::cout, m, verifier);
+        std::cout << fmt::format("Files copied to: {}\n", verifier_options.copy_to->string());
+    }
 }
 
 
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <set>
+#include <tuple>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "cpu_info.hpp"
+
+namespace tt = torrenttools;
+
+TEST_CASE("test available cpu count")
+{
+    auto cpuset_count = tt::cpuset_cpu_count();
+    auto available_count = tt::available_cpu_count();
+
+    CHECK(cpuset_count >= 1);
+    CHECK(available_count >= 1);
+    CHECK(available_count <= cpuset_count);
+
+    if (auto quota = tt::cgroup_cpu_quota(); quota) {
+        CHECK(*quota > 0);
+    }
+}
+
+
+TEST_CASE("test cpu topology")
+{
+    auto cpus = tt::read_cpu_topology();
+#ifdef __linux__
+    CHECK(cpus.size() == tt::cpuset_cpu_count());
+#endif
+
+    SECTION("thread placement") {
+        auto placement = tt::make_thread_placement(3, false);
+        if (cpus.empty()) {
+            CHECK(placement.hasher_cpus.empty());
+            return;
+        }
+        REQUIRE(placement.hasher_cpus.size() == 3);
+        CHECK_FALSE(placement.numa_node);
+
+        // different physical cores are used before SMT siblings
+        std::set<std::tuple<int, int, int>> cores;
+        for (const auto& cpu : cpus) {
+            cores.emplace(cpu.numa_node, cpu.package_id, cpu.core_id);
+        }
+        std::set<int> used(placement.hasher_cpus.begin(), placement.hasher_cpus.end());
+        CHECK(used.size() == std::min<std::size_t>(3, cores.size()));
+    }
+
+    SECTION("numa placement") {
+        auto placement = tt::make_thread_placement(2, true);
+        if (cpus.empty()) {
+            return;
+        }
+        REQUIRE(placement.numa_node);
+        for (int cpu : placement.hasher_cpus) {
+            auto it = std::find_if(cpus.begin(), cpus.end(), [=](const auto& c) { return c.id == cpu; });
+            REQUIRE(it != cpus.end());
+            CHECK(it->numa_node == *placement.numa_node);
+        }
+    }
+}
+
+TEST_CASE("test format_cpu_list")
+{
+    CHECK(tt::format_cpu_list(std::vector<int>{}) == "");
+    CHECK(tt::format_cpu_list(std::vector{0}) == "0");
+    CHECK(tt::format_cpu_list(std::vector{3, 0, 1, 2, 8, 10, 11}) == "0-3,8,10-11");
+    CHECK(tt::format_cpu_list(std::vector{1, 1, 2}) == "1-2");
+}
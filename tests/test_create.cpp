@@ -1,12 +1,26 @@
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdio>
+#include <cstring>
 #include <experimental/source_location>
+#include <fstream>
+#include <sstream>
+#include <thread>
 
 #include <catch2/catch.hpp>
 #include <fmt/format.h>
 #include <CLI/CLI.hpp>
 
 #include <dottorrent/dht_node.hpp>
+#include <dottorrent/hasher/factory.hpp>
 #include "create.hpp"
+#include "path_arena.hpp"
+#include "prehasher.hpp"
+#include "rate_limiter.hpp"
+#include "storage_hasher.hpp"
+#include "tar_hasher.hpp"
 #include "tracker_database.hpp"
 #include "test_resources.hpp"
 #include "config_parser.hpp"
@@ -251,6 +265,15 @@ TEST_CASE("test create app argument parsing")
             PARSE_ARGS(cmd);
             CHECK(create_options.threads==4);
         }
+        SECTION("auto") {
+            auto cmd = fmt::format("create {} --threads auto", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.threads.has_value());
+        }
+        SECTION("zero") {
+            auto cmd = fmt::format("create {} --threads 0", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
     }
 
     SECTION("source") {
@@ -482,7 +505,274 @@ TEST_CASE("test create app argument parsing")
             CHECK_FALSE(create_options.io_block_size.has_value());
         }
     }
+
+    SECTION("io-engine") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.io_engine == tt::io_engine::sync);
+        }
+        SECTION("sync") {
+            auto cmd = fmt::format("create {} --io-engine sync", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.io_engine == tt::io_engine::sync);
+        }
+        SECTION("uring") {
+            auto cmd = fmt::format("create {} --io-engine uring", file);
+            if (tt::is_available(tt::io_engine::uring)) {
+                PARSE_ARGS(cmd);
+                CHECK(create_options.io_engine == tt::io_engine::uring);
+            } else {
+                CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+            }
+        }
+        SECTION("mmap") {
+            auto cmd = fmt::format("create {} --io-engine mmap", file);
+            if (tt::is_available(tt::io_engine::mmap)) {
+                PARSE_ARGS(cmd);
+                CHECK(create_options.io_engine == tt::io_engine::mmap);
+            } else {
+                CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+            }
+        }
+        SECTION("invalid engine") {
+            auto cmd = fmt::format("create {} --io-engine foo", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("io-queue-depth") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.io_queue_depth == 32);
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --io-queue-depth 64", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.io_queue_depth == 64);
+        }
+        SECTION("zero") {
+            auto cmd = fmt::format("create {} --io-queue-depth 0", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("direct-io") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.direct_io);
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --direct-io", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.direct_io);
+        }
+    }
+
+    SECTION("drop-cache") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.drop_cache);
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --drop-cache --read-order cached", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.drop_cache);
+            CHECK(create_options.read_order == tt::read_order::cached);
+        }
+    }
+
+    SECTION("resource limits") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.max_read_rate == 0);
+            CHECK(create_options.max_iops == 0);
+            CHECK_FALSE(create_options.background);
+        }
+        SECTION("options given") {
+            auto cmd = fmt::format("create {} --max-read-rate 50M/s --max-iops 200 --background", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.max_read_rate == 50 * 1024 * 1024);
+            CHECK(create_options.max_iops == 200);
+            CHECK(create_options.background);
+        }
+        SECTION("zero rate") {
+            auto cmd = fmt::format("create {} --max-read-rate 0", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+        SECTION("invalid iops") {
+            auto cmd = fmt::format("create {} --max-iops 10K", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("pipeline") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.pipeline);
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --pipeline --protocol hybrid --piece-size 1M", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.pipeline);
+        }
+    }
+
+    SECTION("max-memory") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.max_memory == 0);
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --max-memory 512M", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.max_memory == 512 * 1024 * 1024);
+        }
+        SECTION("too small") {
+            auto cmd = fmt::format("create {} --max-memory 4K", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("hash-backend") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.hash_backend);
+        }
+        SECTION("auto") {
+            auto cmd = fmt::format("create {} --hash-backend auto", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.hash_backend);
+        }
+        SECTION("openssl") {
+            auto cmd = fmt::format("create {} --hash-backend openssl", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.hash_backend == tt::hash_backend::openssl);
+        }
+        SECTION("invalid") {
+            auto cmd = fmt::format("create {} --hash-backend foo", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("cpu-affinity") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.cpu_affinity);
+            CHECK_FALSE(create_options.numa);
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --cpu-affinity --numa", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.cpu_affinity);
+            CHECK(create_options.numa);
+        }
+    }
     
+    SECTION("batch") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.batch_manifest.has_value());
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create --batch {}", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.batch_manifest == fs::canonical(file));
+        }
+        SECTION("together with a target") {
+            auto cmd = fmt::format("create {0} --batch {0}", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("hash-cache") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.hash_cache.has_value());
+        }
+        SECTION("option given") {
+            auto cmd = fmt::format("create {} --hash-cache /tmp/torrenttools-hashes", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.hash_cache == fs::path("/tmp/torrenttools-hashes"));
+        }
+    }
+
+    SECTION("checkpoint and resume") {
+        SECTION("default") {
+            auto cmd = fmt::format("create {}", file);
+            PARSE_ARGS(cmd);
+            CHECK_FALSE(create_options.checkpoint.has_value());
+            CHECK_FALSE(create_options.resume);
+        }
+        SECTION("options given") {
+            auto cmd = fmt::format("create {} --checkpoint /tmp/test.checkpoint --resume", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.checkpoint == fs::path("/tmp/test.checkpoint"));
+            CHECK(create_options.resume);
+        }
+        SECTION("together with batch") {
+            auto cmd = fmt::format("create --batch {} --resume", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("stdin data") {
+        SECTION("name and size given") {
+            auto cmd = "create --stdin-data --name foo.bin --size 3M";
+            PARSE_ARGS(cmd);
+            CHECK(create_options.read_data_from_stdin);
+            CHECK(create_options.name == "foo.bin");
+            CHECK(create_options.data_size == 3 * 1024 * 1024);
+        }
+        SECTION("size in bytes") {
+            auto cmd = "create --stdin-data --name foo.bin --size 12345";
+            PARSE_ARGS(cmd);
+            CHECK(create_options.data_size == 12345);
+        }
+        SECTION("missing size") {
+            auto cmd = "create --stdin-data --name foo.bin";
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+        SECTION("together with target") {
+            auto cmd = fmt::format("create {} --stdin-data --name foo.bin --size 10", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("from tar") {
+        SECTION("archive given") {
+            auto cmd = fmt::format("create --from-tar {}", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.tar_archive == fs::path(file));
+        }
+        SECTION("together with target") {
+            auto cmd = fmt::format("create {} --from-tar {}", file, file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
+    SECTION("copy to") {
+        SECTION("directory given") {
+            auto cmd = fmt::format("create {} --copy-to copies", file);
+            PARSE_ARGS(cmd);
+            CHECK(create_options.copy_to == fs::path("copies"));
+        }
+        SECTION("together with resume") {
+            auto cmd = fmt::format("create {} --copy-to copies --resume", file);
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+    }
+
     SECTION("output") {
         SECTION("default") {
             auto cmd = fmt::format("create {}", file);
@@ -1030,6 +1320,915 @@ TEST_CASE("test create app: io-block-size")
     }
 }
 
+TEST_CASE("test create app: io-engine")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    main_app_options main_options{};
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+
+    create_app_options options{
+            .target = fs::path(TEST_DIR)/"resources",
+            .protocol_version = protocol,
+            .piece_size = 32_KiB,
+    };
+    options.set_creation_date = false;
+
+    options.destination = fs::path(tmp_dir)/"test-io-engine-sync.torrent";
+    options.io_engine = tt::io_engine::sync;
+    run_create_app(main_options, options);
+    auto reference = dt::load_metafile(*options.destination);
+
+    auto check_same_info_hash = [&](const dt::metafile& m) {
+        if ((protocol & dt::protocol::v1) == dt::protocol::v1) {
+            CHECK(dt::info_hash_v1(m) == dt::info_hash_v1(reference));
+        }
+        if ((protocol & dt::protocol::v2) == dt::protocol::v2) {
+            CHECK(dt::info_hash_v2(m) == dt::info_hash_v2(reference));
+        }
+    };
+
+    SECTION("same hashes as dottorrent") {
+        // hash the same file list, including padding files of hybrid storage, with the hasher of dottorrent
+        dt::metafile expected {};
+        expected.set_name(reference.name());
+        auto& storage = expected.storage();
+        storage.set_root_directory(options.target);
+        storage.set_piece_size(reference.storage().piece_size());
+        for (const auto& entry : reference.storage()) {
+            storage.add_file(dt::file_entry(entry.path(), entry.file_size(),
+                    entry.is_padding_file() ? dt::file_attributes::padding_file : dt::file_attributes::none));
+        }
+        storage.set_file_mode(reference.storage().file_mode());
+
+        dt::storage_hasher hasher(storage, dt::storage_hasher_options{ .protocol_version = protocol });
+        hasher.start();
+        hasher.wait();
+        check_same_info_hash(expected);
+    }
+
+    SECTION("sync with small io-block-size") {
+        options.destination = fs::path(tmp_dir)/"test-io-engine-block-size.torrent";
+        options.io_block_size = 32_KiB;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+
+    SECTION("adaptive threads") {
+        options.destination = fs::path(tmp_dir)/"test-io-engine-auto-threads.torrent";
+        options.threads = std::nullopt;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+
+    SECTION("hash backends") {
+        for (auto backend : tt::available_hash_backends()) {
+            options.destination = fs::path(tmp_dir) / fmt::format("test-hash-backend-{}.torrent", tt::to_string(backend));
+            options.hash_backend = backend;
+            run_create_app(main_options, options);
+            auto m = dt::load_metafile(*options.destination);
+            check_same_info_hash(m);
+        }
+    }
+
+#ifdef __linux__
+    SECTION("direct-io") {
+        options.destination = fs::path(tmp_dir)/"test-io-engine-direct-io.torrent";
+        options.direct_io = true;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+
+    SECTION("rate limits") {
+        options.destination = fs::path(tmp_dir)/"test-io-engine-rate-limits.torrent";
+        options.max_read_rate = 1024_MiB;
+        options.max_iops = 100000;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+
+    SECTION("drop cache, cached files first") {
+        options.destination = fs::path(tmp_dir)/"test-io-engine-drop-cache.torrent";
+        options.drop_cache = true;
+        options.read_order = tt::read_order::cached;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+
+        if (tt::is_available(tt::io_engine::mmap)) {
+            options.destination = fs::path(tmp_dir)/"test-io-engine-drop-cache-mmap.torrent";
+            options.io_engine = tt::io_engine::mmap;
+            run_create_app(main_options, options);
+            auto m2 = dt::load_metafile(*options.destination);
+            check_same_info_hash(m2);
+        }
+    }
+
+    SECTION("cpu affinity and numa") {
+        options.destination = fs::path(tmp_dir)/"test-io-engine-cpu-affinity.torrent";
+        options.threads = 4;
+        options.cpu_affinity = true;
+        options.numa = true;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+#endif
+
+    SECTION("mmap") {
+        if (!tt::is_available(tt::io_engine::mmap)) {
+            SUCCEED("mmap is not supported on this platform");
+            return;
+        }
+        options.destination = fs::path(tmp_dir)/"test-io-engine-mmap.torrent";
+        options.io_engine = tt::io_engine::mmap;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+
+    SECTION("uring") {
+        if (!tt::is_available(tt::io_engine::uring)) {
+            SUCCEED("io_uring support is not enabled");
+            return;
+        }
+        options.destination = fs::path(tmp_dir)/"test-io-engine-uring.torrent";
+        options.io_engine = tt::io_engine::uring;
+        options.io_queue_depth = 4;
+        run_create_app(main_options, options);
+        auto m = dt::load_metafile(*options.destination);
+        check_same_info_hash(m);
+    }
+}
+
+TEST_CASE("test create app: rate limiter")
+{
+    using namespace std::chrono_literals;
+
+    SECTION("reads beyond the burst wait for the bucket to refill") {
+        tt::rate_limiter limiter(1024 * 1024, 0);
+        auto start = tt::rate_limiter::clock::now();
+        // the first second of reads is a burst, the next 256 KiB are in debt
+        CHECK(limiter.acquire(1024 * 1024, 1));
+        CHECK(limiter.acquire(256 * 1024, 1));
+        CHECK(limiter.acquire(256 * 1024, 1));
+        CHECK(tt::rate_limiter::clock::now() - start >= 200ms);
+    }
+
+    SECTION("operations are limited across threads") {
+        tt::rate_limiter limiter(0, 100);
+        auto start = tt::rate_limiter::clock::now();
+        {
+            std::vector<std::jthread> threads {};
+            for (int i = 0; i < 3; ++i) {
+                threads.emplace_back([&]() {
+                    for (int j = 0; j < 50; ++j) {
+                        limiter.acquire(4096, 1);
+                    }
+                });
+            }
+        }
+        // 150 operations, of which 100 are a burst
+        CHECK(tt::rate_limiter::clock::now() - start >= 400ms);
+    }
+
+    SECTION("waiting stops on request") {
+        tt::rate_limiter limiter(1, 0);
+        limiter.acquire(3600, 1);
+        std::stop_source stop {};
+        stop.request_stop();
+        CHECK_FALSE(limiter.acquire(1, 1, stop.get_token()));
+    }
+}
+
+TEST_CASE("test create app: device read order")
+{
+    auto segment = [](std::size_t file_index, std::size_t file_offset, std::size_t length) {
+        return tt::file_segment{ .file_index = file_index, .file_offset = file_offset, .length = length };
+    };
+    // file 0 and 2 on device 0, file 1 and 3 on device 1, file 4 is a padding file
+    const std::vector<std::size_t> file_devices {0, 1, 0, 1, tt::no_device};
+    const std::vector<tt::read_request> plan {
+            { .offset = 0, .segments = {segment(0, 0, 100)} },
+            { .offset = 100, .segments = {segment(0, 100, 10), segment(4, 0, 10), segment(1, 0, 80)} },
+            { .offset = 200, .segments = {segment(1, 80, 100)} },
+            { .offset = 300, .segments = {segment(2, 0, 100)} },
+            { .offset = 400, .segments = {segment(3, 0, 100)} },
+            { .offset = 500, .segments = {segment(3, 100, 100)} },
+    };
+
+    SECTION("requests continuing a file stay on the same device") {
+        auto devices = tt::assign_request_devices(plan, file_devices);
+        // the second request reads from files 0 and 1 and starts the group of file 1 on device 1
+        CHECK(devices == std::vector<std::size_t>{0, 1, 1, 0, 1, 1});
+    }
+
+    SECTION("v1 stream plan is read from all devices") {
+        using namespace dottorrent::literals;
+        dt::file_storage storage {};
+        storage.set_piece_size(16_KiB);
+        for (std::size_t i = 0; i < 4; ++i) {
+            storage.add_file(dt::file_entry(fmt::format("file-{}.bin", i), 100_KiB + 1000 * i));
+        }
+        const auto stream_plan = tt::make_stream_read_plan(storage, 64_KiB);
+        const std::vector<std::size_t> devices {0, 1, 0, 1};
+        const auto request_devices = tt::assign_request_devices(stream_plan, devices);
+
+        CHECK(std::count(request_devices.begin(), request_devices.end(), 0) > 0);
+        CHECK(std::count(request_devices.begin(), request_devices.end(), 1) > 0);
+        // requests within a single file are read from the device of that file
+        for (std::size_t i = 0; i < stream_plan.size(); ++i) {
+            if (stream_plan[i].segments.size() == 1) {
+                CHECK(request_devices[i] == devices[stream_plan[i].segments.front().file_index]);
+            }
+        }
+    }
+
+    SECTION("devices alternate and keep their order") {
+        auto order = tt::interleave_by_device(std::vector<std::size_t>{0, 0, 1, 0, 1, 1});
+        CHECK(order == std::vector<std::size_t>{0, 2, 1, 4, 3, 5});
+    }
+
+    SECTION("plan sorted by physical offset") {
+        const auto unknown = tt::unknown_physical_offset;
+        const std::vector<std::uint64_t> keys {unknown, unknown, 100, 50, unknown};
+        auto sorted = plan;
+        tt::sort_read_plan(sorted, keys);
+        std::vector<std::size_t> offsets {};
+        for (const auto& request : sorted) {
+            offsets.push_back(request.offset);
+        }
+        // requests continuing file 3 move with it, files of unknown location are read last
+        CHECK(offsets == std::vector<std::size_t>{400, 500, 300, 0, 100, 200});
+        CHECK(tt::make_read_order("physical") == tt::read_order::physical);
+    }
+
+    SECTION("v1 stream plan sorted by physical offset") {
+        using namespace dottorrent::literals;
+        dt::file_storage storage {};
+        storage.set_piece_size(16_KiB);
+        for (std::size_t i = 0; i < 4; ++i) {
+            storage.add_file(dt::file_entry(fmt::format("file-{}.bin", i), 100_KiB + 1000 * i));
+        }
+        auto stream_plan = tt::make_stream_read_plan(storage, 64_KiB);
+        const auto request_count = stream_plan.size();
+        // the files are stored on disk in reverse order
+        const std::vector<std::uint64_t> keys {300, 200, 100, 0};
+        tt::sort_read_plan(stream_plan, keys);
+        REQUIRE(stream_plan.size() == request_count);
+
+        // the plan starts with the group of the last file, which also reads the tail of file 2
+        const auto& first = stream_plan.front().segments;
+        CHECK(first.front().file_index == 2);
+        CHECK(first.back().file_index == 3);
+        // the first request of the storage is read last
+        CHECK(stream_plan.back().offset == 0);
+        // each piece is still read exactly once
+        std::vector<std::size_t> offsets {};
+        for (const auto& request : stream_plan) {
+            offsets.push_back(request.offset);
+        }
+        std::sort(offsets.begin(), offsets.end());
+        CHECK(std::adjacent_find(offsets.begin(), offsets.end()) == offsets.end());
+    }
+
+    SECTION("v1 stream plan sorted by cached files") {
+        using namespace dottorrent::literals;
+        dt::file_storage storage {};
+        storage.set_piece_size(16_KiB);
+        for (std::size_t i = 0; i < 4; ++i) {
+            storage.add_file(dt::file_entry(fmt::format("file-{}.bin", i), 100_KiB + 1000 * i));
+        }
+        auto stream_plan = tt::make_stream_read_plan(storage, 64_KiB);
+        const auto request_count = stream_plan.size();
+        // keys as returned by page_cache_file_keys: file 1 is cached, file 3 partially
+        const std::vector<std::uint64_t> keys {tt::unknown_physical_offset, 0, tt::unknown_physical_offset, 1};
+        tt::sort_read_plan(stream_plan, keys);
+        REQUIRE(stream_plan.size() == request_count);
+
+        const auto& first = stream_plan.front().segments;
+        CHECK(first.front().file_index == 0);
+        CHECK(first.back().file_index == 1);
+        CHECK(stream_plan.front().offset != 0);
+
+        std::vector<std::size_t> offsets {};
+        for (const auto& request : stream_plan) {
+            offsets.push_back(request.offset);
+        }
+        std::sort(offsets.begin(), offsets.end());
+        CHECK(std::adjacent_find(offsets.begin(), offsets.end()) == offsets.end());
+    }
+}
+
+namespace {
+
+/// Append a ustar member to a tar archive.
+void write_tar_member(std::ostream& os, const std::string& name, const std::string& data, char type = '0')
+{
+    std::array<char, 512> header {};
+    std::copy(name.begin(), name.end(), header.begin());
+    std::snprintf(header.data() + 100, 8, "%07o", 0644);
+    std::snprintf(header.data() + 124, 12, "%011zo", data.size());
+    header[156] = type;
+    std::memcpy(header.data() + 257, "ustar", 6);
+    std::memcpy(header.data() + 263, "00", 2);
+    std::memset(header.data() + 148, ' ', 8);
+    unsigned checksum = 0;
+    for (char c : header) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    std::snprintf(header.data() + 148, 7, "%06o", checksum);
+    os.write(header.data(), header.size());
+    os.write(data.data(), data.size());
+    os << std::string((512 - data.size() % 512) % 512, '\0');
+}
+
+/// Return data of the given size that differs for each seed.
+std::string make_test_data(std::size_t size, std::size_t seed)
+{
+    std::string data(size, '\0');
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = char(((i + seed) * 2654435761u) >> 13);
+    }
+    return data;
+}
+
+/// Files with test data in a directory, file n is written with seed n.
+struct test_files
+{
+    fs::path root;
+    std::size_t piece_size;
+    std::vector<fs::path> paths {};
+    std::vector<std::string> contents {};
+
+    /// Write the files file-<n>.bin with the given sizes to root.
+    test_files(fs::path root_directory, std::size_t piece_size, const std::vector<std::size_t>& file_sizes = {})
+        : root(std::move(root_directory))
+        , piece_size(piece_size)
+    {
+        fs::create_directories(root);
+        for (std::size_t n = 0; n < file_sizes.size(); ++n) {
+            add(fmt::format("file-{}.bin", n), file_sizes[n]);
+        }
+    }
+
+    void add(const fs::path& relative_path, std::size_t size)
+    {
+        paths.push_back(root / relative_path);
+        contents.emplace_back(size, '\0');
+        write(paths.size() - 1, paths.size() - 1);
+    }
+
+    /// Replace the data of file n by data of the same size written with another seed.
+    void write(std::size_t n, std::size_t seed)
+    {
+        contents[n] = make_test_data(contents[n].size(), seed);
+        fs::create_directories(paths[n].parent_path());
+        std::ofstream(paths[n], std::ios::binary | std::ios::trunc).write(contents[n].data(), contents[n].size());
+    }
+
+    dt::file_storage make_storage() const
+    {
+        dt::file_storage storage {};
+        storage.set_root_directory(root);
+        storage.set_file_mode(dt::file_mode::multi);
+        storage.add_files(paths.begin(), paths.end());
+        storage.set_piece_size(piece_size);
+        return storage;
+    }
+};
+
+void hash_storage(dt::file_storage& storage, const tt::hash_pipeline_options& options)
+{
+    tt::storage_hasher hasher(storage, options);
+    hasher.start();
+    hasher.wait();
+}
+
+/// Check the v1 piece hashes and v2 file hashes of storage against those of a reference storage.
+void check_same_hashes(const dt::file_storage& storage, const dt::file_storage& reference, dt::protocol protocol)
+{
+    if ((protocol & dt::protocol::v1) == dt::protocol::v1) {
+        REQUIRE(storage.piece_count() == reference.piece_count());
+        for (std::size_t i = 0; i < storage.piece_count(); ++i) {
+            CHECK(storage.get_piece_hash(i) == reference.get_piece_hash(i));
+        }
+    }
+    if ((protocol & dt::protocol::v2) == dt::protocol::v2) {
+        REQUIRE(storage.file_count() == reference.file_count());
+        for (std::size_t i = 0; i < storage.file_count(); ++i) {
+            if (!storage.at(i).is_padding_file()) {
+                CHECK(storage.at(i).pieces_root() == reference.at(i).pieces_root());
+            }
+        }
+    }
+}
+
+} // namespace
+
+TEST_CASE("test create app: v2 merkle trees")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    main_app_options main_options{};
+    const std::size_t piece_size = 64_KiB;
+
+    // A large file split over multiple blocks, with a partial last piece which is padded to 64 pieces
+    // in the merkle tree, a file of multiple pieces and many small files packed in a single block.
+    std::vector<std::size_t> file_sizes { 50 * piece_size + 5000, piece_size + 30000 };
+    for (std::size_t i = 1; i <= 12; ++i) {
+        file_sizes.push_back(3000 * i + 7);
+    }
+    const test_files files(fs::path(tmp_dir) / "files", piece_size, file_sizes);
+
+    // reference merkle tree over 16 KiB leaves as specified in BEP 52
+    using digest = std::array<std::byte, 32>;
+    auto hash = [](std::span<const std::byte> lhs, std::span<const std::byte> rhs = {}) {
+        auto hasher = dt::make_hasher(dt::hash_function::sha256);
+        hasher->update(lhs);
+        hasher->update(rhs);
+        digest d {};
+        hasher->finalize_to(d);
+        return d;
+    };
+    auto to_hash = [](const digest& d) {
+        return dt::sha256_hash(std::string_view(reinterpret_cast<const char*>(d.data()), d.size()));
+    };
+    auto check_merkle_tree = [&](const dt::file_entry& entry, std::span<const std::byte> data) {
+        std::vector<digest> layer {};
+        for (std::size_t pos = 0; pos < data.size(); pos += 16_KiB) {
+            layer.push_back(hash(data.subspan(pos, std::min<std::size_t>(16_KiB, data.size() - pos))));
+        }
+        layer.resize(std::bit_ceil(layer.size()));
+        std::vector<dt::sha256_hash> piece_layer {};
+        for (std::size_t leaves = piece_size / 16_KiB; layer.size() > 1; leaves /= 2) {
+            if (leaves == 1 && data.size() > piece_size) {
+                for (std::size_t i = 0; i < (data.size() + piece_size - 1) / piece_size; ++i) {
+                    piece_layer.push_back(to_hash(layer[i]));
+                }
+            }
+            for (std::size_t i = 0; i < layer.size() / 2; ++i) {
+                layer[i] = hash(layer[2*i], layer[2*i+1]);
+            }
+            layer.resize(layer.size() / 2);
+        }
+        CHECK(entry.pieces_root() == to_hash(layer.front()));
+        CHECK(entry.piece_layer() == piece_layer);
+    };
+
+    auto threads = GENERATE(1, 4);
+    create_app_options options{
+            .target = files.root,
+            .protocol_version = dt::protocol::v2,
+            .piece_size = piece_size,
+            .threads = threads,
+    };
+    options.set_creation_date = false;
+    options.io_block_size = 2 * piece_size;
+    options.destination = fs::path(tmp_dir) / fmt::format("test-merkle-tree-{}.torrent", threads);
+    run_create_app(main_options, options);
+
+    auto m = dt::load_metafile(*options.destination);
+    REQUIRE(m.storage().file_count() == file_sizes.size());
+    for (const auto& entry : m.storage()) {
+        // all files have a different size
+        auto it = std::find(file_sizes.begin(), file_sizes.end(), entry.file_size());
+        REQUIRE(it != file_sizes.end());
+        check_merkle_tree(entry, std::as_bytes(std::span(files.contents[std::distance(file_sizes.begin(), it)])));
+    }
+}
+
+TEST_CASE("test create app: hash cache")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    main_app_options main_options{};
+    const std::size_t piece_size = 32_KiB;
+
+    // files with pieces shared between files in v1, files of multiple pieces and a small last file
+    test_files files(fs::path(tmp_dir) / "files", piece_size,
+                     {5 * piece_size + 1000, 3 * piece_size, 7000, 2 * piece_size + 123, 500});
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+    create_app_options options{
+            .target = files.root,
+            .protocol_version = protocol,
+            .piece_size = piece_size,
+            .checksums = {dt::hash_function::md5},
+    };
+    options.set_creation_date = false;
+
+    std::size_t run = 0;
+    auto create = [&](bool use_cache) {
+        options.hash_cache = use_cache ? std::optional(fs::path(tmp_dir) / "cache") : std::nullopt;
+        options.destination = fs::path(tmp_dir) / fmt::format("test-hash-cache-{}.torrent", run++);
+        run_create_app(main_options, options);
+        return dt::load_metafile(*options.destination);
+    };
+    auto check_same_info_hash = [&](const dt::metafile& m, const dt::metafile& reference) {
+        if ((protocol & dt::protocol::v1) == dt::protocol::v1) {
+            CHECK(dt::info_hash_v1(m) == dt::info_hash_v1(reference));
+        }
+        if ((protocol & dt::protocol::v2) == dt::protocol::v2) {
+            CHECK(dt::info_hash_v2(m) == dt::info_hash_v2(reference));
+        }
+    };
+
+    auto reference = create(false);
+    check_same_info_hash(create(true), reference);
+    CHECK_FALSE(fs::is_empty(fs::path(tmp_dir) / "cache"));
+
+    SECTION("unchanged files") {
+        check_same_info_hash(create(true), reference);
+    }
+
+    SECTION("changed file") {
+        files.write(1, 42);
+        fs::last_write_time(files.paths[1], fs::last_write_time(files.paths[1]) + std::chrono::seconds(10));
+        auto changed = create(false);
+        check_same_info_hash(create(true), changed);
+        check_same_info_hash(create(true), changed);
+    }
+}
+
+TEST_CASE("test create app: pipeline")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    const std::size_t piece_size = 32_KiB;
+
+    test_files files(fs::path(tmp_dir) / "files", piece_size,
+                     {5 * piece_size + 1000, 3 * piece_size, 7000, 2 * piece_size + 123});
+
+    auto protocol = GENERATE(dt::protocol::v2, dt::protocol::hybrid);
+    tt::hash_pipeline_options options { .protocol_version = protocol };
+
+    auto reference = files.make_storage();
+    hash_storage(reference, options);
+
+    tt::hash_cache cache {};
+    {
+        tt::prehasher prehasher(files.root, piece_size, options, cache);
+        for (const auto& path : files.paths) {
+            prehasher.add_file(path.lexically_relative(files.root).string(), tt::scanned_file {
+                    .file_size = fs::file_size(path), .identity = tt::read_file_identity(path) });
+        }
+        // finish() drops the files that are still queued
+        prehasher.wait_idle();
+        prehasher.finish();
+        CHECK(prehasher.hashed_file_count() == files.paths.size());
+        CHECK(prehasher.failed_batch_count() == 0);
+    }
+
+    // change the data without changing the identity of the files,
+    // the hashes only match the reference when the files are not read again
+    for (std::size_t n = 0; n < files.paths.size(); ++n) {
+        const auto mtime = fs::last_write_time(files.paths[n]);
+        files.write(n, 42);
+        fs::last_write_time(files.paths[n], mtime);
+    }
+
+    auto storage = files.make_storage();
+    tt::storage_hasher hasher(storage, options, cache);
+    hasher.start();
+    hasher.wait();
+
+    CHECK(hasher.cached_file_count() == files.paths.size());
+    check_same_hashes(storage, reference, protocol);
+}
+
+TEST_CASE("test create app: checkpoint")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    main_app_options main_options{};
+    const std::size_t piece_size = 32_KiB;
+
+    const test_files files(fs::path(tmp_dir) / "files", piece_size, {4 * piece_size + 1000, 9000, 2 * piece_size});
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+    const bool v1 = (protocol & dt::protocol::v1) == dt::protocol::v1;
+    tt::hash_pipeline_options options { .protocol_version = protocol, .checksums = {dt::hash_function::md5} };
+    tt::checkpoint_options checkpoint { .path = fs::path(tmp_dir) / "test.checkpoint" };
+
+    auto reference = files.make_storage();
+    {
+        tt::storage_hasher hasher(reference, options, std::nullopt, checkpoint);
+        hasher.start();
+        hasher.wait();
+        hasher.write_checkpoint();
+    }
+    REQUIRE(fs::exists(checkpoint.path));
+
+    SECTION("resume restores all hashes") {
+        // a record cut off while writing is ignored
+        std::ofstream(checkpoint.path, std::ios::app) << "file 0 pieces-ro";
+
+        auto storage = files.make_storage();
+        checkpoint.resume = true;
+        tt::storage_hasher hasher(storage, options, std::nullopt, checkpoint);
+        hasher.start();
+        hasher.wait();
+
+        CHECK(hasher.resumed_file_count() == files.paths.size());
+        if (v1) {
+            CHECK(hasher.resumed_piece_count() == storage.piece_count());
+        }
+        check_same_hashes(storage, reference, protocol);
+    }
+
+    SECTION("modified files do not match the checkpoint") {
+        fs::last_write_time(files.paths[1], fs::last_write_time(files.paths[1]) + std::chrono::seconds(10));
+        auto storage = files.make_storage();
+        checkpoint.resume = true;
+        tt::storage_hasher hasher(storage, options, std::nullopt, checkpoint);
+        CHECK_THROWS_AS(hasher.start(), std::invalid_argument);
+    }
+
+    SECTION("checkpoint is removed when the metafile is written") {
+        create_app_options create_options{
+                .target = files.root,
+                .protocol_version = protocol,
+                .piece_size = piece_size,
+        };
+        create_options.destination = fs::path(tmp_dir) / "test-checkpoint.torrent";
+        create_options.resume = true;
+        run_create_app(main_options, create_options);
+        CHECK(fs::exists(*create_options.destination));
+        CHECK_FALSE(fs::exists(fs::path(tmp_dir) / "test-checkpoint.torrent.checkpoint"));
+    }
+}
+
+TEST_CASE("test create app: stdin data")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    const std::size_t piece_size = 32_KiB;
+
+    const auto data = make_test_data(5 * piece_size + 1234, 0);
+    const auto file = fs::path(tmp_dir) / "foo.bin";
+    std::ofstream(file, std::ios::binary).write(data.data(), data.size());
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+    tt::hash_pipeline_options options { .protocol_version = protocol, .checksums = {dt::hash_function::md5} };
+
+    dt::file_storage reference {};
+    reference.set_root_directory(fs::path(tmp_dir));
+    reference.set_file_mode(dt::file_mode::single);
+    reference.add_file(file);
+    reference.set_piece_size(piece_size);
+    hash_storage(reference, options);
+
+    auto make_storage = [&](std::size_t size) {
+        dt::file_storage storage {};
+        storage.set_file_mode(dt::file_mode::single);
+        storage.add_file(dt::file_entry(fs::path("foo.bin"), size));
+        storage.set_piece_size(piece_size);
+        return storage;
+    };
+
+    SECTION("hashes match the file on disk") {
+        auto storage = make_storage(data.size());
+        std::istringstream input(data);
+        options.input = &input;
+        hash_storage(storage, options);
+        check_same_hashes(storage, reference, protocol);
+    }
+
+    SECTION("input ends early") {
+        auto storage = make_storage(data.size() + 1);
+        std::istringstream input(data);
+        options.input = &input;
+        tt::storage_hasher hasher(storage, options);
+        hasher.start();
+        CHECK_THROWS_AS(hasher.wait(), std::runtime_error);
+    }
+}
+
+TEST_CASE("test create app: tar archive")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    const std::size_t piece_size = 32_KiB;
+
+    const test_files files(fs::path(tmp_dir) / "data", piece_size, {5 * piece_size + 1234, 9000, 2 * piece_size});
+
+    std::ostringstream archive {};
+    write_tar_member(archive, "data/", "", '5');
+    for (std::size_t n = 0; n < files.paths.size(); ++n) {
+        write_tar_member(archive, "data/" + files.paths[n].filename().string(), files.contents[n]);
+    }
+    write_tar_member(archive, "data/link", "", '2');
+    archive << std::string(1024, '\0');
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+    const bool v1 = (protocol & dt::protocol::v1) == dt::protocol::v1;
+    const bool v2 = (protocol & dt::protocol::v2) == dt::protocol::v2;
+    tt::hash_pipeline_options options { .protocol_version = protocol };
+
+    auto reference = files.make_storage();
+    hash_storage(reference, options);
+
+    SECTION("hashes match the extracted files") {
+        std::istringstream input(archive.str());
+        tt::tar_hasher hasher(input, piece_size, options);
+        hasher.run();
+        CHECK(hasher.files_done() == files.paths.size());
+        CHECK(hasher.skipped_member_count() == 1);
+        CHECK(hasher.common_root() == fs::path("data"));
+
+        dt::file_storage storage {};
+        hasher.set_files(storage, /*strip_root=*/true);
+        REQUIRE(storage.file_count() == reference.file_count());
+        for (std::size_t i = 0; i < storage.file_count(); ++i) {
+            CHECK(storage.at(i).path() == reference.at(i).path());
+            CHECK(storage.at(i).file_size() == reference.at(i).file_size());
+        }
+        check_same_hashes(storage, reference, protocol);
+    }
+
+    SECTION("truncated archive") {
+        std::istringstream input(archive.str().substr(0, 2048));
+        tt::tar_hasher hasher(input, piece_size, options);
+        CHECK_THROWS_AS(hasher.run(), std::runtime_error);
+    }
+
+    SECTION("paths outside of the archive root") {
+        std::ostringstream unsafe {};
+        write_tar_member(unsafe, "../escape.bin", "data");
+        std::istringstream input(unsafe.str());
+        tt::tar_hasher hasher(input, piece_size, options);
+        CHECK_THROWS_AS(hasher.run(), std::runtime_error);
+    }
+
+    SECTION("member order of hybrid torrents") {
+        // non-ASCII names are ordered differently by char and unsigned char comparison
+        std::vector<std::string> names {"z.bin", "\xc3\xa9.bin", "a.bin"};
+        std::sort(names.begin(), names.end(), tt::path_less);
+
+        auto make_archive = [](const std::vector<std::string>& member_names) {
+            std::ostringstream os {};
+            for (const auto& name : member_names) {
+                write_tar_member(os, name, "data");
+            }
+            os << std::string(1024, '\0');
+            return os.str();
+        };
+
+        std::istringstream sorted(make_archive(names));
+        tt::tar_hasher sorted_hasher(sorted, piece_size, options);
+        CHECK_NOTHROW(sorted_hasher.run());
+
+        std::reverse(names.begin(), names.end());
+        std::istringstream reversed(make_archive(names));
+        tt::tar_hasher reversed_hasher(reversed, piece_size, options);
+        if (v1 && v2) {
+            CHECK_THROWS_AS(reversed_hasher.run(), std::runtime_error);
+        }
+        else {
+            CHECK_NOTHROW(reversed_hasher.run());
+        }
+    }
+}
+
+TEST_CASE("test create app: copy to")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir{};
+    const std::size_t piece_size = 32_KiB;
+
+    test_files files(fs::path(tmp_dir) / "files", piece_size);
+    const std::vector<std::size_t> file_sizes {4 * piece_size + 1000, 9000, 0, 2 * piece_size};
+    for (std::size_t n = 0; n < file_sizes.size(); ++n) {
+        files.add(fs::path(n % 2 ? "sub" : "") / fmt::format("file-{}.bin", n), file_sizes[n]);
+    }
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+    tt::hash_pipeline_options options { .protocol_version = protocol, .checksums = {dt::hash_function::md5} };
+
+    auto reference = files.make_storage();
+    hash_storage(reference, options);
+
+    const auto destination = fs::path(tmp_dir) / "copy";
+    options.copy_to = destination;
+
+    SECTION("files are copied while hashing") {
+        auto storage = files.make_storage();
+        hash_storage(storage, options);
+
+        check_same_hashes(storage, reference, protocol);
+        for (std::size_t n = 0; n < files.paths.size(); ++n) {
+            auto copy = destination / files.paths[n].lexically_relative(files.root);
+            REQUIRE(fs::exists(copy));
+            std::ifstream f(copy, std::ios::binary);
+            std::string data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+            CHECK(data == files.contents[n]);
+        }
+        // padding files and temporary files are not left behind
+        CHECK_FALSE(fs::exists(destination / ".pad"));
+        for (const auto& entry : fs::recursive_directory_iterator(destination)) {
+            CHECK(entry.path().extension() != ".part");
+        }
+    }
+
+    SECTION("existing files are not overwritten") {
+        fs::create_directories(destination);
+        std::ofstream(destination / "file-0.bin") << "existing";
+        auto storage = files.make_storage();
+        tt::storage_hasher hasher(storage, options);
+        CHECK_THROWS_AS(hasher.start(), std::runtime_error);
+    }
+}
+
+TEST_CASE("test create app: batch")
+{
+    temporary_directory tmp_dir{};
+    main_app_options main_options{};
+    const auto resources = fs::path(TEST_DIR) / "resources";
+
+    CLI::App app("test app", "torrenttools");
+    auto create_app = app.add_subcommand("create", "Create a new metafile");
+    create_app_options create_options{};
+    configure_create_app(create_app, create_options);
+    auto [config, tracker_db] = load_config_and_tracker_db(main_options);
+
+    auto manifest_path = fs::path(tmp_dir) / "manifest.yml";
+    auto write_manifest = [&](std::string_view content) {
+        std::ofstream f(manifest_path);
+        f << content;
+    };
+
+    SECTION("yaml manifest") {
+        write_manifest(fmt::format(
+                "- target: {0}/config\n"
+                "  output: {1}/config.torrent\n"
+                "  announce: [ \"https://tracker.example/announce\" ]\n"
+                "- target: {0}/bittorrent-v2-test.torrent\n"
+                "  comment: second\n",
+                resources.string(), fs::path(tmp_dir).string()));
+
+        auto cmd = fmt::format("create --batch {} --protocol hybrid --no-creation-date --output {}/",
+                               manifest_path.string(), fs::path(tmp_dir).string());
+        PARSE_ARGS(cmd);
+        auto jobs = load_create_batch(create_app, config, create_options);
+        REQUIRE(jobs.size() == 2);
+        CHECK(jobs[0].target == fs::canonical(resources / "config"));
+        CHECK(jobs[0].announce_list.size() == 1);
+        CHECK(jobs[0].protocol_version == dt::protocol::hybrid);
+        CHECK_FALSE(jobs[0].set_creation_date);
+        CHECK(jobs[1].comment == "second");
+        CHECK(jobs[1].protocol_version == dt::protocol::hybrid);
+
+        std::ostringstream os {};
+        run_create_batch(jobs, config, tracker_db, os);
+
+        auto first = dt::load_metafile(fs::path(tmp_dir) / "config.torrent");
+        CHECK(first.storage().protocol() == dt::protocol::hybrid);
+        auto second = dt::load_metafile(fs::path(tmp_dir) / "bittorrent-v2-test.torrent.torrent");
+        CHECK(second.comment() == "second");
+    }
+
+    SECTION("json manifest") {
+        write_manifest(fmt::format(R"([{{"target": "{}", "piece-size": "64K"}}])",
+                                   (resources / "config").string()));
+        auto cmd = fmt::format("create --batch {}", manifest_path.string());
+        PARSE_ARGS(cmd);
+        auto jobs = load_create_batch(create_app, config, create_options);
+        REQUIRE(jobs.size() == 1);
+        CHECK(jobs[0].piece_size == 64 * 1024);
+    }
+
+    SECTION("entry without target") {
+        write_manifest("- comment: no target\n");
+        auto cmd = fmt::format("create --batch {}", manifest_path.string());
+        PARSE_ARGS(cmd);
+        CHECK_THROWS(load_create_batch(create_app, config, create_options));
+    }
+
+    SECTION("failed jobs are reported") {
+        write_manifest(fmt::format(
+                "- target: {0}/config\n"
+                "  output: {1}/config.torrent\n"
+                "  piece-size: 64K\n"
+                "  io-block-size: 32K\n"
+                "- target: {0}/config\n"
+                "  output: {1}/config.torrent\n",
+                resources.string(), fs::path(tmp_dir).string()));
+        auto cmd = fmt::format("create --batch {}", manifest_path.string());
+        PARSE_ARGS(cmd);
+        auto jobs = load_create_batch(create_app, config, create_options);
+
+        std::ostringstream os {};
+        CHECK_THROWS_AS(run_create_batch(jobs, config, tracker_db, os), std::runtime_error);
+        CHECK(fs::exists(fs::path(tmp_dir) / "config.torrent"));
+    }
+}
+
 TEST_CASE("test create app: protocol")
 {
     using namespace dottorrent::literals;
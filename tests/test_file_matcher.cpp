@@ -1,7 +1,9 @@
 #include <catch2/catch.hpp>
+#include <algorithm>
 #include <filesystem>
 
 #include "file_matcher.hpp"
+#include "path_arena.hpp"
 
 namespace fs = std::filesystem;
 
@@ -108,6 +110,75 @@ TEST_CASE("test file_matcher")
         CHECK_FALSE(contains(files, test_file_matcher_cpp));
     }
 
+    SECTION("test sorted results") {
+        matcher.set_search_root(fs::path(TEST_DIR));
+        matcher.set_thread_count(1);
+        matcher.start();
+        matcher.wait();
+        auto single_threaded = matcher.results();
+
+        torrenttools::file_matcher parallel_matcher{};
+        parallel_matcher.set_search_root(fs::path(TEST_DIR));
+        parallel_matcher.set_thread_count(8);
+        parallel_matcher.start();
+        parallel_matcher.wait();
+        auto files = parallel_matcher.results();
+
+        CHECK(files == single_threaded);
+        CHECK(std::is_sorted(files.begin(), files.end(), [](const fs::path& lhs, const fs::path& rhs) {
+            return std::ranges::lexicographical_compare(lhs.string(), rhs.string());
+        }));
+        CHECK(parallel_matcher.files_included() == files.size());
+        CHECK(parallel_matcher.files_processed() >= files.size());
+        CHECK_FALSE(parallel_matcher.is_running());
+    }
+
+    SECTION("test file sizes and identities") {
+        matcher.allow_extension("cpp");
+        matcher.set_search_root(fs::path(TEST_DIR));
+        matcher.start();
+        matcher.wait();
+        auto files = matcher.file_results();
+
+        REQUIRE_FALSE(files.empty());
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            const auto path = files.path(i);
+            CHECK(path == fs::path(TEST_DIR) / files.relative_path(i));
+            CHECK(files.file(i).file_size == fs::file_size(path));
+#if defined(__linux__)
+            REQUIRE(files.file(i).identity.has_value());
+            CHECK(files.file(i).identity == torrenttools::read_file_identity(path));
+#endif
+        }
+    }
+
+    SECTION("test spilled results") {
+        matcher.set_search_root(fs::path(TEST_DIR));
+        matcher.start();
+        matcher.wait();
+        REQUIRE_FALSE(matcher.is_spilled());
+        auto in_memory = matcher.results();
+
+        torrenttools::file_matcher spilling_matcher{};
+        spilling_matcher.set_search_root(fs::path(TEST_DIR));
+        spilling_matcher.set_max_memory(4096);
+        spilling_matcher.start();
+        spilling_matcher.wait();
+        CHECK(spilling_matcher.is_spilled());
+
+        std::vector<std::uint64_t> sizes {};
+        spilling_matcher.for_each_result([&](std::string_view, const torrenttools::scanned_file& file) {
+            sizes.push_back(file.file_size);
+        });
+        auto files = spilling_matcher.results();
+
+        CHECK(files == in_memory);
+        REQUIRE(sizes.size() == files.size());
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            CHECK(sizes[i] == fs::file_size(files[i]));
+        }
+    }
+
     SECTION("test exclude directory")
     {
         matcher.exclude_directory("resources");
@@ -119,4 +190,43 @@ TEST_CASE("test file_matcher")
         CHECK(contains(files, test_file_matcher_cpp));
         CHECK_FALSE(contains(files, fedora_torrent));
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("test path_arena")
+{
+    torrenttools::path_arena arena {};
+    std::vector<std::string> paths {
+        "b/c", "a", "abcdefgh/b", "abcdefgh/a", "abcdefgh", "a/b", "a.txt", "\xc3\xa9t\xc3\xa9", "Z", "" };
+    for (const auto& p : paths) {
+        arena.push_back(p);
+    }
+    REQUIRE(arena.size() == paths.size());
+
+    SECTION("paths are kept in insertion order") {
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            CHECK(arena[i] == paths[i]);
+            CHECK(arena.id(i) == i);
+        }
+    }
+
+    SECTION("sort as strings") {
+        arena.sort();
+        auto expected = paths;
+        std::sort(expected.begin(), expected.end(), [](const std::string& lhs, const std::string& rhs) {
+            return std::ranges::lexicographical_compare(lhs, rhs);
+        });
+        for (std::size_t i = 0; i < paths.size(); ++i) {
+            CHECK(arena[i] == expected[i]);
+            CHECK(paths[arena.id(i)] == arena[i]);
+        }
+    }
+
+    SECTION("append") {
+        torrenttools::path_arena other {};
+        other.push_back("x/y");
+        arena.append(other);
+        CHECK(arena.size() == paths.size() + 1);
+        CHECK(arena[paths.size()] == "x/y");
+        CHECK(arena.id(paths.size()) == paths.size());
+    }
+}
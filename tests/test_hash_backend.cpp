@@ -0,0 +1,141 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <catch2/catch.hpp>
+
+#include "hash_backend.hpp"
+#include "test_resources.hpp"
+
+namespace tt = torrenttools;
+namespace dt = dottorrent;
+
+namespace {
+
+std::string to_hex(std::span<const std::byte> data)
+{
+    static constexpr auto digits = "0123456789abcdef";
+    std::string s;
+    for (auto b : data) {
+        s += digits[std::to_integer<int>(b) >> 4];
+        s += digits[std::to_integer<int>(b) & 0xf];
+    }
+    return s;
+}
+
+}
+
+TEST_CASE("test hash backend names")
+{
+    CHECK(tt::make_hash_backend("openssl") == tt::hash_backend::openssl);
+    CHECK(tt::make_hash_backend("isal") == tt::hash_backend::isal);
+    CHECK(tt::make_hash_backend("simd") == tt::hash_backend::simd);
+    CHECK_FALSE(tt::make_hash_backend("foo"));
+    CHECK(tt::is_available(tt::hash_backend::openssl));
+
+    for (auto b : tt::available_hash_backends()) {
+        CHECK(tt::make_hash_backend(tt::to_string(b)) == b);
+    }
+}
+
+TEST_CASE("test block hasher")
+{
+    std::string abc = "abc";
+    std::vector<std::byte> large(100'000, std::byte{'a'});
+    std::vector<std::span<const std::byte>> inputs {
+        std::as_bytes(std::span(abc)),
+        std::span<const std::byte>{},
+        large,
+    };
+
+    auto backend = GENERATE(from_range(tt::available_hash_backends()));
+
+    SECTION("sha1") {
+        if (!tt::supports(backend, dt::hash_function::sha1)) {
+            CHECK_THROWS_AS(tt::make_block_hasher(backend, dt::hash_function::sha1), std::invalid_argument);
+            return;
+        }
+        auto hasher = tt::make_block_hasher(backend, dt::hash_function::sha1);
+        REQUIRE(hasher->digest_size() == 20);
+        std::vector<std::byte> out(inputs.size() * hasher->digest_size());
+        hasher->hash(inputs, out);
+
+        CHECK(to_hex(std::span(out).subspan(0, 20)) == "a9993e364706816aba3e25717850c26c9cd0d89d");
+        CHECK(to_hex(std::span(out).subspan(20, 20)) == "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+        CHECK(to_hex(std::span(out).subspan(40, 20)) == "c4d4b30851182fc4eb8675494d42fd7f17e29c93");
+    }
+    SECTION("sha256") {
+        auto hasher = tt::make_block_hasher(backend, dt::hash_function::sha256);
+        REQUIRE(hasher->digest_size() == 32);
+        std::vector<std::byte> out(inputs.size() * hasher->digest_size());
+        hasher->hash(inputs, out);
+
+        CHECK(to_hex(std::span(out).subspan(0, 32)) ==
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+        CHECK(to_hex(std::span(out).subspan(32, 32)) ==
+              "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+        CHECK(to_hex(std::span(out).subspan(64, 32)) ==
+              "6d1cf22d7cc09b085dfc25ee1a1f3ae0265804c607bc2074ad253bcc82fd81ee");
+    }
+    SECTION("unsupported hash function") {
+        CHECK_THROWS_AS(tt::make_block_hasher(backend, dt::hash_function::md5), std::invalid_argument);
+    }
+}
+
+TEST_CASE("test block hasher with leaf batches")
+{
+    // full leaves followed by a short last leaf and the leaves of a next file,
+    // multi-buffer backends must split the batch in runs of equal size
+    std::vector<std::byte> data(100 * 16384);
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = std::byte(i * 131 + (i >> 12));
+    }
+    std::vector<std::span<const std::byte>> inputs;
+    std::size_t pos = 0;
+    for (std::size_t size : {16384, 16384, 16384, 1000, 16384, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64}) {
+        inputs.emplace_back(std::span(data).subspan(pos, size));
+        pos += size;
+    }
+    for (std::size_t i = 0; i < 37; ++i, pos += 16384) {
+        inputs.emplace_back(std::span(data).subspan(pos, 16384));
+    }
+
+    auto reference = tt::make_block_hasher(tt::hash_backend::openssl, dt::hash_function::sha256);
+    std::vector<std::byte> expected(inputs.size() * 32);
+    reference->hash(inputs, expected);
+
+    auto backend = GENERATE(from_range(tt::available_hash_backends()));
+    auto hasher = tt::make_block_hasher(backend, dt::hash_function::sha256);
+    std::vector<std::byte> out(inputs.size() * 32);
+    hasher->hash(inputs, out);
+
+    CHECK(to_hex(out) == to_hex(expected));
+}
+
+TEST_CASE("test select hash backends")
+{
+    SECTION("forced backend") {
+        auto selection = tt::select_hash_backends(tt::hash_backend::openssl);
+        CHECK(selection.sha1 == tt::hash_backend::openssl);
+        CHECK(selection.sha256 == tt::hash_backend::openssl);
+    }
+    SECTION("forced backend without sha1 support") {
+        if (!tt::is_available(tt::hash_backend::simd)) {
+            return;
+        }
+        auto selection = tt::select_hash_backends(tt::hash_backend::simd);
+        CHECK(selection.sha1 == tt::hash_backend::openssl);
+        CHECK(selection.sha256 == tt::hash_backend::simd);
+    }
+    SECTION("calibration is cached") {
+        temporary_directory tmp_dir {};
+        auto cache_file = tmp_dir.path() / "hash-backends";
+        auto selection = tt::select_hash_backends(std::nullopt, cache_file);
+        CHECK(tt::is_available(selection.sha1));
+        CHECK(tt::is_available(selection.sha256));
+
+        auto cached = tt::select_hash_backends(std::nullopt, cache_file);
+        CHECK(cached.sha1 == selection.sha1);
+        CHECK(cached.sha256 == selection.sha256);
+    }
+}
@@ -323,6 +323,30 @@ profiles:
         }
     }
 
+    SECTION("hash-backend") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      hash-backend: auto
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK_FALSE(options.hash_backend.has_value());
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      hash-backend: foo
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
     SECTION("http-seed") {
         SECTION("valid") {
             std::string p = R"(
@@ -410,6 +434,126 @@ profiles:
             CHECK_THROWS_AS(config(p), profile_error);
         }
     }
+    SECTION("io-engine") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      io-engine: sync
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK(options.io_engine == io_engine::sync);
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      io-engine: foo
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
+    SECTION("io-queue-depth") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      io-queue-depth: 64
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK(options.io_queue_depth == 64);
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      io-queue-depth: 0
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
+    SECTION("max-iops") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      max-iops: 100
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK(options.max_iops == 100);
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      max-iops: 0
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
+    SECTION("max-memory") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      max-memory: 512M
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK(options.max_memory == 512 * 1024 * 1024);
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      max-memory: 1K
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
+    SECTION("max-read-rate") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      max-read-rate: 50M
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK(options.max_read_rate == 50 * 1024 * 1024);
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      max-read-rate: 50X
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
     SECTION("name") {
         SECTION("valid") {
             std::string p = R"(
@@ -509,6 +653,30 @@ profiles:
         }
     }
 
+    SECTION("read-order") {
+        SECTION("valid") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      read-order: physical
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK(options.read_order == read_order::physical);
+        }
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      read-order: foo
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+    }
+
     SECTION("set-created-by") {
         SECTION("bad type") {
             std::string p = R"(
@@ -573,6 +741,18 @@ profiles:
             CHECK(options.threads==4);
         }
 
+        SECTION("auto") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      threads: auto
+)";
+            GET_TEST_OPTIONS_CREATE(p);
+            CHECK_FALSE(options.threads.has_value());
+        }
+
         SECTION("bad type") {
             std::string p = R"(
 profiles:
@@ -580,6 +760,17 @@ profiles:
     command: "create"
     options:
       threads: "test"
+)";
+            CHECK_THROWS_AS(config(p), profile_error);
+        }
+
+        SECTION("invalid value") {
+            std::string p = R"(
+profiles:
+  test:
+    command: "create"
+    options:
+      threads: 0
 )";
             CHECK_THROWS_AS(config(p), profile_error);
         }
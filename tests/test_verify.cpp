@@ -8,6 +8,8 @@
 #include <dottorrent/dht_node.hpp>
 #include "create.hpp"
 #include "verify.hpp"
+#include "storage_hasher.hpp"
+#include "storage_verifier.hpp"
 #include "tracker_database.hpp"
 #include "test_resources.hpp"
 
@@ -84,6 +86,70 @@ TEST_CASE("Test verify app argument parsing")
             CHECK(verify_options.threads == 4);
         }
     }
+
+    SECTION("io-block-size") {
+        auto cmd = fmt::format("verify {} {} --io-block-size 4M", test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.io_block_size == 4*1024*1024);
+    }
+
+    SECTION("io-engine") {
+        SECTION("default") {
+            auto cmd = fmt::format("verify {} {}", test_torrent.string(), test_target.string());
+            PARSE_ARGS(cmd);
+            CHECK(verify_options.io_engine == tt::io_engine::sync);
+            CHECK(verify_options.io_queue_depth == 32);
+        }
+        SECTION("invalid engine") {
+            auto cmd = fmt::format("verify {} {} --io-engine foo", test_torrent.string(), test_target.string());
+            CHECK_THROWS(PARSE_ARGS_THROWING(cmd));
+        }
+        SECTION("queue depth") {
+            auto cmd = fmt::format("verify {} {} --io-queue-depth 8", test_torrent.string(), test_target.string());
+            PARSE_ARGS(cmd);
+            CHECK(verify_options.io_queue_depth == 8);
+        }
+    }
+
+    SECTION("direct-io") {
+        auto cmd = fmt::format("verify {} {} --direct-io", test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.direct_io);
+    }
+
+    SECTION("drop-cache") {
+        auto cmd = fmt::format("verify {} {} --drop-cache", test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.drop_cache);
+    }
+
+    SECTION("resource limits") {
+        auto cmd = fmt::format("verify {} {} --max-read-rate 100M --max-iops 50 --background",
+                               test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.max_read_rate == 100 * 1024 * 1024);
+        CHECK(verify_options.max_iops == 50);
+        CHECK(verify_options.background);
+    }
+
+    SECTION("hash-backend") {
+        auto cmd = fmt::format("verify {} {} --hash-backend openssl", test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.hash_backend == tt::hash_backend::openssl);
+    }
+
+    SECTION("cpu-affinity") {
+        auto cmd = fmt::format("verify {} {} --cpu-affinity --numa", test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.cpu_affinity);
+        CHECK(verify_options.numa);
+    }
+
+    SECTION("copy-to") {
+        auto cmd = fmt::format("verify {} {} --restore-to copies", test_torrent.string(), test_target.string());
+        PARSE_ARGS(cmd);
+        CHECK(verify_options.copy_to == fs::path("copies"));
+    }
 }
 
 TEST_CASE("test verify app: v1 torrent")
@@ -116,4 +182,72 @@ TEST_CASE("test verify app: v2 torrent")
 
         run_verify_app(main_options, verify_options);
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("test verify app: copy verified pieces")
+{
+    using namespace dottorrent::literals;
+    temporary_directory tmp_dir {};
+    const std::size_t piece_size = 32_KiB;
+
+    const auto target = fs::path(tmp_dir) / "files";
+    fs::create_directories(target);
+    const std::vector<std::size_t> file_sizes {5 * piece_size + 1000, 9000, 2 * piece_size};
+    std::vector<fs::path> files {};
+    std::vector<std::string> contents {};
+    for (std::size_t n = 0; n < file_sizes.size(); ++n) {
+        std::string data(file_sizes[n], '\0');
+        for (std::size_t i = 0; i < data.size(); ++i) {
+            data[i] = char(((i + n) * 2654435761u) >> 13);
+        }
+        files.push_back(target / fmt::format("file-{}.bin", n));
+        std::ofstream(files.back(), std::ios::binary).write(data.data(), data.size());
+        contents.push_back(std::move(data));
+    }
+
+    auto protocol = GENERATE(dt::protocol::v1, dt::protocol::v2, dt::protocol::hybrid);
+    tt::hash_pipeline_options options { .protocol_version = protocol, .threads = 2 };
+
+    dt::file_storage storage {};
+    storage.set_root_directory(target);
+    storage.set_file_mode(dt::file_mode::multi);
+    storage.add_files(files.begin(), files.end());
+    storage.set_piece_size(piece_size);
+    {
+        tt::storage_hasher hasher(storage, options);
+        hasher.start();
+        hasher.wait();
+    }
+
+    // corrupt the second piece of the first file
+    const std::size_t corrupt_offset = piece_size + 100;
+    {
+        std::fstream f(files[0], std::ios::binary | std::ios::in | std::ios::out);
+        f.seekp(corrupt_offset);
+        f.put(char(~contents[0][corrupt_offset]));
+    }
+
+    const auto destination = fs::path(tmp_dir) / "restore";
+    options.copy_to = destination;
+    tt::storage_verifier verifier(storage, options);
+    verifier.start();
+    verifier.wait();
+
+    auto read_copy = [&](std::size_t n) {
+        std::ifstream f(destination / files[n].filename(), std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    };
+
+    // the failed piece is left as a hole of zeros, all other pieces are copied
+    auto copy = read_copy(0);
+    REQUIRE(copy.size() == contents[0].size());
+    CHECK(copy.substr(0, piece_size) == contents[0].substr(0, piece_size));
+    CHECK(copy.substr(piece_size, piece_size) == std::string(piece_size, '\0'));
+    CHECK(copy.substr(2 * piece_size) == contents[0].substr(2 * piece_size));
+    CHECK(verifier.failed_pieces(0) == std::vector<std::size_t>{1});
+
+    for (std::size_t n = 1; n < files.size(); ++n) {
+        CHECK(read_copy(n) == contents[n]);
+    }
+    CHECK(verifier.bytes_not_copied() == piece_size);
+}